@@ -0,0 +1,458 @@
+#include "ALIGN.h"
+#include "UART.h"
+
+#define ARCSEC_TO_RAD (M_PI / (180.0 * 3600.0))
+#define RAD_TO_ARCSEC (180.0 * 3600.0 / M_PI)
+#define SIDEREAL_RATE_RAD_PER_SEC (SIDEREAL_RATE_ARCSEC_PER_SEC * ARCSEC_TO_RAD)
+#define NUM_PARAMS 6                    // Rotation (3), index error, cone, non-perpendicularity
+#define MIN_COS_EL 0.05                 // Keeps the cone and non-perpendicularity terms finite near the zenith
+
+// One sync point: where the star was on the sky and where the axes were
+typedef struct {
+    double sky[3];                      // Unit vector, sidereal rotation since the epoch already applied
+    double el;                          // X axis angle, rad
+    double az;                          // Z axis angle, rad
+} align_star_t;
+
+// Sync captured in the UART interrupt, moved into the star list by the background task
+typedef struct {
+    volatile bool pending;
+    float ra_hours;
+    float dec_deg;
+    uint64_t time_us;
+    float x_arcsec;
+    float z_arcsec;
+} align_sync_t;
+
+// Working copy of the model on core 0, in double so the finite difference Jacobian stays accurate
+typedef struct {
+    double r[9];
+    double index_el;
+    double cone;
+    double nonperp;
+} align_solution_t;
+
+static align_star_t stars[ALIGN_MAX_STARS];
+static uint8_t star_count;              // Oldest first
+static uint64_t epoch_us;
+static align_sync_t sync_request;
+static volatile bool clear_requested;
+static volatile bool drop_requested;
+static align_solution_t solution;
+static double solution_rms;             // rad
+
+// Published model, core 0 writes it after a solve, core 1 copies it out
+static spin_lock_t *model_lock;
+static align_model_t model;
+static volatile uint32_t model_version;
+
+void align_init(void) {
+    model_lock = spin_lock_init(spin_lock_claim_unused(true));
+    star_count = 0;
+    model.valid = false;
+    model_version = 0;
+    sync_request.pending = false;
+    clear_requested = false;
+    drop_requested = false;
+}
+
+// Called from the UART interrupt, the axis positions are taken right now, the solve runs later
+void align_sync(float ra_hours, float dec_deg) {
+    sync_request.ra_hours = ra_hours;
+    sync_request.dec_deg = dec_deg;
+    sync_request.time_us = time_us_64();
+    sync_request.x_arcsec = stepper_get_position(AXIS_X) / stepper_steps_per_arcsec(AXIS_X);
+    sync_request.z_arcsec = stepper_get_position(AXIS_Z) / stepper_steps_per_arcsec(AXIS_Z);
+    sync_request.pending = true;
+}
+
+void align_control(uint8_t action) {
+    switch (action) {
+        case ALIGN_ACTION_CLEAR: clear_requested = true; break;
+        case ALIGN_ACTION_DROP_LAST: drop_requested = true; break;
+        case ALIGN_ACTION_STATUS: align_send_status(); break;
+    }
+}
+
+bool align_model_valid(void) {
+    return model.valid;
+}
+
+// Copy the model out if it changed since *version, core 1 calls this every pass so it has to be cheap
+bool align_get_model(align_model_t *out, uint32_t *version) {
+    if (model_version == *version) return false;
+    uint32_t save = spin_lock_blocking(model_lock);
+    *out = model;
+    *version = model_version;
+    spin_unlock(model_lock, save);
+    return true;
+}
+
+static void sky_vector(double ra_rad, double dec_rad, double *v) {
+    v[0] = cos(dec_rad) * cos(ra_rad);
+    v[1] = cos(dec_rad) * sin(ra_rad);
+    v[2] = sin(dec_rad);
+}
+
+static double wrap_angle(double a) {
+    while (a > M_PI) a -= 2.0 * M_PI;
+    while (a < -M_PI) a += 2.0 * M_PI;
+    return a;
+}
+
+static void mat_mul(const double *a, const double *b, double *out) {
+    double t[9];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            t[i * 3 + j] = a[i * 3] * b[j] + a[i * 3 + 1] * b[3 + j] + a[i * 3 + 2] * b[6 + j];
+        }
+    }
+    memcpy(out, t, sizeof(t));
+}
+
+// Rotation by the vector w (axis * angle)
+static void rotation_from_vector(const double *w, double *r) {
+    double angle = sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]);
+    double s = angle > 1e-12 ? sin(angle) / angle : 1.0;
+    double c = angle > 1e-12 ? (1.0 - cos(angle)) / (angle * angle) : 0.5;
+    // R = I + s [w]x + c [w]x^2
+    r[0] = 1.0 - c * (w[1] * w[1] + w[2] * w[2]);
+    r[1] = -s * w[2] + c * w[0] * w[1];
+    r[2] =  s * w[1] + c * w[0] * w[2];
+    r[3] =  s * w[2] + c * w[0] * w[1];
+    r[4] = 1.0 - c * (w[0] * w[0] + w[2] * w[2]);
+    r[5] = -s * w[0] + c * w[1] * w[2];
+    r[6] = -s * w[1] + c * w[0] * w[2];
+    r[7] =  s * w[0] + c * w[1] * w[2];
+    r[8] = 1.0 - c * (w[0] * w[0] + w[1] * w[1]);
+}
+
+// Gram-Schmidt on the rows, keeps the accumulated updates a proper rotation
+static void orthonormalize(double *r) {
+    double *a = &r[0], *b = &r[3], *c = &r[6];
+    double n = sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+    for (int i = 0; i < 3; i++) a[i] /= n;
+    double d = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    for (int i = 0; i < 3; i++) b[i] -= d * a[i];
+    n = sqrt(b[0] * b[0] + b[1] * b[1] + b[2] * b[2]);
+    for (int i = 0; i < 3; i++) b[i] /= n;
+    c[0] = a[1] * b[2] - a[2] * b[1];
+    c[1] = a[2] * b[0] - a[0] * b[2];
+    c[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+// Axis angles the model predicts for a sky vector
+static void predict(const align_solution_t *s, const double *sky, double *el, double *az) {
+    double v[3];
+    for (int i = 0; i < 3; i++) {
+        v[i] = s->r[i * 3] * sky[0] + s->r[i * 3 + 1] * sky[1] + s->r[i * 3 + 2] * sky[2];
+    }
+    double el0 = asin(fmax(-1.0, fmin(1.0, v[2])));
+    double cos_el = fmax(cos(el0), MIN_COS_EL);
+    *el = el0 + astro_refraction(el0) + s->index_el;
+    *az = atan2(v[1], v[0]) + s->cone / cos_el + s->nonperp * sin(el0) / cos_el;
+}
+
+// Residuals of every star, azimuth scaled by cos(el) so both are true angles on the sky
+static double residuals(const align_solution_t *s, double *res) {
+    double sum = 0.0;
+    for (int i = 0; i < star_count; i++) {
+        double el, az;
+        predict(s, stars[i].sky, &el, &az);
+        res[i * 2] = stars[i].el - el;
+        res[i * 2 + 1] = wrap_angle(stars[i].az - az) * cos(stars[i].el);
+        sum += res[i * 2] * res[i * 2] + res[i * 2 + 1] * res[i * 2 + 1];
+    }
+    return sum;
+}
+
+// Parameter k nudged by delta: 0-2 rotate the whole model, 3-5 are the error terms
+static void perturb(align_solution_t *s, int k, double delta) {
+    if (k < 3) {
+        double w[3] = {0.0, 0.0, 0.0};
+        double rot[9];
+        w[k] = delta;
+        rotation_from_vector(w, rot);
+        mat_mul(rot, s->r, s->r);
+    } else if (k == 3) {
+        s->index_el += delta;
+    } else if (k == 4) {
+        s->cone += delta;
+    } else {
+        s->nonperp += delta;
+    }
+}
+
+// Solves a x = b in place (Gaussian elimination with partial pivoting)
+static bool solve_linear(double a[NUM_PARAMS][NUM_PARAMS], double *b, double *x) {
+    for (int col = 0; col < NUM_PARAMS; col++) {
+        int pivot = col;
+        for (int row = col + 1; row < NUM_PARAMS; row++) {
+            if (fabs(a[row][col]) > fabs(a[pivot][col])) pivot = row;
+        }
+        if (fabs(a[pivot][col]) < 1e-18) return false;
+        if (pivot != col) {
+            for (int j = 0; j < NUM_PARAMS; j++) {
+                double t = a[col][j]; a[col][j] = a[pivot][j]; a[pivot][j] = t;
+            }
+            double t = b[col]; b[col] = b[pivot]; b[pivot] = t;
+        }
+        for (int row = col + 1; row < NUM_PARAMS; row++) {
+            double f = a[row][col] / a[col][col];
+            for (int j = col; j < NUM_PARAMS; j++) a[row][j] -= f * a[col][j];
+            b[row] -= f * b[col];
+        }
+    }
+    for (int row = NUM_PARAMS - 1; row >= 0; row--) {
+        double sum = b[row];
+        for (int j = row + 1; j < NUM_PARAMS; j++) sum -= a[row][j] * x[j];
+        x[row] = sum / a[row][row];
+    }
+    return true;
+}
+
+// One Gauss-Newton step on the normal equations. With fewer than ALIGN_TERMS_MIN_STARS stars the error terms
+// are held at zero by a stiff prior, the rotation alone is then a (possibly underdetermined, damped) fit
+static bool gauss_newton_step(void) {
+    static double res[ALIGN_MAX_STARS * 2];
+    static double res_k[ALIGN_MAX_STARS * 2];
+    static double jac[NUM_PARAMS][ALIGN_MAX_STARS * 2];
+    const double h = 1e-7;
+    int rows = star_count * 2;
+
+    residuals(&solution, res);
+    for (int k = 0; k < NUM_PARAMS; k++) {
+        align_solution_t nudged = solution;
+        perturb(&nudged, k, h);
+        residuals(&nudged, res_k);
+        // Residual = measured - predicted, so the Jacobian of the prediction is the negated difference
+        for (int i = 0; i < rows; i++) jac[k][i] = (res[i] - res_k[i]) / h;
+    }
+
+    double a[NUM_PARAMS][NUM_PARAMS];
+    double b[NUM_PARAMS];
+    for (int k = 0; k < NUM_PARAMS; k++) {
+        for (int l = 0; l < NUM_PARAMS; l++) {
+            double sum = 0.0;
+            for (int i = 0; i < rows; i++) sum += jac[k][i] * jac[l][i];
+            a[k][l] = sum;
+        }
+        double sum = 0.0;
+        for (int i = 0; i < rows; i++) sum += jac[k][i] * res[i];
+        b[k] = sum;
+        a[k][k] += 1e-9;
+    }
+
+    double prior = star_count >= ALIGN_TERMS_MIN_STARS ? 1e-6 : 1e6;
+    const double terms[3] = {solution.index_el, solution.cone, solution.nonperp};
+    for (int k = 3; k < NUM_PARAMS; k++) {
+        a[k][k] += prior;
+        b[k] -= prior * terms[k - 3];
+    }
+
+    double step[NUM_PARAMS];
+    if (!solve_linear(a, b, step)) return false;
+    for (int k = 0; k < NUM_PARAMS; k++) {
+        perturb(&solution, k, step[k]);
+    }
+    orthonormalize(solution.r);
+    return true;
+}
+
+static void star_mount_vector(const align_star_t *star, double *v) {
+    sky_vector(star->az, star->el, v);
+}
+
+// Starting point without a usable previous solution: the rotation that takes the first star onto its axis position,
+// from two stars the rotation matching both directions (TRIAD)
+static void initial_rotation(void) {
+    double s1[3], m1[3];
+    memcpy(s1, stars[0].sky, sizeof(s1));
+    star_mount_vector(&stars[0], m1);
+
+    if (star_count == 1) {
+        double v[3] = {s1[1] * m1[2] - s1[2] * m1[1], s1[2] * m1[0] - s1[0] * m1[2], s1[0] * m1[1] - s1[1] * m1[0]};
+        double c = s1[0] * m1[0] + s1[1] * m1[1] + s1[2] * m1[2];
+        double sn = sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        double w[3] = {0.0, 0.0, 0.0};
+        if (sn > 1e-12) {
+            double angle = atan2(sn, c);
+            for (int i = 0; i < 3; i++) w[i] = v[i] / sn * angle;
+        } else if (c < 0.0) {
+            // Opposite directions, any perpendicular axis will do
+            double p[3] = {-s1[1], s1[0], 0.0};
+            double n = sqrt(p[0] * p[0] + p[1] * p[1]);
+            if (n < 1e-6) { p[0] = 1.0; p[1] = 0.0; n = 1.0; }
+            for (int i = 0; i < 3; i++) w[i] = p[i] / n * M_PI;
+        }
+        rotation_from_vector(w, solution.r);
+        return;
+    }
+
+    // Newest star as the second direction, it is the one that changed
+    const align_star_t *second = &stars[star_count - 1];
+    double s2[3], m2[3];
+    memcpy(s2, second->sky, sizeof(s2));
+    star_mount_vector(second, m2);
+
+    // Orthonormal frames from both pairs, R = sum(mount_k * sky_k^T)
+    double fs[3][3], fm[3][3];
+    const double *src[2][2] = {{s1, s2}, {m1, m2}};
+    double (*frames[2])[3] = {fs, fm};
+    for (int f = 0; f < 2; f++) {
+        const double *a = src[f][0], *b = src[f][1];
+        double (*t)[3] = frames[f];
+        memcpy(t[0], a, sizeof(double) * 3);
+        t[1][0] = a[1] * b[2] - a[2] * b[1];
+        t[1][1] = a[2] * b[0] - a[0] * b[2];
+        t[1][2] = a[0] * b[1] - a[1] * b[0];
+        double n = sqrt(t[1][0] * t[1][0] + t[1][1] * t[1][1] + t[1][2] * t[1][2]);
+        if (n < 1e-9) {
+            // Both syncs on the same star, fall back to the single star rotation
+            uint8_t count = star_count;
+            star_count = 1;
+            initial_rotation();
+            star_count = count;
+            return;
+        }
+        for (int i = 0; i < 3; i++) t[1][i] /= n;
+        t[2][0] = t[0][1] * t[1][2] - t[0][2] * t[1][1];
+        t[2][1] = t[0][2] * t[1][0] - t[0][0] * t[1][2];
+        t[2][2] = t[0][0] * t[1][1] - t[0][1] * t[1][0];
+    }
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            solution.r[i * 3 + j] = fm[0][i] * fs[0][j] + fm[1][i] * fs[1][j] + fm[2][i] * fs[2][j];
+        }
+    }
+}
+
+// Re-solve after the star list changed. From ALIGN_TERMS_MIN_STARS on the previous solution is the starting point,
+// so each new star only costs a few iterations around a model that is already close
+static void align_solve(void) {
+    if (star_count == 0) {
+        memset(&solution, 0, sizeof(solution));
+        solution_rms = 0.0;
+        uint32_t save = spin_lock_blocking(model_lock);
+        model.valid = false;
+        model_version++;
+        spin_unlock(model_lock, save);
+        return;
+    }
+
+    if (star_count < ALIGN_TERMS_MIN_STARS || !model.valid) {
+        memset(&solution, 0, sizeof(solution));
+        initial_rotation();
+    }
+    for (int i = 0; i < ALIGN_ITERATIONS; i++) {
+        if (!gauss_newton_step()) {
+            DEBUG_PRINT("Alignment solve failed, singular normal equations\n");
+            break;
+        }
+    }
+
+    static double res[ALIGN_MAX_STARS * 2];
+    solution_rms = sqrt(residuals(&solution, res) / star_count);
+
+    uint32_t save = spin_lock_blocking(model_lock);
+    for (int i = 0; i < 9; i++) model.matrix[i] = (float)solution.r[i];
+    model.index_el = (float)solution.index_el;
+    model.cone = (float)solution.cone;
+    model.nonperp = (float)solution.nonperp;
+    model.epoch_us = epoch_us;
+    model.valid = true;
+    model_version++;
+    spin_unlock(model_lock, save);
+
+    DEBUG_PRINT("Alignment solved from %d stars, rms %.1f\"\n", star_count, solution_rms * RAD_TO_ARCSEC);
+}
+
+void align_background_task(void) {
+    bool changed = false;
+
+    if (clear_requested) {
+        clear_requested = false;
+        star_count = 0;
+        changed = true;
+    }
+
+    if (drop_requested) {
+        drop_requested = false;
+        if (star_count > 0) {
+            star_count--;
+            changed = true;
+        }
+    }
+
+    if (sync_request.pending) {
+        uint32_t save = save_and_disable_interrupts();
+        align_sync_t sync = sync_request;
+        sync_request.pending = false;
+        restore_interrupts(save);
+
+        if (star_count == 0) {
+            epoch_us = sync.time_us;
+        }
+        if (star_count == ALIGN_MAX_STARS) {
+            memmove(&stars[0], &stars[1], sizeof(align_star_t) * (ALIGN_MAX_STARS - 1));
+            star_count--;
+        }
+        align_star_t *star = &stars[star_count++];
+        double ra_hours, dec_deg;
+        astro_apparent(sync.ra_hours, sync.dec_deg, sync.time_us, &ra_hours, &dec_deg);
+        double elapsed_s = (double)(int64_t)(sync.time_us - epoch_us) / 1e6;
+        double ra_rad = ra_hours * (M_PI / 12.0) - elapsed_s * SIDEREAL_RATE_RAD_PER_SEC;
+        sky_vector(ra_rad, dec_deg * (M_PI / 180.0), star->sky);
+        star->el = sync.x_arcsec * ARCSEC_TO_RAD;
+        star->az = sync.z_arcsec * ARCSEC_TO_RAD;
+        changed = true;
+    }
+
+    if (changed) {
+        align_solve();
+        align_send_status();
+    }
+}
+
+void align_send_status(void) {
+    // Status: stars(u8) + valid(u8) + rms(f32) + index error(f32) + cone(f32) + non-perpendicularity(f32), arcsec
+    uint8_t status[18];
+    float values[4] = {
+        (float)(solution_rms * RAD_TO_ARCSEC),
+        (float)(solution.index_el * RAD_TO_ARCSEC),
+        (float)(solution.cone * RAD_TO_ARCSEC),
+        (float)(solution.nonperp * RAD_TO_ARCSEC)
+    };
+    status[0] = star_count;
+    status[1] = model.valid ? 1 : 0;
+    memcpy(&status[2], values, sizeof(values));
+    queue_response(CMD_ALIGN_STATUS, status, sizeof(status));
+}
+
+// Axis angles for a target through the model, core 1 float math like the matrix based tracking.
+// Also returns the angle the sky turned through (hour angle like) for the field rotation
+void align_mount_angles(const align_model_t *m, const astro_corrections_t *corrections, float ra_hours, float dec_deg,
+                        uint64_t time_us, float *x_arcsec, float *z_arcsec, float *ha_rad) {
+    float elapsed_s = (float)(int64_t)(time_us - m->epoch_us) / 1000000.0f;
+    float ra_rad = ra_hours * (float)(M_PI / 12.0) - elapsed_s * (float)SIDEREAL_RATE_RAD_PER_SEC;
+    float dec_rad = dec_deg * (float)(M_PI / 180.0);
+
+    float cos_dec = cosf(dec_rad);
+    float sky[3] = {cos_dec * cosf(ra_rad), cos_dec * sinf(ra_rad), sinf(dec_rad)};
+    float v[3];
+    for (int i = 0; i < 3; i++) {
+        v[i] = m->matrix[i * 3] * sky[0] + m->matrix[i * 3 + 1] * sky[1] + m->matrix[i * 3 + 2] * sky[2];
+    }
+    if (v[2] > 1.0f) v[2] = 1.0f;
+    if (v[2] < -1.0f) v[2] = -1.0f;
+
+    float el = asinf(v[2]);
+    float cos_el = cosf(el);
+    if (cos_el < (float)MIN_COS_EL) cos_el = (float)MIN_COS_EL;
+    float az = atan2f(v[1], v[0]) + m->cone / cos_el + m->nonperp * sinf(el) / cos_el;
+    astro_note_elevation(el);
+
+    *x_arcsec = (el + astro_refraction_at(corrections, el) + m->index_el) * (float)RAD_TO_ARCSEC;
+    *z_arcsec = az * (float)RAD_TO_ARCSEC;
+    *ha_rad = ra_rad;
+}
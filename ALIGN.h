@@ -0,0 +1,51 @@
+#ifndef ALIGN_H
+#define ALIGN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+#include "pico/sync.h"
+#include "STEPPER.h"
+#include "ASTRO.h"
+#include "DEBUGPRINT.h"
+
+// Multi-star alignment solved on the device
+// The host centres a star and sends its RA/Dec, the firmware pairs it with the axis positions at that moment.
+// From the sync points a pointing model is fitted by least squares: the sky -> mount rotation plus the
+// elevation index error, the cone error (optical axis not perpendicular to the elevation axis) and the
+// non-perpendicularity of the two axes. The model is re-solved on core 0 every time a sync arrives and
+// handed to core 1, where celestial tracking and gotos use it instead of a host supplied matrix.
+// Sync and goto coordinates go through the corrections in ASTRO.h, refraction is part of the fitted model.
+
+#define ALIGN_MAX_STARS 12              // Sync points kept, a new sync replaces the oldest one
+#define ALIGN_TERMS_MIN_STARS 3         // Cone, non-perpendicularity and index error are only fitted from this many stars
+#define ALIGN_ITERATIONS 8              // Gauss-Newton iterations per solve
+#define SITE_LATITUDE_DEG 0.0f          // Default site latitude, only used for the field rotation
+
+typedef enum {
+    ALIGN_ACTION_CLEAR = 0,             // Drop every sync point and the model
+    ALIGN_ACTION_STATUS = 1,            // Just report status
+    ALIGN_ACTION_DROP_LAST = 2          // Remove the newest sync point (a misidentified star) and re-solve
+} align_action_t;
+
+// Pointing model, everything core 1 needs to turn RA/Dec into axis angles
+typedef struct {
+    bool valid;
+    float matrix[9];                    // Sky -> mount rotation (row-major, same layout as the host matrix)
+    float index_el;                     // Elevation (X) encoder zero error, rad
+    float cone;                         // Collimation error, rad
+    float nonperp;                      // Axis non-perpendicularity, rad
+    uint64_t epoch_us;                  // Boot time the sidereal rotation is counted from
+} align_model_t;
+
+void align_init(void);
+void align_sync(float ra_hours, float dec_deg);
+void align_control(uint8_t action);
+void align_background_task(void);
+void align_send_status(void);
+bool align_model_valid(void);
+bool align_get_model(align_model_t *model, uint32_t *version);
+void align_mount_angles(const align_model_t *model, const astro_corrections_t *corrections, float ra_hours, float dec_deg,
+                        uint64_t time_us, float *x_arcsec, float *z_arcsec, float *ha_rad);
+
+#endif // ALIGN_H
@@ -0,0 +1,209 @@
+#include "ASTRO.h"
+#include "CONFIG.h"
+#include <math.h>
+#include <string.h>
+
+#define DEG_TO_RAD (M_PI / 180.0)
+#define ARCSEC_TO_RAD (M_PI / (180.0 * 3600.0))
+#define UNIX_EPOCH_JD 2440587.5
+#define J2000_JD 2451545.0
+#define ABERRATION_ARCSEC 20.49552          // Constant of annual aberration
+#define REFRACTION_MIN_EL_DEG -1.0          // The formula diverges below the horizon, hold it there
+
+static int64_t unix_offset_ms;              // Unix time at boot
+static volatile bool time_valid;
+static volatile float temperature_c;
+static volatile float current_el_rad;       // Last elevation core 1 computed a target for
+
+static float target_ra_hours;
+static float target_dec_deg;
+static volatile bool target_set;
+static volatile uint32_t target_sequence;   // Counts goto targets, an apparent place is only published for the latest
+static uint32_t apparent_sequence;          // Target the published offsets belong to
+static uint32_t last_apparent_us;
+static uint32_t last_refraction_us;
+
+static spin_lock_t *corrections_lock;
+static astro_corrections_t corrections;
+static volatile uint32_t corrections_version;
+
+void astro_init(void) {
+    corrections_lock = spin_lock_init(spin_lock_claim_unused(true));
+    time_valid = false;
+    temperature_c = ASTRO_DEFAULT_TEMP_C;
+    current_el_rad = (float)(M_PI / 4.0);
+    target_set = false;
+    memset(&corrections, 0, sizeof(corrections));
+    corrections_version = 0;
+    last_refraction_us = time_us_32();
+}
+
+void astro_set_unix_time(int64_t unix_ms) {
+    unix_offset_ms = unix_ms - (int64_t)(time_us_64() / 1000);
+    time_valid = true;
+}
+
+bool astro_time_valid(void) {
+    return time_valid;
+}
+
+// Unix time of a time_us_64() stamp, false until the host sent the time
+bool astro_unix_us(uint64_t boot_us, int64_t *unix_us) {
+    if (!time_valid) return false;
+    *unix_us = unix_offset_ms * 1000 + (int64_t)boot_us;
+    return true;
+}
+
+// -1000 is what the DS18B20 driver returns without a sensor
+void astro_set_temperature(float celsius) {
+    if (celsius > -100.0f && celsius < 100.0f) {
+        temperature_c = celsius;
+    }
+}
+
+void astro_note_elevation(float el_rad) {
+    current_el_rad = el_rad;
+}
+
+bool astro_get_corrections(astro_corrections_t *out, uint32_t *version) {
+    if (corrections_version == *version) return false;
+    uint32_t save = spin_lock_blocking(corrections_lock);
+    *out = corrections;
+    *version = corrections_version;
+    spin_unlock(corrections_lock, save);
+    return true;
+}
+
+// Catalogue (J2000) -> apparent place of date, low precision (Meeus ch. 21-23), a few arcsec
+// Without a time from the host the coordinates are passed through as they are
+void astro_apparent(double ra_hours, double dec_deg, uint64_t time_us, double *app_ra_hours, double *app_dec_deg) {
+    if (!time_valid) {
+        *app_ra_hours = ra_hours;
+        *app_dec_deg = dec_deg;
+        return;
+    }
+
+    double jd = (unix_offset_ms + (int64_t)(time_us / 1000)) / 86400000.0 + UNIX_EPOCH_JD;
+    double t = (jd - J2000_JD) / 36525.0;
+    double ra = ra_hours * 15.0 * DEG_TO_RAD;
+    double dec = dec_deg * DEG_TO_RAD;
+
+    // Precession, IAU 1976
+    double zeta  = (2306.2181 * t + 0.30188 * t * t + 0.017998 * t * t * t) * ARCSEC_TO_RAD;
+    double z     = (2306.2181 * t + 1.09468 * t * t + 0.018203 * t * t * t) * ARCSEC_TO_RAD;
+    double theta = (2004.3109 * t - 0.42665 * t * t - 0.041833 * t * t * t) * ARCSEC_TO_RAD;
+    double a = cos(dec) * sin(ra + zeta);
+    double b = cos(theta) * cos(dec) * cos(ra + zeta) - sin(theta) * sin(dec);
+    double c = sin(theta) * cos(dec) * cos(ra + zeta) + cos(theta) * sin(dec);
+    ra = atan2(a, b) + z;
+    dec = asin(c);
+
+    // Nutation, the four largest terms
+    double omega = (125.04452 - 1934.136261 * t) * DEG_TO_RAD;
+    double l_sun = (280.4665 + 36000.7698 * t) * DEG_TO_RAD;
+    double l_moon = (218.3165 + 481267.8813 * t) * DEG_TO_RAD;
+    double dpsi = (-17.20 * sin(omega) - 1.32 * sin(2 * l_sun) - 0.23 * sin(2 * l_moon) + 0.21 * sin(2 * omega)) * ARCSEC_TO_RAD;
+    double deps = (9.20 * cos(omega) + 0.57 * cos(2 * l_sun) + 0.10 * cos(2 * l_moon) - 0.09 * cos(2 * omega)) * ARCSEC_TO_RAD;
+    double eps = (23.4392911 - 46.8150 / 3600.0 * t) * DEG_TO_RAD + deps;
+
+    // Annual aberration from the Sun's true longitude
+    double m_sun = (357.52911 + 35999.05029 * t) * DEG_TO_RAD;
+    double sun = l_sun + (1.914602 * sin(m_sun) + 0.019993 * sin(2 * m_sun)) * DEG_TO_RAD;
+    double k = ABERRATION_ARCSEC * ARCSEC_TO_RAD;
+
+    double cos_dec = fmax(cos(dec), 1e-6);
+    double tan_dec = sin(dec) / cos_dec;
+    double dra = (cos(eps) + sin(eps) * sin(ra) * tan_dec) * dpsi - cos(ra) * tan_dec * deps
+               - k * (cos(ra) * cos(sun) * cos(eps) + sin(ra) * sin(sun)) / cos_dec;
+    double ddec = sin(eps) * cos(ra) * dpsi + sin(ra) * deps
+                - k * (cos(sun) * cos(eps) * (tan(eps) * cos_dec - sin(ra) * sin(dec)) + cos(ra) * sin(dec) * sin(sun));
+    ra += dra;
+    dec += ddec;
+
+    ra = fmod(ra, 2.0 * M_PI);
+    if (ra < 0) ra += 2.0 * M_PI;
+    *app_ra_hours = ra / (15.0 * DEG_TO_RAD);
+    *app_dec_deg = dec / DEG_TO_RAD;
+}
+
+// Refraction for a true elevation (Saemundsson), scaled by pressure and temperature
+double astro_refraction(double el_rad) {
+    double h = el_rad / DEG_TO_RAD;
+    if (h < REFRACTION_MIN_EL_DEG) h = REFRACTION_MIN_EL_DEG;
+    double r_arcmin = 1.02 / tan((h + 10.3 / (h + 5.11)) * DEG_TO_RAD) + 0.0019279;  // Offset makes it 0 at the zenith
+    r_arcmin *= (device_config.pressure_hpa / 1010.0) * (283.0 / (273.0 + temperature_c));
+    return r_arcmin * 60.0 * ARCSEC_TO_RAD;
+}
+
+static void update_apparent(astro_corrections_t *c, float ra_hours, float dec_deg) {
+    double ra, dec;
+    astro_apparent(ra_hours, dec_deg, time_us_64(), &ra, &dec);
+    double dra = ra - ra_hours;
+    if (dra > 12.0) dra -= 24.0;
+    if (dra < -12.0) dra += 24.0;
+    c->ra_offset_h = (float)dra;
+    c->dec_offset_deg = (float)(dec - dec_deg);
+}
+
+static void update_refraction(astro_corrections_t *c) {
+    const double h = 0.005;
+    double el = current_el_rad;
+    c->refraction_el_rad = (float)el;
+    c->refraction_rad = (float)astro_refraction(el);
+    c->refraction_slope = (float)((astro_refraction(el + h) - astro_refraction(el - h)) / (2.0 * h));
+}
+
+// New goto target, called from the UART interrupt. Only latched here, the apparent place is far too much double
+// precision soft float for an interrupt. Until the background task has published it core 1 brakes and holds position,
+// so it never slews towards the uncorrected position first
+void astro_set_target(float ra_hours, float dec_deg) {
+    uint32_t save = spin_lock_blocking(corrections_lock);
+    target_ra_hours = ra_hours;
+    target_dec_deg = dec_deg;
+    target_sequence++;
+    target_set = true;
+    corrections.apparent_ready = false;
+    corrections_version++;
+    spin_unlock(corrections_lock, save);
+}
+
+// Main loop with interrupts on, the lock is only held to take the target and to publish what came out
+void astro_background_task(void) {
+    uint32_t now = time_us_32();
+    bool apparent_due = target_set &&
+                        (apparent_sequence != target_sequence || now - last_apparent_us >= ASTRO_APPARENT_UPDATE_MS * 1000);
+    bool refraction_due = now - last_refraction_us >= ASTRO_REFRACTION_UPDATE_MS * 1000;
+    if (!apparent_due && !refraction_due) return;
+
+    uint32_t save = spin_lock_blocking(corrections_lock);
+    float ra_hours = target_ra_hours;
+    float dec_deg = target_dec_deg;
+    uint32_t sequence = target_sequence;
+    spin_unlock(corrections_lock, save);
+
+    astro_corrections_t c;
+    if (apparent_due) {
+        update_apparent(&c, ra_hours, dec_deg);
+    }
+    if (refraction_due) {
+        update_refraction(&c);
+        last_refraction_us = now;
+    }
+
+    save = spin_lock_blocking(corrections_lock);
+    // A target that came in meanwhile keeps waiting for its own apparent place, computed on the next pass
+    if (apparent_due && sequence == target_sequence) {
+        corrections.ra_offset_h = c.ra_offset_h;
+        corrections.dec_offset_deg = c.dec_offset_deg;
+        corrections.apparent_ready = true;
+        apparent_sequence = sequence;
+        last_apparent_us = now;
+    }
+    if (refraction_due) {
+        corrections.refraction_rad = c.refraction_rad;
+        corrections.refraction_slope = c.refraction_slope;
+        corrections.refraction_el_rad = c.refraction_el_rad;
+    }
+    corrections_version++;
+    spin_unlock(corrections_lock, save);
+}
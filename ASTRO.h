@@ -0,0 +1,50 @@
+#ifndef ASTRO_H
+#define ASTRO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+#include "pico/sync.h"
+#include "DEBUGPRINT.h"
+
+// Coordinate corrections for gotos through the on-device pointing model
+// Once the host has told us the time, RA/Dec are taken as J2000 catalogue positions and turned into apparent
+// positions of date (precession, nutation, annual aberration). Refraction lifts every target by what the
+// atmosphere does at the measured temperature and the configured pressure.
+// None of this is evaluated per step or in an interrupt: the main loop recomputes the apparent target right after a
+// goto and then once a minute, the refraction at the current elevation once a second, core 1 only adds offsets and a
+// linear refraction term.
+
+#define ASTRO_APPARENT_UPDATE_MS 60000      // Precession, nutation and aberration of the goto target
+#define ASTRO_REFRACTION_UPDATE_MS 1000     // Refraction at the current elevation
+#define ASTRO_PRESSURE_HPA 1010.0f          // Default air pressure at the site
+#define ASTRO_DEFAULT_TEMP_C 10.0f          // Used until the DS18B20 reported a temperature
+
+// Everything core 1 needs, published as one block
+typedef struct {
+    float ra_offset_h;                      // Apparent minus catalogue RA of the goto target
+    float dec_offset_deg;
+    float refraction_rad;                   // Refraction at refraction_el_rad
+    float refraction_slope;                 // d(refraction)/d(elevation) there
+    float refraction_el_rad;
+    bool apparent_ready;                    // The offsets belong to the current goto target, core 1 waits for them
+} astro_corrections_t;
+
+void astro_init(void);
+void astro_set_unix_time(int64_t unix_ms);
+bool astro_time_valid(void);
+bool astro_unix_us(uint64_t boot_us, int64_t *unix_us);
+void astro_set_temperature(float celsius);
+void astro_set_target(float ra_hours, float dec_deg);
+void astro_apparent(double ra_hours, double dec_deg, uint64_t time_us, double *app_ra_hours, double *app_dec_deg);
+double astro_refraction(double el_rad);
+bool astro_get_corrections(astro_corrections_t *corrections, uint32_t *version);
+void astro_note_elevation(float el_rad);
+void astro_background_task(void);
+
+// Refraction near el from the linearised coefficients, cheap enough for every pass of the step loop
+static inline float astro_refraction_at(const astro_corrections_t *c, float el_rad) {
+    return c->refraction_rad + c->refraction_slope * (el_rad - c->refraction_el_rad);
+}
+
+#endif // ASTRO_H
@@ -11,8 +11,8 @@ void fan_set_speed(float duty_percent) {
     // Save for telemetry
     g_fan_speed_percent = (uint8_t)(duty_percent + 0.5f);
 
-    uint slice = pwm_gpio_to_slice_num(FAN_PWM_PIN);
-    uint chan  = pwm_gpio_to_channel(FAN_PWM_PIN);
+    uint slice = pwm_gpio_to_slice_num(device_config.fan_pwm_pin);
+    uint chan  = pwm_gpio_to_channel(device_config.fan_pwm_pin);
     uint16_t level = (uint16_t)(duty_percent / 100.0 * 65535);
     pwm_set_chan_level(slice, chan, level);
 }
@@ -27,26 +27,38 @@ int main()
     // This ensures that DEBUG_PRINT only use the USB for output and doesn't make the uart output garbage
     stdio_uart_init_full(uart1, 9600, -1, -1);
     
-    // GPIO setup
-    gpio_init(TEMP_SENSE_PIN); gpio_set_dir(TEMP_SENSE_PIN, GPIO_OUT);
-    gpio_put(TEMP_SENSE_PIN, 1);
-    gpio_init(FAN_PWM_PIN); gpio_set_dir(FAN_PWM_PIN, GPIO_OUT);
+    // Everything below takes its pins and constants from here
+    config_init();
+
+    // GPIO setup, the 1-Wire bus is searched for sensors here
+    ds18b20_init(device_config.temp_sense_pin);
+    gpio_init(device_config.fan_pwm_pin); gpio_set_dir(device_config.fan_pwm_pin, GPIO_OUT);
     gpio_init(ONBOARD_LED_PIN); gpio_set_dir(ONBOARD_LED_PIN, GPIO_OUT);
 
     // Setup PWM on FAN pin
-    gpio_set_function(FAN_PWM_PIN, GPIO_FUNC_PWM);
-    uint slice = pwm_gpio_to_slice_num(FAN_PWM_PIN);
+    gpio_set_function(device_config.fan_pwm_pin, GPIO_FUNC_PWM);
+    uint slice = pwm_gpio_to_slice_num(device_config.fan_pwm_pin);
     pwm_set_wrap(slice, 65535); // 16-bit resolution
     pwm_set_clkdiv(slice, 76.3f); // divisor for ~25 kHz, lower frequencies cause the fan to emit audible high pitched noise
     pwm_set_enabled(slice, true);
     fan_set_speed(100); // the fans are pretty slow, just let them be at full speed
 
-    sleep_ms(5000); // The stepper drivers do like to power up with some delay
-                    // haven't had any issues with this removed, however, some people on the internet reported issues 
-                    // and since this happens only once at startup, well leave it here for safety
+    // The stepper drivers do like to power up with some delay
+    // haven't had any issues with this removed, however, some people on the internet reported issues 
+    // so wait until the configured delay has passed since boot - the time spent initializing already counts
+    sleep_until(from_us_since_boot((uint64_t)device_config.driver_powerup_ms * 1000));
+
+    astro_init();
+    limits_init();
+    home_init();
+    guide_init();
+    shutter_init();
+    sequence_init();
+    align_init();
 
     // Initialize stepper motor GPIOs and launch process in a separate core
     stepper_init();
+    checkpoint_restore();
 
     // UART setup
     uart_init_protocol();
@@ -56,9 +68,22 @@ int main()
 
     uint32_t last_telemetry_time = time_us_32();
     const uint32_t TELEMETRY_INTERVAL_US = 2000000; // 2 seconds
+    const uint32_t IDLE_WAIT_US = 1000;             // Longest sleep between passes, interrupts end it sooner
 
     while (1) {
+        fault_background_task();
+        limits_background_task();
+        home_background_task();
+        guide_background_task();
+        shutter_background_task();
+        sequence_background_task();
         uart_background_task();
+        config_background_task();
+        checkpoint_background_task();
+        tmc2209_background_task();
+        align_background_task();
+        astro_background_task();
+        ds18b20_background_task();
         uint32_t current_time = time_us_32();
         
         //time will wrap around every 71 minutes or so, handle that
@@ -71,10 +96,13 @@ int main()
 
         // Send telemetry every 2 seconds
         if (time_diff >= TELEMETRY_INTERVAL_US) {
-            float t = ds18b20_read_temp();
+            float t = ds18b20_ambient_temp();
+            astro_set_temperature(t);
 
-            // Telemetry: temp (float) + X,Y,Z (int32) + enabled(u8) + paused(u8) + fan_pct(u8) = 19 bytes
-            uint8_t telemetry[20];
+            // Telemetry: temp (float) + X,Y,Z (int32) + enabled(u8) + paused(u8) + slewing(u8) + fan_pct(u8)
+            //            + reference(u8) + restored mode(u8) + X,Y,Z encoder error (int16, 0.1 arcsec)
+            //            + last, worst core 1 wake latency (u16, us) = 32 bytes
+            uint8_t telemetry[32];
             int32_t x = stepper_get_position_arcsec(AXIS_X);
             int32_t y = stepper_get_position_arcsec(AXIS_Y);
             int32_t z = stepper_get_position_arcsec(AXIS_Z);
@@ -90,12 +118,29 @@ int main()
             telemetry[17] = paused;
             telemetry[18] = celestial_slewing;
             telemetry[19] = g_fan_speed_percent;
-
-            queue_response(CMD_STATUS, telemetry, 20);
+            telemetry[20] = (uint8_t)stepper_get_reference();
+            telemetry[21] = (uint8_t)checkpoint_restored_mode();
+            for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+                float tenths = encoder_get_error(axis) * 10.0f;
+                if (tenths > INT16_MAX) tenths = INT16_MAX;
+                if (tenths < INT16_MIN) tenths = INT16_MIN;
+                int16_t encoder_error = (int16_t)tenths;
+                memcpy(&telemetry[22 + axis * 2], &encoder_error, sizeof(int16_t));
+            }
+            uint16_t wake_last_us, wake_worst_us;
+            stepper_get_wake_latency(&wake_last_us, &wake_worst_us);
+            memcpy(&telemetry[28], &wake_last_us, sizeof(uint16_t));
+            memcpy(&telemetry[30], &wake_worst_us, sizeof(uint16_t));
+
+            queue_response(CMD_STATUS, telemetry, sizeof(telemetry));
             DEBUG_PRINT("Telemetry: T=%.2fC X=%d Y=%d Z=%d en=%d pa=%d slew=%d fan=%u%%\n",
                         t, x, y, z, enabled, paused, celestial_slewing, g_fan_speed_percent);
 
             last_telemetry_time = current_time;
         }
+
+        // Every task above is driven by interrupts (UART, DMA, USB, GPIO) or by time, sleep until one of them.
+        // An interrupt taken during the pass is latched as an event, so WFE does not miss it
+        best_effort_wfe_or_timeout(make_timeout_time_us(IDLE_WAIT_US));
     }
 }
@@ -8,6 +8,18 @@
 #include "PIN_ASSIGNMENTS.h"
 #include "UART.h"
 #include "STEPPER.h"
+#include "CONFIG.h"
+#include "CHECKPOINT.h"
+#include "TMC2209.h"
+#include "FAULT.h"
+#include "ALIGN.h"
+#include "ASTRO.h"
+#include "LIMITS.h"
+#include "HOME.h"
+#include "GUIDE.h"
+#include "ENCODER.h"
+#include "SHUTTER.h"
+#include "SEQUENCE.h"
 #include "DEBUGPRINT.h"
 
 #include "pico/stdlib.h"
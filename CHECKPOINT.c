@@ -0,0 +1,109 @@
+#include "CHECKPOINT.h"
+#include "CONFIG.h"
+#include "PEC.h"
+#include <string.h>
+
+_Static_assert(sizeof(checkpoint_t) <= CHECKPOINT_RECORD_SIZE - FLASHSTORE_OVERHEAD, "checkpoint_t does not fit a flash record");
+
+static flash_store_t checkpoint_store = {
+    .offset = FLASHSTORE_CHECKPOINT_OFFSET,
+    .sectors = FLASHSTORE_SECTORS_CHECKPOINT,
+    .record_size = CHECKPOINT_RECORD_SIZE,
+};
+static volatile bool checkpoint_requested = false;
+static checkpoint_t last_written;
+static uint32_t last_checkpoint_time = 0;
+static stepper_mode_t restored_mode = STEPPER_MODE_IDLE;
+
+// Called once at boot after stepper_init(), core 1 is still paused at that point
+void checkpoint_restore(void) {
+    static uint8_t payload[CHECKPOINT_RECORD_SIZE - FLASHSTORE_OVERHEAD];
+    last_checkpoint_time = time_us_32();
+
+    if (!flash_store_load(&checkpoint_store, payload)) {
+        DEBUG_PRINT("No position checkpoint in flash\n");
+        memset(&last_written, 0, sizeof(last_written));
+        return;
+    }
+
+    checkpoint_t checkpoint;
+    memcpy(&checkpoint, payload, sizeof(checkpoint_t));
+    last_written = checkpoint;
+
+    if (checkpoint.position_microsteps != POSITION_MICROSTEPS) {
+        DEBUG_PRINT("Checkpoint was counted in 1/%u microsteps, ignoring it\n", checkpoint.position_microsteps);
+        return;
+    }
+
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        stepper_set_position(axis, checkpoint.position_steps[axis]);
+        pec_applied_steps[axis] = checkpoint.pec_applied_steps[axis];
+    }
+    restored_mode = (stepper_mode_t)checkpoint.mode;
+
+    position_reference_t reference;
+    if (checkpoint.reference == REFERENCE_LOST) {
+        reference = REFERENCE_LOST;
+    } else if (checkpoint.flags & CHECKPOINT_FLAG_AT_REST) {
+        reference = REFERENCE_RESTORED;
+    } else {
+        reference = REFERENCE_APPROXIMATE;
+    }
+    stepper_set_reference(reference);
+
+    DEBUG_PRINT("Restored checkpoint %lu: X=%ld Y=%ld Z=%ld mode=%d reference=%d\n", checkpoint_store.sequence,
+                checkpoint.position_steps[AXIS_X], checkpoint.position_steps[AXIS_Y], checkpoint.position_steps[AXIS_Z],
+                checkpoint.mode, reference);
+}
+
+stepper_mode_t checkpoint_restored_mode(void) {
+    return restored_mode;
+}
+
+// Safe to call from interrupt context, the write itself happens in checkpoint_background_task()
+void checkpoint_request(void) {
+    checkpoint_requested = true;
+}
+
+static void checkpoint_write(void) {
+    static uint8_t payload[CHECKPOINT_RECORD_SIZE - FLASHSTORE_OVERHEAD];
+    checkpoint_t checkpoint;
+    memset(&checkpoint, 0, sizeof(checkpoint));
+
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        checkpoint.position_steps[axis] = stepper_get_position(axis);
+        checkpoint.pec_applied_steps[axis] = pec_applied_steps[axis];
+    }
+    checkpoint.position_microsteps = POSITION_MICROSTEPS;
+    checkpoint.mode = (uint8_t)stepper_get_mode();
+    checkpoint.flags = stepper_is_moving() ? 0 : CHECKPOINT_FLAG_AT_REST;
+    checkpoint.reference = (uint8_t)stepper_get_reference();
+
+    // Nothing changed since the last record, save the flash the wear
+    if (memcmp(&checkpoint, &last_written, sizeof(checkpoint_t)) == 0) {
+        return;
+    }
+
+    memset(payload, 0, sizeof(payload));
+    memcpy(payload, &checkpoint, sizeof(checkpoint_t));
+    if (flash_store_append(&checkpoint_store, payload)) {
+        last_written = checkpoint;
+    }
+    DEBUG_PRINT("Checkpoint %lu written, at rest=%d\n", checkpoint_store.sequence, checkpoint.flags & CHECKPOINT_FLAG_AT_REST);
+}
+
+void checkpoint_background_task(void) {
+    uint32_t now = time_us_32();
+    bool periodic_due = (now - last_checkpoint_time) >= (CHECKPOINT_INTERVAL_MS * 1000u);
+
+    if (!checkpoint_requested && !periodic_due) return;
+
+    // A pause or stop request is only worth an exact record once the axes have settled
+    if (checkpoint_requested && stepper_is_moving() && !periodic_due) {
+        return;
+    }
+
+    checkpoint_requested = false;
+    last_checkpoint_time = now;
+    checkpoint_write();
+}
@@ -0,0 +1,37 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "STEPPER.h"
+#include "FLASHSTORE.h"
+#include "DEBUGPRINT.h"
+
+// Position / mode checkpoints
+// Positions and the motion mode are journalled into their own flash ring on pause, stop and periodically
+// while moving, and restored at boot so a reset does not lose the reference point.
+// Records are 64 bytes, 4 per page, so a sector is only erased every 64 checkpoints.
+// Writes happen from the core 0 main loop, core 1 runs from RAM and is never stalled by them.
+
+#define CHECKPOINT_RECORD_SIZE 64
+#define CHECKPOINT_INTERVAL_MS 60000    // Periodic checkpoint while the position keeps changing
+#define FLASHSTORE_SECTORS_CHECKPOINT 4
+#define FLASHSTORE_CHECKPOINT_OFFSET (FLASHSTORE_CONFIG_OFFSET - FLASHSTORE_SECTORS_CHECKPOINT * FLASH_SECTOR_SIZE)
+
+#define CHECKPOINT_FLAG_AT_REST 0x01    // Written while no axis was moving, the positions are exact
+
+typedef struct {
+    int32_t position_steps[NUM_AXES];
+    int32_t pec_applied_steps[NUM_AXES];
+    uint16_t position_microsteps;       // Positions are only valid in the unit they were counted in
+    uint8_t mode;                       // stepper_mode_t at the time of writing
+    uint8_t flags;
+    uint8_t reference;                  // position_reference_t at the time of writing
+} checkpoint_t;
+
+void checkpoint_restore(void);
+void checkpoint_request(void);
+void checkpoint_background_task(void);
+stepper_mode_t checkpoint_restored_mode(void);
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,434 @@
+#include "CONFIG.h"
+#include "UART.h"
+#include "hardware/watchdog.h"
+
+device_config_t device_config;
+
+// The stored block is what gets edited by CMD_CONFIG_SET, device_config stays what was loaded at boot
+static device_config_t stored_config;
+static flash_store_t config_store = {
+    .offset = FLASHSTORE_CONFIG_OFFSET,
+    .sectors = FLASHSTORE_SECTORS_CONFIG,
+    .record_size = CONFIG_RECORD_SIZE,
+};
+static volatile bool save_requested = false;
+static volatile uint8_t save_flags = 0;
+
+_Static_assert(sizeof(device_config_t) <= CONFIG_RECORD_SIZE - FLASHSTORE_OVERHEAD, "device_config_t does not fit a flash record");
+
+// Bytes of device_config_t each version knew about, fields are only ever appended
+// (sizeof() of an old version would also cover its tail padding, which is where the next version's fields start)
+static const uint16_t config_version_size[CONFIG_VERSION + 1] = {
+    [1] = offsetof(device_config_t, tmc2209_enabled),
+    [2] = offsetof(device_config_t, acceleration),
+    [3] = offsetof(device_config_t, latitude),
+    [4] = offsetof(device_config_t, pressure_hpa),
+    [5] = offsetof(device_config_t, soft_limit_min),
+    [6] = offsetof(device_config_t, limit_zones),
+    [7] = offsetof(device_config_t, home_pin),
+    [8] = offsetof(device_config_t, guide_pin),
+    [9] = offsetof(device_config_t, backlash),
+    [10] = offsetof(device_config_t, encoder_pin),
+    [11] = offsetof(device_config_t, temp_resolution),
+    [12] = offsetof(device_config_t, shutter_pin),
+    [13] = offsetof(device_config_t, trigger_pin),
+    [14] = sizeof(device_config_t),
+};
+
+typedef enum {
+    CONFIG_TYPE_U8,
+    CONFIG_TYPE_U16,
+    CONFIG_TYPE_U32,
+    CONFIG_TYPE_FLOAT
+} config_type_t;
+
+typedef struct {
+    uint16_t offset;
+    uint8_t type;
+} config_key_info_t;
+
+#define CONFIG_FIELD(field, type) { offsetof(device_config_t, field), type }
+#define CONFIG_ZONE_FIELDS(n) \
+    [CONFIG_KEY_ZONE_FIRST + (n) * 4 + 0] = CONFIG_FIELD(limit_zones[n].x_min, CONFIG_TYPE_U32), \
+    [CONFIG_KEY_ZONE_FIRST + (n) * 4 + 1] = CONFIG_FIELD(limit_zones[n].x_max, CONFIG_TYPE_U32), \
+    [CONFIG_KEY_ZONE_FIRST + (n) * 4 + 2] = CONFIG_FIELD(limit_zones[n].z_min, CONFIG_TYPE_U32), \
+    [CONFIG_KEY_ZONE_FIRST + (n) * 4 + 3] = CONFIG_FIELD(limit_zones[n].z_max, CONFIG_TYPE_U32)
+
+static const config_key_info_t config_keys[CONFIG_KEY_COUNT] = {
+    [CONFIG_KEY_GEAR_RATIO_X]      = CONFIG_FIELD(gear_ratio[AXIS_X], CONFIG_TYPE_FLOAT),
+    [CONFIG_KEY_GEAR_RATIO_Y]      = CONFIG_FIELD(gear_ratio[AXIS_Y], CONFIG_TYPE_FLOAT),
+    [CONFIG_KEY_GEAR_RATIO_Z]      = CONFIG_FIELD(gear_ratio[AXIS_Z], CONFIG_TYPE_FLOAT),
+    [CONFIG_KEY_STEPS_PER_REV]     = CONFIG_FIELD(steps_per_rev, CONFIG_TYPE_U16),
+    [CONFIG_KEY_MICROSTEPPING]     = CONFIG_FIELD(microstepping, CONFIG_TYPE_U16),
+    [CONFIG_KEY_BAUD_RATE]         = CONFIG_FIELD(baud_rate, CONFIG_TYPE_U32),
+    [CONFIG_KEY_STEP_PIN_X]        = CONFIG_FIELD(step_pin[AXIS_X], CONFIG_TYPE_U8),
+    [CONFIG_KEY_STEP_PIN_Y]        = CONFIG_FIELD(step_pin[AXIS_Y], CONFIG_TYPE_U8),
+    [CONFIG_KEY_STEP_PIN_Z]        = CONFIG_FIELD(step_pin[AXIS_Z], CONFIG_TYPE_U8),
+    [CONFIG_KEY_DIR_PIN_X]         = CONFIG_FIELD(dir_pin[AXIS_X], CONFIG_TYPE_U8),
+    [CONFIG_KEY_DIR_PIN_Y]         = CONFIG_FIELD(dir_pin[AXIS_Y], CONFIG_TYPE_U8),
+    [CONFIG_KEY_DIR_PIN_Z]         = CONFIG_FIELD(dir_pin[AXIS_Z], CONFIG_TYPE_U8),
+    [CONFIG_KEY_X_DIR_INV_PIN]     = CONFIG_FIELD(x_dir_inv_pin, CONFIG_TYPE_U8),
+    [CONFIG_KEY_EN_PIN]            = CONFIG_FIELD(en_pin, CONFIG_TYPE_U8),
+    [CONFIG_KEY_EN_SENSE_PIN]      = CONFIG_FIELD(en_sense_pin, CONFIG_TYPE_U8),
+    [CONFIG_KEY_TEMP_SENSE_PIN]    = CONFIG_FIELD(temp_sense_pin, CONFIG_TYPE_U8),
+    [CONFIG_KEY_FAN_PWM_PIN]       = CONFIG_FIELD(fan_pwm_pin, CONFIG_TYPE_U8),
+    [CONFIG_KEY_TMC2209_TX_PIN]    = CONFIG_FIELD(tmc2209_tx_pin, CONFIG_TYPE_U8),
+    [CONFIG_KEY_UART_TX_PIN]       = CONFIG_FIELD(uart_tx_pin, CONFIG_TYPE_U8),
+    [CONFIG_KEY_UART_RX_PIN]       = CONFIG_FIELD(uart_rx_pin, CONFIG_TYPE_U8),
+    [CONFIG_KEY_STEP_INTERVAL_US]  = CONFIG_FIELD(step_interval_us, CONFIG_TYPE_U16),
+    [CONFIG_KEY_DIR_SETUP_US]      = CONFIG_FIELD(dir_setup_us, CONFIG_TYPE_U16),
+    [CONFIG_KEY_STEP_PULSE_US]     = CONFIG_FIELD(step_pulse_us, CONFIG_TYPE_U16),
+    [CONFIG_KEY_DRIVER_POWERUP_MS] = CONFIG_FIELD(driver_powerup_ms, CONFIG_TYPE_U16),
+    [CONFIG_KEY_TMC2209_ENABLED]   = CONFIG_FIELD(tmc2209_enabled, CONFIG_TYPE_U8),
+    [CONFIG_KEY_TMC2209_ADDRESS_X] = CONFIG_FIELD(tmc2209_address[AXIS_X], CONFIG_TYPE_U8),
+    [CONFIG_KEY_TMC2209_ADDRESS_Y] = CONFIG_FIELD(tmc2209_address[AXIS_Y], CONFIG_TYPE_U8),
+    [CONFIG_KEY_TMC2209_ADDRESS_Z] = CONFIG_FIELD(tmc2209_address[AXIS_Z], CONFIG_TYPE_U8),
+    [CONFIG_KEY_TMC2209_ADDRESS_X2] = CONFIG_FIELD(tmc2209_x2_address, CONFIG_TYPE_U8),
+    [CONFIG_KEY_RUN_CURRENT]       = CONFIG_FIELD(run_current, CONFIG_TYPE_U8),
+    [CONFIG_KEY_HOLD_CURRENT]      = CONFIG_FIELD(hold_current, CONFIG_TYPE_U8),
+    [CONFIG_KEY_SLEW_MICROSTEPPING] = CONFIG_FIELD(slew_microstepping, CONFIG_TYPE_U16),
+    [CONFIG_KEY_TRACK_MICROSTEPPING] = CONFIG_FIELD(track_microstepping, CONFIG_TYPE_U16),
+    [CONFIG_KEY_ACCELERATION]      = CONFIG_FIELD(acceleration, CONFIG_TYPE_FLOAT),
+    [CONFIG_KEY_LATITUDE]          = CONFIG_FIELD(latitude, CONFIG_TYPE_FLOAT),
+    [CONFIG_KEY_PRESSURE]          = CONFIG_FIELD(pressure_hpa, CONFIG_TYPE_FLOAT),
+    // Signed, sent as the raw bytes like the floats
+    [CONFIG_KEY_SOFT_LIMIT_MIN_X]  = CONFIG_FIELD(soft_limit_min[AXIS_X], CONFIG_TYPE_U32),
+    [CONFIG_KEY_SOFT_LIMIT_MIN_Y]  = CONFIG_FIELD(soft_limit_min[AXIS_Y], CONFIG_TYPE_U32),
+    [CONFIG_KEY_SOFT_LIMIT_MIN_Z]  = CONFIG_FIELD(soft_limit_min[AXIS_Z], CONFIG_TYPE_U32),
+    [CONFIG_KEY_SOFT_LIMIT_MAX_X]  = CONFIG_FIELD(soft_limit_max[AXIS_X], CONFIG_TYPE_U32),
+    [CONFIG_KEY_SOFT_LIMIT_MAX_Y]  = CONFIG_FIELD(soft_limit_max[AXIS_Y], CONFIG_TYPE_U32),
+    [CONFIG_KEY_SOFT_LIMIT_MAX_Z]  = CONFIG_FIELD(soft_limit_max[AXIS_Z], CONFIG_TYPE_U32),
+    CONFIG_ZONE_FIELDS(0),
+    CONFIG_ZONE_FIELDS(1),
+    CONFIG_ZONE_FIELDS(2),
+    CONFIG_ZONE_FIELDS(3),
+    [CONFIG_KEY_HOME_PIN_X]        = CONFIG_FIELD(home_pin[AXIS_X], CONFIG_TYPE_U8),
+    [CONFIG_KEY_HOME_PIN_Y]        = CONFIG_FIELD(home_pin[AXIS_Y], CONFIG_TYPE_U8),
+    [CONFIG_KEY_HOME_PIN_Z]        = CONFIG_FIELD(home_pin[AXIS_Z], CONFIG_TYPE_U8),
+    [CONFIG_KEY_HOME_DIRECTION]    = CONFIG_FIELD(home_direction, CONFIG_TYPE_U8),
+    [CONFIG_KEY_HOME_ACTIVE_HIGH]  = CONFIG_FIELD(home_active_high, CONFIG_TYPE_U8),
+    [CONFIG_KEY_HOME_POSITION_X]   = CONFIG_FIELD(home_position[AXIS_X], CONFIG_TYPE_U32),
+    [CONFIG_KEY_HOME_POSITION_Y]   = CONFIG_FIELD(home_position[AXIS_Y], CONFIG_TYPE_U32),
+    [CONFIG_KEY_HOME_POSITION_Z]   = CONFIG_FIELD(home_position[AXIS_Z], CONFIG_TYPE_U32),
+    [CONFIG_KEY_HOME_SEARCH_SPEED] = CONFIG_FIELD(home_search_speed, CONFIG_TYPE_FLOAT),
+    [CONFIG_KEY_HOME_LATCH_SPEED]  = CONFIG_FIELD(home_latch_speed, CONFIG_TYPE_FLOAT),
+    [CONFIG_KEY_GUIDE_PIN_RA_POS]  = CONFIG_FIELD(guide_pin[GUIDE_LINE_RA_POS], CONFIG_TYPE_U8),
+    [CONFIG_KEY_GUIDE_PIN_RA_NEG]  = CONFIG_FIELD(guide_pin[GUIDE_LINE_RA_NEG], CONFIG_TYPE_U8),
+    [CONFIG_KEY_GUIDE_PIN_DEC_POS] = CONFIG_FIELD(guide_pin[GUIDE_LINE_DEC_POS], CONFIG_TYPE_U8),
+    [CONFIG_KEY_GUIDE_PIN_DEC_NEG] = CONFIG_FIELD(guide_pin[GUIDE_LINE_DEC_NEG], CONFIG_TYPE_U8),
+    [CONFIG_KEY_GUIDE_AXIS_RA]     = CONFIG_FIELD(guide_axis_ra, CONFIG_TYPE_U8),
+    [CONFIG_KEY_GUIDE_AXIS_DEC]    = CONFIG_FIELD(guide_axis_dec, CONFIG_TYPE_U8),
+    [CONFIG_KEY_GUIDE_RATE]        = CONFIG_FIELD(guide_rate, CONFIG_TYPE_FLOAT),
+    [CONFIG_KEY_BACKLASH_X]        = CONFIG_FIELD(backlash[AXIS_X], CONFIG_TYPE_FLOAT),
+    [CONFIG_KEY_BACKLASH_Y]        = CONFIG_FIELD(backlash[AXIS_Y], CONFIG_TYPE_FLOAT),
+    [CONFIG_KEY_BACKLASH_Z]        = CONFIG_FIELD(backlash[AXIS_Z], CONFIG_TYPE_FLOAT),
+    [CONFIG_KEY_BACKLASH_RATE]     = CONFIG_FIELD(backlash_rate, CONFIG_TYPE_FLOAT),
+    [CONFIG_KEY_ENCODER_PIN_X]     = CONFIG_FIELD(encoder_pin[AXIS_X], CONFIG_TYPE_U8),
+    [CONFIG_KEY_ENCODER_PIN_Y]     = CONFIG_FIELD(encoder_pin[AXIS_Y], CONFIG_TYPE_U8),
+    [CONFIG_KEY_ENCODER_PIN_Z]     = CONFIG_FIELD(encoder_pin[AXIS_Z], CONFIG_TYPE_U8),
+    [CONFIG_KEY_ENCODER_COUNTS_X]  = CONFIG_FIELD(encoder_counts_per_rev[AXIS_X], CONFIG_TYPE_FLOAT),
+    [CONFIG_KEY_ENCODER_COUNTS_Y]  = CONFIG_FIELD(encoder_counts_per_rev[AXIS_Y], CONFIG_TYPE_FLOAT),
+    [CONFIG_KEY_ENCODER_COUNTS_Z]  = CONFIG_FIELD(encoder_counts_per_rev[AXIS_Z], CONFIG_TYPE_FLOAT),
+    [CONFIG_KEY_TEMP_RESOLUTION]   = CONFIG_FIELD(temp_resolution, CONFIG_TYPE_U8),
+    [CONFIG_KEY_TEMP_AMBIENT_SENSOR] = CONFIG_FIELD(temp_ambient_sensor, CONFIG_TYPE_U8),
+    [CONFIG_KEY_SHUTTER_PIN]       = CONFIG_FIELD(shutter_pin, CONFIG_TYPE_U8),
+    [CONFIG_KEY_SHUTTER_ACTIVE_HIGH] = CONFIG_FIELD(shutter_active_high, CONFIG_TYPE_U8),
+    [CONFIG_KEY_TRIGGER_PIN]       = CONFIG_FIELD(trigger_pin, CONFIG_TYPE_U8),
+    [CONFIG_KEY_TRIGGER_ACTIVE_HIGH] = CONFIG_FIELD(trigger_active_high, CONFIG_TYPE_U8),
+};
+
+static inline uint8_t field_width(uint8_t key) {
+    switch (config_keys[key].type) {
+        case CONFIG_TYPE_U8: return 1;
+        case CONFIG_TYPE_U16: return 2;
+        default: return 4;
+    }
+}
+
+#define CONFIG_GPIO_COUNT 30                // RP2040 bank 0, 1u << pin is only defined below 32
+
+static inline bool pin_valid(uint8_t pin) {
+    return pin < CONFIG_GPIO_COUNT;
+}
+
+// Optional inputs and outputs use 0xFF for none
+static inline bool optional_pin_valid(uint8_t pin) {
+    return pin == 0xFF || pin < CONFIG_GPIO_COUNT;
+}
+
+static inline bool microsteps_valid(uint16_t microsteps) {
+    return microsteps != 0 && microsteps <= POSITION_MICROSTEPS && (microsteps & (microsteps - 1)) == 0;
+}
+
+// Range of each key's value, beyond the width of its type. A value that passes here cannot stop the firmware from
+// booting into a working state: no division by zero, no shift past a GPIO mask, no NaN in the step rates
+static bool config_key_valid(const device_config_t *config, uint8_t key) {
+    const uint8_t *field = (const uint8_t *)config + config_keys[key].offset;
+    // Only the field's own bytes, a narrow one can be the last in the struct
+    uint8_t u8 = *field;
+    uint16_t u16 = 0;
+    uint32_t u32 = 0;
+    float f = 0.0f;
+    if (field_width(key) >= sizeof(uint16_t)) memcpy(&u16, field, sizeof(uint16_t));
+    if (field_width(key) >= sizeof(uint32_t)) {
+        memcpy(&u32, field, sizeof(uint32_t));
+        memcpy(&f, field, sizeof(float));
+    }
+    if (config_keys[key].type == CONFIG_TYPE_FLOAT && !isfinite(f)) return false;
+
+    switch (key) {
+        case CONFIG_KEY_GEAR_RATIO_X:
+        case CONFIG_KEY_GEAR_RATIO_Y:
+        case CONFIG_KEY_GEAR_RATIO_Z:
+            return f > 0.0f;
+        case CONFIG_KEY_STEPS_PER_REV:
+        case CONFIG_KEY_STEP_INTERVAL_US:
+            return u16 > 0;
+        case CONFIG_KEY_MICROSTEPPING:
+        case CONFIG_KEY_SLEW_MICROSTEPPING:
+        case CONFIG_KEY_TRACK_MICROSTEPPING:
+            return microsteps_valid(u16);
+        case CONFIG_KEY_BAUD_RATE:
+            return u32 >= 300 && u32 <= 1000000;
+        case CONFIG_KEY_STEP_PIN_X:
+        case CONFIG_KEY_STEP_PIN_Y:
+        case CONFIG_KEY_STEP_PIN_Z:
+        case CONFIG_KEY_DIR_PIN_X:
+        case CONFIG_KEY_DIR_PIN_Y:
+        case CONFIG_KEY_DIR_PIN_Z:
+        case CONFIG_KEY_X_DIR_INV_PIN:
+        case CONFIG_KEY_EN_PIN:
+        case CONFIG_KEY_EN_SENSE_PIN:
+        case CONFIG_KEY_TEMP_SENSE_PIN:
+        case CONFIG_KEY_FAN_PWM_PIN:
+        case CONFIG_KEY_TMC2209_TX_PIN:
+        case CONFIG_KEY_UART_TX_PIN:
+        case CONFIG_KEY_UART_RX_PIN:
+            return pin_valid(u8);
+        case CONFIG_KEY_HOME_PIN_X:
+        case CONFIG_KEY_HOME_PIN_Y:
+        case CONFIG_KEY_HOME_PIN_Z:
+        case CONFIG_KEY_GUIDE_PIN_RA_POS:
+        case CONFIG_KEY_GUIDE_PIN_RA_NEG:
+        case CONFIG_KEY_GUIDE_PIN_DEC_POS:
+        case CONFIG_KEY_GUIDE_PIN_DEC_NEG:
+        case CONFIG_KEY_SHUTTER_PIN:
+        case CONFIG_KEY_TRIGGER_PIN:
+            return optional_pin_valid(u8);
+        case CONFIG_KEY_ENCODER_PIN_X:
+        case CONFIG_KEY_ENCODER_PIN_Y:
+        case CONFIG_KEY_ENCODER_PIN_Z:
+            return u8 == ENCODER_PIN_NONE || u8 + 1 < CONFIG_GPIO_COUNT;   // B is the next GPIO
+        case CONFIG_KEY_TMC2209_ADDRESS_X:
+        case CONFIG_KEY_TMC2209_ADDRESS_Y:
+        case CONFIG_KEY_TMC2209_ADDRESS_Z:
+        case CONFIG_KEY_TMC2209_ADDRESS_X2:
+            return u8 <= 3;
+        case CONFIG_KEY_RUN_CURRENT:
+        case CONFIG_KEY_HOLD_CURRENT:
+            return u8 <= 31;
+        case CONFIG_KEY_LATITUDE:
+            return f >= -90.0f && f <= 90.0f;
+        case CONFIG_KEY_ACCELERATION:
+        case CONFIG_KEY_PRESSURE:
+        case CONFIG_KEY_GUIDE_RATE:
+        case CONFIG_KEY_BACKLASH_X:
+        case CONFIG_KEY_BACKLASH_Y:
+        case CONFIG_KEY_BACKLASH_Z:
+        case CONFIG_KEY_BACKLASH_RATE:
+            return f >= 0.0f;                   // 0 picks the compiled in default where there is one
+        case CONFIG_KEY_HOME_SEARCH_SPEED:
+        case CONFIG_KEY_HOME_LATCH_SPEED:
+            return f > 0.0f;
+        case CONFIG_KEY_TEMP_RESOLUTION:
+            return u8 >= 9 && u8 <= 12;
+        default:
+            return true;
+    }
+}
+
+void config_set_defaults(device_config_t *config) {
+    memset(config, 0, sizeof(device_config_t));
+    config->version = CONFIG_VERSION;
+    config->size = sizeof(device_config_t);
+    config->gear_ratio[AXIS_X] = X_STEPPER_GEAR_RATIO;
+    config->gear_ratio[AXIS_Y] = Y_STEPPER_GEAR_RATIO;
+    config->gear_ratio[AXIS_Z] = Z_STEPPER_GEAR_RATIO;
+    config->steps_per_rev = STEPS_PER_REV;
+    config->microstepping = MICROSTEPPING;
+    config->baud_rate = BAUD_RATE;
+    config->step_pin[AXIS_X] = X_STEP_PIN;
+    config->step_pin[AXIS_Y] = Y_STEP_PIN;
+    config->step_pin[AXIS_Z] = Z_STEP_PIN;
+    config->dir_pin[AXIS_X] = X_DIR_PIN;
+    config->dir_pin[AXIS_Y] = Y_DIR_PIN;
+    config->dir_pin[AXIS_Z] = Z_DIR_PIN;
+    config->x_dir_inv_pin = X_DIR_PIN_INV;
+    config->en_pin = EN_PIN;
+    config->en_sense_pin = EN_SENSE_PIN;
+    config->temp_sense_pin = TEMP_SENSE_PIN;
+    config->fan_pwm_pin = FAN_PWM_PIN;
+    config->tmc2209_tx_pin = TMC2209_TX_PIN;
+    config->uart_tx_pin = UART_TX_PIN;
+    config->uart_rx_pin = UART_RX_PIN;
+    config->step_interval_us = STEP_INTERVAL_MS * 1000;
+    config->dir_setup_us = DIR_SETUP_TIME_US;
+    config->step_pulse_us = STEP_PULSE_WIDTH_US;
+    config->driver_powerup_ms = DRIVER_POWERUP_MS;
+    config->tmc2209_enabled = 1;
+    config->tmc2209_address[AXIS_X] = TMC2209_ADDRESS_X;
+    config->tmc2209_address[AXIS_Y] = TMC2209_ADDRESS_Y;
+    config->tmc2209_address[AXIS_Z] = TMC2209_ADDRESS_Z;
+    config->tmc2209_x2_address = TMC2209_ADDRESS_X2;
+    config->run_current = TMC2209_RUN_CURRENT;
+    config->hold_current = TMC2209_HOLD_CURRENT;
+    config->slew_microstepping = SLEW_MICROSTEPPING;
+    config->track_microstepping = TRACK_MICROSTEPPING;
+    config->acceleration = ACCELERATION_ARCSEC_S2;
+    config->latitude = SITE_LATITUDE_DEG;
+    config->pressure_hpa = ASTRO_PRESSURE_HPA;
+    for (int axis = 0; axis < NUM_AXES; axis++) {
+        config->soft_limit_min[axis] = 0;
+        config->soft_limit_max[axis] = 0;
+    }
+    memset(config->limit_zones, 0, sizeof(config->limit_zones));
+    for (int axis = 0; axis < NUM_AXES; axis++) {
+        config->home_pin[axis] = HOME_PIN_NONE;
+        config->home_position[axis] = 0;
+    }
+    config->home_direction = 0;
+    config->home_active_high = 0;
+    config->home_search_speed = HOME_SEARCH_SPEED_ARCSEC;
+    config->home_latch_speed = HOME_LATCH_SPEED_ARCSEC;
+    for (int line = 0; line < GUIDE_LINE_COUNT; line++) {
+        config->guide_pin[line] = GUIDE_PIN_NONE;
+    }
+    config->guide_axis_ra = AXIS_Z;
+    config->guide_axis_dec = AXIS_X;
+    config->guide_rate = GUIDE_RATE_ARCSEC;
+    for (int axis = 0; axis < NUM_AXES; axis++) {
+        config->backlash[axis] = 0.0f;
+    }
+    config->backlash_rate = BACKLASH_RATE_ARCSEC;
+    for (int axis = 0; axis < NUM_AXES; axis++) {
+        config->encoder_pin[axis] = ENCODER_PIN_NONE;
+        config->encoder_counts_per_rev[axis] = 0.0f;
+    }
+    config->temp_resolution = DS18B20_RESOLUTION;
+    config->temp_ambient_sensor = 0;
+    config->shutter_pin = SHUTTER_PIN_NONE;
+    config->shutter_active_high = 0;        // Flash-sync contacts pull the line low
+    config->trigger_pin = SEQUENCE_PIN_NONE;
+    config->trigger_active_high = 1;        // Drives an optocoupler or transistor that shorts the remote release
+}
+
+// Load the newest valid block, a block written by an older firmware only overrides the fields it knew about
+void config_init(void) {
+    static uint8_t payload[CONFIG_RECORD_SIZE - FLASHSTORE_OVERHEAD];
+
+    config_set_defaults(&device_config);
+    if (flash_store_load(&config_store, payload)) {
+        device_config_t *loaded = (device_config_t *)payload;
+        if (loaded->version >= 1 && loaded->version <= CONFIG_VERSION) {
+            uint16_t size = loaded->size < config_version_size[loaded->version] ? loaded->size : config_version_size[loaded->version];
+            memcpy(&device_config, payload, size);
+            device_config.version = CONFIG_VERSION;
+            device_config.size = sizeof(device_config_t);
+            DEBUG_PRINT("Config loaded from flash (sequence %lu)\n", config_store.sequence);
+
+            // A block from a firmware without these checks can hold values that stop motion on every boot
+            device_config_t defaults;
+            config_set_defaults(&defaults);
+            for (uint8_t key = 0; key < CONFIG_KEY_COUNT; key++) {
+                if (config_key_valid(&device_config, key)) continue;
+                memcpy((uint8_t *)&device_config + config_keys[key].offset,
+                       (const uint8_t *)&defaults + config_keys[key].offset, field_width(key));
+                DEBUG_PRINT("Config key %d out of range, using the default\n", key);
+            }
+        } else {
+            DEBUG_PRINT("Config block from a newer firmware, using defaults\n");
+        }
+    } else {
+        DEBUG_PRINT("No valid config in flash, using defaults\n");
+    }
+    stored_config = device_config;
+}
+
+bool config_get(uint8_t key, uint32_t *value) {
+    if (key >= CONFIG_KEY_COUNT) return false;
+
+    const uint8_t *field = (const uint8_t *)&stored_config + config_keys[key].offset;
+    switch (config_keys[key].type) {
+        case CONFIG_TYPE_U8:
+            *value = *field;
+            break;
+        case CONFIG_TYPE_U16: {
+            uint16_t v;
+            memcpy(&v, field, sizeof(uint16_t));
+            *value = v;
+            break;
+        }
+        default:    // U32 and FLOAT are both sent as their raw 4 bytes
+            memcpy(value, field, sizeof(uint32_t));
+            break;
+    }
+    return true;
+}
+
+// Values out of range for their key are refused and the stored one is kept
+bool config_set(uint8_t key, uint32_t value) {
+    if (key >= CONFIG_KEY_COUNT) return false;
+
+    uint8_t *field = (uint8_t *)&stored_config + config_keys[key].offset;
+    uint8_t previous[sizeof(uint32_t)];
+    memcpy(previous, field, field_width(key));
+    switch (config_keys[key].type) {
+        case CONFIG_TYPE_U8:
+            if (value > UINT8_MAX) return false;
+            *field = (uint8_t)value;
+            break;
+        case CONFIG_TYPE_U16: {
+            if (value > UINT16_MAX) return false;
+            uint16_t v = (uint16_t)value;
+            memcpy(field, &v, sizeof(uint16_t));
+            break;
+        }
+        default:
+            memcpy(field, &value, sizeof(uint32_t));
+            break;
+    }
+    if (!config_key_valid(&stored_config, key)) {
+        memcpy(field, previous, field_width(key));
+        return false;
+    }
+    return true;
+}
+
+// Flash writes take tens of ms, they are done from the main loop, not from the UART interrupt
+void config_request_save(uint8_t flags) {
+    save_flags = flags;
+    save_requested = true;
+}
+
+void config_background_task(void) {
+    if (!save_requested) return;
+    save_requested = false;
+
+    if (save_flags & CONFIG_SAVE_RESET_DEFAULTS) {
+        config_set_defaults(&stored_config);
+    }
+
+    static uint8_t payload[CONFIG_RECORD_SIZE - FLASHSTORE_OVERHEAD];
+    memset(payload, 0, sizeof(payload));
+    memcpy(payload, &stored_config, sizeof(device_config_t));
+    bool ok = flash_store_append(&config_store, payload);
+    DEBUG_PRINT("Config save %s (sequence %lu)\n", ok ? "done" : "FAILED", config_store.sequence);
+
+    if (ok && (save_flags & CONFIG_SAVE_REBOOT)) {
+        uart_flush_tx();
+        watchdog_reboot(0, 0, 0);
+        while (true) {
+            tight_loop_contents();
+        }
+    }
+}
@@ -0,0 +1,195 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "PIN_ASSIGNMENTS.h"
+#include "STEPPER.h"
+#include "FLASHSTORE.h"
+#include "TMC2209.h"
+#include "ALIGN.h"
+#include "ASTRO.h"
+#include "LIMITS.h"
+#include "HOME.h"
+#include "GUIDE.h"
+#include "ENCODER.h"
+#include "DS18B20.h"
+#include "SHUTTER.h"
+#include "SEQUENCE.h"
+#include "DEBUGPRINT.h"
+
+// Persistent device configuration
+// The compile time #defines in STEPPER.h, UART.h and PIN_ASSIGNMENTS.h are only the defaults now,
+// the values in use are loaded from flash once at boot. Changed values take effect after a reboot,
+// the modules copy what they need into their own precomputed structures at init so the hot paths never look here.
+
+#define CONFIG_VERSION 14
+#define CONFIG_RECORD_SIZE FLASH_PAGE_SIZE
+#define DRIVER_POWERUP_MS 5000      // Default delay after boot before the stepper drivers are touched
+
+typedef struct {
+    uint16_t version;               // CONFIG_VERSION of the firmware that wrote the block
+    uint16_t size;                  // sizeof(device_config_t) of the firmware that wrote the block
+    float gear_ratio[NUM_AXES];
+    uint16_t steps_per_rev;
+    uint16_t microstepping;
+    uint32_t baud_rate;
+    uint8_t step_pin[NUM_AXES];
+    uint8_t dir_pin[NUM_AXES];
+    uint8_t x_dir_inv_pin;
+    uint8_t en_pin;
+    uint8_t en_sense_pin;
+    uint8_t temp_sense_pin;
+    uint8_t fan_pwm_pin;
+    uint8_t tmc2209_tx_pin;
+    uint8_t uart_tx_pin;
+    uint8_t uart_rx_pin;
+    uint16_t step_interval_us;
+    uint16_t dir_setup_us;
+    uint16_t step_pulse_us;
+    uint16_t driver_powerup_ms;
+    // Version 2
+    uint8_t tmc2209_enabled;                // Configure the drivers over their UART, 0 = leave them to the strapping
+    uint8_t tmc2209_address[NUM_AXES];
+    uint8_t tmc2209_x2_address;             // Second X driver
+    uint8_t run_current;                    // IRUN 0-31
+    uint8_t hold_current;                   // IHOLD 0-31
+    uint16_t slew_microstepping;
+    uint16_t track_microstepping;
+    // Version 3
+    float acceleration;                     // arcsec/s², limit for every step rate change
+    // Version 4
+    float latitude;                         // Site latitude in degrees, field rotation of gotos through the pointing model
+    // Version 5
+    float pressure_hpa;                     // Site air pressure for the refraction
+    // Version 6
+    int32_t soft_limit_min[NUM_AXES];       // arcsec, an axis with min >= max has no limits
+    int32_t soft_limit_max[NUM_AXES];
+    // Version 7
+    limit_zone_t limit_zones[LIMIT_MAX_ZONES];  // Forbidden zones
+    // Version 8
+    uint8_t home_pin[NUM_AXES];             // Home switch GPIO, HOME_PIN_NONE if the axis has none
+    uint8_t home_direction;                 // Bit per axis, set = search in the positive direction
+    uint8_t home_active_high;               // Bit per axis, set = switch reads high when hit (pull-down instead of pull-up)
+    int32_t home_position[NUM_AXES];        // arcsec, position of the switch edge
+    float home_search_speed;                // arcsec/s
+    float home_latch_speed;
+    // Version 9
+    uint8_t guide_pin[GUIDE_LINE_COUNT];    // ST-4 RA+, RA-, Dec+, Dec- GPIO, GUIDE_PIN_NONE if not wired
+    uint8_t guide_axis_ra;                  // Axis the RA lines move
+    uint8_t guide_axis_dec;                 // Axis the Dec lines move
+    float guide_rate;                       // arcsec/s
+    // Version 10
+    float backlash[NUM_AXES];               // arcsec of gear slack taken up on every reversal
+    float backlash_rate;                    // arcsec/s the slack is taken up at
+    // Version 11
+    uint8_t encoder_pin[NUM_AXES];          // Encoder A input, B is the next GPIO, ENCODER_PIN_NONE without an encoder
+    float encoder_counts_per_rev[NUM_AXES]; // Quadrature counts per axis turn, negative if it counts the other way
+    // Version 12
+    uint8_t temp_resolution;                // DS18B20 resolution, 9-12 bit
+    uint8_t temp_ambient_sensor;            // Index in ROM order of the DS18B20 reported as ambient temperature
+    // Version 13
+    uint8_t shutter_pin;                    // Camera flash-sync/shutter input, SHUTTER_PIN_NONE without one
+    uint8_t shutter_active_high;            // Level while the exposure runs
+    // Version 14
+    uint8_t trigger_pin;                    // Camera trigger output of the sequencer, SEQUENCE_PIN_NONE without one
+    uint8_t trigger_active_high;            // Level that holds the shutter open
+} device_config_t;
+
+// Keys for CMD_CONFIG_GET / CMD_CONFIG_SET, never renumber - hosts store these
+typedef enum {
+    CONFIG_KEY_GEAR_RATIO_X = 0,
+    CONFIG_KEY_GEAR_RATIO_Y = 1,
+    CONFIG_KEY_GEAR_RATIO_Z = 2,
+    CONFIG_KEY_STEPS_PER_REV = 3,
+    CONFIG_KEY_MICROSTEPPING = 4,
+    CONFIG_KEY_BAUD_RATE = 5,
+    CONFIG_KEY_STEP_PIN_X = 6,
+    CONFIG_KEY_STEP_PIN_Y = 7,
+    CONFIG_KEY_STEP_PIN_Z = 8,
+    CONFIG_KEY_DIR_PIN_X = 9,
+    CONFIG_KEY_DIR_PIN_Y = 10,
+    CONFIG_KEY_DIR_PIN_Z = 11,
+    CONFIG_KEY_X_DIR_INV_PIN = 12,
+    CONFIG_KEY_EN_PIN = 13,
+    CONFIG_KEY_EN_SENSE_PIN = 14,
+    CONFIG_KEY_TEMP_SENSE_PIN = 15,
+    CONFIG_KEY_FAN_PWM_PIN = 16,
+    CONFIG_KEY_TMC2209_TX_PIN = 17,
+    CONFIG_KEY_UART_TX_PIN = 18,
+    CONFIG_KEY_UART_RX_PIN = 19,
+    CONFIG_KEY_STEP_INTERVAL_US = 20,
+    CONFIG_KEY_DIR_SETUP_US = 21,
+    CONFIG_KEY_STEP_PULSE_US = 22,
+    CONFIG_KEY_DRIVER_POWERUP_MS = 23,
+    CONFIG_KEY_TMC2209_ENABLED = 24,
+    CONFIG_KEY_TMC2209_ADDRESS_X = 25,
+    CONFIG_KEY_TMC2209_ADDRESS_Y = 26,
+    CONFIG_KEY_TMC2209_ADDRESS_Z = 27,
+    CONFIG_KEY_TMC2209_ADDRESS_X2 = 28,
+    CONFIG_KEY_RUN_CURRENT = 29,
+    CONFIG_KEY_HOLD_CURRENT = 30,
+    CONFIG_KEY_SLEW_MICROSTEPPING = 31,
+    CONFIG_KEY_TRACK_MICROSTEPPING = 32,
+    CONFIG_KEY_ACCELERATION = 33,
+    CONFIG_KEY_LATITUDE = 34,
+    CONFIG_KEY_PRESSURE = 35,
+    CONFIG_KEY_SOFT_LIMIT_MIN_X = 36,
+    CONFIG_KEY_SOFT_LIMIT_MIN_Y = 37,
+    CONFIG_KEY_SOFT_LIMIT_MIN_Z = 38,
+    CONFIG_KEY_SOFT_LIMIT_MAX_X = 39,
+    CONFIG_KEY_SOFT_LIMIT_MAX_Y = 40,
+    CONFIG_KEY_SOFT_LIMIT_MAX_Z = 41,
+    CONFIG_KEY_ZONE_FIRST = 42,             // Zone n: key 42 + 4n X min, +1 X max, +2 Z min, +3 Z max
+    CONFIG_KEY_ZONE_LAST = 42 + LIMIT_MAX_ZONES * 4 - 1,
+    CONFIG_KEY_HOME_PIN_X = 58,
+    CONFIG_KEY_HOME_PIN_Y = 59,
+    CONFIG_KEY_HOME_PIN_Z = 60,
+    CONFIG_KEY_HOME_DIRECTION = 61,
+    CONFIG_KEY_HOME_ACTIVE_HIGH = 62,
+    CONFIG_KEY_HOME_POSITION_X = 63,
+    CONFIG_KEY_HOME_POSITION_Y = 64,
+    CONFIG_KEY_HOME_POSITION_Z = 65,
+    CONFIG_KEY_HOME_SEARCH_SPEED = 66,
+    CONFIG_KEY_HOME_LATCH_SPEED = 67,
+    CONFIG_KEY_GUIDE_PIN_RA_POS = 68,
+    CONFIG_KEY_GUIDE_PIN_RA_NEG = 69,
+    CONFIG_KEY_GUIDE_PIN_DEC_POS = 70,
+    CONFIG_KEY_GUIDE_PIN_DEC_NEG = 71,
+    CONFIG_KEY_GUIDE_AXIS_RA = 72,
+    CONFIG_KEY_GUIDE_AXIS_DEC = 73,
+    CONFIG_KEY_GUIDE_RATE = 74,
+    CONFIG_KEY_BACKLASH_X = 75,
+    CONFIG_KEY_BACKLASH_Y = 76,
+    CONFIG_KEY_BACKLASH_Z = 77,
+    CONFIG_KEY_BACKLASH_RATE = 78,
+    CONFIG_KEY_ENCODER_PIN_X = 79,
+    CONFIG_KEY_ENCODER_PIN_Y = 80,
+    CONFIG_KEY_ENCODER_PIN_Z = 81,
+    CONFIG_KEY_ENCODER_COUNTS_X = 82,
+    CONFIG_KEY_ENCODER_COUNTS_Y = 83,
+    CONFIG_KEY_ENCODER_COUNTS_Z = 84,
+    CONFIG_KEY_TEMP_RESOLUTION = 85,
+    CONFIG_KEY_TEMP_AMBIENT_SENSOR = 86,
+    CONFIG_KEY_SHUTTER_PIN = 87,
+    CONFIG_KEY_SHUTTER_ACTIVE_HIGH = 88,
+    CONFIG_KEY_TRIGGER_PIN = 89,
+    CONFIG_KEY_TRIGGER_ACTIVE_HIGH = 90,
+    CONFIG_KEY_COUNT
+} config_key_t;
+
+// Flags for CMD_CONFIG_SAVE
+#define CONFIG_SAVE_RESET_DEFAULTS 0x01     // Start from the compiled in defaults
+#define CONFIG_SAVE_REBOOT 0x02             // Reboot after saving so the new values take effect
+
+extern device_config_t device_config;
+
+void config_init(void);
+void config_set_defaults(device_config_t *config);
+bool config_get(uint8_t key, uint32_t *value);
+bool config_set(uint8_t key, uint32_t value);
+void config_request_save(uint8_t flags);
+void config_background_task(void);
+
+#endif // CONFIG_H
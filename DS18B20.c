@@ -1,22 +1,67 @@
+#include <string.h>
 #include "DS18B20.h"
 #include "PIN_ASSIGNMENTS.h"
+#include "CONFIG.h"
+
+#define DS18B20_FAMILY 0x28
+#define ROM_SEARCH 0xF0
+#define ROM_MATCH 0x55
+#define ROM_SKIP 0xCC
+#define CMD_CONVERT_T 0x44
+#define CMD_WRITE_SCRATCHPAD 0x4E
+#define CMD_READ_SCRATCHPAD 0xBE
+
+typedef enum {
+    BUS_IDLE = 0,
+    BUS_CONVERTING
+} bus_state_t;
+
+static uint onewire_pin = TEMP_SENSE_PIN;
+
+static uint8_t sensor_rom[DS18B20_MAX_SENSORS][8];
+static uint8_t sensor_count = 0;
+static uint8_t resolution = DS18B20_RESOLUTION;
+static uint32_t conversion_ms;
+
+static volatile float sensor_temp[DS18B20_MAX_SENSORS];
+static volatile bool sensor_valid[DS18B20_MAX_SENSORS];
+
+static bus_state_t bus_state = BUS_IDLE;
+static uint8_t next_sensor;                 // Sensor to read on the next pass once the conversion is done
+static uint32_t conversion_start_ms;
+static bool converted_once = false;
 
 // --- 1-Wire primitives ---
+// Open drain: the line is pulled low by switching the pin to an output (its level is 0), released by switching it
+// to an input and left to the pull-up, so a sensor can pull it low against us.
+// Interrupts are off for each time slot, a UART interrupt in the middle would stretch the slot past the sample point
+static inline void onewire_low(void) {
+    gpio_set_dir(onewire_pin, GPIO_OUT);
+}
+
+static inline void onewire_release(void) {
+    gpio_set_dir(onewire_pin, GPIO_IN);
+}
+
 static void onewire_write_bit(bool bit) {
-    gpio_put(TEMP_SENSE_PIN, 0);
+    uint32_t save = save_and_disable_interrupts();
+    onewire_low();
     sleep_us(bit ? 6 : 60);
-    gpio_put(TEMP_SENSE_PIN, 1);
+    onewire_release();
+    restore_interrupts(save);
     if (bit) sleep_us(64);
     else sleep_us(10);
 }
 
 static bool onewire_read_bit(void) {
     bool bit;
-    gpio_put(TEMP_SENSE_PIN, 0);
+    uint32_t save = save_and_disable_interrupts();
+    onewire_low();
     sleep_us(6);
-    gpio_put(TEMP_SENSE_PIN, 1);
+    onewire_release();
     sleep_us(9);
-    bit = gpio_get(TEMP_SENSE_PIN);
+    bit = gpio_get(onewire_pin);
+    restore_interrupts(save);
     sleep_us(55);
     return bit;
 }
@@ -37,30 +82,181 @@ static uint8_t onewire_read_byte(void) {
 }
 
 static bool onewire_reset(void) {
-    gpio_put(TEMP_SENSE_PIN, 0);
+    onewire_low();
     sleep_us(480);
-    gpio_put(TEMP_SENSE_PIN, 1);
+    onewire_release();
     sleep_us(70);
-    bool presence = !gpio_get(TEMP_SENSE_PIN);
+    bool presence = !gpio_get(onewire_pin);
     sleep_us(410);
     return presence;
 }
 
+// Dallas/Maxim CRC8 (x^8 + x^5 + x^4 + 1, LSB first), covers ROM codes and the scratchpad
+static uint8_t onewire_crc8(const uint8_t *data, uint8_t length) {
+    uint8_t crc = 0;
+    for (uint8_t i = 0; i < length; i++) {
+        uint8_t byte = data[i];
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            uint8_t mix = (crc ^ byte) & 0x01;
+            crc >>= 1;
+            if (mix) crc ^= 0x8C;
+            byte >>= 1;
+        }
+    }
+    return crc;
+}
+
+// Standard ROM search (Maxim application note 187): every pass walks the ROM tree bit by bit, at the last
+// branch where both values were seen it takes the 1 side this time, until no unexplored branch is left.
+// Only ROMs of the family count towards max_roms, other devices on the line do not take a sensor's place
+static uint8_t onewire_search(uint8_t roms[][8], uint8_t max_roms, uint8_t family) {
+    uint8_t rom[8] = {0};
+    int last_discrepancy = -1;
+    uint8_t found = 0;
+
+    while (found < max_roms) {
+        if (!onewire_reset()) break;
+        onewire_write_byte(ROM_SEARCH);
+
+        int discrepancy = -1;
+        for (int bit = 0; bit < 64; bit++) {
+            bool id_bit = onewire_read_bit();
+            bool complement = onewire_read_bit();
+            if (id_bit && complement) return found;     // Nobody answered, the bus changed under us
+
+            bool direction;
+            if (id_bit != complement) {
+                direction = id_bit;                     // Every remaining device has the same bit here
+            } else if (bit < last_discrepancy) {
+                direction = (rom[bit / 8] >> (bit % 8)) & 1;
+            } else {
+                direction = bit == last_discrepancy;
+            }
+            if (id_bit == complement && !direction) discrepancy = bit;
+
+            if (direction) rom[bit / 8] |= 1 << (bit % 8);
+            else rom[bit / 8] &= ~(1 << (bit % 8));
+            onewire_write_bit(direction);
+        }
+
+        if (onewire_crc8(rom, 7) != rom[7]) {
+            DEBUG_PRINT("1-Wire ROM with a bad CRC skipped\n");
+        } else if (rom[0] == family) {
+            memcpy(roms[found++], rom, 8);
+        }
+        if (discrepancy < 0) break;                     // That was the last branch
+        last_discrepancy = discrepancy;
+    }
+    return found;
+}
+
 // --- DS18B20 specific ---
-float ds18b20_read_temp(void) {
-    if (!onewire_reset()) return -1000.0f; // no sensor
+void ds18b20_init(uint pin) {
+    onewire_pin = pin;
+    gpio_init(onewire_pin);
+    gpio_pull_up(onewire_pin);          // Backs up the external pull-up
+    gpio_put(onewire_pin, 0);
+    onewire_release();
 
-    onewire_write_byte(0xCC); // Skip ROM
-    onewire_write_byte(0x44); // Convert T
-    sleep_ms(750); // wait for conversion
+    resolution = device_config.temp_resolution;
+    if (resolution < 9 || resolution > 12) resolution = DS18B20_RESOLUTION;
+    conversion_ms = 750 >> (12 - resolution);           // 93.75, 187.5, 375, 750 ms
+    conversion_ms += 10;
 
+    sensor_count = onewire_search(sensor_rom, DS18B20_MAX_SENSORS, DS18B20_FAMILY);
+    for (uint8_t i = 0; i < sensor_count; i++) {
+        sensor_valid[i] = false;
+    }
+    DEBUG_PRINT("%d DS18B20 sensor(s) found, %d bit\n", sensor_count, resolution);
+    if (sensor_count == 0) return;
+
+    // Alarm thresholds are unused, resolution goes to RAM only so the EEPROM is not worn by every boot
     onewire_reset();
-    onewire_write_byte(0xCC); // Skip ROM
-    onewire_write_byte(0xBE); // Read Scratchpad
+    onewire_write_byte(ROM_SKIP);
+    onewire_write_byte(CMD_WRITE_SCRATCHPAD);
+    onewire_write_byte(0x7F);                           // TH
+    onewire_write_byte(0x80);                           // TL
+    onewire_write_byte((uint8_t)(((resolution - 9) << 5) | 0x1F));
+}
+
+static bool read_sensor(uint8_t index) {
+    uint8_t scratchpad[9];
 
-    uint8_t lsb = onewire_read_byte();
-    uint8_t msb = onewire_read_byte();
-    int16_t raw = (msb << 8) | lsb;
+    if (!onewire_reset()) return false;
+    onewire_write_byte(ROM_MATCH);
+    for (uint8_t i = 0; i < 8; i++) {
+        onewire_write_byte(sensor_rom[index][i]);
+    }
+    onewire_write_byte(CMD_READ_SCRATCHPAD);
+    for (uint8_t i = 0; i < 9; i++) {
+        scratchpad[i] = onewire_read_byte();
+    }
+    // An absent sensor reads all ones, which can pass the CRC by chance
+    if (scratchpad[4] == 0xFF || onewire_crc8(scratchpad, 8) != scratchpad[8]) return false;
 
-    return raw / 16.0f;
-}
\ No newline at end of file
+    int16_t raw = (int16_t)((scratchpad[1] << 8) | scratchpad[0]);
+    raw &= ~((1 << (12 - resolution)) - 1);             // The low bits are undefined below 12 bit
+    sensor_temp[index] = raw / 16.0f;
+    return true;
+}
+
+// Main loop: a broadcast Convert T every DS18B20_PERIOD_MS, the sensors are read by their ROM once done, one per pass.
+// Only the bus traffic itself blocks, about 12 ms per pass
+void ds18b20_background_task(void) {
+    if (sensor_count == 0) return;
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+
+    switch (bus_state) {
+        case BUS_IDLE:
+            if (converted_once && now - conversion_start_ms < DS18B20_PERIOD_MS) return;
+            if (!onewire_reset()) {
+                for (uint8_t i = 0; i < sensor_count; i++) sensor_valid[i] = false;
+                conversion_start_ms = now;
+                converted_once = true;
+                return;
+            }
+            onewire_write_byte(ROM_SKIP);
+            onewire_write_byte(CMD_CONVERT_T);
+            conversion_start_ms = now;
+            converted_once = true;
+            next_sensor = 0;
+            bus_state = BUS_CONVERTING;
+            break;
+
+        case BUS_CONVERTING:
+            if (now - conversion_start_ms < conversion_ms) return;
+            // One sensor per pass, the main loop gets back in between
+            sensor_valid[next_sensor] = read_sensor(next_sensor);
+            if (++next_sensor >= sensor_count) {
+                bus_state = BUS_IDLE;
+            }
+            break;
+    }
+}
+
+uint8_t ds18b20_count(void) {
+    return sensor_count;
+}
+
+bool ds18b20_get_temp(uint8_t index, float *celsius) {
+    if (index >= sensor_count || !sensor_valid[index]) return false;
+    *celsius = sensor_temp[index];
+    return true;
+}
+
+bool ds18b20_get_rom(uint8_t index, uint8_t *rom) {
+    if (index >= sensor_count) return false;
+    memcpy(rom, sensor_rom[index], 8);
+    return true;
+}
+
+uint8_t ds18b20_resolution(void) {
+    return resolution;
+}
+
+// The sensor chosen in the config, DS18B20_NO_READING without a valid reading
+float ds18b20_ambient_temp(void) {
+    float celsius;
+    if (!ds18b20_get_temp(device_config.temp_ambient_sensor, &celsius)) return DS18B20_NO_READING;
+    return celsius;
+}
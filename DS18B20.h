@@ -4,12 +4,25 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "pico/stdlib.h"
+#include "DEBUGPRINT.h"
 
-static void onewire_write_bit(bool bit);
-static bool onewire_read_bit(void);
-static void onewire_write_byte(uint8_t data);
-static uint8_t onewire_read_byte(void);
-static bool onewire_reset(void);
-float ds18b20_read_temp(void);
+// DS18B20 temperature sensors
+// Any number of sensors up to DS18B20_MAX_SENSORS share the 1-Wire bus, found by a ROM search at boot and listed in
+// ROM order. One broadcast Convert T starts all of them at once, the background task reads each one by its ROM once
+// the conversion time of the configured resolution has passed, so nothing waits for the conversion. Readings with a
+// bad scratchpad CRC are dropped. The sensor picked in the config is the ambient one for telemetry and refraction.
 
-#endif // DS18B20_H
\ No newline at end of file
+#define DS18B20_MAX_SENSORS 4
+#define DS18B20_PERIOD_MS 1000              // A new conversion starts this often
+#define DS18B20_RESOLUTION 12               // Default, 9-12 bit take 94-750 ms to convert
+#define DS18B20_NO_READING -1000.0f         // Reported without a valid reading
+
+void ds18b20_init(uint pin);
+void ds18b20_background_task(void);
+uint8_t ds18b20_count(void);
+bool ds18b20_get_temp(uint8_t index, float *celsius);
+bool ds18b20_get_rom(uint8_t index, uint8_t *rom);
+uint8_t ds18b20_resolution(void);
+float ds18b20_ambient_temp(void);
+
+#endif // DS18B20_H
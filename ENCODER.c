@@ -0,0 +1,107 @@
+#include "ENCODER.h"
+#include "CONFIG.h"
+#include "ENCODER.pio.h"
+
+static PIO encoder_pio = pio1;
+static int encoder_sm[NUM_AXES];                // -1 without an encoder
+static float units_per_count[NUM_AXES];         // Position units, negative for an encoder counting the other way
+static float arcsec_per_unit[NUM_AXES];
+static int32_t deadband_units[NUM_AXES];
+
+// Core 1, the count that matched the step position when the encoder was last zeroed
+static bool zeroed[NUM_AXES];
+static int32_t zero_count[NUM_AXES];
+static int32_t zero_position[NUM_AXES];
+static volatile bool rezero_requested[NUM_AXES];
+static volatile float error_arcsec[NUM_AXES];   // Step position minus encoder, for the telemetry
+
+// After stepper_apply_config, the units come from the step resolution
+void encoder_init(void) {
+    bool program_loaded = false;
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        encoder_sm[axis] = -1;
+        zeroed[axis] = false;
+        rezero_requested[axis] = false;
+        error_arcsec[axis] = 0.0f;
+
+        uint pin = device_config.encoder_pin[axis];
+        float counts_per_rev = device_config.encoder_counts_per_rev[axis];
+        if (pin == ENCODER_PIN_NONE || counts_per_rev == 0.0f) continue;
+
+        if (!program_loaded) {
+            pio_add_program(encoder_pio, &quadrature_encoder_program);
+            program_loaded = true;
+        }
+        int sm = pio_claim_unused_sm(encoder_pio, false);
+        if (sm < 0) {
+            DEBUG_PRINT("No PIO state machine left for the encoder of axis %d\n", axis);
+            continue;
+        }
+
+        pio_sm_set_consecutive_pindirs(encoder_pio, sm, pin, 2, false);
+        gpio_pull_up(pin);
+        gpio_pull_up(pin + 1);
+        pio_sm_config config = quadrature_encoder_program_get_default_config(0);
+        sm_config_set_in_pins(&config, pin);
+        sm_config_set_jmp_pin(&config, pin);
+        sm_config_set_in_shift(&config, false, false, 32);  // Shift left, no autopush
+        sm_config_set_clkdiv(&config, 1.0f);                // Full speed, 10 cycles per sample at worst
+        pio_sm_init(encoder_pio, sm, 0, &config);
+        pio_sm_set_enabled(encoder_pio, sm, true);
+        encoder_sm[axis] = sm;
+
+        float steps_per_arcsec = stepper_steps_per_arcsec(axis);
+        units_per_count[axis] = steps_per_arcsec * FULL_TURN_ARCSEC / counts_per_rev;
+        arcsec_per_unit[axis] = 1.0f / steps_per_arcsec;
+        float deadband = ENCODER_DEADBAND_COUNTS * units_per_count[axis];
+        deadband_units[axis] = (int32_t)(deadband >= 0 ? deadband : -deadband);
+        DEBUG_PRINT("Encoder on axis %d, pins %d/%d, %.0f counts per turn\n", axis, pin, pin + 1, counts_per_rev);
+    }
+}
+
+bool encoder_present(uint8_t axis) {
+    return axis < NUM_AXES && encoder_sm[axis] >= 0;
+}
+
+// The step position was set (checkpoint, homing), the encoder takes it over at the next check
+void encoder_rezero(uint8_t axis) {
+    if (axis < NUM_AXES) rezero_requested[axis] = true;
+}
+
+// Drain what the state machine pushed so far, the next push is at most 10 cycles away and current
+static int32_t read_count(uint8_t axis) {
+    uint sm = (uint)encoder_sm[axis];
+    uint pending = pio_sm_get_rx_fifo_level(encoder_pio, sm) + 1;
+    uint32_t count = 0;
+    while (pending-- > 0) {
+        count = pio_sm_get_blocking(encoder_pio, sm);
+    }
+    return (int32_t)count;
+}
+
+// Core 1, step position minus where the encoder says the axis is, in position units
+bool encoder_error_units(uint8_t axis, int32_t position, int32_t *error) {
+    if (encoder_sm[axis] < 0) return false;
+
+    int32_t count = read_count(axis);
+    if (!zeroed[axis] || rezero_requested[axis]) {
+        rezero_requested[axis] = false;
+        zeroed[axis] = true;
+        zero_count[axis] = count;
+        zero_position[axis] = position;
+    }
+
+    float encoder_position = zero_position[axis] + (float)(count - zero_count[axis]) * units_per_count[axis];
+    float difference = position - encoder_position;
+    *error = (int32_t)(difference >= 0 ? difference + 0.5f : difference - 0.5f);
+    error_arcsec[axis] = *error * arcsec_per_unit[axis];
+    return true;
+}
+
+int32_t encoder_deadband_units(uint8_t axis) {
+    return deadband_units[axis];
+}
+
+float encoder_get_error(uint8_t axis) {
+    return error_arcsec[axis];
+}
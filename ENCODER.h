@@ -0,0 +1,28 @@
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "STEPPER.h"
+#include "DEBUGPRINT.h"
+
+// Quadrature encoders
+// Optional encoders on the axis outputs, decoded by a PIO state machine each (pio1, the TMC2209 UART has pio0),
+// so counting costs no CPU time at all. A and B go on consecutive pins. Core 1 reads the counts every
+// ENCODER_CHECK_US and compares them with the step position, the difference is trimmed away with extra
+// steps that do not count in the position, the same way PEC corrections are output.
+
+#define ENCODER_PIN_NONE 0xFF
+#define ENCODER_CHECK_US 10000          // Correction period on core 1
+#define ENCODER_DEADBAND_COUNTS 2       // Errors up to this are encoder resolution, not drift
+
+void encoder_init(void);
+bool encoder_present(uint8_t axis);
+void encoder_rezero(uint8_t axis);
+bool encoder_error_units(uint8_t axis, int32_t position, int32_t *error);
+int32_t encoder_deadband_units(uint8_t axis);
+float encoder_get_error(uint8_t axis);
+
+#endif // ENCODER_H
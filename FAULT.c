@@ -0,0 +1,114 @@
+#include "FAULT.h"
+#include "CONFIG.h"
+#include "UART.h"
+#include "TMC2209.h"
+
+volatile bool fault_freeze_pending = false;     // Set by the interrupt, cleared by the step loop once it stopped
+
+static uint sense_pin;
+static spin_lock_t *fault_lock;                 // Core 1 interrupt vs. core 0 restore
+static volatile bool power_lost = false;
+static volatile bool loss_reported = true;
+static volatile uint32_t edge_time_us = 0;      // Last EN_SENSE edge
+static volatile uint32_t loss_time_us = 0;      // Edge that started the current fault
+static volatile uint32_t freeze_latency_us = 0; // Interrupt to step loop stopped, for the report
+static uint32_t max_freeze_latency_us = 0;
+
+static inline bool motor_power_present(void) {
+    return gpio_get(sense_pin) == EN_SENSE_POWERED_LEVEL;
+}
+
+// Runs on core 1, no DEBUG_PRINT and nothing that blocks in here
+static void fault_gpio_irq(void) {
+    gpio_acknowledge_irq(sense_pin, gpio_get_irq_event_mask(sense_pin));
+    uint32_t now = time_us_32();
+
+    uint32_t save = spin_lock_blocking(fault_lock);
+    edge_time_us = now;
+    if (!power_lost && !motor_power_present()) {
+        power_lost = true;
+        loss_time_us = now;
+        fault_freeze_pending = true;
+        stepper_emergency_stop();
+    }
+    spin_unlock(fault_lock, save);
+}
+
+// Core 0, before core 1 is launched
+void fault_init(void) {
+    sense_pin = device_config.en_sense_pin;
+    fault_lock = spin_lock_init(spin_lock_claim_unused(true));
+    edge_time_us = time_us_32();
+
+    // No motor supply at boot is not an emergency, nothing was moving - it just has to come up before anything moves
+    if (!motor_power_present()) {
+        power_lost = true;
+        DEBUG_PRINT("No motor power at boot\n");
+    }
+}
+
+// The interrupt goes to whichever core enables it, called first thing on core 1
+void fault_init_core1(void) {
+    gpio_add_raw_irq_handler_masked(1u << sense_pin, fault_gpio_irq);
+    gpio_set_irq_enabled(sense_pin, GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, true);
+    irq_set_enabled(IO_IRQ_BANK0, true);
+}
+
+// Called by the step loop when it sees fault_freeze_pending, no step pulse is generated after this
+void fault_acknowledge_freeze(void) {
+    freeze_latency_us = time_us_32() - loss_time_us;
+    fault_freeze_pending = false;
+    loss_reported = false;
+}
+
+bool fault_is_active(void) {
+    return power_lost;
+}
+
+static void fault_report(uint8_t state, uint32_t latency_us) {
+    // ESTOP: state(u8) + latency interrupt -> step loop frozen (u16, µs) + worst latency since boot (u16, µs)
+    uint8_t report[5];
+    uint16_t latency = latency_us > UINT16_MAX ? UINT16_MAX : (uint16_t)latency_us;
+    uint16_t max_latency = max_freeze_latency_us > UINT16_MAX ? UINT16_MAX : (uint16_t)max_freeze_latency_us;
+    report[0] = state;
+    memcpy(&report[1], &latency, sizeof(uint16_t));
+    memcpy(&report[3], &max_latency, sizeof(uint16_t));
+    queue_priority_response(CMD_ESTOPTRIG, report, sizeof(report));
+}
+
+void fault_background_task(void) {
+    if (!power_lost) return;
+
+    if (!loss_reported && !fault_freeze_pending) {
+        loss_reported = true;
+        if (freeze_latency_us > max_freeze_latency_us) {
+            max_freeze_latency_us = freeze_latency_us;
+        }
+        fault_report(FAULT_STATE_POWER_LOST, freeze_latency_us);
+        DEBUG_PRINT("Motor power lost, step loop frozen after %lu us\n", freeze_latency_us);
+    }
+
+    // Wait for the supply to be back and stable (no edges) before touching the drivers
+    if (!motor_power_present() || time_us_32() - edge_time_us < FAULT_RESTORE_STABLE_MS * 1000) return;
+    if (fault_freeze_pending || !loss_reported) return;
+
+    // A driver that lost its supply may have reset its registers, so configure them from scratch
+    // core 1 is paused and the motors are disabled at this point
+    if (tmc2209_configure()) {
+        DEBUG_PRINT("TMC2209 drivers reconfigured after power loss\n");
+    }
+    stepper_reset_microstepping();
+
+    bool restored = false;
+    uint32_t save = spin_lock_blocking(fault_lock);
+    if (power_lost && motor_power_present()) {
+        power_lost = false;
+        restored = true;
+    }
+    spin_unlock(fault_lock, save);
+
+    if (restored) {
+        fault_report(FAULT_STATE_POWER_RESTORED, 0);
+        DEBUG_PRINT("Motor power restored\n");
+    }
+}
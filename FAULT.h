@@ -0,0 +1,32 @@
+#ifndef FAULT_H
+#define FAULT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "hardware/irq.h"
+#include "STEPPER.h"
+#include "DEBUGPRINT.h"
+
+// Motor power monitoring
+// EN_SENSE follows the motor supply. A falling edge is an emergency stop: the GPIO interrupt runs on core 1,
+// the same core as the step loop, so step generation is frozen before the interrupt returns.
+// Core 0 only reports it (CMD_ESTOPTRIG) and brings the drivers back once the supply is stable again.
+
+#define EN_SENSE_POWERED_LEVEL 1        // EN_SENSE reads high while the motor supply is present
+#define FAULT_RESTORE_STABLE_MS 500     // Supply has to be back this long before the drivers are reconfigured
+
+// CMD_ESTOPTRIG states
+#define FAULT_STATE_POWER_LOST 0
+#define FAULT_STATE_POWER_RESTORED 1
+
+extern volatile bool fault_freeze_pending;
+
+void fault_init(void);
+void fault_init_core1(void);
+void fault_acknowledge_freeze(void);
+bool fault_is_active(void);
+void fault_background_task(void);
+
+#endif // FAULT_H
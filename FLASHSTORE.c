@@ -0,0 +1,121 @@
+#include "FLASHSTORE.h"
+#include <string.h>
+
+uint32_t flash_store_crc32(const uint8_t *data, size_t length) {
+    uint32_t crc = 0xFFFFFFFFu;
+
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (uint8_t j = 0; j < 8; j++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+static inline uint32_t slot_count(const flash_store_t *store) {
+    return store->sectors * FLASH_SECTOR_SIZE / store->record_size;
+}
+
+static inline uint32_t slots_per_sector(const flash_store_t *store) {
+    return FLASH_SECTOR_SIZE / store->record_size;
+}
+
+// Flash is memory mapped through XIP, reading is just a pointer
+static inline const uint8_t *slot_ptr(const flash_store_t *store, uint32_t slot) {
+    return (const uint8_t *)(XIP_BASE + store->offset + slot * store->record_size);
+}
+
+static bool slot_is_valid(const flash_store_t *store, uint32_t slot, uint32_t *sequence) {
+    const uint8_t *record = slot_ptr(store, slot);
+    uint32_t magic, crc;
+    memcpy(&magic, record, sizeof(uint32_t));
+    if (magic != FLASHSTORE_MAGIC) return false;
+
+    memcpy(&crc, record + store->record_size - sizeof(uint32_t), sizeof(uint32_t));
+    if (crc != flash_store_crc32(record, store->record_size - sizeof(uint32_t))) return false;
+
+    memcpy(sequence, record + sizeof(uint32_t), sizeof(uint32_t));
+    return true;
+}
+
+static bool range_is_blank(const uint8_t *data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] != 0xFF) return false;
+    }
+    return true;
+}
+
+// Find the newest valid record, returns false if the region holds none
+bool flash_store_load(flash_store_t *store, void *payload) {
+    uint32_t count = slot_count(store);
+    int32_t newest = -1;
+    uint32_t newest_sequence = 0;
+
+    for (uint32_t slot = 0; slot < count; slot++) {
+        uint32_t sequence;
+        if (!slot_is_valid(store, slot, &sequence)) continue;
+        // Signed difference so a wrapped sequence number still compares correctly
+        if (newest < 0 || (int32_t)(sequence - newest_sequence) > 0) {
+            newest = (int32_t)slot;
+            newest_sequence = sequence;
+        }
+    }
+
+    if (newest < 0) {
+        store->sequence = 0;
+        store->next_slot = 0;
+        return false;
+    }
+
+    memcpy(payload, slot_ptr(store, newest) + FLASHSTORE_HEADER_SIZE, store->record_size - FLASHSTORE_OVERHEAD);
+    store->sequence = newest_sequence;
+    store->next_slot = ((uint32_t)newest + 1) % count;
+    return true;
+}
+
+bool flash_store_append(flash_store_t *store, const void *payload) {
+    static uint8_t page[FLASH_PAGE_SIZE];
+    uint32_t count = slot_count(store);
+    uint32_t per_sector = slots_per_sector(store);
+    uint32_t slot = store->next_slot % count;
+
+    // A slot that is not blank in the middle of a sector means an interrupted write, skip to the next sector
+    if (slot % per_sector != 0 && !range_is_blank(slot_ptr(store, slot), store->record_size)) {
+        slot = ((slot / per_sector + 1) * per_sector) % count;
+    }
+
+    // Entering a sector - erase it unless it is already blank
+    if (slot % per_sector == 0) {
+        const uint8_t *sector = slot_ptr(store, slot);
+        if (!range_is_blank(sector, FLASH_SECTOR_SIZE)) {
+            flash_range_erase(store->offset + slot * store->record_size, FLASH_SECTOR_SIZE);
+        }
+    }
+
+    // Build the page image, bytes left at 0xFF are not changed by programming
+    uint32_t slot_offset = store->offset + slot * store->record_size;
+    uint32_t page_offset = slot_offset & ~(FLASH_PAGE_SIZE - 1);
+    uint8_t *record = page + (slot_offset - page_offset);
+    uint32_t magic = FLASHSTORE_MAGIC;
+    uint32_t sequence = store->sequence + 1;
+
+    memset(page, 0xFF, sizeof(page));
+    memcpy(record, &magic, sizeof(uint32_t));
+    memcpy(record + sizeof(uint32_t), &sequence, sizeof(uint32_t));
+    memcpy(record + FLASHSTORE_HEADER_SIZE, payload, store->record_size - FLASHSTORE_OVERHEAD);
+    uint32_t crc = flash_store_crc32(record, store->record_size - sizeof(uint32_t));
+    memcpy(record + store->record_size - sizeof(uint32_t), &crc, sizeof(uint32_t));
+
+    flash_range_program(page_offset, page, FLASH_PAGE_SIZE);
+
+    store->next_slot = (slot + 1) % count;
+
+    uint32_t written_sequence;
+    if (!slot_is_valid(store, slot, &written_sequence) || written_sequence != sequence) {
+        DEBUG_PRINT("ERROR: Flash record verify failed at offset 0x%08lx\n", slot_offset);
+        return false;
+    }
+    store->sequence = sequence;
+    return true;
+}
@@ -0,0 +1,39 @@
+#ifndef FLASHSTORE_H
+#define FLASHSTORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "DEBUGPRINT.h"
+
+// Wear levelled record store in flash
+// A region of whole sectors is used as a ring of fixed size records, every write goes to the next free slot
+// and only when the ring wraps into a sector that sector is erased. The newest record with a valid CRC wins.
+// The region always spans at least 2 sectors, so erasing the next sector never destroys the newest record.
+//
+// The firmware runs from RAM (copy_to_ram binary), so programming flash does not need core 1 to be parked
+// and interrupts can stay enabled - the step timing on core 1 is never stalled by a flash write
+
+#define FLASHSTORE_MAGIC 0x53504250u        // "PBPS"
+#define FLASHSTORE_HEADER_SIZE 8            // magic + sequence
+#define FLASHSTORE_OVERHEAD 12              // header + crc32
+
+// Flash layout, counted from the end of flash
+#define FLASHSTORE_SECTORS_CONFIG 2
+#define FLASHSTORE_CONFIG_OFFSET (PICO_FLASH_SIZE_BYTES - FLASHSTORE_SECTORS_CONFIG * FLASH_SECTOR_SIZE)
+
+typedef struct {
+    uint32_t offset;        // Flash offset of the region, sector aligned
+    uint32_t sectors;       // Number of sectors in the region, at least 2
+    uint32_t record_size;   // Size of one record including the overhead, must divide FLASH_PAGE_SIZE or be a multiple of it
+    uint32_t next_slot;     // Slot the next record goes to
+    uint32_t sequence;      // Sequence number of the newest record
+} flash_store_t;
+
+uint32_t flash_store_crc32(const uint8_t *data, size_t length);
+bool flash_store_load(flash_store_t *store, void *payload);
+bool flash_store_append(flash_store_t *store, const void *payload);
+
+#endif // FLASHSTORE_H
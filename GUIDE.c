@@ -0,0 +1,347 @@
+#include "GUIDE.h"
+#include "CONFIG.h"
+#include "UART.h"
+#include "PEC.h"
+
+static float guide_rate = GUIDE_RATE_ARCSEC;
+static uint guide_pins[GUIDE_LINE_COUNT];
+static uint8_t pair_axis[2];                    // Axis moved by the RA and the Dec line pair
+static uint32_t pin_mask = 0;
+
+// Pulses from CMD_GUIDE, written in the UART interrupt and taken over by core 1
+typedef struct {
+    bool pending;
+    float rate;                                 // arcsec/s, signed
+    uint32_t duration_us;
+} guide_request_t;
+
+typedef struct {
+    bool pending;
+    float arcsec;                           // Signed distance, added to what is left of a running dither
+    float rate;                             // arcsec/s
+} dither_request_t;
+
+static spin_lock_t *request_lock;
+static guide_request_t requests[NUM_AXES];
+static dither_request_t dither_requests[NUM_AXES];  // From the sequencer, a channel of its own so guide pulses go on
+static uint32_t request_received_us;
+static bool command_pending = false;                // A CMD_GUIDE is among the requests, not only dithers
+static volatile uint32_t request_version = 0;
+static volatile bool reset_requested = false;
+static volatile bool status_requested = false;
+
+// Core 1, the running pulses and what they and the ST-4 lines added up to since the tracking mode started.
+// Finished corrections are added to done_arcsec once, the running ones are worked out from their start so
+// nothing is summed per pass
+static uint32_t applied_version = 0;
+static float pulse_rate[NUM_AXES];
+static uint32_t pulse_length_us[NUM_AXES];
+static uint32_t pulse_start_us[NUM_AXES];
+static float st4_applied_rate[NUM_AXES];
+static uint32_t st4_since_us;
+static float dither_rate[NUM_AXES];
+static uint32_t dither_length_us[NUM_AXES];
+static uint32_t dither_start_us[NUM_AXES];
+static volatile bool dither_running = false;
+static float done_arcsec[NUM_AXES];
+static volatile float offset_arcsec[NUM_AXES];
+static volatile float velocity_arcsec[NUM_AXES];
+
+// ST-4 lines, written by the GPIO interrupt on core 1
+static volatile float st4_rate[NUM_AXES];
+static int8_t pair_sign[2];
+static uint32_t pair_since_us[2];
+static volatile uint8_t st4_lines = 0;
+static volatile bool st4_changed = false;
+static volatile uint32_t st4_edge_us;
+static volatile int32_t st4_pec_total[NUM_AXES];   // Finished ST-4 corrections, PEC_SAMPLE_UNIT_ARCSEC
+static int32_t st4_pec_fed[NUM_AXES];               // Core 0, part of the total already given to the PEC recording
+
+// Receipt (end of the frame or the ST-4 edge) until the step loop runs with the new rate
+static volatile uint16_t command_latency_us = 0;
+static volatile uint16_t command_latency_max_us = 0;
+static volatile uint16_t st4_latency_us = 0;
+static volatile uint16_t st4_latency_max_us = 0;
+static volatile uint16_t command_count = 0;
+
+static void guide_gpio_irq(void) {
+    uint32_t now = time_us_32();
+    uint8_t lines = 0;
+    for (uint8_t line = 0; line < GUIDE_LINE_COUNT; line++) {
+        if (guide_pins[line] == GUIDE_PIN_NONE) continue;
+        uint32_t events = gpio_get_irq_event_mask(guide_pins[line]);
+        if (events) gpio_acknowledge_irq(guide_pins[line], events);
+        // ST-4 outputs are open collector, a line is active when pulled low
+        if (!gpio_get(guide_pins[line])) lines |= 1u << line;
+    }
+    if (lines == st4_lines) return;
+
+    float rate[NUM_AXES] = {0.0f, 0.0f, 0.0f};
+    for (uint8_t pair = 0; pair < 2; pair++) {
+        if (pair_axis[pair] >= NUM_AXES) continue;
+        int8_t sign = (int8_t)((lines >> (2 * pair)) & 1) - (int8_t)((lines >> (2 * pair + 1)) & 1);
+        if (sign != pair_sign[pair]) {
+            // A finished correction goes to the PEC recording, same as a CMD_PEC_SAMPLE
+            if (pair_sign[pair]) {
+                float samples = pair_sign[pair] * guide_rate * (now - pair_since_us[pair]) / 1000000.0f / PEC_SAMPLE_UNIT_ARCSEC;
+                st4_pec_total[pair_axis[pair]] += (int32_t)(samples >= 0 ? samples + 0.5f : samples - 0.5f);
+            }
+            pair_sign[pair] = sign;
+            pair_since_us[pair] = now;
+        }
+        rate[pair_axis[pair]] += sign * guide_rate;
+    }
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        st4_rate[axis] = rate[axis];
+    }
+    st4_lines = lines;
+    st4_edge_us = now;
+    st4_changed = true;
+}
+
+void guide_init(void) {
+    request_lock = spin_lock_init(spin_lock_claim_unused(true));
+    if (device_config.guide_rate > 0.0f) guide_rate = device_config.guide_rate;
+    pair_axis[0] = device_config.guide_axis_ra;
+    pair_axis[1] = device_config.guide_axis_dec;
+
+    pin_mask = 0;
+    for (uint8_t line = 0; line < GUIDE_LINE_COUNT; line++) {
+        guide_pins[line] = device_config.guide_pin[line];
+        if (guide_pins[line] == GUIDE_PIN_NONE) continue;
+        gpio_init(guide_pins[line]);
+        gpio_set_dir(guide_pins[line], GPIO_IN);
+        gpio_pull_up(guide_pins[line]);
+        pin_mask |= 1u << guide_pins[line];
+    }
+}
+
+// Same core as the step loop, so an ST-4 edge changes the rate the next pass uses
+void guide_init_core1(void) {
+    if (!pin_mask) return;
+    gpio_add_raw_irq_handler_masked(pin_mask, guide_gpio_irq);
+    for (uint8_t line = 0; line < GUIDE_LINE_COUNT; line++) {
+        if (guide_pins[line] == GUIDE_PIN_NONE) continue;
+        gpio_set_irq_enabled(guide_pins[line], GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, true);
+    }
+    irq_set_enabled(IO_IRQ_BANK0, true);
+}
+
+// Called from the UART interrupt. A pulse replaces whatever is left of the previous one on its axis,
+// axes with a 0 value are left alone
+void guide_command(uint8_t mode, const int16_t *values, uint32_t received_us) {
+    if (mode > GUIDE_MODE_NUDGE) return;
+
+    int16_t pec_samples[NUM_AXES];
+    uint32_t save = spin_lock_blocking(request_lock);
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        pec_samples[axis] = 0;
+        if (values[axis] == 0) continue;
+        float magnitude = values[axis] > 0 ? values[axis] : -(float)values[axis];
+        float seconds = mode == GUIDE_MODE_PULSE ? magnitude / 1000.0f : magnitude * GUIDE_NUDGE_UNIT_ARCSEC / guide_rate;
+        float rate = values[axis] > 0 ? guide_rate : -guide_rate;
+        requests[axis].pending = true;
+        requests[axis].rate = rate;
+        requests[axis].duration_us = (uint32_t)(seconds * 1000000.0f);
+        // Rounded, short corrections truncated towards 0 would leave out a good part of the recorded curve
+        float samples = rate * seconds / PEC_SAMPLE_UNIT_ARCSEC;
+        pec_samples[axis] = (int16_t)(samples >= 0 ? samples + 0.5f : samples - 0.5f);
+    }
+    request_received_us = received_us;
+    command_pending = true;
+    request_version++;
+    spin_unlock(request_lock, save);
+    command_count++;
+
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        if (pec_samples[axis]) pec_add_guide_sample(axis, pec_samples[axis]);
+    }
+}
+
+// Sequencer dither, signed arcsec on the RA and Dec axes at the given rate. Unlike CMD_GUIDE it is not a guide
+// correction, so it stays out of the PEC recording and the latency figures
+void guide_dither(float ra_arcsec, float dec_arcsec, float rate) {
+    if (rate <= 0.0f) rate = guide_rate;
+    float arcsec[NUM_AXES] = {0.0f, 0.0f, 0.0f};
+    if (pair_axis[0] < NUM_AXES) arcsec[pair_axis[0]] += ra_arcsec;
+    if (pair_axis[1] < NUM_AXES) arcsec[pair_axis[1]] += dec_arcsec;
+
+    uint32_t save = spin_lock_blocking(request_lock);
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        if (arcsec[axis] == 0.0f) continue;
+        if (!dither_requests[axis].pending) dither_requests[axis].arcsec = 0.0f;
+        dither_requests[axis].pending = true;
+        dither_requests[axis].arcsec += arcsec[axis];
+        dither_requests[axis].rate = rate;
+    }
+    dither_running = true;
+    request_version++;
+    spin_unlock(request_lock, save);
+}
+
+// The last dither has been taken over by core 1 and has run out
+bool guide_dither_done(void) {
+    return request_version == applied_version && !dither_running;
+}
+
+void guide_control(uint8_t action) {
+    if (action == GUIDE_ACTION_CLEAR) {
+        guide_reset();
+        command_latency_max_us = 0;
+        st4_latency_max_us = 0;
+    }
+    status_requested = true;
+}
+
+// A new tracking mode starts without any guide offset, core 1 does the reset. Dithers not taken over yet are
+// dropped here, core 1 does not pick up requests while the motors are stopped and would apply them afterwards
+void guide_reset(void) {
+    uint32_t save = spin_lock_blocking(request_lock);
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        dither_requests[axis].pending = false;
+    }
+    spin_unlock(request_lock, save);
+    reset_requested = true;
+}
+
+static void note_latency(volatile uint16_t *last, volatile uint16_t *worst, uint32_t latency_us) {
+    uint16_t latency = latency_us > UINT16_MAX ? UINT16_MAX : (uint16_t)latency_us;
+    *last = latency;
+    if (latency > *worst) *worst = latency;
+}
+
+// Part of a pulse or dither run by now_us
+static inline float run_progress(float rate, uint32_t start_us, uint32_t length_us, uint32_t now_us) {
+    uint32_t run_us = now_us - start_us;
+    if (run_us > length_us) run_us = length_us;
+    return rate * run_us / 1000000.0f;
+}
+
+static inline float pulse_progress(uint8_t axis, uint32_t now_us) {
+    return run_progress(pulse_rate[axis], pulse_start_us[axis], pulse_length_us[axis], now_us);
+}
+
+static inline float dither_progress(uint8_t axis, uint32_t now_us) {
+    return run_progress(dither_rate[axis], dither_start_us[axis], dither_length_us[axis], now_us);
+}
+
+// Core 1, every pass of the step loop while the motors run
+void guide_update(uint32_t now_us) {
+    if (reset_requested) {
+        reset_requested = false;
+        for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+            pulse_length_us[axis] = 0;
+            dither_length_us[axis] = 0;
+            done_arcsec[axis] = 0.0f;
+        }
+        st4_since_us = now_us;
+    }
+
+    if (request_version != applied_version) {
+        uint32_t save = spin_lock_blocking(request_lock);
+        for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+            if (dither_requests[axis].pending) {
+                // Unlike a guide pulse a dither is a distance, what is left of the running one is carried over
+                float progress = dither_progress(axis, now_us);
+                float remaining = dither_rate[axis] * dither_length_us[axis] / 1000000.0f - progress;
+                if (dither_length_us[axis] == 0) remaining = 0.0f;
+                float arcsec = remaining + dither_requests[axis].arcsec;
+                float rate = dither_requests[axis].rate;
+                done_arcsec[axis] += progress;
+                dither_rate[axis] = arcsec > 0 ? rate : -rate;
+                dither_length_us[axis] = (uint32_t)(fabsf(arcsec) / rate * 1000000.0f);
+                dither_start_us[axis] = now_us;
+                dither_requests[axis].pending = false;
+            }
+            if (!requests[axis].pending) continue;
+            // A replaced pulse only counts as far as it got
+            done_arcsec[axis] += pulse_progress(axis, now_us);
+            pulse_rate[axis] = requests[axis].rate;
+            pulse_length_us[axis] = requests[axis].duration_us;
+            pulse_start_us[axis] = now_us;
+            requests[axis].pending = false;
+        }
+        uint32_t received_us = request_received_us;
+        bool was_command = command_pending;
+        command_pending = false;
+        applied_version = request_version;
+        spin_unlock(request_lock, save);
+        if (was_command) note_latency(&command_latency_us, &command_latency_max_us, now_us - received_us);
+    }
+    if (st4_changed) {
+        st4_changed = false;
+        uint32_t edge_us = st4_edge_us;
+        for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+            done_arcsec[axis] += st4_applied_rate[axis] * (int32_t)(edge_us - st4_since_us) / 1000000.0f;
+            st4_applied_rate[axis] = st4_rate[axis];
+        }
+        st4_since_us = edge_us;
+        note_latency(&st4_latency_us, &st4_latency_max_us, now_us - edge_us);
+    }
+
+    float st4_time = (int32_t)(now_us - st4_since_us) / 1000000.0f;
+    bool dithering = false;
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        float velocity = st4_applied_rate[axis];
+        if (now_us - pulse_start_us[axis] < pulse_length_us[axis]) {
+            velocity += pulse_rate[axis];
+        } else if (pulse_length_us[axis]) {
+            done_arcsec[axis] += pulse_progress(axis, now_us);
+            pulse_length_us[axis] = 0;
+        }
+        if (now_us - dither_start_us[axis] < dither_length_us[axis]) {
+            velocity += dither_rate[axis];
+            dithering = true;
+        } else if (dither_length_us[axis]) {
+            done_arcsec[axis] += dither_progress(axis, now_us);
+            dither_length_us[axis] = 0;
+        }
+        offset_arcsec[axis] = done_arcsec[axis] + pulse_progress(axis, now_us) + dither_progress(axis, now_us) +
+                              st4_applied_rate[axis] * st4_time;
+        velocity_arcsec[axis] = velocity;
+    }
+    dither_running = dithering;
+}
+
+// arcsec/s to add to a rate
+float guide_velocity(uint8_t axis) {
+    return velocity_arcsec[axis];
+}
+
+// arcsec to add to a target position
+float guide_offset(uint8_t axis) {
+    return offset_arcsec[axis];
+}
+
+static void guide_send_status(void) {
+    // Status: X,Y,Z guide offset(f32, arcsec) + command latency last, worst(u16, µs) + ST-4 latency last, worst(u16, µs)
+    //         + commands received(u16) + active ST-4 lines(u8) = 23 bytes
+    uint8_t status[23];
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        float offset = offset_arcsec[axis];
+        memcpy(&status[axis * 4], &offset, sizeof(float));
+    }
+    uint16_t values[5] = {command_latency_us, command_latency_max_us, st4_latency_us, st4_latency_max_us, command_count};
+    memcpy(&status[12], values, sizeof(values));
+    status[22] = st4_lines;
+    queue_response(CMD_GUIDE_STATUS, status, sizeof(status));
+}
+
+void guide_background_task(void) {
+    // CMD_GUIDE and CMD_PEC_SAMPLE feed the recording from the UART interrupt
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        int32_t delta = st4_pec_total[axis] - st4_pec_fed[axis];
+        if (delta == 0) continue;
+        if (delta > INT16_MAX) delta = INT16_MAX;
+        if (delta < INT16_MIN) delta = INT16_MIN;
+        uint32_t irq_state = save_and_disable_interrupts();
+        pec_add_guide_sample(axis, (int16_t)delta);
+        restore_interrupts(irq_state);
+        st4_pec_fed[axis] += delta;
+    }
+
+    if (status_requested) {
+        status_requested = false;
+        guide_send_status();
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef GUIDE_H
+#define GUIDE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+#include "pico/sync.h"
+#include "hardware/gpio.h"
+#include "STEPPER.h"
+#include "DEBUGPRINT.h"
+
+// Autoguiding
+// Guide corrections are timed rate offsets at the guide rate, added on top of whatever tracking mode runs without
+// restarting it: rate tracking adds the guide rate to the axis rate, celestial tracking and profiles add the
+// accumulated guide offset to their targets. They come from CMD_GUIDE, which is neither ACKed nor checked for
+// duplicates so it never waits behind the stop-and-wait queue, or from ST-4 inputs read by a GPIO interrupt on core 1.
+// Corrections are in mount axes, the guiding software calibrates the sky directions like with any ST-4 mount.
+// Sequencer dithers run on a channel of their own on the configured RA/Dec axes, so they neither cut guide pulses
+// short nor go into the PEC recording.
+
+#define GUIDE_PIN_NONE 0xFF
+#define GUIDE_RATE_ARCSEC 7.5f              // Default guide rate, 0.5x sidereal
+#define GUIDE_NUDGE_UNIT_ARCSEC 0.01f       // CMD_GUIDE nudges are in 0.01 arcsec units
+
+typedef enum {
+    GUIDE_MODE_PULSE = 0,                   // Signed pulse length per axis, ms at the guide rate
+    GUIDE_MODE_NUDGE = 1                    // Signed distance per axis, moved at the guide rate
+} guide_mode_t;
+
+typedef enum {
+    GUIDE_ACTION_STATUS = 0,                // Just report status
+    GUIDE_ACTION_CLEAR = 1                  // Stop running pulses and drop the accumulated offset
+} guide_action_t;
+
+// ST-4 lines, indexes into the guide_pin config
+typedef enum {
+    GUIDE_LINE_RA_POS = 0,
+    GUIDE_LINE_RA_NEG = 1,
+    GUIDE_LINE_DEC_POS = 2,
+    GUIDE_LINE_DEC_NEG = 3,
+    GUIDE_LINE_COUNT
+} guide_line_t;
+
+void guide_init(void);
+void guide_init_core1(void);
+void guide_command(uint8_t mode, const int16_t *values, uint32_t received_us);
+void guide_dither(float ra_arcsec, float dec_arcsec, float rate);
+bool guide_dither_done(void);
+void guide_control(uint8_t action);
+void guide_reset(void);
+void guide_update(uint32_t now_us);
+float guide_velocity(uint8_t axis);
+float guide_offset(uint8_t axis);
+void guide_background_task(void);
+
+#endif // GUIDE_H
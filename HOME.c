@@ -0,0 +1,250 @@
+#include "HOME.h"
+#include "CONFIG.h"
+#include "UART.h"
+#include "FAULT.h"
+#include "PROFILE.h"
+
+typedef enum {
+    PHASE_IDLE = 0,
+    PHASE_NEXT,                     // Pick the next axis
+    PHASE_RELEASE,                  // Started on the switch, moving off it
+    PHASE_SEARCH,                   // Fast approach
+    PHASE_BACKOFF,
+    PHASE_LATCH                     // Slow approach, this edge is the reference
+} home_phase_t;
+
+static uint home_pins[NUM_AXES];
+static uint32_t pin_mask = 0;
+
+static volatile bool start_requested = false;
+static volatile bool abort_requested = false;
+static volatile uint8_t requested_axes = 0;
+
+static volatile home_phase_t phase = PHASE_IDLE;
+static volatile uint8_t home_axis = 0;
+static uint8_t pending_axes;
+static bool all_homed;
+static int32_t search_edge_units;
+
+// Written by the switch interrupt on core 1
+static volatile bool edge_pending = false;
+static volatile int32_t edge_units;
+
+static inline bool switch_active(uint8_t axis) {
+    return gpio_get(home_pins[axis]) == ((device_config.home_active_high >> axis) & 1);
+}
+
+static inline int32_t units_to_arcsec(uint8_t axis, int32_t units) {
+    return (int32_t)(units / stepper_steps_per_arcsec(axis));
+}
+
+// Core 1, runs between step pulses. The first matching edge stops the axis, bounces after it are ignored
+static void home_gpio_irq(void) {
+    uint32_t now = time_us_32();
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        if (home_pins[axis] == HOME_PIN_NONE) continue;
+        uint32_t events = gpio_get_irq_event_mask(home_pins[axis]);
+        if (!events) continue;
+        gpio_acknowledge_irq(home_pins[axis], events);
+
+        home_phase_t p = phase;
+        if (axis != home_axis || edge_pending) continue;
+        if (p != PHASE_RELEASE && p != PHASE_SEARCH && p != PHASE_LATCH) continue;
+        bool want_active = p != PHASE_RELEASE;
+        if (switch_active(axis) != want_active) continue;
+
+        edge_units = stepper_edge_position(axis, now);
+        stepper_home_cancel_move(axis);
+        edge_pending = true;
+    }
+}
+
+// Core 0, before core 1 is launched
+void home_init(void) {
+    pin_mask = 0;
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        home_pins[axis] = device_config.home_pin[axis];
+        if (home_pins[axis] == HOME_PIN_NONE) continue;
+        gpio_init(home_pins[axis]);
+        gpio_set_dir(home_pins[axis], GPIO_IN);
+        if ((device_config.home_active_high >> axis) & 1) {
+            gpio_pull_down(home_pins[axis]);
+        } else {
+            gpio_pull_up(home_pins[axis]);
+        }
+        pin_mask |= 1u << home_pins[axis];
+    }
+}
+
+// Same core as the step loop, like the EN_SENSE interrupt
+void home_init_core1(void) {
+    if (!pin_mask) return;
+    gpio_add_raw_irq_handler_masked(pin_mask, home_gpio_irq);
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        if (home_pins[axis] == HOME_PIN_NONE) continue;
+        gpio_set_irq_enabled(home_pins[axis], GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, true);
+    }
+    irq_set_enabled(IO_IRQ_BANK0, true);
+}
+
+// Bit per axis, axes without a switch are skipped and leave the reference alone
+void home_start(uint8_t axis_mask) {
+    requested_axes = axis_mask;
+    start_requested = true;
+}
+
+void home_abort(void) {
+    abort_requested = true;
+}
+
+bool home_is_active(void) {
+    return phase != PHASE_IDLE;
+}
+
+static void home_report(uint8_t axis, home_result_t result, float correction_arcsec, float edge_spread_arcsec) {
+    // Status: axis(u8) + result(u8) + position correction(f32, arcsec) + search vs. latch edge(f32, arcsec)
+    uint8_t status[10];
+    status[0] = axis;
+    status[1] = result;
+    memcpy(&status[2], &correction_arcsec, sizeof(float));
+    memcpy(&status[6], &edge_spread_arcsec, sizeof(float));
+    queue_response(CMD_HOME_STATUS, status, sizeof(status));
+}
+
+static void home_finish(home_result_t result) {
+    stepper_home_finish();
+    if (result != HOME_RESULT_HOMED) {
+        home_report(home_axis, result, 0.0f, 0.0f);
+        DEBUG_PRINT("Homing of axis %d %s\n", home_axis, result == HOME_RESULT_FAILED ? "failed, no switch edge" : "aborted");
+    } else if (all_homed) {
+        stepper_set_reference(REFERENCE_HOMED);
+    }
+    edge_pending = false;
+    phase = PHASE_IDLE;
+}
+
+static bool search_positive(uint8_t axis) {
+    return (device_config.home_direction >> axis) & 1;
+}
+
+static void start_axis(uint8_t axis) {
+    int32_t position = stepper_get_position_arcsec(axis);
+    int32_t toward = search_positive(axis) ? HOME_SEARCH_ARCSEC : -HOME_SEARCH_ARCSEC;
+    edge_pending = false;
+    home_axis = axis;
+    if (switch_active(axis)) {
+        phase = PHASE_RELEASE;
+        stepper_home_move(axis, position - toward, device_config.home_search_speed);
+    } else {
+        phase = PHASE_SEARCH;
+        stepper_home_move(axis, position + toward, device_config.home_search_speed);
+    }
+    DEBUG_PRINT("Homing axis %d\n", axis);
+}
+
+void home_background_task(void) {
+    if (abort_requested) {
+        abort_requested = false;
+        if (phase != PHASE_IDLE) home_finish(HOME_RESULT_ABORTED);
+    }
+
+    if (start_requested) {
+        start_requested = false;
+        if (!stepper_is_enabled() || stepper_is_paused() || fault_is_active()) {
+            DEBUG_PRINT("Motors not running, cannot home!\n");
+            home_report(0xFF, HOME_RESULT_ABORTED, 0.0f, 0.0f);
+            return;
+        }
+        stepper_stop_tracking();
+        stepper_stop_celestial_tracking();
+        profile_stop();
+        stepper_stop_all_moves();
+        pending_axes = requested_axes;
+        all_homed = true;
+        phase = PHASE_NEXT;
+    }
+
+    if (phase == PHASE_IDLE) return;
+
+    // Whatever stopped the motors or started other motion ends the homing
+    stepper_mode_t mode = stepper_get_mode();
+    if (!stepper_is_enabled() || stepper_is_paused() || fault_is_active() ||
+        (mode != STEPPER_MODE_IDLE && mode != STEPPER_MODE_STATIC)) {
+        home_finish(HOME_RESULT_ABORTED);
+        return;
+    }
+
+    // Every phase continues from rest, after the move ended or the switch interrupt cancelled it
+    if (phase != PHASE_NEXT && stepper_axis_busy(home_axis)) return;
+
+    float spread, correction;
+    int32_t direction = search_positive(home_axis) ? 1 : -1;
+    switch (phase) {
+        case PHASE_NEXT:
+            for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+                if (!(pending_axes & (1u << axis))) continue;
+                pending_axes &= ~(1u << axis);
+                if (home_pins[axis] == HOME_PIN_NONE) {
+                    all_homed = false;
+                    continue;
+                }
+                start_axis(axis);
+                return;
+            }
+            home_finish(HOME_RESULT_HOMED);
+            break;
+
+        case PHASE_RELEASE:
+            if (!edge_pending) {
+                home_finish(HOME_RESULT_FAILED);
+                break;
+            }
+            start_axis(home_axis);
+            break;
+
+        case PHASE_SEARCH:
+            if (!edge_pending) {
+                home_finish(HOME_RESULT_FAILED);
+                break;
+            }
+            search_edge_units = edge_units;
+            edge_pending = false;
+            phase = PHASE_BACKOFF;
+            stepper_home_move(home_axis, units_to_arcsec(home_axis, search_edge_units) - direction * HOME_BACKOFF_ARCSEC,
+                              device_config.home_search_speed);
+            break;
+
+        case PHASE_BACKOFF:
+            // Still on the switch after backing off, the slow approach would never see an edge
+            if (switch_active(home_axis)) {
+                home_finish(HOME_RESULT_FAILED);
+                break;
+            }
+            phase = PHASE_LATCH;
+            stepper_home_move(home_axis, units_to_arcsec(home_axis, search_edge_units) + direction * HOME_BACKOFF_ARCSEC,
+                              device_config.home_latch_speed);
+            break;
+
+        case PHASE_LATCH: {
+            if (!edge_pending) {
+                home_finish(HOME_RESULT_FAILED);
+                break;
+            }
+            // The latch edge becomes the configured home position, sub-step: the edge was interpolated
+            float steps_per_arcsec = stepper_steps_per_arcsec(home_axis);
+            int32_t home_units = (int32_t)(device_config.home_position[home_axis] * steps_per_arcsec);
+            int32_t shift = home_units - edge_units;
+            stepper_set_position(home_axis, stepper_get_position(home_axis) + shift);
+            correction = shift / steps_per_arcsec;
+            spread = (edge_units - search_edge_units) / steps_per_arcsec;
+            edge_pending = false;
+            home_report(home_axis, HOME_RESULT_HOMED, correction, spread);
+            DEBUG_PRINT("Axis %d homed, position corrected by %.1f\"\n", home_axis, correction);
+            phase = PHASE_NEXT;
+            break;
+        }
+
+        default:
+            break;
+    }
+}
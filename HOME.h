@@ -0,0 +1,37 @@
+#ifndef HOME_H
+#define HOME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+#include "STEPPER.h"
+#include "DEBUGPRINT.h"
+
+// Homing on index switches
+// Each axis with a home pin is driven towards its switch at the search speed. The switch edge is caught by a
+// GPIO interrupt on core 1, which cancels the move right away and takes the position at the edge, interpolated
+// between steps. The axis then backs off and approaches again at the latch speed, the second edge is the
+// reference: the position counter is shifted so the edge reads the configured home position.
+// Axes are homed one after the other, X first so the camera is clear before the mount turns.
+
+#define HOME_PIN_NONE 0xFF
+#define HOME_SEARCH_ARCSEC 1296000          // Search range, a full turn
+#define HOME_BACKOFF_ARCSEC 1800            // Back-off before the slow approach, also the overtravel it allows
+#define HOME_SEARCH_SPEED_ARCSEC 3600.0f    // Default fast search, 1°/s
+#define HOME_LATCH_SPEED_ARCSEC 60.0f       // Default slow approach
+
+typedef enum {
+    HOME_RESULT_HOMED = 0,
+    HOME_RESULT_FAILED = 1,                 // No switch edge within the search range
+    HOME_RESULT_ABORTED = 2                 // Stopped, paused, fault or another motion command
+} home_result_t;
+
+void home_init(void);
+void home_init_core1(void);
+void home_start(uint8_t axis_mask);
+void home_abort(void);
+bool home_is_active(void);
+void home_background_task(void);
+
+#endif // HOME_H
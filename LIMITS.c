@@ -0,0 +1,65 @@
+#include "LIMITS.h"
+#include "CONFIG.h"
+#include "UART.h"
+
+static limit_zone_t zones[LIMIT_MAX_ZONES];
+static uint8_t zone_count;
+
+// Raised on core 1, reported from the core 0 main loop
+static volatile bool event_pending = false;
+static uint8_t event_kind;
+static uint8_t event_index;
+static int32_t event_position[NUM_AXES];
+
+void limits_init(void) {
+    zone_count = 0;
+    for (int i = 0; i < LIMIT_MAX_ZONES; i++) {
+        const limit_zone_t *zone = &device_config.limit_zones[i];
+        if (zone->x_min >= zone->x_max) continue;
+        zones[zone_count++] = *zone;
+        DEBUG_PRINT("Forbidden zone %d: X %d..%d\", Z %d..%d\"\n", i, zone->x_min, zone->x_max, zone->z_min, zone->z_max);
+    }
+}
+
+// Zone containing the point, -1 if none
+int8_t limits_zone_at(int32_t x_arcsec, int32_t z_arcsec) {
+    if (zone_count == 0) return -1;
+
+    int32_t pan = z_arcsec % FULL_TURN_ARCSEC;
+    if (pan >= FULL_TURN_ARCSEC / 2) pan -= FULL_TURN_ARCSEC;
+    if (pan < -FULL_TURN_ARCSEC / 2) pan += FULL_TURN_ARCSEC;
+
+    for (uint8_t i = 0; i < zone_count; i++) {
+        const limit_zone_t *zone = &zones[i];
+        if (x_arcsec < zone->x_min || x_arcsec > zone->x_max) continue;
+        bool in_pan = zone->z_min <= zone->z_max ? (pan >= zone->z_min && pan <= zone->z_max)
+                                                 : (pan >= zone->z_min || pan <= zone->z_max);
+        if (in_pan) return (int8_t)i;
+    }
+    return -1;
+}
+
+// Core 1, after it cancelled the motion. A second event before core 0 sent the first one is dropped
+void limits_raise(uint8_t kind, uint8_t index, const int32_t *position_arcsec) {
+    if (event_pending) return;
+    event_kind = kind;
+    event_index = index;
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        event_position[axis] = position_arcsec[axis];
+    }
+    event_pending = true;
+}
+
+void limits_background_task(void) {
+    if (!event_pending) return;
+
+    // Event: kind(u8) + axis or zone(u8) + X,Y,Z position(int32 arcsec) = 14 bytes
+    uint8_t event[14];
+    event[0] = event_kind;
+    event[1] = event_index;
+    memcpy(&event[2], event_position, sizeof(event_position));
+    event_pending = false;
+
+    DEBUG_PRINT("Limit hit: %s %d\n", event[0] == LIMIT_EVENT_ZONE ? "zone" : "axis", event[1]);
+    queue_response(CMD_LIMIT_EVENT, event, sizeof(event));
+}
@@ -0,0 +1,39 @@
+#ifndef LIMITS_H
+#define LIMITS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+#include "STEPPER.h"
+#include "DEBUGPRINT.h"
+
+// Forbidden zones and the limit events
+// Besides the per-axis soft limits (config keys 36-41) up to LIMIT_MAX_ZONES boxes in tilt (X) / pan (Z) can be
+// configured that the mount must never enter, e.g. where the camera hits a tripod leg. Core 1 checks where the
+// axes would come to rest every LIMIT_CHECK_US, not per step. A violation cancels the motion, the axes brake
+// to rest and core 0 reports it with CMD_LIMIT_EVENT.
+
+#define LIMIT_MAX_ZONES 4
+#define LIMIT_CHECK_US 10000            // Guard period on core 1, the stopping distance covers one period of travel
+
+// Pan range is an angle modulo a turn (-180°..180°), z_min > z_max is a range across ±180°.
+// A zone with x_min >= x_max is unused
+typedef struct {
+    int32_t x_min;                      // arcsec
+    int32_t x_max;
+    int32_t z_min;
+    int32_t z_max;
+} limit_zone_t;
+
+typedef enum {
+    LIMIT_EVENT_SOFT_LIMIT = 0,         // Index is the axis
+    LIMIT_EVENT_ZONE = 1,               // Index is the zone
+    LIMIT_EVENT_RATE = 2                // CMD_MOVE_TRACKING refused, index is the axis beyond the step rate
+} limit_event_kind_t;
+
+void limits_init(void);
+int8_t limits_zone_at(int32_t x_arcsec, int32_t z_arcsec);
+void limits_raise(uint8_t kind, uint8_t index, const int32_t *position_arcsec);
+void limits_background_task(void);
+
+#endif // LIMITS_H
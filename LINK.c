@@ -0,0 +1,155 @@
+#include <string.h>
+#include "LINK.h"
+
+static const uint32_t supported_rates[] = { 9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600 };
+
+static uint32_t base_rate;
+static uint32_t current_rate;
+static uint32_t previous_rate;
+static uint32_t pending_rate;
+static volatile link_state_t state = LINK_STATE_STABLE;
+static volatile link_event_t last_event = LINK_EVENT_NONE;
+static uint32_t confirm_deadline_ms;
+static volatile bool lost = false;
+
+// Written from the UART interrupt
+static volatile uint16_t window_ok = 0;
+static volatile uint16_t window_bad = 0;
+static volatile uint32_t total_ok = 0;
+static volatile uint32_t total_bad = 0;
+static volatile bool confirmed = false;
+
+static uint16_t fallbacks = 0;
+static uint16_t last_window_ok = 0;
+static uint16_t last_window_bad = 0;
+
+static void reset_window(void) {
+    window_ok = 0;
+    window_bad = 0;
+    confirmed = false;
+}
+
+void link_init(uint32_t rate) {
+    base_rate = rate;
+    current_rate = rate;
+    previous_rate = rate;
+    state = LINK_STATE_STABLE;
+    last_event = LINK_EVENT_NONE;
+    lost = false;
+    reset_window();
+}
+
+// CMD_BAUD_SET, the switch itself waits for link_poll
+bool link_request(uint32_t rate) {
+    bool supported = false;
+    for (size_t i = 0; i < sizeof(supported_rates) / sizeof(supported_rates[0]); i++) {
+        if (supported_rates[i] == rate) supported = true;
+    }
+    if (!supported || state != LINK_STATE_STABLE) {
+        last_event = LINK_EVENT_REJECTED;
+        return false;
+    }
+    pending_rate = rate;
+    state = LINK_STATE_SWITCH_PENDING;
+    return true;
+}
+
+// UART interrupt, every received frame that reached the CRC check or failed before it
+void link_frame(bool ok) {
+    if (ok) {
+        window_ok++;
+        total_ok++;
+        confirmed = true;
+    } else {
+        window_bad++;
+        total_bad++;
+    }
+}
+
+// Our messages went unACKed, the host may have dropped back already
+void link_lost(void) {
+    lost = true;
+}
+
+// Background task with the UART interrupt masked. ack_sent tells the ACK of CMD_BAUD_SET is off the wire.
+// Returns the rate to switch the UART to, 0 to leave it. report asks for a CMD_LINK_STATUS at the rate in use
+uint32_t link_poll(uint32_t now_ms, bool ack_sent, bool *report) {
+    *report = false;
+    switch (state) {
+        case LINK_STATE_SWITCH_PENDING:
+            if (!ack_sent) return 0;
+            previous_rate = current_rate;
+            current_rate = pending_rate;
+            confirm_deadline_ms = now_ms + LINK_CONFIRM_MS;
+            state = LINK_STATE_CONFIRMING;
+            reset_window();
+            lost = false;
+            DEBUG_PRINT("Link switching to %u baud\n", current_rate);
+            return current_rate;
+
+        case LINK_STATE_CONFIRMING:
+            if (confirmed) {
+                state = LINK_STATE_STABLE;
+                last_event = LINK_EVENT_SWITCHED;
+                *report = true;
+                DEBUG_PRINT("Link confirmed at %u baud\n", current_rate);
+                return 0;
+            }
+            if ((int32_t)(now_ms - confirm_deadline_ms) < 0) return 0;
+            current_rate = previous_rate;
+            state = LINK_STATE_STABLE;
+            last_event = LINK_EVENT_CONFIRM_TIMEOUT;
+            *report = true;
+            reset_window();
+            DEBUG_PRINT("Link not confirmed, back to %u baud\n", current_rate);
+            return current_rate;
+
+        case LINK_STATE_STABLE:
+        default:
+            break;
+    }
+
+    uint16_t frames = window_ok + window_bad;
+    bool too_many_errors = false;
+    if (frames >= LINK_WINDOW_FRAMES) {
+        too_many_errors = (uint32_t)window_bad * 100 >= (uint32_t)frames * LINK_ERROR_PERCENT;
+        last_window_ok = window_ok;
+        last_window_bad = window_bad;
+        reset_window();
+    }
+    bool dropped = lost;
+    lost = false;
+    if ((too_many_errors || dropped) && current_rate != base_rate) {
+        current_rate = base_rate;
+        previous_rate = base_rate;
+        last_event = LINK_EVENT_FALLBACK;
+        fallbacks++;
+        *report = true;
+        DEBUG_PRINT("Link errors, back to %u baud\n", current_rate);
+        return current_rate;
+    }
+    return 0;
+}
+
+uint32_t link_rate(void) {
+    return current_rate;
+}
+
+// CMD_LINK_STATUS payload, returns its length
+uint8_t link_get_status(uint8_t *buffer) {
+    uint16_t window_frames_ok = window_ok;
+    uint16_t window_frames_bad = window_bad;
+    uint32_t ok = total_ok;
+    uint32_t bad = total_bad;
+    memcpy(&buffer[0], &current_rate, sizeof(uint32_t));
+    buffer[4] = (uint8_t)state;
+    buffer[5] = (uint8_t)last_event;
+    memcpy(&buffer[6], &window_frames_ok, sizeof(uint16_t));
+    memcpy(&buffer[8], &window_frames_bad, sizeof(uint16_t));
+    memcpy(&buffer[10], &last_window_ok, sizeof(uint16_t));
+    memcpy(&buffer[12], &last_window_bad, sizeof(uint16_t));
+    memcpy(&buffer[14], &ok, sizeof(uint32_t));
+    memcpy(&buffer[18], &bad, sizeof(uint32_t));
+    memcpy(&buffer[22], &fallbacks, sizeof(uint16_t));
+    return 24;
+}
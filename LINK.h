@@ -0,0 +1,41 @@
+#ifndef LINK_H
+#define LINK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "DEBUGPRINT.h"
+
+// UART link rate negotiation
+// The link boots at the configured baud rate, the safe one for the wiring. CMD_BAUD_SET steps it up: the command is
+// ACKed at the old rate, then both ends switch. The first good frame at the new rate confirms it, without one within
+// LINK_CONFIRM_MS the Pico goes back to the old rate. Good and bad frames (CRC, COBS, length, overflow) are counted
+// per window, too many bad ones or lost ACKs drop the link back to the configured rate, where the host finds it again.
+// Only the state machine lives here, no hardware, UART.c applies the rates.
+
+#define LINK_CONFIRM_MS 3000                // A good frame at the new rate has to arrive within this
+#define LINK_WINDOW_FRAMES 32               // Frames per error rate window
+#define LINK_ERROR_PERCENT 20               // Bad frames in a window that drop the link back
+
+typedef enum {
+    LINK_STATE_STABLE = 0,
+    LINK_STATE_SWITCH_PENDING = 1,          // Waiting for the ACK of CMD_BAUD_SET to leave at the old rate
+    LINK_STATE_CONFIRMING = 2               // Switched, waiting for a good frame at the new rate
+} link_state_t;
+
+typedef enum {
+    LINK_EVENT_NONE = 0,
+    LINK_EVENT_SWITCHED = 1,                // The new rate was confirmed
+    LINK_EVENT_REJECTED = 2,                // Not a supported rate
+    LINK_EVENT_CONFIRM_TIMEOUT = 3,         // No good frame at the new rate, back to the old one
+    LINK_EVENT_FALLBACK = 4                 // Error rate or lost ACKs, back to the configured rate
+} link_event_t;
+
+void link_init(uint32_t base_rate);
+bool link_request(uint32_t rate);
+void link_frame(bool ok);
+void link_lost(void);
+uint32_t link_poll(uint32_t now_ms, bool ack_sent, bool *report);
+uint32_t link_rate(void);
+uint8_t link_get_status(uint8_t *buffer);
+
+#endif // LINK_H
@@ -0,0 +1,173 @@
+#include "PEC.h"
+#include "UART.h"
+#include "CONFIG.h"
+
+pec_axis_t pec_axes[NUM_AXES];
+volatile int32_t pec_applied_steps[NUM_AXES] = {0, 0, 0};
+int32_t pec_period_steps = STEPS_PER_REV * POSITION_MICROSTEPS;
+
+// Recording state - only one axis can be recorded at a time
+typedef struct {
+    bool active;
+    uint8_t axis;
+    uint8_t start_bin;              // Where the drift started, the detrend ramp starts here
+    uint8_t last_bin;
+    uint16_t bins_visited;          // Bins passed since the start, one full period = PEC_TABLE_SIZE
+    int32_t cumulative;             // Integrated guide correction, 0.1 arcsec
+    int32_t sum[PEC_TABLE_SIZE];    // Sum of cumulative correction per bin
+    uint16_t count[PEC_TABLE_SIZE]; // Number of samples per bin
+} pec_recording_t;
+
+static pec_recording_t recording;
+
+// Rebuild the precomputed step table after the compact table changed
+// This is the only place where the table is touched with floats
+static void pec_rebuild(uint8_t axis) {
+    float steps_per_unit = stepper_steps_per_arcsec(axis) * PEC_UNIT_ARCSEC;
+    for (int i = 0; i < PEC_TABLE_SIZE; i++) {
+        float steps = pec_axes[axis].table[i] * steps_per_unit;
+        pec_axes[axis].table_steps[i] = (int16_t)(steps >= 0 ? steps + 0.5f : steps - 0.5f);
+    }
+}
+
+void pec_init(void) {
+    pec_period_steps = (int32_t)device_config.steps_per_rev * POSITION_MICROSTEPS;
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        pec_axes[axis].enabled = false;
+        memset(pec_axes[axis].table, 0, sizeof(pec_axes[axis].table));
+        memset(pec_axes[axis].table_steps, 0, sizeof(pec_axes[axis].table_steps));
+        pec_applied_steps[axis] = 0;
+    }
+    recording.active = false;
+}
+
+void pec_set_enabled(uint8_t axis, bool enable) {
+    if (axis >= NUM_AXES) return;
+    pec_axes[axis].enabled = enable;
+    DEBUG_PRINT("PEC %s on axis %d\n", enable ? "enabled" : "disabled", axis);
+}
+
+void pec_clear(uint8_t axis) {
+    if (axis >= NUM_AXES) return;
+    memset(pec_axes[axis].table, 0, sizeof(pec_axes[axis].table));
+    pec_rebuild(axis);
+}
+
+bool pec_upload(uint8_t axis, uint8_t start, uint8_t count, const int8_t *values) {
+    if (axis >= NUM_AXES || count > PEC_MAX_CHUNK || start + count > PEC_TABLE_SIZE) {
+        DEBUG_PRINT("Invalid PEC upload: axis %d, start %d, count %d\n", axis, start, count);
+        return false;
+    }
+    memcpy(&pec_axes[axis].table[start], values, count);
+    pec_rebuild(axis);
+    return true;
+}
+
+uint8_t pec_download(uint8_t axis, uint8_t start, uint8_t count, int8_t *values) {
+    if (axis >= NUM_AXES || start >= PEC_TABLE_SIZE) return 0;
+    if (count > PEC_MAX_DOWNLOAD_CHUNK) count = PEC_MAX_DOWNLOAD_CHUNK;
+    if (start + count > PEC_TABLE_SIZE) count = PEC_TABLE_SIZE - start;
+    memcpy(values, &pec_axes[axis].table[start], count);
+    return count;
+}
+
+void pec_start_recording(uint8_t axis) {
+    if (axis >= NUM_AXES) return;
+    memset(&recording, 0, sizeof(recording));
+    recording.axis = axis;
+    recording.last_bin = pec_phase_index(stepper_get_position(axis));
+    recording.start_bin = recording.last_bin;
+    recording.active = true;
+    DEBUG_PRINT("PEC recording started on axis %d at bin %d\n", axis, recording.last_bin);
+}
+
+void pec_abort_recording(void) {
+    recording.active = false;
+}
+
+// Turn the recorded sums into a table: average per bin, fill empty bins from their neighbour,
+// then remove the linear drift over the period (a tracking rate error, not periodic error) and the mean
+static void pec_finish_recording(void) {
+    uint8_t axis = recording.axis;
+    int32_t value[PEC_TABLE_SIZE];
+    int32_t last = 0;
+    const uint8_t start = recording.start_bin;
+
+    // Bins in recording order from the start bin, an empty bin right after it takes the last recorded one
+    for (int k = PEC_TABLE_SIZE - 1; k >= 0; k--) {
+        uint8_t i = (start + k) & (PEC_TABLE_SIZE - 1);
+        if (recording.count[i] > 0) {
+            last = recording.sum[i] / recording.count[i];
+            break;
+        }
+    }
+    for (int k = 0; k < PEC_TABLE_SIZE; k++) {
+        uint8_t i = (start + k) & (PEC_TABLE_SIZE - 1);
+        if (recording.count[i] > 0) {
+            last = recording.sum[i] / recording.count[i];
+        }
+        value[i] = last;
+    }
+
+    int32_t drift = recording.cumulative;
+    int32_t mean = 0;
+    for (int i = 0; i < PEC_TABLE_SIZE; i++) {
+        value[i] -= drift * ((i - start) & (PEC_TABLE_SIZE - 1)) / PEC_TABLE_SIZE;
+        mean += value[i];
+    }
+    mean /= PEC_TABLE_SIZE;
+
+    // 0.1 arcsec samples -> PEC_UNIT_ARCSEC table entries
+    const int32_t scale = (int32_t)(PEC_UNIT_ARCSEC / PEC_SAMPLE_UNIT_ARCSEC + 0.5f);
+    for (int i = 0; i < PEC_TABLE_SIZE; i++) {
+        int32_t v = value[i] - mean;
+        v = (v >= 0 ? v + scale / 2 : v - scale / 2) / scale;
+        if (v > INT8_MAX) v = INT8_MAX;
+        if (v < INT8_MIN) v = INT8_MIN;
+        pec_axes[axis].table[i] = (int8_t)v;
+    }
+    pec_rebuild(axis);
+    recording.active = false;
+
+    DEBUG_PRINT("PEC recording finished on axis %d\n", axis);
+    pec_send_status(axis);
+}
+
+// Guide corrections sent by the host while recording, the integral of the corrections
+// over one period is the correction curve we want to play back
+void pec_add_guide_sample(uint8_t axis, int16_t correction) {
+    if (!recording.active || axis != recording.axis) return;
+
+    // Same bins as the playback, see pec_target_steps
+    uint8_t bin = pec_phase_index(stepper_get_position(axis));
+    if (bin != recording.last_bin) {
+        // Guide samples can be further apart than a bin, count every bin passed either way
+        int passed = (bin - recording.last_bin) & (PEC_TABLE_SIZE - 1);
+        if (passed > PEC_TABLE_SIZE / 2) passed = PEC_TABLE_SIZE - passed;
+        recording.bins_visited += passed;
+        recording.last_bin = bin;
+    }
+
+    recording.cumulative += correction;
+    recording.sum[bin] += recording.cumulative;
+    if (recording.count[bin] < UINT16_MAX) {
+        recording.count[bin]++;
+    }
+
+    if (recording.bins_visited >= PEC_TABLE_SIZE) {
+        pec_finish_recording();
+    }
+}
+
+void pec_send_status(uint8_t axis) {
+    if (axis >= NUM_AXES) return;
+    // Status: axis(u8) + enabled(u8) + recording(u8) + bins recorded(u16)
+    uint8_t status[5];
+    bool is_recording = recording.active && recording.axis == axis;
+    uint16_t progress = is_recording ? recording.bins_visited : 0;
+    status[0] = axis;
+    status[1] = pec_axes[axis].enabled ? 1 : 0;
+    status[2] = is_recording ? 1 : 0;
+    memcpy(&status[3], &progress, sizeof(uint16_t));
+    queue_response(CMD_PEC_STATUS, status, sizeof(status));
+}
@@ -0,0 +1,62 @@
+#ifndef PEC_H
+#define PEC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "STEPPER.h"
+#include "DEBUGPRINT.h"
+
+// Periodic error correction
+// The dominant periodic error of the 14 tooth pinions repeats once per motor revolution,
+// so the table is indexed by the motor shaft phase (position modulo one revolution)
+#define PEC_TABLE_SIZE 128              // Bins per worm/pinion period
+#define PEC_UNIT_ARCSEC 0.5f            // Stored table values are in 0.5 arcsec units
+#define PEC_SAMPLE_UNIT_ARCSEC 0.1f     // Guide samples from the host are in 0.1 arcsec units
+#define PEC_MAX_CHUNK 64                // Max table entries per upload frame
+#define PEC_MAX_DOWNLOAD_CHUNK 28       // Max table entries per response frame
+
+typedef enum {
+    PEC_ACTION_DISABLE = 0,
+    PEC_ACTION_ENABLE = 1,
+    PEC_ACTION_RECORD = 2,          // Start recording from guide corrections
+    PEC_ACTION_ABORT_RECORD = 3,
+    PEC_ACTION_CLEAR = 4,           // Zero the table
+    PEC_ACTION_STATUS = 5           // Just report status
+} pec_action_t;
+
+typedef struct {
+    bool enabled;
+    int8_t table[PEC_TABLE_SIZE];           // Compact storage, PEC_UNIT_ARCSEC per count
+    int16_t table_steps[PEC_TABLE_SIZE];    // Same table precomputed in steps for the step loops
+} pec_axis_t;
+
+extern pec_axis_t pec_axes[NUM_AXES];
+extern volatile int32_t pec_applied_steps[NUM_AXES];   // Correction steps output so far (not counted in the axis position)
+extern int32_t pec_period_steps;                        // Position units per motor revolution, from the config
+
+void pec_init(void);
+void pec_set_enabled(uint8_t axis, bool enable);
+void pec_clear(uint8_t axis);
+bool pec_upload(uint8_t axis, uint8_t start, uint8_t count, const int8_t *values);
+uint8_t pec_download(uint8_t axis, uint8_t start, uint8_t count, int8_t *values);
+void pec_start_recording(uint8_t axis);
+void pec_abort_recording(void);
+void pec_add_guide_sample(uint8_t axis, int16_t correction);
+void pec_send_status(uint8_t axis);
+
+// Table index for a given motor position, integer only
+static inline uint8_t pec_phase_index(int32_t motor_steps) {
+    int32_t phase = motor_steps % pec_period_steps;
+    if (phase < 0) phase += pec_period_steps;
+    return (uint8_t)(phase * PEC_TABLE_SIZE / pec_period_steps);
+}
+
+// Correction (in steps) the axis should have applied at its current position
+// Called from the core 1 step loops, so no float and no trig in here. The bin goes by the position without the
+// correction, a correction step over a bin edge would otherwise change its own target and hunt across the edge
+static inline int32_t pec_target_steps(uint8_t axis, int32_t position_steps) {
+    if (!pec_axes[axis].enabled) return 0;
+    return pec_axes[axis].table_steps[pec_phase_index(position_steps)];
+}
+
+#endif // PEC_H
@@ -1,3 +1,4 @@
+// Default pin assignments, the pins in use come from the flash config (CONFIG.h) and can be changed per mount
 // By default the stdout UART is `uart0`, so we will use the second one
 #define UART_ID uart0
 #define UART_TX_PIN 1
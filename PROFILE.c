@@ -0,0 +1,166 @@
+#include "PROFILE.h"
+#include "UART.h"
+#include "hardware/sync.h"
+
+// Single producer (UART interrupt, core 0) / single consumer (step loop, core 1) ring, indices only ever increase
+static profile_point_t points[PROFILE_MAX_POINTS];
+static volatile uint16_t head = 0;          // Next slot to write, core 0
+static volatile uint16_t tail = 0;          // Oldest point still needed, core 1
+static volatile uint16_t clear_mark = 0;    // Points before it were cleared, core 0. Core 1 catches its tail up to it,
+                                            // so each index keeps a single writer
+
+static volatile bool profile_active = false;
+static volatile bool profile_following = false;    // Velocity feed-forward follower instead of the position chaser
+static volatile bool underrun = false;      // Playback ran past the last point, the axes hold it
+static volatile uint64_t start_time_us = 0;
+static volatile uint32_t playback_ms = 0;
+
+// Oldest point not cleared, the ring is far smaller than the index range so the difference tells which is ahead
+static inline uint16_t first_index(void) {
+    uint16_t t = tail;
+    uint16_t mark = clear_mark;
+    return (int16_t)(mark - t) > 0 ? mark : t;
+}
+
+static inline uint16_t point_count(void) {
+    return (uint16_t)(head - first_index());
+}
+
+static inline profile_point_t *point_at(uint16_t index) {
+    return &points[index & (PROFILE_MAX_POINTS - 1)];
+}
+
+// Points: time_ms(u32) + X, Y, Z position (float32 arcsec) each, times have to keep increasing
+bool profile_upload(uint8_t count, const uint8_t *data) {
+    if (count > PROFILE_MAX_CHUNK || count > PROFILE_MAX_POINTS - point_count()) {
+        DEBUG_PRINT("Profile upload of %d points does not fit\n", count);
+        return false;
+    }
+
+    uint16_t index = head;
+    uint32_t last_time = point_count() > 0 ? point_at(index - 1)->time_ms : 0;
+    for (uint8_t i = 0; i < count; i++) {
+        profile_point_t point;
+        memcpy(&point.time_ms, &data[i * 16], sizeof(uint32_t));
+        memcpy(point.position_arcsec, &data[i * 16 + 4], sizeof(point.position_arcsec));
+        if ((point_count() > 0 || i > 0) && point.time_ms <= last_time) {
+            DEBUG_PRINT("Profile point %lu ms not after %lu ms, batch dropped\n", point.time_ms, last_time);
+            return false;
+        }
+        *point_at(index++) = point;
+        last_time = point.time_ms;
+    }
+
+    // Points have to be in memory before core 1 can see the new head
+    __dmb();
+    head = index;
+    return true;
+}
+
+bool profile_start(bool follow) {
+    if (point_count() == 0) {
+        DEBUG_PRINT("Profile is empty, nothing to start\n");
+        return false;
+    }
+    underrun = false;
+    playback_ms = 0;
+    start_time_us = time_us_64();
+    profile_following = follow;
+    profile_active = true;
+    DEBUG_PRINT("Profile started with %d points\n", point_count());
+    return true;
+}
+
+// Safe from interrupt context
+void profile_stop(void) {
+    profile_active = false;
+}
+
+// Core 1 may be past its profile_active check and dropping points right now, so the tail stays its own:
+// the clear only moves the mark and core 1 skips to it on its next sample
+void profile_clear(void) {
+    profile_active = false;
+    clear_mark = head;
+    underrun = false;
+}
+
+bool profile_is_active(void) {
+    return profile_active;
+}
+
+bool profile_is_following(void) {
+    return profile_following;
+}
+
+static inline float segment_velocity(const profile_point_t *from, const profile_point_t *to, uint8_t axis) {
+    return (to->position_arcsec[axis] - from->position_arcsec[axis]) * 1000.0f / (float)(to->time_ms - from->time_ms);
+}
+
+// Core 1: where the axes should be right now, false if there is nothing to follow
+bool profile_sample(profile_sample_t *sample) {
+    if (!profile_active) return false;
+    uint16_t mark = clear_mark;
+    if ((int16_t)(mark - tail) > 0) tail = mark;
+
+    // Interpolated to the microsecond, a fast mover covers a lot in a millisecond
+    uint64_t now_us = time_us_64() - start_time_us;
+    uint32_t now_ms = (uint32_t)(now_us / 1000);
+    playback_ms = now_ms;
+
+    // Drop points playback has passed, the one before now is still needed for the interpolation
+    uint16_t count = point_count();
+    while (count >= 2 && point_at(tail + 1)->time_ms <= now_ms) {
+        tail++;
+        count--;
+    }
+    if (count == 0) return false;
+
+    memset(sample, 0, sizeof(profile_sample_t));
+    const profile_point_t *from = point_at(tail);
+    if (count == 1 || now_ms <= from->time_ms) {
+        // Before the first point the axes slew to it, after the last one they hold it
+        underrun = count == 1 && now_ms > from->time_ms;
+        memcpy(sample->position_arcsec, from->position_arcsec, sizeof(from->position_arcsec));
+        if (count >= 2) {
+            sample->time_to_next_s = (from->time_ms - now_ms) / 1000.0f;
+            for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+                sample->next_velocity_arcsec_s[axis] = segment_velocity(from, point_at(tail + 1), axis);
+            }
+        }
+        return true;
+    }
+
+    const profile_point_t *to = point_at(tail + 1);
+    float fraction = (float)(now_us - from->time_ms * 1000ull) / ((to->time_ms - from->time_ms) * 1000.0f);
+    const profile_point_t *after = count >= 3 ? point_at(tail + 2) : NULL;
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        sample->position_arcsec[axis] = from->position_arcsec[axis] + (to->position_arcsec[axis] - from->position_arcsec[axis]) * fraction;
+        sample->velocity_arcsec_s[axis] = segment_velocity(from, to, axis);
+        // Holding the last point afterwards is a velocity of 0
+        sample->next_velocity_arcsec_s[axis] = after ? segment_velocity(to, after, axis) : 0.0f;
+    }
+    sample->time_to_next_s = (to->time_ms * 1000ull - now_us) / 1000000.0f;
+    underrun = false;
+    return true;
+}
+
+void profile_send_status(void) {
+    // Status: active(u8) + underrun(u8) + free slots(u16) + playback time(u32, ms) + last point time(u32, ms)
+    //         + worst X, Y, Z tracking error since the last status (u16 each, 0.1 arcsec)
+    uint8_t status[18];
+    uint16_t count = point_count();
+    uint16_t free_slots = PROFILE_MAX_POINTS - count;
+    uint32_t time_ms = playback_ms;
+    uint32_t last_time = count > 0 ? point_at(head - 1)->time_ms : 0;
+    status[0] = profile_active ? 1 : 0;
+    status[1] = underrun ? 1 : 0;
+    memcpy(&status[2], &free_slots, sizeof(uint16_t));
+    memcpy(&status[4], &time_ms, sizeof(uint32_t));
+    memcpy(&status[8], &last_time, sizeof(uint32_t));
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        float error = stepper_take_tracking_error(axis) * 10.0f + 0.5f;
+        uint16_t error_tenths = error > UINT16_MAX ? UINT16_MAX : (uint16_t)error;
+        memcpy(&status[12 + axis * 2], &error_tenths, sizeof(uint16_t));
+    }
+    queue_response(CMD_PROFILE_STATUS, status, sizeof(status));
+}
@@ -0,0 +1,48 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+#include "STEPPER.h"
+#include "DEBUGPRINT.h"
+
+// Tracking profiles for non-sidereal targets (comets, the Moon, satellites)
+// The host uploads time tagged axis positions in batches, core 1 plays them back piecewise linear,
+// so the motion no longer depends on the link latency. Points are kept in a ring buffer that the host tops up
+// while the profile runs, a point is dropped once playback has passed the next one.
+
+#define PROFILE_MAX_POINTS 64           // Ring buffer size, power of two
+#define PROFILE_MAX_CHUNK 7             // Max points per upload frame
+
+typedef enum {
+    PROFILE_ACTION_STOP = 0,
+    PROFILE_ACTION_START = 1,           // Playback time 0 is when this command is received
+    PROFILE_ACTION_CLEAR = 2,           // Stop and drop every point
+    PROFILE_ACTION_STATUS = 3,          // Just report status
+    PROFILE_ACTION_FOLLOW = 4           // Start in trajectory following mode (fast movers like satellites)
+} profile_action_t;
+
+typedef struct {
+    uint32_t time_ms;                   // Playback time the axes should be at the position
+    float position_arcsec[NUM_AXES];
+} profile_point_t;
+
+// Where the profile is at a given moment, and where it is heading
+typedef struct {
+    float position_arcsec[NUM_AXES];
+    float velocity_arcsec_s[NUM_AXES];          // Slope of the current segment, 0 before the first and after the last point
+    float next_velocity_arcsec_s[NUM_AXES];     // Slope of the segment after it
+    float time_to_next_s;                       // Until the current segment ends
+} profile_sample_t;
+
+bool profile_upload(uint8_t count, const uint8_t *data);
+bool profile_start(bool follow);
+void profile_stop(void);
+void profile_clear(void);
+bool profile_is_active(void);
+bool profile_is_following(void);
+bool profile_sample(profile_sample_t *sample);
+void profile_send_status(void);
+
+#endif // PROFILE_H
@@ -0,0 +1,303 @@
+#include "SEQUENCE.h"
+#include "CONFIG.h"
+#include "UART.h"
+#include "GUIDE.h"
+#include <string.h>
+
+#define PLAN_SIZE 22
+
+typedef struct {
+    uint32_t exposure_ms;
+    uint16_t frames;
+    uint16_t gap_ms;
+    uint8_t dither_pattern;
+    uint8_t dither_every;                   // Dither before every Nth frame
+    float dither_amplitude;                 // arcsec
+    float dither_rate;                      // arcsec/s, 0 for the guide rate
+    uint16_t settle_ms;
+    uint16_t settle_tolerance;              // 0.01 arcsec of tracking error, 0 to only wait settle_ms
+} sequence_plan_t;
+
+static uint trigger_pin = SEQUENCE_PIN_NONE;
+static bool active_high;
+
+// From the UART interrupt, picked up by the background task
+static uint8_t requested_plan[PLAN_SIZE];
+static volatile bool start_requested = false;
+static volatile bool abort_requested = false;
+static volatile bool status_requested = false;
+
+static sequence_plan_t plan;
+static volatile sequence_phase_t phase = SEQUENCE_PHASE_IDLE;
+static uint16_t frames_done;
+static uint16_t dither_count;
+static float dither_offset[2];              // RA, Dec arcsec from where the sequence started
+static uint32_t phase_start_ms;
+static bool settle_timed_out;
+static uint32_t random_state = 1;
+
+static alarm_id_t exposure_alarm = 0;
+static volatile bool exposure_done = false;
+
+static inline void trigger_set(bool active) {
+    gpio_put(trigger_pin, active == active_high);
+}
+
+// Alarm interrupt, ends the exposure on time whatever the main loop is doing
+static int64_t exposure_end(alarm_id_t id, void *user_data) {
+    trigger_set(false);
+    exposure_done = true;
+    return 0;
+}
+
+void sequence_init(void) {
+    trigger_pin = device_config.trigger_pin;
+    if (trigger_pin == SEQUENCE_PIN_NONE) return;
+    active_high = device_config.trigger_active_high != 0;
+    gpio_init(trigger_pin);
+    trigger_set(false);
+    gpio_set_dir(trigger_pin, GPIO_OUT);
+    random_state = time_us_32() | 1;
+    DEBUG_PRINT("Camera trigger on GPIO %d, active %s\n", trigger_pin, active_high ? "high" : "low");
+}
+
+// Called from the UART interrupt
+void sequence_start(const uint8_t *data, uint8_t length) {
+    if (length < PLAN_SIZE) return;
+    memcpy(requested_plan, data, PLAN_SIZE);
+    start_requested = true;
+}
+
+// Called from the UART interrupt, answered with CMD_SEQUENCE_STATUS
+void sequence_control(uint8_t action) {
+    if (action == SEQUENCE_ACTION_ABORT) {
+        abort_requested = true;
+    } else {
+        status_requested = true;
+    }
+}
+
+// Status: event(u8) + phase(u8) + frames done(u16) + frames(u16) + dithers(u16) + RA, Dec dither offset(float, arcsec)
+static void report(sequence_event_t event) {
+    uint8_t status[16];
+    status[0] = (uint8_t)event;
+    status[1] = (uint8_t)phase;
+    memcpy(&status[2], &frames_done, sizeof(uint16_t));
+    memcpy(&status[4], &plan.frames, sizeof(uint16_t));
+    memcpy(&status[6], &dither_count, sizeof(uint16_t));
+    memcpy(&status[8], &dither_offset[0], sizeof(float));
+    memcpy(&status[12], &dither_offset[1], sizeof(float));
+    queue_response(CMD_SEQUENCE_STATUS, status, sizeof(status));
+}
+
+static bool parse_plan(void) {
+    memcpy(&plan.exposure_ms, &requested_plan[0], sizeof(uint32_t));
+    memcpy(&plan.frames, &requested_plan[4], sizeof(uint16_t));
+    memcpy(&plan.gap_ms, &requested_plan[6], sizeof(uint16_t));
+    plan.dither_pattern = requested_plan[8];
+    plan.dither_every = requested_plan[9];
+    memcpy(&plan.dither_amplitude, &requested_plan[10], sizeof(float));
+    memcpy(&plan.dither_rate, &requested_plan[14], sizeof(float));
+    memcpy(&plan.settle_ms, &requested_plan[18], sizeof(uint16_t));
+    memcpy(&plan.settle_tolerance, &requested_plan[20], sizeof(uint16_t));
+
+    if (plan.exposure_ms == 0 || plan.frames == 0) return false;
+    if (plan.dither_pattern > SEQUENCE_DITHER_RANDOM) return false;
+    if (plan.dither_pattern != SEQUENCE_DITHER_NONE) {
+        if (plan.dither_every == 0 || !(plan.dither_amplitude > 0.0f)) return false;
+        if (plan.dither_rate < 0.0f) return false;
+    }
+    return true;
+}
+
+// Point index (from 1) of a square spiral walked outwards from 0,0: (1,0), (1,1), (0,1), (-1,1), (-1,0), ...
+static void spiral_point(uint16_t index, int *x, int *y) {
+    int px = 0, py = 0, dx = 1, dy = 0, leg = 1, step = 0, turns = 0;
+    for (uint16_t i = 0; i < index; i++) {
+        px += dx;
+        py += dy;
+        if (++step < leg) continue;
+        step = 0;
+        int t = dx;
+        dx = -dy;
+        dy = t;
+        if (++turns % 2 == 0) leg++;
+    }
+    *x = px;
+    *y = py;
+}
+
+// xorshift32, plenty for scattering dither positions
+static float random_unit(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return (random_state >> 8) / (float)(1u << 23) - 1.0f;     // -1..1
+}
+
+static void move_dither(float ra, float dec) {
+    float delta_ra = ra - dither_offset[0];
+    float delta_dec = dec - dither_offset[1];
+    dither_offset[0] = ra;
+    dither_offset[1] = dec;
+    if (delta_ra != 0.0f || delta_dec != 0.0f) {
+        guide_dither(delta_ra, delta_dec, plan.dither_rate);
+    }
+}
+
+static void start_dither(void) {
+    dither_count++;
+    float ra, dec;
+    if (plan.dither_pattern == SEQUENCE_DITHER_SPIRAL) {
+        int x, y;
+        spiral_point((dither_count - 1) % SEQUENCE_SPIRAL_POINTS + 1, &x, &y);
+        ra = x * plan.dither_amplitude;
+        dec = y * plan.dither_amplitude;
+    } else {
+        ra = random_unit() * plan.dither_amplitude;
+        dec = random_unit() * plan.dither_amplitude;
+    }
+    move_dither(ra, dec);
+    phase = SEQUENCE_PHASE_DITHER;
+}
+
+static void start_exposure(void) {
+    phase_start_ms = to_ms_since_boot(get_absolute_time());
+    exposure_done = false;
+    trigger_set(true);
+    exposure_alarm = add_alarm_in_us((uint64_t)plan.exposure_ms * 1000, exposure_end, NULL, true);
+    if (exposure_alarm <= 0) {
+        // No alarm slot, the main loop ends the exposure a little late instead
+        exposure_alarm = 0;
+    }
+    phase = SEQUENCE_PHASE_EXPOSE;
+}
+
+static void start_frame(void) {
+    bool dither = plan.dither_pattern != SEQUENCE_DITHER_NONE && frames_done > 0 &&
+                  frames_done % plan.dither_every == 0;
+    if (dither) {
+        start_dither();
+    } else {
+        start_exposure();
+    }
+}
+
+// Ends the sequence, the mount goes back to where it started
+static void finish(sequence_event_t event) {
+    if (phase == SEQUENCE_PHASE_EXPOSE) {
+        if (exposure_alarm > 0) cancel_alarm(exposure_alarm);
+        exposure_alarm = 0;
+        trigger_set(false);
+    }
+    move_dither(0.0f, 0.0f);
+    phase = SEQUENCE_PHASE_IDLE;
+    report(event);
+    DEBUG_PRINT("Sequence %s after %d of %d frames\n", event == SEQUENCE_EVENT_FINISHED ? "finished" : "aborted",
+                frames_done, plan.frames);
+}
+
+// Dithers are guide offsets, only the tracking modes move the axes by them
+static bool tracking(void) {
+    stepper_mode_t mode = stepper_get_mode();
+    return mode == STEPPER_MODE_TRACKING || mode == STEPPER_MODE_CELESTIAL || mode == STEPPER_MODE_PROFILE;
+}
+
+// The RA/Dec axes are within the tolerance of their target, dither offset included
+static bool settled(void) {
+    if (plan.settle_tolerance == 0) return true;
+    float tolerance = plan.settle_tolerance * SEQUENCE_TOLERANCE_UNIT_ARCSEC;
+    uint8_t axes[2] = { device_config.guide_axis_ra, device_config.guide_axis_dec };
+    for (uint8_t i = 0; i < 2; i++) {
+        if (axes[i] >= NUM_AXES) continue;
+        if (fabsf(stepper_get_tracking_error(axes[i])) > tolerance) return false;
+    }
+    return true;
+}
+
+void sequence_background_task(void) {
+    // Every step below may queue an event, one slot stays free for ACKs
+    if (response_queue_free() <= 1) return;
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+
+    if (status_requested) {
+        status_requested = false;
+        report(SEQUENCE_EVENT_STATUS);
+        return;
+    }
+    if (start_requested) {
+        start_requested = false;
+        if (phase != SEQUENCE_PHASE_IDLE || trigger_pin == SEQUENCE_PIN_NONE || !parse_plan() ||
+            (plan.dither_pattern != SEQUENCE_DITHER_NONE && !tracking())) {
+            report(SEQUENCE_EVENT_REJECTED);
+            return;
+        }
+        frames_done = 0;
+        dither_count = 0;
+        dither_offset[0] = 0.0f;
+        dither_offset[1] = 0.0f;
+        DEBUG_PRINT("Sequence of %d x %u ms started\n", plan.frames, plan.exposure_ms);
+        start_frame();
+        return;
+    }
+    if (phase == SEQUENCE_PHASE_IDLE) {
+        abort_requested = false;
+        return;
+    }
+    // A dither only moves while the motors run and a tracking mode applies it, it would never arrive otherwise
+    bool motors_stopped = plan.dither_pattern != SEQUENCE_DITHER_NONE &&
+                          (!stepper_is_enabled() || stepper_is_paused() || !tracking());
+    if (abort_requested || motors_stopped) {
+        abort_requested = false;
+        finish(SEQUENCE_EVENT_ABORTED);
+        return;
+    }
+
+    switch (phase) {
+        case SEQUENCE_PHASE_DITHER:
+            if (!guide_dither_done()) return;
+            phase_start_ms = now;
+            settle_timed_out = false;
+            phase = SEQUENCE_PHASE_SETTLE;
+            break;
+
+        case SEQUENCE_PHASE_SETTLE:
+            if (now - phase_start_ms < plan.settle_ms) return;
+            if (!settled()) {
+                if (now - phase_start_ms < SEQUENCE_SETTLE_TIMEOUT_MS) return;
+                if (!settle_timed_out) {
+                    settle_timed_out = true;
+                    report(SEQUENCE_EVENT_SETTLE_TIMEOUT);
+                    return;
+                }
+            }
+            start_exposure();
+            break;
+
+        case SEQUENCE_PHASE_EXPOSE:
+            if (!exposure_done) {
+                if (exposure_alarm != 0 || now - phase_start_ms < plan.exposure_ms) return;
+                trigger_set(false);
+            }
+            exposure_alarm = 0;
+            frames_done++;
+            // The last frame is only reported as finished, one event per pass
+            if (frames_done >= plan.frames) {
+                finish(SEQUENCE_EVENT_FINISHED);
+                return;
+            }
+            report(SEQUENCE_EVENT_FRAME_DONE);
+            phase_start_ms = now;
+            phase = SEQUENCE_PHASE_GAP;
+            break;
+
+        case SEQUENCE_PHASE_GAP:
+            if (now - phase_start_ms < plan.gap_ms) return;
+            start_frame();
+            break;
+
+        case SEQUENCE_PHASE_IDLE:
+        default:
+            break;
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+#include "STEPPER.h"
+#include "DEBUGPRINT.h"
+
+// Exposure / dither sequencer
+// The host sends the whole imaging plan once with CMD_SEQUENCE_START: exposure length, frame count, the gap between
+// frames for readout, a dither pattern and how the mount has to settle after a dither. The firmware then drives the
+// camera trigger output and dithers on its own, the host only gets a CMD_SEQUENCE_STATUS event per frame and at the end.
+// The exposure is timed by a hardware alarm, not by the main loop. Dithers are guide offsets on the configured RA/Dec
+// axes (GUIDE.h), so they ride on whatever tracking mode runs and the offset is taken back when the sequence ends.
+
+#define SEQUENCE_PIN_NONE 0xFF
+#define SEQUENCE_SPIRAL_POINTS 24           // Square spiral positions, 5x5 around the start, then it starts over
+#define SEQUENCE_SETTLE_TIMEOUT_MS 60000    // Exposes anyway if the axes are still off target by then
+#define SEQUENCE_TOLERANCE_UNIT_ARCSEC 0.01f
+
+typedef enum {
+    SEQUENCE_DITHER_NONE = 0,
+    SEQUENCE_DITHER_SPIRAL = 1,             // Square spiral, amplitude is the grid step
+    SEQUENCE_DITHER_RANDOM = 2              // Uniform within +-amplitude on both axes
+} sequence_dither_t;
+
+typedef enum {
+    SEQUENCE_ACTION_STATUS = 0,             // Just report status
+    SEQUENCE_ACTION_ABORT = 1               // End the exposure now and take the dither back
+} sequence_action_t;
+
+typedef enum {
+    SEQUENCE_PHASE_IDLE = 0,
+    SEQUENCE_PHASE_DITHER,                  // Guide offset running to the next dither position
+    SEQUENCE_PHASE_SETTLE,                  // Settle time, then the tracking error tolerance
+    SEQUENCE_PHASE_EXPOSE,                  // Trigger output active
+    SEQUENCE_PHASE_GAP                      // Camera readout before the next frame
+} sequence_phase_t;
+
+typedef enum {
+    SEQUENCE_EVENT_STATUS = 0,              // Answer to SEQUENCE_ACTION_STATUS
+    SEQUENCE_EVENT_FRAME_DONE = 1,
+    SEQUENCE_EVENT_FINISHED = 2,
+    SEQUENCE_EVENT_ABORTED = 3,
+    SEQUENCE_EVENT_REJECTED = 4,            // Bad plan, no trigger pin, dithers without tracking or already running
+    SEQUENCE_EVENT_SETTLE_TIMEOUT = 5       // Axes not within tolerance of their target, exposing anyway
+} sequence_event_t;
+
+void sequence_init(void);
+void sequence_start(const uint8_t *plan, uint8_t length);
+void sequence_control(uint8_t action);
+void sequence_background_task(void);
+
+#endif // SEQUENCE_H
@@ -0,0 +1,108 @@
+#include "SHUTTER.h"
+#include "CONFIG.h"
+#include "UART.h"
+#include "ASTRO.h"
+#include <string.h>
+
+typedef struct {
+    uint64_t time_us;
+    int32_t position[NUM_AXES];             // Position units
+    bool start;
+} shutter_event_t;
+
+static uint shutter_pin = SHUTTER_PIN_NONE;
+static bool active_high;
+
+// Single producer (core 1 interrupt), single consumer (core 0 main loop)
+static shutter_event_t events[SHUTTER_MAX_EVENTS];
+static volatile uint8_t event_head = 0;
+static volatile uint8_t event_tail = 0;
+static volatile uint32_t dropped = 0;       // Written by core 1 only
+
+static uint16_t sequence = 0;
+static uint32_t dropped_reported = 0;
+
+// Core 1, runs between step pulses. Both edges come in, the rise/fall flags tell which one it was
+static void shutter_gpio_irq(void) {
+    uint32_t flags = gpio_get_irq_event_mask(shutter_pin);
+    if (!flags) return;
+    gpio_acknowledge_irq(shutter_pin, flags);
+
+    uint64_t now = time_us_64();
+    uint8_t next = (event_head + 1) % SHUTTER_MAX_EVENTS;
+    if (next == event_tail) {
+        dropped++;
+        return;
+    }
+
+    // Both flags at once means the pulse was shorter than the interrupt latency, the level says where it ended
+    bool rise = flags & GPIO_IRQ_EDGE_RISE;
+    if ((flags & GPIO_IRQ_EDGE_RISE) && (flags & GPIO_IRQ_EDGE_FALL)) {
+        rise = gpio_get(shutter_pin);
+    }
+    shutter_event_t *event = &events[event_head];
+    event->time_us = now;
+    event->start = rise == active_high;
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        event->position[axis] = stepper_edge_position(axis, (uint32_t)now);
+    }
+    __dmb();
+    event_head = next;
+}
+
+// Core 0, before core 1 is launched
+void shutter_init(void) {
+    shutter_pin = device_config.shutter_pin;
+    if (shutter_pin == SHUTTER_PIN_NONE) return;
+    active_high = device_config.shutter_active_high != 0;
+    gpio_init(shutter_pin);
+    gpio_set_dir(shutter_pin, GPIO_IN);
+    if (active_high) {
+        gpio_pull_down(shutter_pin);
+    } else {
+        gpio_pull_up(shutter_pin);
+    }
+    DEBUG_PRINT("Shutter capture on GPIO %d, active %s\n", shutter_pin, active_high ? "high" : "low");
+}
+
+// Same core as the step loop, the positions are read where they are written
+void shutter_init_core1(void) {
+    if (shutter_pin == SHUTTER_PIN_NONE) return;
+    gpio_add_raw_irq_handler_masked(1u << shutter_pin, shutter_gpio_irq);
+    gpio_set_irq_enabled(shutter_pin, GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, true);
+    irq_set_enabled(IO_IRQ_BANK0, true);
+}
+
+// Sends buffered events while the response queue has room, one slot stays free for ACKs
+void shutter_background_task(void) {
+    while (event_tail != event_head && response_queue_free() > 1) {
+        __dmb();
+        shutter_event_t *event = &events[event_tail];
+
+        // Event: sequence(u16) + flags(u8) + dropped before it(u8) + time(i64, µs) + X, Y, Z position(i32, 0.01 arcsec)
+        uint8_t report[24];
+        uint8_t flags = event->start ? SHUTTER_FLAG_START : 0;
+        int64_t time_us = (int64_t)event->time_us;
+        if (astro_unix_us(event->time_us, &time_us)) {
+            flags |= SHUTTER_FLAG_UNIX_TIME;
+        }
+        uint32_t dropped_now = dropped;
+        uint32_t dropped_since = dropped_now - dropped_reported;
+        dropped_reported = dropped_now;
+
+        memcpy(&report[0], &sequence, sizeof(uint16_t));
+        report[2] = flags;
+        report[3] = dropped_since > UINT8_MAX ? UINT8_MAX : (uint8_t)dropped_since;
+        memcpy(&report[4], &time_us, sizeof(int64_t));
+        for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+            // Double, a float runs out of digits for 0.01 arcsec beyond a few degrees
+            double arcsec = event->position[axis] / (double)stepper_steps_per_arcsec(axis);
+            int32_t hundredths = (int32_t)llround(arcsec * SHUTTER_POSITION_SCALE);
+            memcpy(&report[12 + axis * 4], &hundredths, sizeof(int32_t));
+        }
+        event_tail = (event_tail + 1) % SHUTTER_MAX_EVENTS;
+        sequence++;
+
+        queue_response(CMD_SHUTTER_EVENT, report, sizeof(report));
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef SHUTTER_H
+#define SHUTTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+#include "STEPPER.h"
+#include "DEBUGPRINT.h"
+
+// Shutter / flash-sync capture
+// The camera's flash-sync or shutter output on a GPIO marks exposure start (edge to the active level) and end.
+// A GPIO interrupt on core 1, the step loop's core, latches the 64-bit time and all three axis positions,
+// interpolated between steps like the homing edges. The events are buffered and sent to the host as
+// CMD_SHUTTER_EVENT from the main loop, so a burst of exposures is not lost behind the stop-and-wait queue.
+
+#define SHUTTER_PIN_NONE 0xFF
+#define SHUTTER_MAX_EVENTS 32               // Buffered events, more are counted as dropped
+#define SHUTTER_POSITION_SCALE 100.0f       // Positions are sent in 0.01 arcsec
+
+typedef enum {
+    SHUTTER_FLAG_START = 0x01,              // Edge to the active level, the exposure started
+    SHUTTER_FLAG_UNIX_TIME = 0x02           // Time is unix µs, otherwise µs since boot
+} shutter_flag_t;
+
+void shutter_init(void);
+void shutter_init_core1(void);
+void shutter_background_task(void);
+
+#endif // SHUTTER_H
@@ -1,12 +1,22 @@
 #include "STEPPER.h"
+#include "CONFIG.h"
+#include "PEC.h"
+#include "CHECKPOINT.h"
+#include "TMC2209.h"
+#include "FAULT.h"
+#include "PROFILE.h"
+#include "ALIGN.h"
+#include "LIMITS.h"
+#include "HOME.h"
+#include "GUIDE.h"
+#include "ENCODER.h"
+#include "SHUTTER.h"
 
-bool stepper_enabled = false;
+volatile bool stepper_enabled = false;
 volatile bool stepper_paused = true;
 volatile bool celestial_tracking_slewing_finished = false;
 
-volatile int32_t x_position_steps = 0;
-volatile int32_t y_position_steps = 0;
-volatile int32_t z_position_steps = 0;
+static volatile position_reference_t position_reference = REFERENCE_NONE;
 
 // Multi-axis command structures - one command per axis
 volatile stepper_command_t axis_commands[NUM_AXES] = {
@@ -25,110 +35,591 @@ volatile celestial_tracking_state_t celestial_state = {
     .align_matrix = {1,0,0, 0,1,0, 0,0,1},  // Identity matrix
     .latitude = 0.0f,
     .ref_unix_time = 0,
-    .ref_boot_time_us = 0
+    .ref_boot_time_us = 0,
+    .use_model = false
 };
 
+// Core 1 copy of the pointing model, refreshed whenever core 0 publishes a new solve
+static align_model_t celestial_model;
+static uint32_t celestial_model_version;
+static astro_corrections_t celestial_corrections;
+static uint32_t celestial_corrections_version;
+
 // Target positions for celestial tracking (computed each cycle)
 static volatile int32_t celestial_target_arcsec[NUM_AXES] = {0, 0, 0};
+static volatile bool celestial_targets_valid = false;      // celestial_target_arcsec holds the previous pass' targets
+
+// Per-axis descriptors, derived from the flash config once at init so the step loops only do lookups.
+// Positions are counted in 1/256 microsteps (POSITION_MICROSTEPS) whatever the drivers are set to,
+// a step pulse adds 256 / microstepping, so switching the resolution never rescales or rounds the counters
+typedef struct {
+    volatile int32_t position;
+    uint step_pin;
+    uint dir_pin;
+    uint32_t step_mask;             // SIO masks, every axis due in a pass steps with the same register write
+    uint32_t dir_mask;
+    uint32_t dir_inv_mask;          // Direction pins driven inverted, the second X driver
+    float gear_ratio;
+    float steps_per_arcsec;
+    float arcsec_per_step;
+    bool continuous;                // Turns without end (pan, field rotation), targets are angles modulo a turn
+    bool limited;
+    int32_t limit_min_arcsec;
+    int32_t limit_max_arcsec;
+} stepper_axis_params_t;
+
+static stepper_axis_params_t axis_params[NUM_AXES];
+static uint x_dir_inv_pin = X_DIR_PIN_INV;
+static uint en_pin = EN_PIN;
+static uint32_t step_interval_us = STEP_INTERVAL_MS * 1000;
+static uint32_t dir_setup_us = DIR_SETUP_TIME_US;
+static uint32_t step_pulse_us = STEP_PULSE_WIDTH_US;
+
+// Driver microstep resolution per axis, only changed by core 1 between step pulses
+static uint16_t axis_microsteps[NUM_AXES];
+static int32_t axis_step_units[NUM_AXES];           // Position units per step pulse
+static bool microstep_switching[NUM_AXES];
+static uint32_t microstep_ready_time[NUM_AXES];     // When the CHOPCONF write has reached the driver
+// Where the drivers' microstep counters are, in position units. Every pulse moves it, PEC, encoder trim and backlash
+// take-up included, a sync does not, so it drifts off the position. Coarse steps are only whole steps from its grid
+static int32_t motor_phase[NUM_AXES];
+static uint16_t slew_microsteps = SLEW_MICROSTEPPING;
+static uint16_t track_microsteps = TRACK_MICROSTEPPING;
+static float fine_max_speed;                        // Position units per second the step rate allows at the fine resolution
+
+// Motion planner state, only written by core 1
+static float axis_speed[NUM_AXES];                  // Position units per second, never negative, towards axis_direction
+static bool axis_direction[NUM_AXES];
+static uint32_t axis_last_step_us[NUM_AXES];
+static float axis_accel[NUM_AXES];                  // Position units per second², from the config
+static volatile bool pause_requested = false;       // Ramp down to rest, then pause
+static volatile float tracking_error_max[NUM_AXES]; // Worst distance to a profile target since the host last asked, arcsec
+static volatile float tracking_error[NUM_AXES];     // Target minus position on the last pass, arcsec
+static float rate_lag_units[NUM_AXES];              // Rate tracking: motion the ramp still owes the commanded rate
+static float rate_travel_units[NUM_AXES];           // Rate tracking: motion the ramped velocity made since the last step
+static volatile float axis_speed_cap[NUM_AXES];     // Position units per second a homing move may go, 0 = step rate limit
+static volatile bool home_moves_active = false;     // Homing moves ignore the soft limits, the reference is what they establish
+
+// Backlash take-up, core 1 only. After a reversal the gear slack is driven through at the take-up speed before the
+// planner's steps count again, the take-up steps turn the motor but not the reported position
+static int32_t backlash_units[NUM_AXES];            // Position units of slack, from the config
+static float backlash_speed[NUM_AXES];              // Position units per second
+static bool backlash_side_known[NUM_AXES];          // Unknown at boot, the first move only sets the side
+static bool backlash_side[NUM_AXES];                // Direction the slack is taken up in
+static int32_t backlash_remaining[NUM_AXES];
+static uint32_t backlash_last_us[NUM_AXES];
+
+// Encoder correction, core 1 only. Position units the encoders asked for so far, output like PEC steps
+static int32_t encoder_trim[NUM_AXES];
+
+// Trajectory following (PROFILE_ACTION_FOLLOW), core 1 only. The control loop sets a step rate per axis every
+// FOLLOW_CONTROL_US, in between the pulses come from an integer phase accumulator so fast movers can step at high rates
+static uint32_t follow_last_control_us;
+static uint32_t follow_last_pass_us;
+static uint32_t follow_rate[NUM_AXES];              // Step pulses per µs, 0.32 fixed point
+static uint64_t follow_phase[NUM_AXES];             // Accumulated fractional pulses, 0.32 fixed point
+static float follow_max_pulse_rate;                 // Pulses per second, bounded by the pulse timing instead of the step interval
+static volatile bool disable_requested = false;     // Ramp down to rest, then disable the drivers
+
+// Idle wake-up: core 1 waits in WFE while it has nothing to step, core 0 sends an event with every command.
+// The time from the event to core 1 running again is kept for the telemetry
+static volatile uint32_t wake_posted_us;
+static volatile bool wake_posted = false;
+static volatile uint16_t wake_latency_last_us = 0;
+static volatile uint16_t wake_latency_worst_us = 0;
+
+static inline float steps_per_rev(void) {
+    return (float)device_config.steps_per_rev * POSITION_MICROSTEPS;
+}
 
 int32_t arcseconds_to_steps(int32_t arcseconds, float gear_ratio) {
     // 1296000 = 360° * 60 * 60 (arcseconds in a full circle)
-    float steps_per_arcsecond = ((float)STEPS_PER_REV * MICROSTEPPING * gear_ratio) / 1296000.0f;
+    float steps_per_arcsecond = (steps_per_rev() * gear_ratio) / 1296000.0f;
     
     float exact_steps = arcseconds * steps_per_arcsecond;
     return (int32_t)(exact_steps >= 0 ? exact_steps + 0.5f : exact_steps - 0.5f);
 }
 
 int32_t steps_to_arcseconds(int32_t steps, float gear_ratio) {
-    float arcseconds_per_step = 1296000.0f / ((float)STEPS_PER_REV * MICROSTEPPING * gear_ratio);
+    float arcseconds_per_step = 1296000.0f / (steps_per_rev() * gear_ratio);
     
     float exact_arcseconds = steps * arcseconds_per_step;
     return (int32_t)(exact_arcseconds >= 0 ? exact_arcseconds + 0.5f : exact_arcseconds - 0.5f);
 }
 
-static inline uint get_step_pin(uint8_t axis) {
-    switch (axis) {
-        case AXIS_X: return X_STEP_PIN;
-        case AXIS_Y: return Y_STEP_PIN;
-        case AXIS_Z: return Z_STEP_PIN;
-        default: return 0;
+// Same conversions with the precomputed per-axis factors, used by the step loops
+static inline int32_t axis_arcsec_to_steps(uint8_t axis, int32_t arcseconds) {
+    float exact_steps = arcseconds * axis_params[axis].steps_per_arcsec;
+    return (int32_t)(exact_steps >= 0 ? exact_steps + 0.5f : exact_steps - 0.5f);
+}
+
+static inline int32_t axis_steps_to_arcsec(uint8_t axis, int32_t steps) {
+    float exact_arcseconds = steps * axis_params[axis].arcsec_per_step;
+    return (int32_t)(exact_arcseconds >= 0 ? exact_arcseconds + 0.5f : exact_arcseconds - 0.5f);
+}
+
+static inline volatile int32_t* get_position_ptr(uint8_t axis) {
+    return &axis_params[axis].position;
+}
+
+static inline bool axis_in_limits(uint8_t axis, int32_t arcsec) {
+    return !axis_params[axis].limited ||
+           (arcsec >= axis_params[axis].limit_min_arcsec && arcsec <= axis_params[axis].limit_max_arcsec);
+}
+
+// Equivalent of a wrapped angle (atan2, ±180°) the axis should head for. While tracking, the target continues
+// from the previous one so it never jumps by a turn. A new target, or one that would leave the soft limits,
+// takes the shortest legal way from where the axis is (unwinding the cables if it has to).
+// Without any legal equivalent (limits narrower than a turn) the axis waits at the nearer limit.
+// The limit guard stops an axis about a step before it would cross a limit, so a target within two steps of one
+// already counts as outside, or a tracked axis would be stopped there before its target ever left the limits
+static int32_t unwrap_target(uint8_t axis, int32_t angle, bool continuing) {
+    if (!axis_params[axis].continuous) return angle;
+    
+    int32_t margin = axis_steps_to_arcsec(axis, 2 * axis_step_units[axis]) + 1;
+    int32_t low = axis_params[axis].limit_min_arcsec + margin;
+    int32_t high = axis_params[axis].limit_max_arcsec - margin;
+    if (low > high) low = high = (axis_params[axis].limit_min_arcsec + axis_params[axis].limit_max_arcsec) / 2;
+    int32_t position = axis_steps_to_arcsec(axis, *get_position_ptr(axis));
+    int32_t reference = continuing ? celestial_target_arcsec[axis] : position;
+    int32_t turns = (int32_t)floorf((float)(reference - angle) / FULL_TURN_ARCSEC + 0.5f);
+    int32_t nearest = angle + turns * FULL_TURN_ARCSEC;
+    if (!axis_params[axis].limited || (nearest >= low && nearest <= high)) return nearest;
+    
+    bool found = false;
+    int32_t best = nearest;
+    int32_t best_distance = INT32_MAX;
+    for (int32_t k = turns - 2; k <= turns + 2; k++) {
+        int32_t candidate = angle + k * FULL_TURN_ARCSEC;
+        int32_t distance = candidate > position ? candidate - position : position - candidate;
+        if (candidate >= low && candidate <= high && distance < best_distance) {
+            best = candidate;
+            best_distance = distance;
+            found = true;
+        }
     }
+    if (found) return best;
+    return nearest < low ? low : high;
 }
 
-static inline uint get_dir_pin(uint8_t axis) {
-    switch (axis) {
-        case AXIS_Z: return Z_DIR_PIN;
-        case AXIS_Y: return Y_DIR_PIN;
-        case AXIS_X: return X_DIR_PIN;
-        default: return 0;
+// Microstepping has to be a power of two the TMC2209 can do, anything else falls back to the default
+static uint16_t valid_microsteps(uint16_t microsteps, uint16_t fallback) {
+    if (microsteps == 0 || microsteps > POSITION_MICROSTEPS || (microsteps & (microsteps - 1)) != 0) {
+        return fallback;
     }
+    return microsteps;
 }
 
-static inline float get_gear_ratio(uint8_t axis) {
-    switch (axis) {
-        case AXIS_X: return X_STEPPER_GEAR_RATIO;
-        case AXIS_Y: return Y_STEPPER_GEAR_RATIO;
-        case AXIS_Z: return Z_STEPPER_GEAR_RATIO;
-        default: return 1.0f;
+static void stepper_apply_config(void) {
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        axis_params[axis].step_pin = device_config.step_pin[axis];
+        axis_params[axis].dir_pin = device_config.dir_pin[axis];
+        axis_params[axis].step_mask = 1u << device_config.step_pin[axis];
+        axis_params[axis].dir_mask = 1u << device_config.dir_pin[axis];
+        axis_params[axis].dir_inv_mask = axis == AXIS_X ? 1u << device_config.x_dir_inv_pin : 0;
+        axis_params[axis].gear_ratio = device_config.gear_ratio[axis];
+        axis_params[axis].steps_per_arcsec = (steps_per_rev() * device_config.gear_ratio[axis]) / 1296000.0f;
+        axis_params[axis].arcsec_per_step = 1296000.0f / (steps_per_rev() * device_config.gear_ratio[axis]);
+        float acceleration = device_config.acceleration > 0.0f ? device_config.acceleration : ACCELERATION_ARCSEC_S2;
+        axis_accel[axis] = acceleration * axis_params[axis].steps_per_arcsec;
+        axis_params[axis].continuous = axis != AXIS_X;
+        axis_params[axis].limited = device_config.soft_limit_min[axis] < device_config.soft_limit_max[axis];
+        axis_params[axis].limit_min_arcsec = device_config.soft_limit_min[axis];
+        axis_params[axis].limit_max_arcsec = device_config.soft_limit_max[axis];
+        float backlash = device_config.backlash[axis] > 0.0f ? device_config.backlash[axis] : 0.0f;
+        float backlash_rate = device_config.backlash_rate > 0.0f ? device_config.backlash_rate : BACKLASH_RATE_ARCSEC;
+        backlash_units[axis] = (int32_t)(backlash * axis_params[axis].steps_per_arcsec + 0.5f);
+        backlash_speed[axis] = backlash_rate * axis_params[axis].steps_per_arcsec;
     }
+    x_dir_inv_pin = device_config.x_dir_inv_pin;
+    en_pin = device_config.en_pin;
+    step_interval_us = device_config.step_interval_us;
+    dir_setup_us = device_config.dir_setup_us;
+    step_pulse_us = device_config.step_pulse_us;
+
+    // Without the UART the drivers stay at whatever their strapping gives
+    slew_microsteps = valid_microsteps(device_config.slew_microstepping, SLEW_MICROSTEPPING);
+    track_microsteps = valid_microsteps(device_config.track_microstepping, TRACK_MICROSTEPPING);
+    fine_max_speed = (float)(POSITION_MICROSTEPS / track_microsteps) * 1000000.0f / step_interval_us;
+    // One pulse per pass at most: direction setup, pulse high, the pulse's low time and the rest of the pass
+    follow_max_pulse_rate = 1000000.0f / (float)(dir_setup_us + 2 * step_pulse_us + FOLLOW_PASS_US);
+    stepper_reset_microstepping();
 }
 
-static inline volatile int32_t* get_position_ptr(uint8_t axis) {
-    switch (axis) {
-        case AXIS_X: return &x_position_steps;
-        case AXIS_Y: return &y_position_steps;
-        case AXIS_Z: return &z_position_steps;
-        default: return NULL;
+// The drivers went back to their boot resolution (motor supply came back), only while core 1 is not stepping
+void stepper_reset_microstepping(void) {
+    uint16_t base_microsteps = valid_microsteps(device_config.microstepping, MICROSTEPPING);
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        axis_microsteps[axis] = base_microsteps;
+        axis_step_units[axis] = POSITION_MICROSTEPS / base_microsteps;
+        microstep_switching[axis] = false;
+        motor_phase[axis] = 0;          // Drivers (re)started, their counters are at the reset position
+    }
+}
+
+// Resolution an axis wants: rate tracking runs fine unless its rate is beyond the fine step rate, moves and celestial
+// slews run coarse until they are within MICROSTEP_FINE_ZONE coarse steps of the target, so the step rate is spent on distance
+static inline uint16_t wanted_microsteps(uint8_t axis, int32_t distance) {
+    if (!tmc2209_is_enabled()) return axis_microsteps[axis];
+    // Too fast for the fine step rate, the planner brakes first
+    if (axis_microsteps[axis] < track_microsteps && axis_speed[axis] > fine_max_speed) return axis_microsteps[axis];
+
+    int32_t coarse_units = POSITION_MICROSTEPS / slew_microsteps;
+    if (tracking_state.tracking_active) {
+        float rate = tracking_state.rates_arcsec_per_sec[axis] + guide_velocity(axis);
+        float speed = fabsf(rate) * axis_params[axis].steps_per_arcsec;
+        if (speed <= TRACK_FINE_SPEED_RATIO * fine_max_speed) return track_microsteps;
+        // Between the two the resolution stays, above the fine step rate it goes coarse on a coarse step boundary
+        if (speed <= fine_max_speed || axis_microsteps[axis] <= slew_microsteps) return axis_microsteps[axis];
+        // Still braking from the other direction, a coarse step would only come after the reversal
+        if (axis_speed[axis] > 0.0f && axis_direction[axis] != (rate > 0.0f)) return axis_microsteps[axis];
+        return motor_phase[axis] % coarse_units == 0 ? slew_microsteps : axis_microsteps[axis];
+    }
+
+    int32_t remaining = distance >= 0 ? distance : -distance;
+    if (axis_microsteps[axis] <= slew_microsteps) {
+        return remaining > MICROSTEP_FINE_ZONE * coarse_units ? slew_microsteps : track_microsteps;
+    }
+
+    // Back to coarse only well outside the fine zone (no flapping while a celestial target wanders around the edge)
+    // and only on a coarse step boundary of the motor, so every coarse step lands on a full coarse microstep.
+    // Fine steps towards the target reach the next boundary within one coarse step
+    if (remaining > 2 * MICROSTEP_FINE_ZONE * coarse_units && motor_phase[axis] % coarse_units == 0) {
+        return slew_microsteps;
+    }
+    return axis_microsteps[axis];
+}
+
+// Bring the driver resolution of an axis to what it wants for the distance left, only ever called between step pulses.
+// Returns false while the axis must not step because a CHOPCONF write is still on its way to the driver
+static bool axis_resolution_ready(uint8_t axis, int32_t distance) {
+    if (microstep_switching[axis]) {
+        if ((int32_t)(time_us_32() - microstep_ready_time[axis]) < 0) return false;
+        microstep_switching[axis] = false;
+    }
+
+    uint16_t wanted = wanted_microsteps(axis, distance);
+    if (wanted == axis_microsteps[axis]) return true;
+
+    // Bus busy (core 0 reading diagnostics) - keep stepping at the old resolution and try again next pass
+    uint32_t done_time;
+    if (!tmc2209_try_set_microstepping(axis, wanted, &done_time)) return true;
+
+    axis_microsteps[axis] = wanted;
+    axis_step_units[axis] = POSITION_MICROSTEPS / wanted;
+    microstep_ready_time[axis] = done_time;
+    microstep_switching[axis] = true;
+    return false;
+}
+
+// Fastest an axis may go at its current resolution, one step per step interval
+static inline float axis_max_speed(uint8_t axis) {
+    float max_speed = (float)axis_step_units[axis] * 1000000.0f / step_interval_us;
+    float cap = axis_speed_cap[axis];
+    return cap > 0.0f && cap < max_speed ? cap : max_speed;
+}
+
+// Highest speed² an axis may have with `ahead` units left: low enough to come to rest on the target,
+// and to be within the fine step rate by the time it enters the fine zone
+static inline float braking_limit2(uint8_t axis, float ahead) {
+    float limit = 2.0f * axis_accel[axis] * ahead;
+    if (tmc2209_is_enabled() && axis_microsteps[axis] < track_microsteps) {
+        float zone = (float)(MICROSTEP_FINE_ZONE * (POSITION_MICROSTEPS / slew_microsteps));
+        float zone_limit = fine_max_speed * fine_max_speed + 2.0f * axis_accel[axis] * (ahead - zone);
+        if (zone_limit < limit) limit = zone_limit;
+    }
+    return limit;
+}
+
+// Motion planner for an axis chasing a position (static moves, celestial tracking): accelerates, cruises at the
+// step rate limit and brakes so it comes to rest on the target. The speed changes by at most the acceleration
+// limit per step and the direction only ever changes from rest. stop brakes to rest wherever that ends up.
+// Returns true when a step towards *direction is due now
+static bool plan_step(uint8_t axis, int32_t distance, bool stop, uint32_t now_us, bool *direction) {
+    int32_t step_units = axis_step_units[axis];
+    float accel = axis_accel[axis];
+    float max_speed = axis_max_speed(axis);
+
+    if (axis_speed[axis] == 0.0f) {
+        if (stop || (distance * 2 <= step_units && distance * 2 >= -step_units)) return false;
+        float start_speed = sqrtf(2.0f * accel * step_units);
+        axis_speed[axis] = start_speed < max_speed ? start_speed : max_speed;
+        axis_direction[axis] = distance > 0;
+        axis_last_step_us[axis] = now_us;
+        *direction = axis_direction[axis];
+        return true;
+    }
+
+    if ((float)(now_us - axis_last_step_us[axis]) * axis_speed[axis] < step_units * 1000000.0f) return false;
+
+    // Distance left in the direction we are moving, negative once the target is behind us
+    float ahead = (float)(axis_direction[axis] ? distance : -distance);
+    float speed2 = axis_speed[axis] * axis_speed[axis];
+    float max_speed2 = max_speed * max_speed;
+    // Above the step rate limit (handed over from the trajectory follower) the axis brakes down to it at the
+    // acceleration limit, it is never cut to the limit in one step
+    if (stop || speed2 >= braking_limit2(axis, ahead) || speed2 > max_speed2) {
+        speed2 -= 2.0f * accel * step_units;
+        // What is left of a ramp that should end at 0 is float rounding (sqrt and back), stepping on with it
+        // overshoots the target and crawls back at that speed. Anything under half a step's worth is rest
+        if (speed2 < accel * step_units) {
+            axis_speed[axis] = 0.0f;
+            return false;
+        }
+    } else {
+        speed2 += 2.0f * accel * step_units;
+        if (speed2 > max_speed2) speed2 = max_speed2;
+    }
+
+    axis_speed[axis] = sqrtf(speed2);
+    axis_last_step_us[axis] = now_us;
+    *direction = axis_direction[axis];
+    return true;
+}
+
+// Motor steps still to output that do not count in the position: PEC and the encoder trim.
+// Both end up in pec_applied_steps, which is what keeps the PEC phase on the motor shaft
+static inline int32_t correction_diff(uint8_t axis, int32_t position) {
+    return pec_target_steps(axis, position) + encoder_trim[axis] - pec_applied_steps[axis];
+}
+
+// A step goes into the position only while the nominal motion wants at least half a step the same way,
+// a step against it or past it is correction output
+static inline bool nominal_step_wanted(int32_t nominal_diff, bool direction, int32_t step_units) {
+    return direction ? nominal_diff * 2 >= step_units : nominal_diff * 2 <= -step_units;
+}
+
+static inline void record_tracking_error(uint8_t axis, int32_t error_units) {
+    float error = (float)(error_units >= 0 ? error_units : -error_units) * axis_params[axis].arcsec_per_step;
+    if (error > tracking_error_max[axis]) {
+        tracking_error_max[axis] = error;
+    }
+}
+
+static inline void set_tracking_error(uint8_t axis, float error_units) {
+    tracking_error[axis] = error_units * axis_params[axis].arcsec_per_step;
+}
+
+// Target minus position right now while a tracking mode runs, arcsec. Rate tracking has no target position,
+// there it is the part of a guide run or dither the axis has not caught up with yet
+float stepper_get_tracking_error(uint8_t axis) {
+    if (axis >= NUM_AXES) return 0.0f;
+    stepper_mode_t mode = stepper_get_mode();
+    if (mode == STEPPER_MODE_IDLE || mode == STEPPER_MODE_STATIC) return 0.0f;
+    return tracking_error[axis];
+}
+
+// Worst tracking error of a profile since the last call, arcsec
+float stepper_take_tracking_error(uint8_t axis) {
+    if (axis >= NUM_AXES) return 0.0f;
+    float error = tracking_error_max[axis];
+    tracking_error_max[axis] = 0.0f;
+    return error;
+}
+
+// Step pulses of one pass of the step loop, collected per axis and output together by step_batch_output
+typedef struct {
+    uint32_t step_mask;
+    uint32_t repeat_mask;           // Axes that get a second pulse (PEC doubling a tracking step)
+    uint32_t dir_set_mask;
+    uint32_t dir_clr_mask;
+} step_batch_t;
+
+static bool step_direction[NUM_AXES];   // Level the direction pins are at
+
+static inline void step_batch_add(step_batch_t *batch, uint8_t axis, bool direction) {
+    const stepper_axis_params_t *params = &axis_params[axis];
+    if (step_direction[axis] != direction) {
+        batch->dir_set_mask |= direction ? params->dir_mask : params->dir_inv_mask;
+        batch->dir_clr_mask |= direction ? params->dir_inv_mask : params->dir_mask;
+        step_direction[axis] = direction;
+    }
+    batch->step_mask |= params->step_mask;
+    motor_phase[axis] += direction ? axis_step_units[axis] : -axis_step_units[axis];
+}
+
+// Direction pins first (one setup time for all of them), then one pulse on every step pin
+static void step_batch_output(const step_batch_t *batch) {
+    if (!batch->step_mask) return;
+    if (batch->dir_set_mask | batch->dir_clr_mask) {
+        gpio_set_mask(batch->dir_set_mask);
+        gpio_clr_mask(batch->dir_clr_mask);
+        sleep_us(dir_setup_us);
+    }
+    gpio_set_mask(batch->step_mask);
+    sleep_us(step_pulse_us);
+    gpio_clr_mask(batch->step_mask);
+    if (batch->repeat_mask) {
+        sleep_us(step_pulse_us);
+        gpio_set_mask(batch->repeat_mask);
+        sleep_us(step_pulse_us);
+        gpio_clr_mask(batch->repeat_mask);
+    }
+}
+
+// Slack still to take up. It ends on the nearest step like a target does, under half a step left is done
+static inline bool backlash_pending(uint8_t axis) {
+    return backlash_remaining[axis] * 2 > axis_step_units[axis];
+}
+
+// Whether a step the planner wants counts. A reversal starts the take-up and holds the axis until it is done
+static inline bool backlash_taken_up(uint8_t axis, bool direction, uint32_t now_us) {
+    if (backlash_units[axis] == 0) return true;
+    if (!backlash_side_known[axis]) {
+        backlash_side_known[axis] = true;
+        backlash_side[axis] = direction;
+        return true;
+    }
+    if (direction != backlash_side[axis]) {
+        backlash_side[axis] = direction;
+        backlash_remaining[axis] = backlash_units[axis];
+        backlash_last_us[axis] = now_us - 1000000;      // First take-up step right away
+    }
+    return !backlash_pending(axis);
+}
+
+// A planned step that is not held back by a take-up. While the take-up runs the ramp waits at rest, otherwise it
+// would build up speed for steps that never went out and arrive too fast to brake onto the target
+static inline bool planned_step(uint8_t axis, int32_t distance, bool stop, uint32_t now_us, bool *direction) {
+    if (!plan_step(axis, distance, stop, now_us, direction)) return false;
+    if (backlash_taken_up(axis, *direction, now_us)) return true;
+    axis_speed[axis] = 0.0f;
+    return false;
+}
+
+// Take-up steps at their own speed, limited only by the step interval
+static void backlash_takeup(step_batch_t *batch, uint32_t now_us) {
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        if (!backlash_pending(axis) || microstep_switching[axis]) continue;
+        int32_t step_units = axis_step_units[axis];
+        float speed = backlash_speed[axis];
+        float max_speed = (float)step_units * 1000000.0f / step_interval_us;
+        if (speed > max_speed) speed = max_speed;
+        if ((float)(now_us - backlash_last_us[axis]) * speed < step_units * 1000000.0f) continue;
+        step_batch_add(batch, axis, backlash_side[axis]);
+        backlash_remaining[axis] -= step_units;
+        backlash_last_us[axis] = now_us;
     }
 }
 
 void stepper_init_pins() {
-    gpio_init(Y_STEP_PIN); gpio_set_dir(Y_STEP_PIN, GPIO_OUT);
-    gpio_init(Y_DIR_PIN); gpio_set_dir(Y_DIR_PIN, GPIO_OUT);
-    gpio_init(X_STEP_PIN); gpio_set_dir(X_STEP_PIN, GPIO_OUT);
-    gpio_init(X_DIR_PIN); gpio_set_dir(X_DIR_PIN, GPIO_OUT);
-    gpio_init(X_DIR_PIN_INV); gpio_set_dir(X_DIR_PIN_INV, GPIO_OUT);
-    gpio_init(Z_STEP_PIN); gpio_set_dir(Z_STEP_PIN, GPIO_OUT);
-    gpio_init(Z_DIR_PIN); gpio_set_dir(Z_DIR_PIN, GPIO_OUT);
-    gpio_init(EN_SENSE_PIN); gpio_set_dir(EN_SENSE_PIN, GPIO_IN);
-    gpio_init(EN_PIN); gpio_set_dir(EN_PIN, GPIO_OUT);    
-
-    gpio_put(X_STEP_PIN, 0);
-    gpio_put(X_DIR_PIN, 0);
-    gpio_put(X_DIR_PIN_INV, 1); // REMEMBER: second X axis stepper must be inverted
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        gpio_init(axis_params[axis].step_pin); gpio_set_dir(axis_params[axis].step_pin, GPIO_OUT);
+        gpio_init(axis_params[axis].dir_pin); gpio_set_dir(axis_params[axis].dir_pin, GPIO_OUT);
+        gpio_put(axis_params[axis].step_pin, 0);
+        gpio_put(axis_params[axis].dir_pin, 0);
+        step_direction[axis] = false;
+    }
+    gpio_init(x_dir_inv_pin); gpio_set_dir(x_dir_inv_pin, GPIO_OUT);
+    gpio_init(device_config.en_sense_pin); gpio_set_dir(device_config.en_sense_pin, GPIO_IN);
+    gpio_init(en_pin); gpio_set_dir(en_pin, GPIO_OUT);
+
+    gpio_put(x_dir_inv_pin, 1); // REMEMBER: second X axis stepper must be inverted
                                 // this could be differently by actually letting these drivers not only share a step pin
                                 // but also a direction pin, and swapping the wires of a single coil on the second motor
                                 // ie swapping the red and blue wires, but since we already have a gpio for each drivers 
                                 // dir pin we can just invert in software and have all the colors be the same way 
-    gpio_put(Y_STEP_PIN, 0);
-    gpio_put(Y_DIR_PIN, 0);
-    gpio_put(Z_STEP_PIN, 0);
-    gpio_put(Z_DIR_PIN, 0);
-    gpio_put(EN_PIN, 1); // Disable stepper driver initially
+    gpio_put(en_pin, 1); // Disable stepper driver initially
+}
+
+// Core 0, the step loop has something new to do
+void stepper_wake(void) {
+    wake_posted_us = time_us_32();
+    wake_posted = true;
+    __sev();
+}
+
+void stepper_get_wake_latency(uint16_t *last_us, uint16_t *worst_us) {
+    *last_us = wake_latency_last_us;
+    *worst_us = wake_latency_worst_us;
+}
+
+// Core 1, sleeps until stepper_wake(), an interrupt or the timeout. An event sent since the state was checked
+// is latched, so WFE returns right away and nothing is missed
+static void idle_wait(uint32_t timeout_us) {
+    wake_posted = false;
+    best_effort_wfe_or_timeout(make_timeout_time_us(timeout_us));
+    if (wake_posted) {
+        uint32_t latency = time_us_32() - wake_posted_us;
+        uint16_t latency_us = latency > UINT16_MAX ? UINT16_MAX : (uint16_t)latency;
+        wake_latency_last_us = latency_us;
+        if (latency_us > wake_latency_worst_us) wake_latency_worst_us = latency_us;
+    }
 }
 
 void stepper_init() {
+    stepper_apply_config();
     stepper_init_pins();
+    if (tmc2209_init()) {
+        DEBUG_PRINT("TMC2209 drivers configured over UART\n");
+    }
+    pec_init();
+    encoder_init();
+    fault_init();
     multicore_launch_core1(stepper_core1_entry);
     DEBUG_PRINT("Stepper motor control initialized and launched on core 1\n");
 }
 
 void stepper_set_enable(bool enable) {
-    gpio_put(EN_PIN, enable ? 0 : 1); // Active low
+    if (enable && fault_is_active()) {
+        DEBUG_PRINT("No motor power, not enabling the drivers\n");
+        return;
+    }
+    gpio_put(en_pin, enable ? 0 : 1); // Active low
     stepper_enabled = enable;
+    if (!enable) {
+        checkpoint_request();
+    }
     DEBUG_PRINT("Stepper motors %s\n", enable ? "enabled" : "disabled");
+    stepper_wake();
 }
 
+// Ramp every axis down to rest, core 1 pauses once they all stopped
 void stepper_pause() {
+    if (!stepper_enabled || stepper_paused) {
+        stepper_hard_pause();
+        return;
+    }
+    pause_requested = true;
+    DEBUG_PRINT("Stepper motors pausing\n");
+    stepper_wake();
+}
+
+// Pause right away without a ramp, at higher speeds the motors may lose steps
+void stepper_hard_pause() {
+    pause_requested = false;
     stepper_paused = true;
+    checkpoint_request();
     DEBUG_PRINT("Stepper motors paused\n");
 }
 
+// Forget all motion, ramp down to rest and then disable the drivers
+void stepper_stop(void) {
+    stepper_stop_all_moves();
+    stepper_stop_tracking();
+    stepper_stop_celestial_tracking();
+    profile_stop();
+    if (!stepper_enabled || stepper_paused) {
+        stepper_set_enable(false);
+        return;
+    }
+    disable_requested = true;
+    DEBUG_PRINT("Stepper motors stopping\n");
+    stepper_wake();
+}
+
 void stepper_resume() {
+    if (fault_is_active()) {
+        DEBUG_PRINT("No motor power, cannot resume!\n");
+        return;
+    }
+    pause_requested = false;
+    disable_requested = false;
     stepper_paused = false;
     DEBUG_PRINT("Stepper motors resumed\n");
     if(!stepper_enabled)
         stepper_set_enable(true);
+    stepper_wake();
 }
 
 bool stepper_is_enabled(void) {
@@ -139,6 +630,29 @@ bool stepper_is_paused(void) {
     return stepper_paused;
 }
 
+// Motor power is gone: stop everything and forget every motion, nothing resumes on its own when it comes back.
+// Called from the fault interrupt, so no DEBUG_PRINT in here
+void stepper_emergency_stop(void) {
+    stepper_paused = true;
+    pause_requested = false;
+    disable_requested = false;
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        axis_commands[axis].valid = false;
+    }
+    tracking_state.tracking_active = false;
+    celestial_state.active = false;
+    celestial_tracking_slewing_finished = false;
+    profile_stop();
+
+    // Unpowered motors can be turned by hand, and steps in flight were lost
+    if (stepper_enabled) {
+        position_reference = REFERENCE_LOST;
+    }
+    gpio_put(en_pin, 1);
+    stepper_enabled = false;
+    checkpoint_request();
+}
+
 void stepper_queue_static_move(uint8_t axis, int32_t position_arcsec) {
     if (!stepper_enabled) {
         DEBUG_PRINT("Stepper not enabled, cannot move!\n");
@@ -150,6 +664,18 @@ void stepper_queue_static_move(uint8_t axis, int32_t position_arcsec) {
         return;
     }
     
+    if (!axis_in_limits(axis, position_arcsec)) {
+        DEBUG_PRINT("Move of axis %d to %d\" is outside the soft limits\n", axis, position_arcsec);
+        return;
+    }
+    int32_t x = axis == AXIS_X ? position_arcsec : stepper_get_position_arcsec(AXIS_X);
+    int32_t z = axis == AXIS_Z ? position_arcsec : stepper_get_position_arcsec(AXIS_Z);
+    int8_t zone = limits_zone_at(x, z);
+    if (zone >= 0 && zone != limits_zone_at(stepper_get_position_arcsec(AXIS_X), stepper_get_position_arcsec(AXIS_Z))) {
+        DEBUG_PRINT("Move of axis %d to %d\" ends in forbidden zone %d\n", axis, position_arcsec, zone);
+        return;
+    }
+    
     // Stop any tracking modes
     if (tracking_state.tracking_active) {
         DEBUG_PRINT("Stopping rate tracking mode to execute static move\n");
@@ -159,6 +685,7 @@ void stepper_queue_static_move(uint8_t axis, int32_t position_arcsec) {
         DEBUG_PRINT("Stopping celestial tracking to execute static move\n");
         celestial_state.active = false;
     }
+    profile_stop();
     
     // Set up command for this specific axis
     axis_commands[axis].axis = axis;
@@ -167,6 +694,7 @@ void stepper_queue_static_move(uint8_t axis, int32_t position_arcsec) {
     axis_commands[axis].valid = true;
 
     DEBUG_PRINT("Queued static move: Axis %d to %ld arcsec\n", axis, position_arcsec);
+    stepper_wake();
 }
 
 void stepper_stop_all_moves() {
@@ -176,18 +704,41 @@ void stepper_stop_all_moves() {
     DEBUG_PRINT("All axis movements stopped\n");
 }
 
+// Fastest rate an axis can track, one step per step interval at the coarsest resolution it can switch to
+float stepper_max_rate_arcsec(uint8_t axis) {
+    uint16_t microsteps = tmc2209_is_enabled() ? slew_microsteps : axis_microsteps[axis];
+    float max_speed = (float)(POSITION_MICROSTEPS / microsteps) * 1000000.0f / step_interval_us;
+    return max_speed * axis_params[axis].arcsec_per_step;
+}
+
 void stepper_start_tracking(float x_rate_arcsec, float y_rate_arcsec, float z_rate_arcsec) {
     if (!stepper_enabled) {
         DEBUG_PRINT("Stepper not enabled, cannot start tracking!\n");
         return;
     }
     
+    // Faster than one step per step interval at the coarsest resolution cannot be stepped, refuse it instead of
+    // running slower than asked, whatever ran before keeps running
+    float rates[NUM_AXES] = { x_rate_arcsec, y_rate_arcsec, z_rate_arcsec };
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        if (fabsf(rates[axis]) <= stepper_max_rate_arcsec(axis)) continue;
+        int32_t position[NUM_AXES];
+        for (uint8_t i = 0; i < NUM_AXES; i++) {
+            position[i] = stepper_get_position_arcsec(i);
+        }
+        DEBUG_PRINT("Tracking rate %0.1f arcsec/s on axis %d above the step rate limit\n", rates[axis], axis);
+        limits_raise(LIMIT_EVENT_RATE, axis, position);
+        return;
+    }
+    
     stepper_stop_all_moves();
+    guide_reset();
     
     // Stop celestial tracking if active
     if (celestial_state.active) {
         celestial_state.active = false;
     }
+    profile_stop();
     
     // Set up tracking state
     tracking_state.tracking_active = true;
@@ -201,14 +752,11 @@ void stepper_start_tracking(float x_rate_arcsec, float y_rate_arcsec, float z_ra
     tracking_state.last_step_time[AXIS_Y] = current_time;
     tracking_state.last_step_time[AXIS_Z] = current_time;
     
-    // Set direction pins based on rates
-    gpio_put(X_DIR_PIN, x_rate_arcsec >= 0);
-    gpio_put(X_DIR_PIN_INV, x_rate_arcsec < 0);  // Inverted
-    gpio_put(Y_DIR_PIN, y_rate_arcsec >= 0);
-    gpio_put(Z_DIR_PIN, z_rate_arcsec >= 0);
+    // Direction pins follow the ramped velocity in the step loop, an axis still moving the other way brakes first
     
     DEBUG_PRINT("Started tracking mode: X=%0.2f, Y=%0.2f, Z=%0.2f arcsec/sec\n", 
            x_rate_arcsec, y_rate_arcsec, z_rate_arcsec);
+    stepper_wake();
 }
 
 void stepper_stop_tracking() {
@@ -226,12 +774,16 @@ void stepper_start_celestial_tracking(float ra, float dec, const float* align_ma
     }
     
     stepper_stop_all_moves();
+    guide_reset();
     tracking_state.tracking_active = false;
+    profile_stop();
     celestial_tracking_slewing_finished = false;
+    celestial_targets_valid = false;
     
     celestial_state.target_ra = ra;
     celestial_state.target_dec = dec;
     celestial_state.latitude = latitude;
+    celestial_state.use_model = false;
     celestial_state.ref_unix_time = ref_time;
     celestial_state.ref_boot_time_us = time_us_32();
     
@@ -243,6 +795,37 @@ void stepper_start_celestial_tracking(float ra, float dec, const float* align_ma
     
     DEBUG_PRINT("Started celestial tracking: RA=%.4fh, Dec=%.4f°, Lat=%.4f°\n", 
                 ra, dec, latitude);
+    stepper_wake();
+}
+
+// Goto through the on-device pointing model: slews to the target, then keeps tracking it
+void stepper_start_model_tracking(float ra, float dec) {
+    if (!stepper_enabled) {
+        DEBUG_PRINT("Stepper not enabled, cannot goto!\n");
+        return;
+    }
+    if (!align_model_valid()) {
+        DEBUG_PRINT("No pointing model, sync on a star first\n");
+        return;
+    }
+    
+    stepper_stop_all_moves();
+    guide_reset();
+    tracking_state.tracking_active = false;
+    profile_stop();
+    celestial_tracking_slewing_finished = false;
+    celestial_targets_valid = false;
+    
+    celestial_state.target_ra = ra;
+    celestial_state.target_dec = dec;
+    celestial_state.latitude = device_config.latitude;
+    celestial_state.ref_boot_time_us = time_us_32();
+    celestial_state.use_model = true;
+    astro_set_target(ra, dec);
+    celestial_state.active = true;
+    
+    DEBUG_PRINT("Goto through the pointing model: RA=%.4fh, Dec=%.4f°\n", ra, dec);
+    stepper_wake();
 }
 
 void stepper_stop_celestial_tracking(void) {
@@ -253,64 +836,97 @@ void stepper_stop_celestial_tracking(void) {
     celestial_tracking_slewing_finished = false;
 }
 
+// Follow the uploaded tracking profile, the planner chases the interpolated positions like celestial targets
+void stepper_start_profile(bool follow) {
+    if (!stepper_enabled) {
+        DEBUG_PRINT("Stepper not enabled, cannot start a profile!\n");
+        return;
+    }
+    
+    stepper_stop_all_moves();
+    guide_reset();
+    tracking_state.tracking_active = false;
+    stepper_stop_celestial_tracking();
+    follow_last_control_us = time_us_32() - FOLLOW_CONTROL_US;
+    follow_last_pass_us = time_us_32();
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        follow_rate[axis] = 0;
+        follow_phase[axis] = 0;
+    }
+    profile_start(follow);
+    stepper_wake();
+}
+
 bool stepper_is_celestial_tracking(void) {
     return celestial_tracking_slewing_finished;
 }
 
-static void compute_celestial_targets(void) {
-    if (!celestial_state.active) return;
+// False while there are no targets for this goto yet: no valid model, or the apparent place not published
+static bool compute_celestial_targets(void) {
+    if (!celestial_state.active) return false;
     
-    uint32_t current_time_us = time_us_32();
-    uint32_t elapsed_us;
-    if (current_time_us >= celestial_state.ref_boot_time_us) {
-        elapsed_us = current_time_us - celestial_state.ref_boot_time_us;
+    float mount_x_arcsec, mount_z_arcsec, ha_rad;
+    float dec_rad = celestial_state.target_dec * (M_PI / 180.0f);
+    float cos_dec = cosf(dec_rad);
+    
+    if (celestial_state.use_model) {
+        // On-device pointing model, picks up a re-solve after each new sync
+        // and the apparent place / refraction core 0 keeps up to date
+        align_get_model(&celestial_model, &celestial_model_version);
+        astro_get_corrections(&celestial_corrections, &celestial_corrections_version);
+        if (!celestial_model.valid || !celestial_corrections.apparent_ready) return false;
+        align_mount_angles(&celestial_model, &celestial_corrections,
+                           celestial_state.target_ra + celestial_corrections.ra_offset_h,
+                           celestial_state.target_dec + celestial_corrections.dec_offset_deg, time_us_64(),
+                           &mount_x_arcsec, &mount_z_arcsec, &ha_rad);
     } else {
-        // Handle 32-bit wraparound (occurs every ~71 minutes)
-        elapsed_us = (UINT32_MAX - celestial_state.ref_boot_time_us) + current_time_us + 1;
+        uint32_t current_time_us = time_us_32();
+        uint32_t elapsed_us;
+        if (current_time_us >= celestial_state.ref_boot_time_us) {
+            elapsed_us = current_time_us - celestial_state.ref_boot_time_us;
+        } else {
+            // Handle 32-bit wraparound (occurs every ~71 minutes)
+            elapsed_us = (UINT32_MAX - celestial_state.ref_boot_time_us) + current_time_us + 1;
+        }
+        float elapsed_seconds = elapsed_us / 1000000.0f;
+        
+        // RA is in hours: 1h = 15° = 54000 arcsec
+        float target_ra_arcsec = celestial_state.target_ra * 54000.0f;
+        
+        // RA drifts as Earth rotates (hour angle increases)
+        float current_ra_arcsec = target_ra_arcsec - (elapsed_seconds * SIDEREAL_RATE_ARCSEC_PER_SEC);
+        
+        // Step 3: Convert RA/Dec to unit vector (celestial sphere)
+        float ra_rad = current_ra_arcsec * (M_PI / (180.0f * 3600.0f));
+        
+        float sky_vector[3] = {
+            cos_dec * cosf(ra_rad),   // X component
+            cos_dec * sinf(ra_rad),   // Y component  
+            sinf(dec_rad)             // Z component
+        };
+        
+        // Step 4: Apply alignment matrix to transform sky -> mount coordinates
+        // alignMatrix is row-major: [m00, m01, m02, m10, m11, m12, m20, m21, m22]
+        float mount_vector[3];
+        mount_vector[0] = celestial_state.align_matrix[0]*sky_vector[0] + 
+                          celestial_state.align_matrix[1]*sky_vector[1] + 
+                          celestial_state.align_matrix[2]*sky_vector[2];
+        mount_vector[1] = celestial_state.align_matrix[3]*sky_vector[0] + 
+                          celestial_state.align_matrix[4]*sky_vector[1] + 
+                          celestial_state.align_matrix[5]*sky_vector[2];
+        mount_vector[2] = celestial_state.align_matrix[6]*sky_vector[0] + 
+                          celestial_state.align_matrix[7]*sky_vector[1] + 
+                          celestial_state.align_matrix[8]*sky_vector[2];
+        
+        // Step 5: Convert unit vector to mount angles (in arcseconds)
+        // X axis = tilt (altitude), Z axis = pan (azimuth)
+        mount_z_arcsec = atan2f(mount_vector[1], mount_vector[0]) * (180.0f * 3600.0f / M_PI);
+        mount_x_arcsec = asinf(mount_vector[2]) * (180.0f * 3600.0f / M_PI);
+        ha_rad = ra_rad;  // Hour angle in radians
     }
-    float elapsed_seconds = elapsed_us / 1000000.0f;
-    
-    // RA is in hours: 1h = 15° = 54000 arcsec
-    float target_ra_arcsec = celestial_state.target_ra * 54000.0f;
-    
-    // RA drifts as Earth rotates (hour angle increases)
-    float current_ra_arcsec = target_ra_arcsec - (elapsed_seconds * SIDEREAL_RATE_ARCSEC_PER_SEC);
-    
-    // Dec is in degrees: 1° = 3600 arcsec
-    float target_dec_arcsec = celestial_state.target_dec * 3600.0f;
-    
-    // Step 3: Convert RA/Dec to unit vector (celestial sphere)
-    float ra_rad = current_ra_arcsec * (M_PI / (180.0f * 3600.0f));
-    float dec_rad = target_dec_arcsec * (M_PI / (180.0f * 3600.0f));
-    
-    float cos_dec = cosf(dec_rad);
-    float sky_vector[3] = {
-        cos_dec * cosf(ra_rad),   // X component
-        cos_dec * sinf(ra_rad),   // Y component  
-        sinf(dec_rad)             // Z component
-    };
-    
-    // Step 4: Apply alignment matrix to transform sky -> mount coordinates
-    // alignMatrix is row-major: [m00, m01, m02, m10, m11, m12, m20, m21, m22]
-    float mount_vector[3];
-    mount_vector[0] = celestial_state.align_matrix[0]*sky_vector[0] + 
-                      celestial_state.align_matrix[1]*sky_vector[1] + 
-                      celestial_state.align_matrix[2]*sky_vector[2];
-    mount_vector[1] = celestial_state.align_matrix[3]*sky_vector[0] + 
-                      celestial_state.align_matrix[4]*sky_vector[1] + 
-                      celestial_state.align_matrix[5]*sky_vector[2];
-    mount_vector[2] = celestial_state.align_matrix[6]*sky_vector[0] + 
-                      celestial_state.align_matrix[7]*sky_vector[1] + 
-                      celestial_state.align_matrix[8]*sky_vector[2];
-    
-    // Step 5: Convert unit vector to mount angles (in arcseconds)
-    // X axis = tilt (altitude), Z axis = pan (azimuth)
-    float mount_z_arcsec = atan2f(mount_vector[1], mount_vector[0]) * (180.0f * 3600.0f / M_PI);
-    float mount_x_arcsec = asinf(mount_vector[2]) * (180.0f * 3600.0f / M_PI);
     
     // Step 6: Compute field rotation (Y axis) - parallactic angle
     float lat_rad = celestial_state.latitude * (M_PI / 180.0f);
-    float ha_rad = ra_rad;  // Hour angle in radians
     
     // Parallactic angle formula
     float sin_pa = sinf(ha_rad) * cosf(lat_rad);
@@ -319,10 +935,13 @@ static void compute_celestial_targets(void) {
     
     float mount_y_arcsec = parallactic_angle_rad * (180.0f * 3600.0f / M_PI);
     
-    // Store computed targets
+    // Store computed targets, pan and field rotation unwrapped so crossing ±180° never sends an axis the long way round
+    bool continuing = celestial_targets_valid;
     celestial_target_arcsec[AXIS_X] = (int32_t)mount_x_arcsec;
-    celestial_target_arcsec[AXIS_Z] = (int32_t)mount_z_arcsec;
-    celestial_target_arcsec[AXIS_Y] = (int32_t)mount_y_arcsec;
+    celestial_target_arcsec[AXIS_Z] = unwrap_target(AXIS_Z, (int32_t)mount_z_arcsec, continuing);
+    celestial_target_arcsec[AXIS_Y] = unwrap_target(AXIS_Y, (int32_t)mount_y_arcsec, continuing);
+    celestial_targets_valid = true;
+    return true;
 }
 
 int32_t stepper_get_position(uint8_t axis) {
@@ -330,90 +949,390 @@ int32_t stepper_get_position(uint8_t axis) {
         return 0;
     }
     
-    volatile int32_t* pos_ptr = get_position_ptr(axis);
-    return pos_ptr ? *pos_ptr : 0;
+    return *get_position_ptr(axis);
+}
+
+// Only meant for restoring a checkpoint, core 1 must not be stepping the axis
+void stepper_set_position(uint8_t axis, int32_t steps) {
+    if (axis >= NUM_AXES) return;
+    *get_position_ptr(axis) = steps;
+    encoder_rezero(axis);
+}
+
+stepper_mode_t stepper_get_mode(void) {
+    if (celestial_state.active) return STEPPER_MODE_CELESTIAL;
+    if (profile_is_active()) return STEPPER_MODE_PROFILE;
+    if (tracking_state.tracking_active) return STEPPER_MODE_TRACKING;
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        if (axis_commands[axis].valid) return STEPPER_MODE_STATIC;
+    }
+    return STEPPER_MODE_IDLE;
+}
+
+bool stepper_is_moving(void) {
+    if (!stepper_enabled || stepper_paused) return false;
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        if (axis_speed[axis] > 0.0f) return true;
+    }
+    return stepper_get_mode() != STEPPER_MODE_IDLE;
+}
+
+position_reference_t stepper_get_reference(void) {
+    return position_reference;
+}
+
+void stepper_set_reference(position_reference_t reference) {
+    position_reference = reference;
+}
+
+// Static move for homing: no soft limit or zone checks and a speed cap, the other motion modes are stopped by HOME.c
+void stepper_home_move(uint8_t axis, int32_t position_arcsec, float speed_arcsec) {
+    if (!stepper_enabled || axis >= NUM_AXES) return;
+    home_moves_active = true;
+    axis_speed_cap[axis] = speed_arcsec * axis_params[axis].steps_per_arcsec;
+    axis_commands[axis].axis = axis;
+    axis_commands[axis].target_position = position_arcsec;
+    axis_commands[axis].type = STATIC_MOVE;
+    axis_commands[axis].valid = true;
+    stepper_wake();
+}
+
+// Called from the switch interrupt on core 1, the step loop brakes the axis to rest
+void stepper_home_cancel_move(uint8_t axis) {
+    axis_commands[axis].valid = false;
+}
+
+void stepper_home_finish(void) {
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        axis_commands[axis].valid = false;
+        axis_speed_cap[axis] = 0.0f;
+    }
+    home_moves_active = false;
+}
+
+bool stepper_axis_busy(uint8_t axis) {
+    return axis_commands[axis].valid || axis_speed[axis] > 0.0f;
+}
+
+// Position at a switch edge, interpolated between the last step and the next one from the axis speed.
+// Every motion mode stamps axis_last_step_us when it counts a step in the position.
+// Core 1 only (the switch interrupt), the planner state is not shared
+int32_t stepper_edge_position(uint8_t axis, uint32_t edge_time_us) {
+    int32_t position = *get_position_ptr(axis);
+    if (axis_speed[axis] == 0.0f) return position;
+    float travel = (edge_time_us - axis_last_step_us[axis]) * axis_speed[axis] / 1000000.0f;
+    if (travel > axis_step_units[axis]) travel = axis_step_units[axis];
+    return position + (int32_t)(axis_direction[axis] ? travel : -travel);
+}
+
+float stepper_steps_per_arcsec(uint8_t axis) {
+    return axis_params[axis].steps_per_arcsec;
 }
 
 int32_t stepper_get_position_arcsec(uint8_t axis) {
+    if (axis >= NUM_AXES) return 0;
     int32_t steps = stepper_get_position(axis);
-    return steps_to_arcseconds(steps, get_gear_ratio(axis));
+    return axis_steps_to_arcsec(axis, steps);
+}
+
+// Control update of the trajectory follower: feed-forward velocity from the profile, corrected by the position error.
+// The velocity change towards the next segment starts early enough to stay within the acceleration limit (look-ahead)
+// and is centred on the point between them
+static void follow_control(float dt, bool stopping) {
+    profile_sample_t sample;
+    bool have_sample = profile_sample(&sample);
+
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        volatile int32_t* pos_ptr = get_position_ptr(axis);
+        float accel = axis_accel[axis];
+        float steps_per_arcsec = axis_params[axis].steps_per_arcsec;
+        float command = 0.0f;
+
+        if (have_sample && !stopping) {
+            float target = (sample.position_arcsec[axis] + guide_offset(axis)) * steps_per_arcsec;
+            float error = target - (float)*pos_ptr;
+            record_tracking_error(axis, (int32_t)error);
+            set_tracking_error(axis, error);
+
+            float feed_forward = (sample.velocity_arcsec_s[axis] + guide_velocity(axis)) * steps_per_arcsec;
+            float next = (sample.next_velocity_arcsec_s[axis] + guide_velocity(axis)) * steps_per_arcsec;
+            // Centred on the point: half the change before it and half after, so the lead makes up for the lag.
+            // Reaching the new velocity right on the point would lag behind by the whole ramp on every point
+            float reachable = accel * sample.time_to_next_s + fabsf(next - feed_forward) * 0.5f;
+            if (next - feed_forward > reachable) {
+                feed_forward = next - reachable;
+            } else if (feed_forward - next > reachable) {
+                feed_forward = next + reachable;
+            }
+            command = feed_forward + error * FOLLOW_GAIN;
+
+            // Resolution by the distance covered within the look-ahead window
+            int32_t travel = (int32_t)(command * FOLLOW_LOOKAHEAD_S);
+            if (!axis_resolution_ready(axis, travel)) {
+                follow_rate[axis] = 0;
+                follow_phase[axis] = 0;
+                continue;
+            }
+        }
+
+        // Acceleration limit against the velocity we have, the direction only changes through zero
+        float velocity = axis_direction[axis] ? axis_speed[axis] : -axis_speed[axis];
+        float max_change = accel * dt;
+        if (command > velocity + max_change) {
+            velocity += max_change;
+        } else if (command < velocity - max_change) {
+            velocity -= max_change;
+        } else {
+            velocity = command;
+        }
+        // The follower pulses from every pass of the step loop, the step interval does not apply
+        float max_speed = axis_step_units[axis] * follow_max_pulse_rate;
+        if (velocity > max_speed) velocity = max_speed;
+        if (velocity < -max_speed) velocity = -max_speed;
+
+        axis_speed[axis] = fabsf(velocity);
+        if (velocity != 0.0f) {
+            axis_direction[axis] = velocity > 0.0f;
+        }
+        // 2^32 / 1e6: pulses per second -> pulses per µs in 0.32 fixed point
+        follow_rate[axis] = (uint32_t)(axis_speed[axis] / axis_step_units[axis] * 4294.967296f);
+    }
+}
+
+static void follow_trajectory(uint32_t now_us, bool stopping, step_batch_t *batch) {
+    uint32_t since_control = now_us - follow_last_control_us;
+    if (since_control >= FOLLOW_CONTROL_US) {
+        // After a pause the gap is not time the axes could have used to accelerate
+        if (since_control > 2 * FOLLOW_CONTROL_US) since_control = FOLLOW_CONTROL_US;
+        follow_control(since_control / 1000000.0f, stopping);
+        follow_last_control_us = now_us;
+    }
+
+    // Integer only from here, this runs on every pass of the step loop
+    uint32_t elapsed = now_us - follow_last_pass_us;
+    follow_last_pass_us = now_us;
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        if (follow_rate[axis] == 0) continue;
+        follow_phase[axis] += (uint64_t)elapsed * follow_rate[axis];
+        if (follow_phase[axis] < (1ull << 32)) continue;
+
+        // At most one pulse per pass, a late pass does not turn into a burst
+        follow_phase[axis] -= 1ull << 32;
+        if (follow_phase[axis] >= (1ull << 32)) {
+            follow_phase[axis] = (1ull << 32) - 1;
+        }
+        bool direction = axis_direction[axis];
+        if (!backlash_taken_up(axis, direction, now_us)) continue;
+        step_batch_add(batch, axis, direction);
+        volatile int32_t* pos_ptr = get_position_ptr(axis);
+        *pos_ptr += direction ? axis_step_units[axis] : -axis_step_units[axis];
+        axis_last_step_us[axis] = now_us;
+    }
+}
+
+// Soft limits and forbidden zones, checked every LIMIT_CHECK_US instead of per step: where would each axis come
+// to rest if it only started braking at the next check. Past a soft limit (moving outwards) or inside a zone the
+// axes are not in yet, every motion mode is cancelled and the axes brake to rest like after a stop
+static void limits_guard(float check_dt) {
+    if (stepper_get_mode() == STEPPER_MODE_IDLE) return;    // Already braking, or nothing to guard
+    if (home_moves_active) return;
+    
+    int32_t position[NUM_AXES];
+    int32_t rest[NUM_AXES];
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        int32_t units = *get_position_ptr(axis);
+        float speed = axis_speed[axis];
+        float travel = speed * speed / (2.0f * axis_accel[axis]) + speed * check_dt;
+        position[axis] = axis_steps_to_arcsec(axis, units);
+        rest[axis] = axis_steps_to_arcsec(axis, units + (int32_t)(axis_direction[axis] ? travel : -travel));
+    }
+    
+    int kind = -1;
+    uint8_t index = 0;
+    for (uint8_t axis = 0; axis < NUM_AXES && kind < 0; axis++) {
+        if (!axis_params[axis].limited || axis_speed[axis] == 0.0f) continue;
+        // A static move brakes to rest on its target, which was inside the limits when it was queued
+        int32_t end = rest[axis];
+        if (axis_commands[axis].valid) {
+            int32_t target = axis_commands[axis].target_position;
+            if (axis_direction[axis] ? (end > target && position[axis] <= target) : (end < target && position[axis] >= target)) {
+                end = target;
+            }
+        }
+        if ((axis_direction[axis] && end > axis_params[axis].limit_max_arcsec) ||
+            (!axis_direction[axis] && end < axis_params[axis].limit_min_arcsec)) {
+            kind = LIMIT_EVENT_SOFT_LIMIT;
+            index = axis;
+        }
+    }
+    if (kind < 0) {
+        int8_t zone = limits_zone_at(rest[AXIS_X], rest[AXIS_Z]);
+        if (zone >= 0 && limits_zone_at(position[AXIS_X], position[AXIS_Z]) != zone) {
+            kind = LIMIT_EVENT_ZONE;
+            index = (uint8_t)zone;
+        }
+    }
+    if (kind < 0) return;
+    
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        axis_commands[axis].valid = false;
+    }
+    tracking_state.tracking_active = false;
+    celestial_state.active = false;
+    celestial_tracking_slewing_finished = false;
+    profile_stop();
+    limits_raise((uint8_t)kind, index, position);
+}
+
+// Queue the difference between step position and encoder as a trim. Only once the previous trim is out,
+// or the same error would be queued again
+static void encoder_check(void) {
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        int32_t position = *get_position_ptr(axis);
+        int32_t error;
+        if (!encoder_error_units(axis, position, &error)) continue;
+        
+        int32_t step_units = axis_step_units[axis];
+        int32_t outstanding = correction_diff(axis, position);
+        if (outstanding * 2 >= step_units || outstanding * 2 <= -step_units) continue;
+        
+        int32_t deadband = encoder_deadband_units(axis);
+        if (deadband < step_units) deadband = step_units;
+        if (error < deadband && error > -deadband) continue;
+        // In whole steps, a remainder of half a step would be doubled and dropped back in turn and never clear
+        int32_t steps = (error >= 0 ? error + step_units / 2 : error - step_units / 2) / step_units;
+        encoder_trim[axis] += steps * step_units;
+    }
 }
 
 void stepper_core1_entry() {
     DEBUG_PRINT("Stepper core 1 started\n");
+    fault_init_core1();
+    home_init_core1();
+    guide_init_core1();
+    shutter_init_core1();
     
-    // Per-axis timing variables for multi-axis support
-    static absolute_time_t last_step_time[NUM_AXES] = {0};
-    static absolute_time_t last_dir_change_time[NUM_AXES] = {0};
-
-    // Direction tracking per axis
-    static bool last_direction[NUM_AXES] = {false, false, false};
+    uint32_t last_pass_us = time_us_32();
+    uint32_t last_limit_check_us = last_pass_us;
+    uint32_t last_encoder_check_us = last_pass_us;
     
     while (true) {
+        // The fault interrupt already stopped everything, just note how long it took to get back here
+        if (fault_freeze_pending) {
+            fault_acknowledge_freeze();
+        }
+        uint32_t now_us = time_us_32();
+        float pass_dt = (now_us - last_pass_us) / 1000000.0f;
+        last_pass_us = now_us;
+        
         if (!stepper_enabled || stepper_paused) {
-            sleep_ms(IDLE_SLEEP_MS);
+            // Whatever stopped us, the motors are at rest now
+            for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+                axis_speed[axis] = 0.0f;
+            }
+            idle_wait(IDLE_SLEEP_MS * 1000);
             continue;
         }
         
+        guide_update(now_us);
+        
+        if (now_us - last_limit_check_us >= LIMIT_CHECK_US) {
+            limits_guard((now_us - last_limit_check_us) / 1000000.0f);
+            last_limit_check_us = now_us;
+        }
+        if (now_us - last_encoder_check_us >= ENCODER_CHECK_US) {
+            encoder_check();
+            last_encoder_check_us = now_us;
+        }
+        
+        step_batch_t batch = {0};
         bool active_movement = false;
-        absolute_time_t now = get_absolute_time();
+        bool busy_loop = false;             // Trajectory following steps from every pass, no sleeping
+        bool stopping = pause_requested || disable_requested;
         
-        // Celestial tracking mode - autonomous position tracking
-        if (celestial_state.active) {
+        // Trajectory following - fast movers
+        if (profile_is_active() && profile_is_following()) {
+            active_movement = true;
+            busy_loop = true;
+            follow_trajectory(now_us, stopping, &batch);
+        }
+        // Celestial tracking and tracking profiles - autonomous position tracking
+        else if (celestial_state.active || profile_is_active()) {
             active_movement = true;
             
             // Compute target positions based on current time
-            compute_celestial_targets();
+            int32_t target_positions[NUM_AXES];
+            profile_sample_t sample;
+            bool targets_ready = true;
+            if (celestial_state.active && compute_celestial_targets()) {
+                for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+                    target_positions[axis] = axis_arcsec_to_steps(axis, celestial_target_arcsec[axis]);
+                }
+            } else if (celestial_state.active) {
+                // No corrected target yet, brake and hold instead of heading for the last goto's target
+                targets_ready = false;
+                for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+                    target_positions[axis] = stepper_get_position(axis);
+                }
+            } else if (profile_sample(&sample)) {
+                for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+                    float exact_steps = sample.position_arcsec[axis] * axis_params[axis].steps_per_arcsec;
+                    target_positions[axis] = (int32_t)(exact_steps >= 0 ? exact_steps + 0.5f : exact_steps - 0.5f);
+                }
+            } else {
+                // Profile ran empty between the checks, hold where we are
+                for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+                    target_positions[axis] = stepper_get_position(axis);
+                }
+            }
+            // Guide corrections move the target, whatever the target comes from
+            for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+                float guide_units = guide_offset(axis) * axis_params[axis].steps_per_arcsec;
+                target_positions[axis] += (int32_t)(guide_units >= 0 ? guide_units + 0.5f : guide_units - 0.5f);
+            }
             
             bool all_axes_at_target = true;
             // Move each axis towards its computed target
             for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
                 volatile int32_t* pos_ptr = get_position_ptr(axis);
-                if (!pos_ptr) continue;
                 
                 // Get target in steps
-                int32_t target_steps = arcseconds_to_steps(celestial_target_arcsec[axis], get_gear_ratio(axis));
-                int32_t position_diff = target_steps - *pos_ptr;
-                
-                if (position_diff == 0){
-                    continue;
-                }
-                // Less than 3 steps difference means were close enough to be tracking instead of just chasing the object
-                if (position_diff > 3 || position_diff < -3) {
-                    all_axes_at_target = false;
+                int32_t target_steps = target_positions[axis];
+                int32_t nominal_diff = target_steps - *pos_ptr;
+                // PEC and encoder correction still to be output, these steps move the motor but not the reported position
+                int32_t pec_diff = correction_diff(axis, *pos_ptr);
+                int32_t position_diff = nominal_diff + pec_diff;
+                if (!celestial_state.active) {
+                    record_tracking_error(axis, nominal_diff);
                 }
+                set_tracking_error(axis, (float)nominal_diff);
                 
-                bool direction = position_diff > 0;
+                int32_t coarse_units = POSITION_MICROSTEPS / slew_microsteps;
                 
-                // Update direction if changed
-                if (last_direction[axis] != direction) {
-                    gpio_put(get_dir_pin(axis), direction);
-                    if (axis == AXIS_X) {
-                        gpio_put(X_DIR_PIN_INV, !direction);
-                    }
-                    last_direction[axis] = direction;
-                    last_dir_change_time[axis] = now;
+                // Less than 3 coarse steps difference means were close enough to be tracking instead of just chasing the object
+                if (nominal_diff > 3 * coarse_units || nominal_diff < -3 * coarse_units) {
+                    all_axes_at_target = false;
                 }
+                if (!axis_resolution_ready(axis, position_diff)) {
+                    continue;
+                }
+                int32_t step_units = axis_step_units[axis];
                 
-                // Check timing - celestial tracking uses the same step interval as static moves
-                bool direction_setup_complete = absolute_time_diff_us(last_dir_change_time[axis], now) >= DIR_SETUP_TIME_US;
-                bool step_interval_ready = absolute_time_diff_us(last_step_time[axis], now) >= (STEP_INTERVAL_MS * 1000);
-                
-                if (direction_setup_complete && step_interval_ready) {
-                    gpio_put(get_step_pin(axis), 1);
-                    sleep_us(STEP_PULSE_WIDTH_US);
-                    gpio_put(get_step_pin(axis), 0);
+                bool direction;
+                if (planned_step(axis, position_diff, stopping || !targets_ready, now_us, &direction)) {
+                    step_batch_add(&batch, axis, direction);
                     
-                    if (direction) {
-                        (*pos_ptr)++;
+                    // Nominal motion first, whatever is left over belongs to the PEC correction. A step only counts
+                    // in the position if the nominal motion still wants at least half a step in its direction
+                    int32_t step = direction ? step_units : -step_units;
+                    if (nominal_step_wanted(nominal_diff, direction, step_units)) {
+                        *pos_ptr += step;
                     } else {
-                        (*pos_ptr)--;
+                        pec_applied_steps[axis] += step;
                     }
-                    
-                    last_step_time[axis] = now;
                 }
             }
-            if (all_axes_at_target) {
+            if (all_axes_at_target && celestial_state.active && targets_ready) {
                 celestial_tracking_slewing_finished = true;
             }
         }
@@ -423,110 +1342,173 @@ void stepper_core1_entry() {
             uint32_t current_time = time_us_32();
             
             for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
-                float rate = tracking_state.rates_arcsec_per_sec[axis];
-                if (rate == 0.0f) continue;
+                float guide_rate = guide_velocity(axis);
+                float rate = tracking_state.rates_arcsec_per_sec[axis] + guide_rate;
+                if (rate == 0.0f && axis_speed[axis] == 0.0f) {
+                    rate_lag_units[axis] = 0.0f;
+                    rate_travel_units[axis] = 0.0f;
+                    set_tracking_error(axis, 0.0f);
+                    continue;
+                }
+                
+                if (!axis_resolution_ready(axis, 0)) continue;
+                int32_t step_units = axis_step_units[axis];
+                
+                // Ramp the velocity towards the tracking rate (or down to rest while pausing). Only the target is
+                // held to the step rate limit, an axis still faster than that from the follower brakes down to it
+                float target_velocity = stopping ? 0.0f : rate * axis_params[axis].steps_per_arcsec;
+                float max_speed = axis_max_speed(axis);
+                if (target_velocity > max_speed) target_velocity = max_speed;
+                if (target_velocity < -max_speed) target_velocity = -max_speed;
+                float velocity = axis_direction[axis] ? axis_speed[axis] : -axis_speed[axis];
+                float max_change = axis_accel[axis] * pass_dt;
+                if (target_velocity > velocity + max_change) {
+                    velocity += max_change;
+                } else if (target_velocity < velocity - max_change) {
+                    velocity -= max_change;
+                } else {
+                    velocity = target_velocity;
+                }
                 
-                // Calculate interval between steps
-                float gear_ratio = get_gear_ratio(axis);
-                float steps_per_arcsec = ((float)STEPS_PER_REV * MICROSTEPPING * gear_ratio) / 1296000.0f;
-                float steps_per_sec = fabsf(rate) * steps_per_arcsec;
+                // The ramp lags a guide run or dither on the way in and makes it up on the way out, back on the plain
+                // rate the lag is cleared so a start-up ramp does not count
+                rate_lag_units[axis] += (target_velocity - velocity) * pass_dt;
+                if (stopping || (velocity == target_velocity && guide_rate == 0.0f)) {
+                    rate_lag_units[axis] = 0.0f;
+                }
+                set_tracking_error(axis, rate_lag_units[axis]);
                 
-                if (steps_per_sec > 0.0f) {
-                    uint32_t step_interval_us = (uint32_t)(1000000.0f / steps_per_sec);
+                if (velocity == 0.0f) {
+                    axis_speed[axis] = 0.0f;
+                    rate_travel_units[axis] = 0.0f;
+                    tracking_state.last_step_time[axis] = current_time;
+                    continue;
+                }
+                // Step once the ramped velocity has covered a step. An interval from the current speed would grow
+                // faster than the time since the last step while braking and cut the end of the ramp off.
+                // The travel is signed and kept over a reversal: the part of a step covered before it has to be
+                // travelled back first, or every reversal (a dither against the tracking rate) gains up to a step.
+                // What the last pass covered past the step is carried, or the rate would come out short by the wake-up
+                // overshoot, but no more (a late pass, a finer resolution) so it is not made up in a burst
+                float pass_units = velocity * pass_dt;
+                float max_travel = step_units + fabsf(pass_units);
+                rate_travel_units[axis] += pass_units;
+                if (rate_travel_units[axis] > max_travel) rate_travel_units[axis] = max_travel;
+                if (rate_travel_units[axis] < -max_travel) rate_travel_units[axis] = -max_travel;
+                axis_speed[axis] = fabsf(velocity);
+                axis_direction[axis] = velocity > 0.0f;
+                float travel = axis_direction[axis] ? rate_travel_units[axis] : -rate_travel_units[axis];
+                
+                // Check if it's time for a step
+                if (travel >= step_units && backlash_taken_up(axis, axis_direction[axis], current_time)) {
+                    volatile int32_t* pos_ptr = get_position_ptr(axis);
+                    bool direction = axis_direction[axis];
+                    int32_t step = direction ? step_units : -step_units;
+                    
+                    // PEC is applied by dropping or doubling a tracking step, so the direction pin
+                    // never has to change and the correction rate is bounded by the tracking rate
+                    int32_t pec_diff = correction_diff(axis, *pos_ptr);
+                    int pulses = 1;
+                    if (pec_diff * 2 * (step > 0 ? 1 : -1) <= -step_units) {
+                        pulses = 0;
+                        pec_applied_steps[axis] -= step;
+                    } else if (pec_diff * 2 * (step > 0 ? 1 : -1) >= step_units) {
+                        pulses = 2;
+                        pec_applied_steps[axis] += step;
+                    }
                     
-                    // Check if it's time for a step
-                    if ((current_time - tracking_state.last_step_time[axis]) >= step_interval_us) {
-                        gpio_put(get_step_pin(axis), 1);
-                        sleep_us(TRACKING_STEP_PULSE_US);  // Use defined constant
-                        gpio_put(get_step_pin(axis), 0);
-                        
-                        // Update position
-                        volatile int32_t* pos_ptr = get_position_ptr(axis);
-                        if (pos_ptr) {
-                            if (rate > 0.0f) {
-                                (*pos_ptr)++;
-                            } else {
-                                (*pos_ptr)--;
-                            }
-                        }
-
-                        tracking_state.last_step_time[axis] = current_time;
+                    if (pulses > 0) step_batch_add(&batch, axis, direction);
+                    if (pulses > 1) {
+                        batch.repeat_mask |= axis_params[axis].step_mask;
+                        motor_phase[axis] += step;
                     }
+                    
+                    // Update position
+                    *pos_ptr += step;
+                    rate_travel_units[axis] -= step;
+
+                    tracking_state.last_step_time[axis] = current_time;
+                    axis_last_step_us[axis] = current_time;
                 }
             }
         }
         // Process static movement commands for all axes simultaneously
         else {
-            // Process each axis independently
+            // Process each axis independently, axes without a command that are still moving brake to rest
             for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
-                if (!axis_commands[axis].valid) continue;
+                bool has_command = axis_commands[axis].valid;
+                if (!has_command && axis_speed[axis] == 0.0f) continue;
                 
                 active_movement = true;
                 
                 volatile int32_t* pos_ptr = get_position_ptr(axis);
-                if (!pos_ptr) {
-                    axis_commands[axis].valid = false;
-                    continue;
-                }
-                
-                // Calculate target in steps
-                int32_t target = arcseconds_to_steps(axis_commands[axis].target_position, get_gear_ratio(axis));
-                
-                // Calculate the difference (can be positive or negative)
-                int32_t position_diff = target - *pos_ptr;
-                
-                // Determine direction based on the sign of the difference
-                bool direction = position_diff >= 0;
-                
-                // Calculate absolute steps needed
-                int32_t steps = direction ? position_diff : -position_diff;
                 
-                if (last_direction[axis] != direction) {
-                    gpio_put(get_dir_pin(axis), direction);
-                    
-                    if (axis == AXIS_X) {
-                        gpio_put(X_DIR_PIN_INV, !direction);
-                    }
-                    
-                    last_direction[axis] = direction;
-                    last_dir_change_time[axis] = now;
+                // Calculate the difference (can be positive or negative), outstanding corrections go out with the move
+                int32_t nominal_diff = 0;
+                int32_t position_diff = 0;
+                if (has_command) {
+                    nominal_diff = axis_arcsec_to_steps(axis, axis_commands[axis].target_position) - *pos_ptr;
+                    position_diff = nominal_diff + correction_diff(axis, *pos_ptr);
                 }
                 
-                // Check if it's time for the next step (non-blocking timing)
-                bool direction_setup_complete = absolute_time_diff_us(last_dir_change_time[axis], now) >= DIR_SETUP_TIME_US;
-                bool step_interval_ready = absolute_time_diff_us(last_step_time[axis], now) >= (STEP_INTERVAL_MS * 1000);
+                if (!axis_resolution_ready(axis, position_diff)) continue;
+                int32_t step_units = axis_step_units[axis];
                 
-                if (steps > 0 && direction_setup_complete && step_interval_ready) {
-                    gpio_put(get_step_pin(axis), 1);
-                    sleep_us(STEP_PULSE_WIDTH_US);
-                    gpio_put(get_step_pin(axis), 0);
+                bool direction;
+                if (planned_step(axis, position_diff, stopping || !has_command, now_us, &direction)) {
+                    step_batch_add(&batch, axis, direction);
                     
-                    // Update position in the correct direction
-                    if (direction) {
-                        (*pos_ptr)++;
+                    // Nominal motion first, whatever is left over belongs to the corrections
+                    int32_t step = direction ? step_units : -step_units;
+                    if (!has_command || nominal_step_wanted(nominal_diff, direction, step_units)) {
+                        *pos_ptr += step;
                     } else {
-                        (*pos_ptr)--;
+                        pec_applied_steps[axis] += step;
                     }
                     
-                    // Update last step time for this axis
-                    last_step_time[axis] = now;
-                    
                     static int step_counter[NUM_AXES] = {0};
                     if (++step_counter[axis] % 1000 == 0) {
-                        DEBUG_PRINT("Axis %d: %ld steps remaining\n", axis, steps - 1);
+                        DEBUG_PRINT("Axis %d: %ld units remaining\n", axis, position_diff);
                     }
-                } else if (steps == 0) {
-                    // Target reached for this axis
+                } else if (has_command && !stopping && axis_speed[axis] == 0.0f &&
+                           position_diff * 2 <= step_units && position_diff * 2 >= -step_units) {
+                    // Target reached for this axis, anything within half a step is as close as this resolution gets.
+                    // The same bound the planner starts from, exactly half a step away it would neither start nor end
                     axis_commands[axis].valid = false;
                     DEBUG_PRINT("Axis %d movement complete at position %ld steps\n", axis, *pos_ptr);
                 }
             }
         }
         
+        backlash_takeup(&batch, now_us);
+        step_batch_output(&batch);
+        
+        // A ramped pause or stop completes once every axis is at rest
+        if (stopping) {
+            bool at_rest = true;
+            for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+                if (axis_speed[axis] > 0.0f) at_rest = false;
+            }
+            if (at_rest) {
+                if (disable_requested) {
+                    disable_requested = false;
+                    pause_requested = false;
+                    stepper_set_enable(false);
+                } else if (pause_requested) {
+                    stepper_hard_pause();
+                }
+            }
+        }
+        
+        // An axis still braking down from follower speed needs a pass per step, like the follower itself
+        for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+            if (axis_speed[axis] > axis_max_speed(axis)) busy_loop = true;
+        }
+        
         if (!active_movement) {
-            sleep_ms(INACTIVE_SLEEP_MS);
-        } else {
+            idle_wait(INACTIVE_SLEEP_MS * 1000);
+        } else if (!busy_loop) {
             sleep_us(ACTIVE_SLEEP_US);
         }
     }
-}
\ No newline at end of file
+}
@@ -9,21 +9,31 @@
 #include "pico/sync.h"
 #include "hardware/timer.h"
 
+// Defaults only, the values in use come from the flash config (CONFIG.h)
 #define X_STEPPER_GEAR_RATIO 28.5714285714f // 400:14
 #define Y_STEPPER_GEAR_RATIO 23.5714285714f // 330:14
 #define Z_STEPPER_GEAR_RATIO 30.0f          // 420:14
 
 #define STEPS_PER_REV 400 // 0.9deg stepper motor
-#define MICROSTEPPING 16
+#define MICROSTEPPING 16  // Driver resolution when the TMC2209 UART is not used (set by the strapping)
+#define POSITION_MICROSTEPS 256 // Position counters count 1/256 microsteps, the finest the drivers can do
+#define FULL_TURN_ARCSEC 1296000
+#define MICROSTEP_FINE_ZONE 4   // Coarse steps before the target where moves switch to the fine resolution
+#define TRACK_FINE_SPEED_RATIO 0.9f // Rate tracking goes back to fine below this share of the fine step rate
 
 // Timing constants for stepper control
 #define STEP_INTERVAL_MS 1          // 1ms = 1000 steps/sec
 #define DIR_SETUP_TIME_US 1         // 1μs direction setup time for TMC2209
 #define STEP_PULSE_WIDTH_US 1       // 1μs step pulse width
-#define TRACKING_STEP_PULSE_US 1    // 1μs step pulse for tracking mode
-#define IDLE_SLEEP_MS 10            // Sleep when steppers disabled/paused
+#define IDLE_SLEEP_MS 10            // Longest idle wait when steppers disabled/paused, commands wake core 1 sooner
 #define ACTIVE_SLEEP_US 50          // Sleep between active movement cycles
-#define INACTIVE_SLEEP_MS 1         // Sleep when no movement active
+#define INACTIVE_SLEEP_MS 1         // Longest idle wait when no movement active
+#define ACCELERATION_ARCSEC_S2 10800.0f // Default acceleration limit (3°/s²)
+#define BACKLASH_RATE_ARCSEC 3600.0f   // Default backlash take-up speed (1°/s), the motor runs free so there is no ramp
+#define FOLLOW_CONTROL_US 1000      // Control period of the trajectory follower
+#define FOLLOW_GAIN 20.0f           // Position error correction of the trajectory follower, 1/s
+#define FOLLOW_LOOKAHEAD_S 0.25f    // Travel within this window picks the follower's microstep resolution
+#define FOLLOW_PASS_US 20           // Step loop pass without the pulse itself (guide update, follower, soft float), worst case
 
 enum {
     AXIS_X,
@@ -32,6 +42,23 @@ enum {
     NUM_AXES
 };
 
+typedef enum {
+    STEPPER_MODE_IDLE = 0,
+    STEPPER_MODE_STATIC = 1,
+    STEPPER_MODE_TRACKING = 2,
+    STEPPER_MODE_CELESTIAL = 3,
+    STEPPER_MODE_PROFILE = 4
+} stepper_mode_t;
+
+// How far the position counters can be trusted, reported to the host in the telemetry
+typedef enum {
+    REFERENCE_NONE = 0,             // Reference is wherever the mount was at boot
+    REFERENCE_RESTORED = 1,         // Restored from a checkpoint written at rest
+    REFERENCE_APPROXIMATE = 2,      // Restored from a checkpoint written while moving
+    REFERENCE_LOST = 3,             // Steps were lost, the host has to re-reference
+    REFERENCE_HOMED = 4             // Set by the home switches
+} position_reference_t;
+
 typedef enum {
     STATIC_MOVE = 0,
     TRACKING_MOVE = 1
@@ -61,6 +88,7 @@ typedef struct {
     float latitude;                 // Observer's latitude in degrees
     uint64_t ref_unix_time;         // Unix timestamp when tracking started
     uint32_t ref_boot_time_us;      // Boot time in microseconds when command was received
+    bool use_model;                 // Targets come from the on-device pointing model (ALIGN.h), not the matrix
 } celestial_tracking_state_t;
 
 void stepper_init_pins();
@@ -68,18 +96,41 @@ void stepper_init();
 void stepper_core1_entry();
 void stepper_set_enable(bool enable);
 void stepper_pause();
+void stepper_hard_pause(void);
+void stepper_stop(void);
 void stepper_resume();
 bool stepper_is_enabled(void);
 bool stepper_is_paused(void);
+void stepper_wake(void);
+void stepper_get_wake_latency(uint16_t *last_us, uint16_t *worst_us);
 
 void stepper_queue_static_move(uint8_t axis, int32_t position);
 void stepper_stop_all_moves();  // NEW: Stop all axis movements
+void stepper_stop_tracking(void);
 int32_t stepper_get_position(uint8_t axis);
+void stepper_set_position(uint8_t axis, int32_t steps);
+stepper_mode_t stepper_get_mode(void);
+bool stepper_is_moving(void);
+position_reference_t stepper_get_reference(void);
+void stepper_set_reference(position_reference_t reference);
+void stepper_emergency_stop(void);
+void stepper_reset_microstepping(void);
+float stepper_max_rate_arcsec(uint8_t axis);
 void stepper_start_tracking(float x_rate_arcsec, float y_rate_arcsec, float z_rate_arcsec);
 void stepper_start_celestial_tracking(float ra, float dec, const float* align_matrix, uint64_t ref_time, float latitude);
+void stepper_start_model_tracking(float ra, float dec);
 void stepper_stop_celestial_tracking(void);
 bool stepper_is_celestial_tracking(void);
+void stepper_start_profile(bool follow);
+float stepper_get_tracking_error(uint8_t axis);
+float stepper_take_tracking_error(uint8_t axis);
+void stepper_home_move(uint8_t axis, int32_t position_arcsec, float speed_arcsec);
+void stepper_home_cancel_move(uint8_t axis);
+void stepper_home_finish(void);
+bool stepper_axis_busy(uint8_t axis);
+int32_t stepper_edge_position(uint8_t axis, uint32_t edge_time_us);
 int32_t stepper_get_position_arcsec(uint8_t axis);
+float stepper_steps_per_arcsec(uint8_t axis);
 int32_t arcseconds_to_steps(int32_t arcseconds, float gear_ratio);
 int32_t steps_to_arcseconds(int32_t steps, float gear_ratio);
 
@@ -0,0 +1,359 @@
+#include "TMC2209.h"
+#include "CONFIG.h"
+#include "UART.h"
+#include "hardware/clocks.h"
+#include "TMC2209.pio.h"
+
+#define TMC2209_BYTE_TIME_US ((10 * 1000000 + TMC2209_BAUD_RATE - 1) / TMC2209_BAUD_RATE)
+
+static PIO tmc_pio = pio0;
+static uint sm_tx;
+static uint sm_rx;
+static uint rx_offset;
+static uint tmc_pin;
+static int tmc_dma_channel = -1;
+static bool tmc_hw_ready = false;
+static bool tmc_enabled = false;
+
+// Both cores use the bus: the flag says who owns it, the hardware spin lock only guards flipping the flag
+static spin_lock_t *bus_lock;
+static volatile bool bus_busy = false;
+
+static uint8_t axis_addresses[NUM_AXES][TMC2209_DRIVERS_PER_AXIS];
+static uint8_t axis_driver_count[NUM_AXES];
+static uint32_t chopconf_shadow[4];                 // CHOPCONF is written often, keep a copy per address
+static uint8_t async_buffer[TMC2209_DRIVERS_PER_AXIS * 8];
+
+// Requests from the UART interrupt, handled in tmc2209_background_task()
+static volatile int16_t status_request_axis = -1;
+static volatile bool current_requested = false;
+static volatile uint8_t current_request_axis;
+static volatile uint8_t current_request_run;
+static volatile uint8_t current_request_hold;
+
+// CRC8 as given in the TMC2209 datasheet (polynomial 0x07, bits processed LSB first)
+static uint8_t tmc2209_crc(const uint8_t *data, size_t length) {
+    uint8_t crc = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        uint8_t byte = data[i];
+        for (uint8_t j = 0; j < 8; j++) {
+            if ((crc >> 7) ^ (byte & 0x01)) {
+                crc = (crc << 1) ^ 0x07;
+            } else {
+                crc <<= 1;
+            }
+            byte >>= 1;
+        }
+    }
+    return crc;
+}
+
+static void build_write_datagram(uint8_t *datagram, uint8_t address, uint8_t reg, uint32_t value) {
+    datagram[0] = TMC2209_SYNC;
+    datagram[1] = address;
+    datagram[2] = reg | TMC2209_WRITE;
+    datagram[3] = (uint8_t)(value >> 24);
+    datagram[4] = (uint8_t)(value >> 16);
+    datagram[5] = (uint8_t)(value >> 8);
+    datagram[6] = (uint8_t)value;
+    datagram[7] = tmc2209_crc(datagram, 7);
+}
+
+// MRES field: 0 = 256 microsteps ... 8 = full steps
+static uint8_t microsteps_to_mres(uint16_t microsteps) {
+    uint8_t mres = 8;
+    while (microsteps > 1 && mres > 0) {
+        microsteps >>= 1;
+        mres--;
+    }
+    return mres;
+}
+
+static bool bus_try_acquire(void) {
+    uint32_t save = spin_lock_blocking(bus_lock);
+    bool acquired = !bus_busy;
+    if (acquired) {
+        bus_busy = true;
+    }
+    spin_unlock(bus_lock, save);
+    return acquired;
+}
+
+static void bus_acquire(void) {
+    while (!bus_try_acquire()) {
+        tight_loop_contents();
+    }
+}
+
+static void bus_release(void) {
+    bus_busy = false;
+}
+
+// Wait until an async write has left the DMA, the FIFO and finally the shift register
+static void wait_tx_idle(void) {
+    while (dma_channel_is_busy(tmc_dma_channel)) {
+        tight_loop_contents();
+    }
+    while (!pio_sm_is_tx_fifo_empty(tmc_pio, sm_tx)) {
+        tight_loop_contents();
+    }
+    busy_wait_us_32(TMC2209_BYTE_TIME_US + 10);
+}
+
+// The receiver also collects the echo of every async write nobody reads, start clean before a transaction
+static void rx_reset(void) {
+    pio_sm_set_enabled(tmc_pio, sm_rx, false);
+    pio_sm_clear_fifos(tmc_pio, sm_rx);
+    pio_sm_restart(tmc_pio, sm_rx);
+    pio_sm_exec(tmc_pio, sm_rx, pio_encode_jmp(rx_offset));
+    pio_sm_set_enabled(tmc_pio, sm_rx, true);
+}
+
+static bool rx_byte(uint8_t *byte, uint32_t deadline) {
+    while (pio_sm_is_rx_fifo_empty(tmc_pio, sm_rx)) {
+        if ((int32_t)(time_us_32() - deadline) >= 0) return false;
+    }
+    // 8 bits shifted in from the left end up in the top byte
+    *byte = (uint8_t)(pio_sm_get(tmc_pio, sm_rx) >> 24);
+    return true;
+}
+
+bool tmc2209_write_register(uint8_t address, uint8_t reg, uint32_t value) {
+    if (!tmc_enabled) return false;
+
+    uint8_t datagram[8];
+    build_write_datagram(datagram, address, reg, value);
+
+    bus_acquire();
+    wait_tx_idle();
+    for (int i = 0; i < 8; i++) {
+        pio_sm_put_blocking(tmc_pio, sm_tx, datagram[i]);
+    }
+    wait_tx_idle();
+    bus_release();
+    return true;
+}
+
+bool tmc2209_read_register(uint8_t address, uint8_t reg, uint32_t *value) {
+    if (!tmc_enabled) return false;
+
+    uint8_t request[4] = {TMC2209_SYNC, address, reg, 0};
+    request[3] = tmc2209_crc(request, 3);
+    uint8_t reply[8];
+    bool ok = true;
+
+    bus_acquire();
+    wait_tx_idle();
+    rx_reset();
+    for (int i = 0; i < 4; i++) {
+        pio_sm_put_blocking(tmc_pio, sm_tx, request[i]);
+    }
+
+    // Our own request comes back first, then the line is released so the driver can answer
+    uint32_t deadline = time_us_32() + TMC2209_REPLY_TIMEOUT_US;
+    for (int i = 0; i < 4 && ok; i++) {
+        ok = rx_byte(&reply[0], deadline);
+    }
+    pio_sm_set_consecutive_pindirs(tmc_pio, sm_tx, tmc_pin, 1, false);
+    for (int i = 0; i < 8 && ok; i++) {
+        ok = rx_byte(&reply[i], deadline);
+    }
+    pio_sm_set_consecutive_pindirs(tmc_pio, sm_tx, tmc_pin, 1, true);
+    bus_release();
+
+    if (!ok || reply[0] != TMC2209_SYNC || reply[1] != 0xFF || reply[2] != reg || reply[7] != tmc2209_crc(reply, 7)) {
+        DEBUG_PRINT("TMC2209 read of register 0x%02X from driver %d failed\n", reg, address);
+        return false;
+    }
+    *value = ((uint32_t)reply[3] << 24) | ((uint32_t)reply[4] << 16) | ((uint32_t)reply[5] << 8) | reply[6];
+    return true;
+}
+
+// Writes have no reply, the interface counter is the only way to know a write arrived
+static bool write_register_verified(uint8_t address, uint8_t reg, uint32_t value) {
+    uint32_t count_before, count_after;
+    if (!tmc2209_read_register(address, TMC2209_REG_IFCNT, &count_before)) return false;
+    tmc2209_write_register(address, reg, value);
+    if (!tmc2209_read_register(address, TMC2209_REG_IFCNT, &count_after)) return false;
+    return (uint8_t)(count_after - count_before) == 1;
+}
+
+bool tmc2209_init(void) {
+    if (!device_config.tmc2209_enabled) return false;
+
+    tmc_pin = device_config.tmc2209_tx_pin;
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        axis_addresses[axis][0] = device_config.tmc2209_address[axis] & 0x03;
+        axis_driver_count[axis] = 1;
+    }
+    axis_addresses[AXIS_X][1] = device_config.tmc2209_x2_address & 0x03;
+    axis_driver_count[AXIS_X] = 2;
+
+    bus_lock = spin_lock_init(spin_lock_claim_unused(true));
+
+    // 8 PIO cycles per bit
+    float clock_div = (float)clock_get_hz(clk_sys) / (8 * TMC2209_BAUD_RATE);
+
+    uint tx_offset = pio_add_program(tmc_pio, &tmc2209_uart_tx_program);
+    sm_tx = pio_claim_unused_sm(tmc_pio, true);
+    pio_sm_config tx_config = tmc2209_uart_tx_program_get_default_config(tx_offset);
+    sm_config_set_out_shift(&tx_config, true, false, 32);
+    sm_config_set_out_pins(&tx_config, tmc_pin, 1);
+    sm_config_set_sideset_pins(&tx_config, tmc_pin);
+    sm_config_set_fifo_join(&tx_config, PIO_FIFO_JOIN_TX);
+    sm_config_set_clkdiv(&tx_config, clock_div);
+    pio_sm_set_pins_with_mask(tmc_pio, sm_tx, 1u << tmc_pin, 1u << tmc_pin);
+    pio_sm_set_pindirs_with_mask(tmc_pio, sm_tx, 1u << tmc_pin, 1u << tmc_pin);
+    pio_gpio_init(tmc_pio, tmc_pin);
+    gpio_pull_up(tmc_pin);
+    pio_sm_init(tmc_pio, sm_tx, tx_offset, &tx_config);
+    pio_sm_set_enabled(tmc_pio, sm_tx, true);
+
+    rx_offset = pio_add_program(tmc_pio, &tmc2209_uart_rx_program);
+    sm_rx = pio_claim_unused_sm(tmc_pio, true);
+    pio_sm_config rx_config = tmc2209_uart_rx_program_get_default_config(rx_offset);
+    sm_config_set_in_pins(&rx_config, tmc_pin);
+    sm_config_set_in_shift(&rx_config, true, true, 8);
+    sm_config_set_fifo_join(&rx_config, PIO_FIFO_JOIN_RX);
+    sm_config_set_clkdiv(&rx_config, clock_div);
+    pio_sm_init(tmc_pio, sm_rx, rx_offset, &rx_config);
+    pio_sm_set_enabled(tmc_pio, sm_rx, true);
+
+    // DMA feeds the async writes from core 1
+    tmc_dma_channel = dma_claim_unused_channel(true);
+    dma_channel_config dma_conf = dma_channel_get_default_config(tmc_dma_channel);
+    channel_config_set_transfer_data_size(&dma_conf, DMA_SIZE_8);
+    channel_config_set_read_increment(&dma_conf, true);
+    channel_config_set_write_increment(&dma_conf, false);
+    channel_config_set_dreq(&dma_conf, pio_get_dreq(tmc_pio, sm_tx, true));
+    dma_channel_configure(tmc_dma_channel, &dma_conf, &tmc_pio->txf[sm_tx], NULL, 0, false);
+
+    tmc_hw_ready = true;
+    return tmc2209_configure();
+}
+
+// Write the boot settings to every driver, at init and again when the motor supply comes back
+// Registers are only used when every driver answers, otherwise fall back to the strapping
+bool tmc2209_configure(void) {
+    if (!tmc_hw_ready) return false;
+    tmc_enabled = true;
+
+    uint32_t chopconf = (TMC2209_CHOPCONF_DEFAULT & ~TMC2209_CHOPCONF_MRES_MASK) |
+                        ((uint32_t)microsteps_to_mres(device_config.microstepping) << TMC2209_CHOPCONF_MRES_SHIFT);
+    uint32_t ihold_irun = (device_config.hold_current & 0x1F) | ((uint32_t)(device_config.run_current & 0x1F) << 8) |
+                          ((uint32_t)TMC2209_IHOLDDELAY << 16);
+    bool ok = true;
+    for (uint8_t axis = 0; axis < NUM_AXES && ok; axis++) {
+        for (uint8_t i = 0; i < axis_driver_count[axis] && ok; i++) {
+            uint8_t address = axis_addresses[axis][i];
+            ok = write_register_verified(address, TMC2209_REG_GCONF, TMC2209_GCONF_DEFAULT) &&
+                 write_register_verified(address, TMC2209_REG_CHOPCONF, chopconf) &&
+                 write_register_verified(address, TMC2209_REG_IHOLD_IRUN, ihold_irun);
+            chopconf_shadow[address] = chopconf;
+        }
+    }
+
+    if (!ok) {
+        DEBUG_PRINT("TMC2209 drivers not answering, microstepping stays at %d\n", device_config.microstepping);
+        tmc_enabled = false;
+    }
+    return tmc_enabled;
+}
+
+bool tmc2209_is_enabled(void) {
+    return tmc_enabled;
+}
+
+// Non-blocking, safe to call from core 1 between step pulses
+// Returns false if the bus is in use, done_time_us is when the write will have reached the drivers
+bool tmc2209_try_set_microstepping(uint8_t axis, uint16_t microsteps, uint32_t *done_time_us) {
+    if (!tmc_enabled || axis >= NUM_AXES) return false;
+    if (!bus_try_acquire()) return false;
+    // The DMA is done once the last byte is in the FIFO, a switch behind bytes still waiting there would reach its
+    // driver later than done_time_us says. Only the byte in the shift register is covered by the estimate
+    if (dma_channel_is_busy(tmc_dma_channel) || !pio_sm_is_tx_fifo_empty(tmc_pio, sm_tx)) {
+        bus_release();
+        return false;
+    }
+
+    uint8_t mres = microsteps_to_mres(microsteps);
+    size_t length = 0;
+    for (uint8_t i = 0; i < axis_driver_count[axis]; i++) {
+        uint8_t address = axis_addresses[axis][i];
+        chopconf_shadow[address] = (chopconf_shadow[address] & ~TMC2209_CHOPCONF_MRES_MASK) |
+                                   ((uint32_t)mres << TMC2209_CHOPCONF_MRES_SHIFT);
+        build_write_datagram(&async_buffer[length], address, TMC2209_REG_CHOPCONF, chopconf_shadow[address]);
+        length += 8;
+    }
+    dma_channel_transfer_from_buffer_now(tmc_dma_channel, async_buffer, length);
+    *done_time_us = time_us_32() + (length + 1) * TMC2209_BYTE_TIME_US;
+
+    // The DMA keeps the next user waiting in wait_tx_idle(), the bus itself can be released right away
+    bus_release();
+    return true;
+}
+
+bool tmc2209_set_current(uint8_t axis, uint8_t run_current, uint8_t hold_current) {
+    if (!tmc_enabled || axis >= NUM_AXES) return false;
+
+    uint32_t ihold_irun = (hold_current & 0x1F) | ((uint32_t)(run_current & 0x1F) << 8) | ((uint32_t)TMC2209_IHOLDDELAY << 16);
+    bool ok = true;
+    for (uint8_t i = 0; i < axis_driver_count[axis]; i++) {
+        ok &= tmc2209_write_register(axis_addresses[axis][i], TMC2209_REG_IHOLD_IRUN, ihold_irun);
+    }
+    return ok;
+}
+
+bool tmc2209_read_status(uint8_t axis, tmc2209_status_t *status) {
+    memset(status, 0, sizeof(tmc2209_status_t));
+    if (!tmc_enabled || axis >= NUM_AXES) return false;
+
+    uint8_t address = axis_addresses[axis][0];
+    uint32_t sg_result = 0;
+    uint8_t mres = (chopconf_shadow[address] & TMC2209_CHOPCONF_MRES_MASK) >> TMC2209_CHOPCONF_MRES_SHIFT;
+    status->microstepping = (uint16_t)(256u >> mres);
+    status->ok = tmc2209_read_register(address, TMC2209_REG_SG_RESULT, &sg_result) &&
+                 tmc2209_read_register(address, TMC2209_REG_DRV_STATUS, &status->drv_status);
+    status->sg_result = (uint16_t)sg_result;
+    return status->ok;
+}
+
+void tmc2209_request_status(uint8_t axis) {
+    status_request_axis = axis;
+}
+
+void tmc2209_request_current(uint8_t axis, uint8_t run_current, uint8_t hold_current) {
+    current_request_axis = axis;
+    current_request_run = run_current;
+    current_request_hold = hold_current;
+    current_requested = true;
+}
+
+// Register traffic takes milliseconds, so requests from the UART interrupt are handled here in the main loop
+void tmc2209_background_task(void) {
+    if (current_requested) {
+        current_requested = false;
+        for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+            if (current_request_axis == axis || current_request_axis == 0xFF) {
+                tmc2209_set_current(axis, current_request_run, current_request_hold);
+            }
+        }
+    }
+
+    if (status_request_axis >= 0) {
+        uint8_t axis = (uint8_t)status_request_axis;
+        status_request_axis = -1;
+
+        // Status: axis(u8) + ok(u8) + microstepping(u16) + sg_result(u16) + drv_status(u32)
+        tmc2209_status_t status;
+        uint8_t response[10];
+        tmc2209_read_status(axis, &status);
+        response[0] = axis;
+        response[1] = status.ok ? 1 : 0;
+        memcpy(&response[2], &status.microstepping, sizeof(uint16_t));
+        memcpy(&response[4], &status.sg_result, sizeof(uint16_t));
+        memcpy(&response[6], &status.drv_status, sizeof(uint32_t));
+        queue_response(CMD_DRIVER_STATUS, response, sizeof(response));
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef TMC2209_H
+#define TMC2209_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/sync.h"
+#include "STEPPER.h"
+#include "DEBUGPRINT.h"
+
+// TMC2209 register access over the single wire PDN_UART interface (TMC2209_TX_PIN)
+// The UART is done by PIO so no hardware UART is used up. Core 0 does blocking reads/writes (setup, diagnostics),
+// core 1 can switch the microstep resolution without blocking - the datagrams are pushed out by DMA.
+
+#define TMC2209_BAUD_RATE 115200
+#define TMC2209_SYNC 0x05
+#define TMC2209_WRITE 0x80
+#define TMC2209_REPLY_TIMEOUT_US 5000
+#define TMC2209_DRIVERS_PER_AXIS 2      // X has two drivers on the same step pin
+
+// Registers
+#define TMC2209_REG_GCONF 0x00
+#define TMC2209_REG_GSTAT 0x01
+#define TMC2209_REG_IFCNT 0x02
+#define TMC2209_REG_IHOLD_IRUN 0x10
+#define TMC2209_REG_TCOOLTHRS 0x14
+#define TMC2209_REG_SGTHRS 0x40
+#define TMC2209_REG_SG_RESULT 0x41
+#define TMC2209_REG_MSCNT 0x6A
+#define TMC2209_REG_CHOPCONF 0x6C
+#define TMC2209_REG_DRV_STATUS 0x6F
+
+#define TMC2209_GCONF_DEFAULT 0x000001C1u       // I_scale_analog, pdn_disable, mstep_reg_select, multistep_filt
+#define TMC2209_CHOPCONF_DEFAULT 0x10000053u    // intpol, TOFF=3, HSTRT=5 (reset default without MRES)
+#define TMC2209_CHOPCONF_MRES_SHIFT 24
+#define TMC2209_CHOPCONF_MRES_MASK (0xFu << TMC2209_CHOPCONF_MRES_SHIFT)
+#define TMC2209_IHOLDDELAY 8
+
+// Defaults for the flash config
+#define TMC2209_ADDRESS_X 0
+#define TMC2209_ADDRESS_X2 3
+#define TMC2209_ADDRESS_Y 1
+#define TMC2209_ADDRESS_Z 2
+#define TMC2209_RUN_CURRENT 16          // IRUN, 0-31
+#define TMC2209_HOLD_CURRENT 8          // IHOLD, 0-31
+#define SLEW_MICROSTEPPING 16           // Coarse resolution for static moves and celestial slews
+#define TRACK_MICROSTEPPING 256         // Fine resolution for tracking
+
+typedef struct {
+    bool ok;                    // All reads succeeded
+    uint16_t microstepping;     // What the driver is set to now
+    uint16_t sg_result;         // StallGuard result, lower = more load
+    uint32_t drv_status;        // Raw DRV_STATUS
+} tmc2209_status_t;
+
+bool tmc2209_init(void);
+bool tmc2209_configure(void);
+bool tmc2209_is_enabled(void);
+bool tmc2209_write_register(uint8_t address, uint8_t reg, uint32_t value);
+bool tmc2209_read_register(uint8_t address, uint8_t reg, uint32_t *value);
+bool tmc2209_try_set_microstepping(uint8_t axis, uint16_t microsteps, uint32_t *done_time_us);
+bool tmc2209_set_current(uint8_t axis, uint8_t run_current, uint8_t hold_current);
+bool tmc2209_read_status(uint8_t axis, tmc2209_status_t *status);
+void tmc2209_request_status(uint8_t axis);
+void tmc2209_request_current(uint8_t axis, uint8_t run_current, uint8_t hold_current);
+void tmc2209_background_task(void);
+
+#endif // TMC2209_H
@@ -1,4 +1,12 @@
 #include "UART.h"
+#include "CONFIG.h"
+#include "TMC2209.h"
+#include "PROFILE.h"
+#include "ALIGN.h"
+#include "HOME.h"
+#include "GUIDE.h"
+#include "DS18B20.h"
+#include "SEQUENCE.h"
 
 
 int missed_acks = 0;
@@ -7,20 +15,25 @@ uint8_t last_received_id = 0x00; // Last received message ID, a new message must
 pending_message_t pending_message;
 uint8_t tx_buffer[TX_BUFFER_SIZE]; // Buffer for DMA transmission
 volatile bool tx_busy = false;     // Flag to indicate if DMA TX is in progress
+static volatile transport_t active_transport = TRANSPORT_UART;  // Where the last good frame came from
 
 int uart_tx_dma_channel = -1;      // DMA channel for UART TX
 
 response_message_t response_queue[MAX_RESPONSES];
+static uint32_t response_order = 0;
+static response_message_t priority_response;   // Goes out before anything in the queue (CMD_ESTOPTRIG)
 
 void uart_init_protocol(void) {
 
     for (int i = 0; i < MAX_RESPONSES; i++) {
         response_queue[i].ready = false;
     }
+    priority_response.ready = false;
 
-    uart_init(UART_ID, BAUD_RATE);
-    gpio_set_function(UART_TX_PIN, GPIO_FUNC_UART);
-    gpio_set_function(UART_RX_PIN, GPIO_FUNC_UART);
+    link_init(device_config.baud_rate);
+    uart_init(UART_ID, device_config.baud_rate);
+    gpio_set_function(device_config.uart_tx_pin, GPIO_FUNC_UART);
+    gpio_set_function(device_config.uart_rx_pin, GPIO_FUNC_UART);
     irq_set_exclusive_handler(UART0_IRQ, on_uart_rx);
     irq_set_enabled(UART0_IRQ, true);
     uart_set_irq_enables(UART_ID, true, false);
@@ -203,6 +216,14 @@ void send_uart_message(pending_message_t *msg) {
 
     size_t encoded_size = cobsEncode(raw_buffer, raw_buf_size, tx_buffer);
     tx_buffer[encoded_size] = 0x00; // COBS delimiter
+
+    // Over USB the CDC driver buffers the frame, the DMA stays with the UART
+    if (active_transport == TRANSPORT_USB) {
+        stdio_usb.out_chars((const char *)tx_buffer, (int)encoded_size + 1);
+        DEBUG_PRINT("Sent over USB: CMD=0x%02X, ID=0x%02X, LEN=%d, CRC=0x%02X\n",
+            msg->cmd_type, msg->msg_id, msg->data_length, crc);
+        return;
+    }
     
     // Set up and start DMA transfer
     dma_channel_set_read_addr(uart_tx_dma_channel, tx_buffer, true);
@@ -239,6 +260,7 @@ void process_timeouts(void) {
                 DEBUG_PRINT("ERROR: Message failed after %d retries: CMD=0x%02X, ID=0x%02X\n", 
                         MAX_RETRANSMITS, pending_message.cmd_type, pending_message.msg_id);
                 pending_message.in_use = false;
+                if (active_transport == TRANSPORT_UART) link_lost();
 
                 missed_acks++;
                 if (missed_acks >= MAX_MISSED_ACKS) {
@@ -253,9 +275,46 @@ void process_timeouts(void) {
     }
 }
 
+// Block until everything queued for the UART has left the wire
+void uart_flush_tx(void) {
+    while (tx_busy) {
+        tight_loop_contents();
+    }
+    uart_tx_wait_blocking(UART_ID);
+}
+
+static void send_link_status(void) {
+    uint8_t status[24];
+    queue_response(CMD_LINK_STATUS, status, link_get_status(status));
+}
+
+// Applies rate changes once the ACK of CMD_BAUD_SET is out, the host switches when it receives it
+static void link_task(void) {
+    bool ack_sent = !tx_busy;
+    for (int i = 0; i < MAX_RESPONSES; i++) {
+        if (response_queue[i].ready && response_queue[i].command == CMD_ACK) ack_sent = false;
+    }
+    bool report;
+    uint32_t irq_state = save_and_disable_interrupts();
+    uint32_t rate = link_poll(to_ms_since_boot(get_absolute_time()), ack_sent, &report);
+    restore_interrupts(irq_state);
+
+    if (rate) {
+        uart_flush_tx();
+        uart_set_baudrate(UART_ID, rate);
+    }
+    if (report) {
+        send_link_status();
+    }
+}
+
+static void usb_receive_task(void);
+
 void uart_background_task() {
+    usb_receive_task();
     process_timeouts();
     process_responses();
+    link_task();
 }
 
 void queue_response(uint8_t cmd_type, const uint8_t *data, size_t data_length) {
@@ -265,6 +324,7 @@ void queue_response(uint8_t cmd_type, const uint8_t *data, size_t data_length) {
             response_queue[i].command = cmd_type;
             response_queue[i].data_length = data_length > RESPONSE_DATA_SIZE ? RESPONSE_DATA_SIZE : data_length;    // Cap data length if too long (shouldn't happen)
             memcpy(response_queue[i].data, data, response_queue[i].data_length);
+            response_queue[i].order = response_order++;
             response_queue[i].ready = true;
             return;
         }
@@ -272,14 +332,49 @@ void queue_response(uint8_t cmd_type, const uint8_t *data, size_t data_length) {
     DEBUG_PRINT("ERROR: Response queue full, message dropped\n");
 }
 
-void process_responses(void) {
+uint8_t response_queue_free(void) {
+    uint8_t free_slots = 0;
     for (int i = 0; i < MAX_RESPONSES; i++) {
-        if (response_queue[i].ready) {
-            if(send_command(response_queue[i].command, 
-                             response_queue[i].data, 
-                             response_queue[i].data_length)) {
-                response_queue[i].ready = false;
-            }
+        if (!response_queue[i].ready) free_slots++;
+    }
+    return free_slots;
+}
+
+// Single slot that jumps the queue, a newer priority message replaces one that has not gone out yet.
+// It still has to wait for the ACK of a message already on the wire (stop-and-wait)
+void queue_priority_response(uint8_t cmd_type, const uint8_t *data, size_t data_length) {
+    priority_response.ready = false;
+    priority_response.command = cmd_type;
+    priority_response.data_length = data_length > RESPONSE_DATA_SIZE ? RESPONSE_DATA_SIZE : data_length;
+    memcpy(priority_response.data, data, priority_response.data_length);
+    priority_response.ready = true;
+}
+
+void process_responses(void) {
+    // While the priority message waits for the link, ACKs still go out so the host's commands are not left hanging
+    bool acks_only = false;
+    if (priority_response.ready) {
+        if (send_command(priority_response.command, priority_response.data, priority_response.data_length)) {
+            priority_response.ready = false;
+        } else {
+            acks_only = true;
+        }
+    }
+    // Oldest first, a slot freed and filled again must not overtake the ones still waiting (shutter events, sequence
+    // reports go out in the order they happened)
+    bool tried[MAX_RESPONSES] = { false };
+    for (int pass = 0; pass < MAX_RESPONSES; pass++) {
+        int oldest = -1;
+        for (int i = 0; i < MAX_RESPONSES; i++) {
+            if (tried[i] || !response_queue[i].ready || (acks_only && response_queue[i].command != CMD_ACK)) continue;
+            if (oldest < 0 || (int32_t)(response_queue[i].order - response_queue[oldest].order) < 0) oldest = i;
+        }
+        if (oldest < 0) break;
+        tried[oldest] = true;
+        if (send_command(response_queue[oldest].command,
+                         response_queue[oldest].data,
+                         response_queue[oldest].data_length)) {
+            response_queue[oldest].ready = false;
         }
     }
 }
@@ -294,130 +389,459 @@ void send_ack(uint8_t msg_id) {
     send_uart_message(&ack_msg);
 }
 
-// UART RX interrupt handler
-// NOTE: No DEBUG_PRINT allowed here - it uses USB which can block/deadlock in IRQ context
-void on_uart_rx(void) {
-    static uint8_t incoming_buffer[CMD_BUFFER_SIZE];
-    static int incoming_buffer_index = 0;
-    
-    while (uart_is_readable(UART_ID)) {
-        uint8_t c = uart_getc(UART_ID);
-        
-        if (c == 0) {
-            if (incoming_buffer_index > 0) {
-                uint8_t decoded[CMD_BUFFER_SIZE];
-                size_t decoded_size = cobsDecode(incoming_buffer, incoming_buffer_index, decoded);
+static void process_batch(const uint8_t *data, uint8_t data_length, uint32_t frame_end_us);
+
+// Runs one command, data is its payload. Also runs the sub-commands of a batch frame
+static void process_command(uint8_t cmd_type, const uint8_t *data, uint8_t data_length, uint32_t frame_end_us) {
+    switch (cmd_type) {
+        case CMD_ACK:
+            if (data_length >= 1) {
+                uint8_t acked_id = data[0];  // First data byte
+                if (pending_message.in_use && pending_message.msg_id == acked_id) {
+                    pending_message.in_use = false;
+                    missed_acks = 0;
+                }
+            }
+            break;
+        case CMD_PAUSE:
+            // Optional payload: hard(1), pauses without the deceleration ramp
+            if (data_length >= 1 && data[0]) {
+                stepper_hard_pause();
+            } else {
+                stepper_pause();
+            }
+            break;
+        case CMD_RESUME:
+            stepper_resume();
+            break;
+        case CMD_STOP:
+            // Optional payload: hard(1), disables the drivers without the deceleration ramp
+            if (data_length >= 1 && data[0]) {
+                stepper_stop_celestial_tracking();  // Stop celestial tracking if active
+                stepper_set_enable(false);
+            } else {
+                stepper_stop();
+            }
+            break;
+        case CMD_MOVE_STATIC:
+            if (data_length >= 5) {
+                uint8_t axis = data[0];
+                int32_t position;
+                memcpy(&position, &data[1], sizeof(int32_t));
+                stepper_queue_static_move(axis, position);
+            }
+            break;
+        case CMD_MOVE_TRACKING:
+            if (data_length >= 12) { // 3 floats (4 bytes each)
+                float x_rate, y_rate, z_rate;
+                
+                memcpy(&x_rate, &data[0], sizeof(float));
+                memcpy(&y_rate, &data[4], sizeof(float));
+                memcpy(&z_rate, &data[8], sizeof(float));
+                    
+                stepper_start_tracking(x_rate, y_rate, z_rate);
+            }
+            break;
+        case CMD_TRACK_CELESTIAL:
+            // Payload: RA(4) + Dec(4) + matrix(36) + refTime(8) + latitude(4) = 56 bytes
+            if (data_length >= 56) {
+                float ra, dec, latitude;
+                float align_matrix[9];
+                uint64_t ref_time;
+                
+                memcpy(&ra, &data[0], sizeof(float));
+                memcpy(&dec, &data[4], sizeof(float));
+                memcpy(align_matrix, &data[8], 9 * sizeof(float));
+                memcpy(&ref_time, &data[44], sizeof(uint64_t));
+                memcpy(&latitude, &data[52], sizeof(float));
                 
-                if (decoded_size < 4) {  // CMD + ID + LEN + CRC minimum
-                    incoming_buffer_index = 0;
-                    continue;
+                stepper_start_celestial_tracking(ra, dec, align_matrix, ref_time, latitude);
+            }
+            break;
+        case CMD_GOTO_CELESTIAL:
+            // Payload: RA(4) + Dec(4) + optional unix time(8, ms), needs at least one CMD_ALIGN_SYNC
+            if (data_length >= 8) {
+                float ra, dec;
+                memcpy(&ra, &data[0], sizeof(float));
+                memcpy(&dec, &data[4], sizeof(float));
+                if (data_length >= 16) {
+                    int64_t unix_ms;
+                    memcpy(&unix_ms, &data[8], sizeof(int64_t));
+                    astro_set_unix_time(unix_ms);
                 }
-
-                uint8_t cmd_type = decoded[0];
-                uint8_t msg_id = decoded[1];
-                uint8_t data_length = decoded[2];
-                if (decoded_size != data_length + 4) {  // CMD + ID + LEN + DATA + CRC
-                    incoming_buffer_index = 0;
-                    continue;
+                stepper_start_model_tracking(ra, dec);
+            }
+            break;
+        case CMD_ALIGN_SYNC:
+            // Payload: RA(4) + Dec(4) of the star the mount is centred on + optional unix time(8, ms)
+            if (data_length >= 8) {
+                float ra, dec;
+                memcpy(&ra, &data[0], sizeof(float));
+                memcpy(&dec, &data[4], sizeof(float));
+                if (data_length >= 16) {
+                    int64_t unix_ms;
+                    memcpy(&unix_ms, &data[8], sizeof(int64_t));
+                    astro_set_unix_time(unix_ms);
                 }
-
-                uint8_t received_crc = decoded[decoded_size - 1];
-                uint8_t calculated_crc = calculate_crc8(decoded, decoded_size - 1);
-                if (received_crc != calculated_crc) {
-                    incoming_buffer_index = 0;
-                    continue;
+                align_sync(ra, dec);
+            }
+            break;
+        case CMD_ALIGN_CONTROL:
+            // Payload: action(1), answered with CMD_ALIGN_STATUS once the model is re-solved
+            if (data_length >= 1) {
+                align_control(data[0]);
+            }
+            break;
+        case CMD_GUIDE:
+            // Payload: mode(1) + int16 X, Y, Z pulse (ms) or nudge (0.01 arcsec), signed
+            if (data_length >= 7) {
+                int16_t values[NUM_AXES];
+                memcpy(values, &data[1], sizeof(values));
+                guide_command(data[0], values, frame_end_us);
+            }
+            break;
+        case CMD_GUIDE_CONTROL:
+            // Payload: action(1), answered with CMD_GUIDE_STATUS
+            if (data_length >= 1) {
+                guide_control(data[0]);
+            }
+            break;
+        case CMD_SEQUENCE_START:
+            // Payload: the 22 byte plan, see SEQUENCE.c. Answered with CMD_SEQUENCE_STATUS only if rejected
+            sequence_start(data, data_length);
+            break;
+        case CMD_SEQUENCE_CONTROL:
+            // Payload: action(1), answered with CMD_SEQUENCE_STATUS
+            if (data_length >= 1) {
+                sequence_control(data[0]);
+            }
+            break;
+        case CMD_BAUD_SET:
+            // Payload: uint32 baud rate, the switch happens once the ACK is out. Answered only when rejected,
+            // also over USB which has no rate of its own
+            if (data_length >= 4) {
+                uint32_t rate;
+                memcpy(&rate, &data[0], sizeof(uint32_t));
+                if (active_transport == TRANSPORT_USB || !link_request(rate)) {
+                    send_link_status();
                 }
-
-                if (msg_id == last_received_id) {
-                    queue_response(CMD_ACK, &msg_id, 1);
-                    incoming_buffer_index = 0;
-                    continue;
+            }
+            break;
+        case CMD_LINK_CONTROL:
+            // No payload, answered with CMD_LINK_STATUS
+            send_link_status();
+            break;
+        case CMD_BATCH:
+            process_batch(data, data_length, frame_end_us);
+            break;
+        case CMD_HOME:
+            // Payload: axis mask(1), 0 aborts. Answered with CMD_HOME_STATUS per axis
+            if (data_length >= 1) {
+                if (data[0]) {
+                    home_start(data[0]);
+                } else {
+                    home_abort();
                 }
-
-                // New message, process it
-                last_received_id = msg_id;
-                
-                if (cmd_type != CMD_ACK) {
-                    queue_response(CMD_ACK, &msg_id, 1);
+            }
+            break;
+        case CMD_GETPOS:
+            uint8_t response[12];
+            int32_t x = stepper_get_position_arcsec(AXIS_X);
+            int32_t y = stepper_get_position_arcsec(AXIS_Y);
+            int32_t z = stepper_get_position_arcsec(AXIS_Z);
+            memcpy(&response[0],  &x, sizeof(int32_t));
+            memcpy(&response[4],  &y, sizeof(int32_t));
+            memcpy(&response[8],  &z, sizeof(int32_t));
+
+            queue_response(CMD_POSITION, response, 12);
+            break;
+        case CMD_TEMP_GET:
+            // Payload: sensor index(1), answered with CMD_TEMP_SENSOR
+            if (data_length >= 1) {
+                // index(1) + count(1) + ROM(8) + resolution(1) + valid(1) + temperature(4, float °C)
+                uint8_t temp_response[16] = {0};
+                float celsius = DS18B20_NO_READING;
+                temp_response[0] = data[0];
+                temp_response[1] = ds18b20_count();
+                ds18b20_get_rom(data[0], &temp_response[2]);
+                temp_response[10] = ds18b20_resolution();
+                temp_response[11] = ds18b20_get_temp(data[0], &celsius) ? 1 : 0;
+                memcpy(&temp_response[12], &celsius, sizeof(float));
+                queue_response(CMD_TEMP_SENSOR, temp_response, sizeof(temp_response));
+            }
+            break;
+        case CMD_CONFIG_GET:
+            // Payload: key(1), answered with CMD_CONFIG_VALUE
+            if (data_length >= 1) {
+                uint8_t value_response[6];
+                uint32_t value = 0;
+                value_response[0] = data[0];
+                value_response[1] = config_get(data[0], &value) ? 1 : 0;
+                memcpy(&value_response[2], &value, sizeof(uint32_t));
+                queue_response(CMD_CONFIG_VALUE, value_response, 6);
+            }
+            break;
+        case CMD_CONFIG_SET:
+            // Payload: key(1) + value(4), floats are sent as their raw bytes
+            if (data_length >= 5) {
+                uint32_t value;
+                memcpy(&value, &data[1], sizeof(uint32_t));
+                if (!config_set(data[0], value)) {
+                    // Refused, answered with the value that stays
+                    uint8_t value_response[6];
+                    value_response[0] = data[0];
+                    value_response[1] = 0;
+                    config_get(data[0], &value);
+                    memcpy(&value_response[2], &value, sizeof(uint32_t));
+                    queue_response(CMD_CONFIG_VALUE, value_response, 6);
                 }
-                
-                // Process the command
-                switch (cmd_type) {
-                    case CMD_ACK:
-                        if (data_length >= 1) {
-                            uint8_t acked_id = decoded[3];  // First data byte
-                            if (pending_message.in_use && pending_message.msg_id == acked_id) {
-                                pending_message.in_use = false;
-                                missed_acks = 0;
-                            }
-                        }
-                        break;
-                    case CMD_PAUSE:
-                        stepper_pause();
-                        break;
-                    case CMD_RESUME:
-                        stepper_resume();
-                        break;
-                    case CMD_STOP:
-                        stepper_stop_celestial_tracking();  // Stop celestial tracking if active
-                        stepper_set_enable(false);
-                        break;
-                    case CMD_MOVE_STATIC:
-                        if (data_length >= 5) {
-                            uint8_t axis = decoded[3];
-                            int32_t position;
-                            memcpy(&position, &decoded[4], sizeof(int32_t));
-                            stepper_queue_static_move(axis, position);
-                        }
-                        break;
-                    case CMD_MOVE_TRACKING:
-                        if (data_length >= 12) { // 3 floats (4 bytes each)
-                            float x_rate, y_rate, z_rate;
-                            
-                            memcpy(&x_rate, &decoded[3], sizeof(float));
-                            memcpy(&y_rate, &decoded[7], sizeof(float));
-                            memcpy(&z_rate, &decoded[11], sizeof(float));
-                                
-                            stepper_start_tracking(x_rate, y_rate, z_rate);
-                        }
-                        break;
-                    case CMD_TRACK_CELESTIAL:
-                        // Payload: RA(4) + Dec(4) + matrix(36) + refTime(8) + latitude(4) = 56 bytes
-                        if (data_length >= 56) {
-                            float ra, dec, latitude;
-                            float align_matrix[9];
-                            uint64_t ref_time;
-                            
-                            memcpy(&ra, &decoded[3], sizeof(float));
-                            memcpy(&dec, &decoded[7], sizeof(float));
-                            memcpy(align_matrix, &decoded[11], 9 * sizeof(float));
-                            memcpy(&ref_time, &decoded[47], sizeof(uint64_t));
-                            memcpy(&latitude, &decoded[55], sizeof(float));
-                            
-                            stepper_start_celestial_tracking(ra, dec, align_matrix, ref_time, latitude);
-                        }
-                        break;
-                    case CMD_GETPOS:
-                        uint8_t response[12];
-                        int32_t x = stepper_get_position_arcsec(AXIS_X);
-                        int32_t y = stepper_get_position_arcsec(AXIS_Y);
-                        int32_t z = stepper_get_position_arcsec(AXIS_Z);
-                        memcpy(&response[0],  &x, sizeof(int32_t));
-                        memcpy(&response[4],  &y, sizeof(int32_t));
-                        memcpy(&response[8],  &z, sizeof(int32_t));
-
-                        queue_response(CMD_POSITION, response, 12);
-                        break;
+            }
+            break;
+        case CMD_CONFIG_SAVE:
+            // Payload: flags(1)
+            config_request_save(data_length >= 1 ? data[0] : 0);
+            break;
+        case CMD_PEC_UPLOAD:
+            // Payload: axis(1) + start index(1) + count(1) + int8 values[count]
+            if (data_length >= 3 && data_length >= 3 + data[2]) {
+                pec_upload(data[0], data[1], data[2], (const int8_t *)&data[3]);
+            }
+            break;
+        case CMD_PEC_CONTROL:
+            // Payload: axis(1) + action(1)
+            if (data_length >= 2) {
+                uint8_t axis = data[0];
+                switch (data[1]) {
+                    case PEC_ACTION_DISABLE: pec_set_enabled(axis, false); break;
+                    case PEC_ACTION_ENABLE: pec_set_enabled(axis, true); break;
+                    case PEC_ACTION_RECORD: pec_start_recording(axis); break;
+                    case PEC_ACTION_ABORT_RECORD: pec_abort_recording(); break;
+                    case PEC_ACTION_CLEAR: pec_clear(axis); break;
                 }
+                pec_send_status(axis);
             }
-            
-            incoming_buffer_index = 0;
-        } else {
-            if (incoming_buffer_index < CMD_BUFFER_SIZE - 1) {
-                incoming_buffer[incoming_buffer_index++] = c;
-            } else {
-                incoming_buffer_index = 0;  // Buffer overflow, reset
+            break;
+        case CMD_PEC_SAMPLE:
+            // Payload: axis(1) + int16 guide correction (0.1 arcsec)
+            if (data_length >= 3) {
+                int16_t correction;
+                memcpy(&correction, &data[1], sizeof(int16_t));
+                pec_add_guide_sample(data[0], correction);
+            }
+            break;
+        case CMD_PEC_GETTABLE:
+            // Payload: axis(1) + start index(1) + count(1)
+            if (data_length >= 3) {
+                uint8_t table_response[3 + PEC_MAX_DOWNLOAD_CHUNK];
+                uint8_t count = pec_download(data[0], data[1], data[2], (int8_t *)&table_response[3]);
+                table_response[0] = data[0];
+                table_response[1] = data[1];
+                table_response[2] = count;
+                queue_response(CMD_PEC_TABLE, table_response, 3 + count);
+            }
+            break;
+        case CMD_PROFILE_UPLOAD:
+            // Payload: count(1) + points[count], answered with CMD_PROFILE_STATUS so the host knows what fits
+            if (data_length >= 1 && data_length >= 1 + data[0] * 16) {
+                profile_upload(data[0], &data[1]);
+                profile_send_status();
+            }
+            break;
+        case CMD_PROFILE_CONTROL:
+            // Payload: action(1)
+            if (data_length >= 1) {
+                switch (data[0]) {
+                    case PROFILE_ACTION_STOP: profile_stop(); break;
+                    case PROFILE_ACTION_START: stepper_start_profile(false); break;
+                    case PROFILE_ACTION_FOLLOW: stepper_start_profile(true); break;
+                    case PROFILE_ACTION_CLEAR: profile_clear(); break;
+                }
+                profile_send_status();
+            }
+            break;
+        case CMD_DRIVER_GETSTATUS:
+            // Payload: axis(1), answered with CMD_DRIVER_STATUS from the main loop
+            if (data_length >= 1) {
+                tmc2209_request_status(data[0]);
+            }
+            break;
+        case CMD_DRIVER_CURRENT:
+            // Payload: axis(1, 0xFF = all) + run current(1) + hold current(1), 0-31 each
+            if (data_length >= 3) {
+                tmc2209_request_current(data[0], data[1], data[2]);
             }
+            break;
+    }
+}
+
+// Zigzag varint (LEB128), small values of either sign take one or two bytes instead of four.
+// A 5th byte only has room for the top 4 bits, anything above them is an over-long or corrupt varint
+static bool read_varint(const uint8_t **cursor, const uint8_t *end, int32_t *value) {
+    uint32_t raw = 0;
+    for (uint8_t shift = 0; shift < 35; shift += 7) {
+        if (*cursor >= end) return false;
+        uint8_t byte = *(*cursor)++;
+        if (shift == 28 && (byte & 0x70)) return false;
+        raw |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = (int32_t)(raw >> 1) ^ -(int32_t)(raw & 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Rewrites the compact v2 payload of a sub-command into its v1 payload, commands without a compact form pass through
+static bool expand_compact(uint8_t cmd_type, const uint8_t *data, uint8_t data_length, uint8_t *expanded, uint8_t *expanded_length) {
+    const uint8_t *cursor = data;
+    const uint8_t *end = data + data_length;
+    switch (cmd_type) {
+        case CMD_MOVE_STATIC: {
+            // axis(1) + varint position (arcsec)
+            int32_t position;
+            if (data_length < 1) return false;
+            cursor++;
+            if (!read_varint(&cursor, end, &position) || cursor != end) return false;
+            expanded[0] = data[0];
+            memcpy(&expanded[1], &position, sizeof(int32_t));
+            *expanded_length = 5;
+            return true;
         }
+        case CMD_MOVE_TRACKING:
+            // varint X, Y, Z rate (BATCH_RATE_UNITS per arcsec/s)
+            for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+                int32_t units;
+                if (!read_varint(&cursor, end, &units)) return false;
+                float rate = units / BATCH_RATE_UNITS;
+                memcpy(&expanded[axis * 4], &rate, sizeof(float));
+            }
+            if (cursor != end) return false;
+            *expanded_length = 12;
+            return true;
+        default:
+            memcpy(expanded, data, data_length);
+            *expanded_length = data_length;
+            return true;
+    }
+}
+
+// Protocol v2 batch frame: cmd(1) + length(1) + payload entries back to back, all covered by the one ACK of the frame.
+// The first pass only checks the batch, so a malformed one is dropped instead of half executed
+static void process_batch(const uint8_t *data, uint8_t data_length, uint32_t frame_end_us) {
+    uint8_t expanded[CMD_BUFFER_SIZE];
+    uint8_t expanded_length;
+
+    for (uint8_t pass = 0; pass < 2; pass++) {
+        uint8_t offset = 0;
+        while (offset < data_length) {
+            if (data_length - offset < 2) return;
+            uint8_t cmd_type = data[offset];
+            uint8_t length = data[offset + 1];
+            offset += 2;
+            if (length > data_length - offset) return;
+            if (cmd_type == CMD_ACK || cmd_type == CMD_BATCH) return;  // Neither makes sense inside a batch
+            if (!expand_compact(cmd_type, &data[offset], length, expanded, &expanded_length)) return;
+            if (pass == 1) {
+                process_command(cmd_type, expanded, expanded_length, frame_end_us);
+            }
+            offset += length;
+        }
+    }
+}
+
+// Counts a frame for the link quality of the transport it came in on, only the UART has a rate to fall back from
+static void count_frame(transport_t transport, bool ok) {
+    if (transport == TRANSPORT_UART) link_frame(ok);
+}
+
+// One byte of the framing shared by both transports: COBS delimited, CMD + ID + LEN + DATA + CRC.
+// A good frame also makes its transport the one responses go out on
+static void receive_byte(frame_rx_t *rx, uint8_t c, transport_t transport) {
+    if (c != 0) {
+        if (rx->index < CMD_BUFFER_SIZE - 1) {
+            rx->buffer[rx->index++] = c;
+        } else {
+            count_frame(transport, false);
+            rx->index = 0;  // Buffer overflow, reset
+        }
+        return;
+    }
+    if (rx->index == 0) return;
+
+    uint32_t frame_end_us = time_us_32();
+    uint8_t decoded[CMD_BUFFER_SIZE];
+    size_t decoded_size = cobsDecode(rx->buffer, rx->index, decoded);
+    rx->index = 0;
+
+    if (decoded_size < 4) {  // CMD + ID + LEN + CRC minimum
+        count_frame(transport, false);
+        return;
     }
-}
\ No newline at end of file
+
+    uint8_t cmd_type = decoded[0];
+    uint8_t msg_id = decoded[1];
+    uint8_t data_length = decoded[2];
+    if (decoded_size != (size_t)data_length + 4) {  // CMD + ID + LEN + DATA + CRC
+        count_frame(transport, false);
+        return;
+    }
+
+    uint8_t received_crc = decoded[decoded_size - 1];
+    uint8_t calculated_crc = calculate_crc8(decoded, decoded_size - 1);
+    if (received_crc != calculated_crc) {
+        count_frame(transport, false);
+        return;
+    }
+    count_frame(transport, true);
+    active_transport = transport;
+
+    // Guide corrections skip the ACK and the duplicate check, the host never waits for them
+    // and a lost one is made up by the next. Latency is counted from the end of the frame
+    if (cmd_type == CMD_GUIDE) {
+        process_command(cmd_type, &decoded[3], data_length, frame_end_us);
+        return;
+    }
+
+    if (msg_id == last_received_id) {
+        queue_response(CMD_ACK, &msg_id, 1);
+        return;
+    }
+
+    // New message, process it
+    last_received_id = msg_id;
+
+    if (cmd_type != CMD_ACK) {
+        queue_response(CMD_ACK, &msg_id, 1);
+    }
+
+    process_command(cmd_type, &decoded[3], data_length, frame_end_us);
+}
+
+// UART RX interrupt handler
+// NOTE: No DEBUG_PRINT allowed here - it uses USB which can block/deadlock in IRQ context
+void on_uart_rx(void) {
+    static frame_rx_t uart_rx;
+
+    while (uart_is_readable(UART_ID)) {
+        receive_byte(&uart_rx, uart_getc(UART_ID), TRANSPORT_UART);
+    }
+}
+
+// USB CDC, polled from the background task. Frames are handled with the UART interrupt masked,
+// so the two transports never run commands over each other
+static void usb_receive_task(void) {
+    static frame_rx_t usb_rx;
+    char chunk[64];
+
+    if (active_transport == TRANSPORT_USB && !stdio_usb_connected()) {
+        active_transport = TRANSPORT_UART;  // Host went away, answer on the UART again
+    }
+    int count = stdio_usb.in_chars(chunk, sizeof(chunk));
+    if (count <= 0) return;
+
+    irq_set_enabled(UART0_IRQ, false);
+    for (int i = 0; i < count; i++) {
+        receive_byte(&usb_rx, (uint8_t)chunk[i], TRANSPORT_USB);
+    }
+    irq_set_enabled(UART0_IRQ, true);
+}
@@ -11,7 +11,10 @@
 #include "PIN_ASSIGNMENTS.h"
 #include "pico/time.h"
 #include "pico/stdlib.h"
+#include "pico/stdio_usb.h"
 #include "STEPPER.h"
+#include "PEC.h"
+#include "LINK.h"
 #include "DEBUGPRINT.h"
 
 #define CRC8_POLYNOMIAL 0x07
@@ -22,22 +25,60 @@
 #define ACK_TIMEOUT_MS 1000
 #define MAX_RETRANSMITS 3
 #define MAX_MISSED_ACKS 2
-#define BAUD_RATE 9600
+#define BAUD_RATE 9600   // Default, the value in use comes from the flash config
+
+#define BATCH_RATE_UNITS 10000.0f   // Compact CMD_MOVE_TRACKING rates in CMD_BATCH are in 0.0001 arcsec/s
 
 extern int uart_tx_dma_channel;
 
 enum Commands {
     CMD_ACK = 0x01,
+    CMD_BATCH = 0x02,            // Protocol v2, several sub-commands in one frame with one ACK
+    CMD_BAUD_SET = 0x03,         // Step the link to another baud rate
+    CMD_LINK_CONTROL = 0x04,     // Request the link status
+    CMD_LINK_STATUS = 0x05,      // Link rate and error counts
     CMD_MOVE_STATIC = 0x10,
     CMD_MOVE_TRACKING = 0x11,
     CMD_PAUSE = 0x12,
     CMD_RESUME = 0x13,
     CMD_STOP = 0x14,
     CMD_TRACK_CELESTIAL = 0x15,  // Autonomous celestial tracking with alignment matrix
+    CMD_GOTO_CELESTIAL = 0x16,   // Slew to and track RA/Dec through the on-device pointing model
     CMD_GETPOS = 0x20,
     CMD_POSITION = 0x21,
     CMD_STATUS = 0x22,
-    CMD_ESTOPTRIG = 0x30
+    CMD_TEMP_GET = 0x23,         // Request a DS18B20 reading
+    CMD_TEMP_SENSOR = 0x24,      // DS18B20 ROM and reading (response to CMD_TEMP_GET)
+    CMD_ESTOPTRIG = 0x30,
+    CMD_LIMIT_EVENT = 0x31,      // A soft limit or forbidden zone stopped the motion
+    CMD_PEC_UPLOAD = 0x40,       // Upload a chunk of a PEC table
+    CMD_PEC_CONTROL = 0x41,      // Enable/disable/record/clear PEC on an axis
+    CMD_PEC_SAMPLE = 0x42,       // Guide correction sample used while recording
+    CMD_PEC_GETTABLE = 0x43,     // Request a chunk of a PEC table
+    CMD_PEC_TABLE = 0x44,        // Chunk of a PEC table (response to CMD_PEC_GETTABLE)
+    CMD_PEC_STATUS = 0x45,       // PEC status of an axis
+    CMD_CONFIG_GET = 0x50,       // Read a config value
+    CMD_CONFIG_SET = 0x51,       // Change a config value (takes effect after save + reboot)
+    CMD_CONFIG_VALUE = 0x52,     // Config value (response to CMD_CONFIG_GET)
+    CMD_CONFIG_SAVE = 0x53,      // Write the config to flash
+    CMD_DRIVER_GETSTATUS = 0x60, // Request TMC2209 status of an axis
+    CMD_DRIVER_STATUS = 0x61,    // TMC2209 status (response to CMD_DRIVER_GETSTATUS)
+    CMD_DRIVER_CURRENT = 0x62,   // Set TMC2209 run/hold current
+    CMD_PROFILE_UPLOAD = 0x70,   // Append points to the tracking profile
+    CMD_PROFILE_CONTROL = 0x71,  // Start/stop/clear the tracking profile
+    CMD_PROFILE_STATUS = 0x72,   // Tracking profile status
+    CMD_ALIGN_SYNC = 0x80,       // The mount is centred on this star, add it to the pointing model
+    CMD_ALIGN_CONTROL = 0x81,    // Clear/drop sync points of the pointing model
+    CMD_ALIGN_STATUS = 0x82,     // Pointing model status
+    CMD_HOME = 0x90,             // Home axes on their index switches
+    CMD_HOME_STATUS = 0x91,      // Result of homing an axis
+    CMD_GUIDE = 0xA0,            // Guide correction, not ACKed
+    CMD_GUIDE_CONTROL = 0xA1,    // Guiding status / clear the guide offset
+    CMD_GUIDE_STATUS = 0xA2,     // Guide offset and correction latency
+    CMD_SHUTTER_EVENT = 0xB0,    // Exposure start/end with time and axis positions
+    CMD_SEQUENCE_START = 0xB1,   // Run an exposure/dither plan
+    CMD_SEQUENCE_CONTROL = 0xB2, // Sequence status / abort
+    CMD_SEQUENCE_STATUS = 0xB3   // Sequence progress event
 };
 
 // Message tracking structure
@@ -51,12 +92,25 @@ typedef struct {
     uint8_t retries;             // Number of retransmission attempts
 } pending_message_t;
 
+// Messages come in over the UART or the USB CDC port, responses go back where the last good frame came from
+typedef enum {
+    TRANSPORT_UART = 0,
+    TRANSPORT_USB = 1
+} transport_t;
+
+// Frame being received on one transport
+typedef struct {
+    uint8_t buffer[CMD_BUFFER_SIZE];
+    int index;
+} frame_rx_t;
+
 #define RESPONSE_DATA_SIZE 32
 typedef struct {
     uint8_t command;
     uint8_t data[RESPONSE_DATA_SIZE];
     uint8_t data_length;
     bool ready;
+    uint32_t order;                 // Queued after every slot with a lower one, they go out oldest first
 } response_message_t;
 
 void uart_init_protocol();
@@ -64,6 +118,7 @@ uint8_t calculate_crc8(const uint8_t *data, size_t length);
 void on_uart_rx();
 void process_timeouts();
 void uart_background_task();
+void uart_flush_tx(void);
 bool send_uart_command(uint8_t cmd_type, const uint8_t *data, size_t data_length);
 void send_uart_message(pending_message_t *msg);
 void send_ack(uint8_t seq_num);
@@ -73,5 +128,7 @@ size_t cobsEncode(const void *data, size_t length, uint8_t *buffer);
 size_t cobsDecode(const uint8_t *buffer, size_t length, void *data);
 void process_responses(void);
 void queue_response(uint8_t cmd_type, const uint8_t *data, size_t data_length);
+void queue_priority_response(uint8_t cmd_type, const uint8_t *data, size_t data_length);
+uint8_t response_queue_free(void);
 
 #endif // UART_H
\ No newline at end of file
@@ -0,0 +1,110 @@
+#include "codec.h"
+#include <string.h>
+
+#define CODEC_CMD_MOVE_STATIC 0x10
+#define CODEC_CMD_MOVE_TRACKING 0x11
+
+static uint8_t crc8(const uint8_t *data, size_t length) {
+    uint8_t crc = 0xFF;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+size_t codec_put_varint(uint8_t *out, int32_t value) {
+    uint32_t raw = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    size_t length = 0;
+    do {
+        uint8_t byte = raw & 0x7F;
+        raw >>= 7;
+        out[length++] = raw ? byte | 0x80 : byte;
+    } while (raw);
+    return length;
+}
+
+size_t codec_batch_entry(uint8_t *out, uint8_t cmd_type, const uint8_t *payload, uint8_t length) {
+    out[0] = cmd_type;
+    out[1] = length;
+    memcpy(&out[2], payload, length);
+    return 2 + (size_t)length;
+}
+
+size_t codec_batch_move_static(uint8_t *out, uint8_t axis, int32_t position_arcsec) {
+    uint8_t payload[6];
+    payload[0] = axis;
+    size_t length = 1 + codec_put_varint(&payload[1], position_arcsec);
+    return codec_batch_entry(out, CODEC_CMD_MOVE_STATIC, payload, (uint8_t)length);
+}
+
+size_t codec_batch_move_tracking(uint8_t *out, const int32_t rate_units[3]) {
+    uint8_t payload[15];
+    size_t length = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        length += codec_put_varint(&payload[length], rate_units[axis]);
+    }
+    return codec_batch_entry(out, CODEC_CMD_MOVE_TRACKING, payload, (uint8_t)length);
+}
+
+size_t codec_frame(uint8_t *out, uint8_t cmd_type, uint8_t msg_id, const uint8_t *data, uint8_t length) {
+    uint8_t raw[260];
+    size_t raw_length = 0;
+    raw[raw_length++] = cmd_type;
+    raw[raw_length++] = msg_id;
+    raw[raw_length++] = length;
+    memcpy(&raw[raw_length], data, length);
+    raw_length += length;
+    raw[raw_length] = crc8(raw, raw_length);
+    raw_length++;
+
+    // COBS: every run of non-zero bytes is preceded by its length + 1, at most 254 bytes per run
+    size_t out_length = 0;
+    size_t code_at = out_length++;
+    uint8_t code = 1;
+    for (size_t i = 0; i < raw_length; i++) {
+        if (raw[i] == 0) {
+            out[code_at] = code;
+            code_at = out_length++;
+            code = 1;
+            continue;
+        }
+        out[out_length++] = raw[i];
+        if (++code == 0xFF) {
+            out[code_at] = code;
+            code_at = out_length++;
+            code = 1;
+        }
+    }
+    out[code_at] = code;
+    out[out_length++] = 0x00;
+    return out_length;
+}
+
+bool codec_unframe(const uint8_t *in, size_t in_length, uint8_t *cmd_type, uint8_t *msg_id,
+                   uint8_t *data, uint8_t *length) {
+    uint8_t raw[260];
+    size_t raw_length = 0;
+    size_t i = 0;
+    while (i < in_length) {
+        uint8_t code = in[i++];
+        if (code == 0 || i + code - 1 > in_length) return false;
+        for (uint8_t k = 1; k < code; k++) {
+            if (raw_length >= sizeof(raw)) return false;
+            raw[raw_length++] = in[i++];
+        }
+        if (code < 0xFF && i < in_length) {
+            if (raw_length >= sizeof(raw)) return false;
+            raw[raw_length++] = 0;
+        }
+    }
+    if (raw_length < 4 || raw_length != (size_t)raw[2] + 4) return false;
+    if (crc8(raw, raw_length - 1) != raw[raw_length - 1]) return false;
+    *cmd_type = raw[0];
+    *msg_id = raw[1];
+    *length = raw[2];
+    memcpy(data, &raw[3], raw[2]);
+    return true;
+}
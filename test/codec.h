@@ -0,0 +1,28 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+// Host side of the serial protocol, written from the README rather than from UART.c so a test can tell a wrong
+// encoder from a wrong decoder: frames (CMD + ID + LEN + DATA + CRC, COBS, 0x00) and v2 batch entries
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define CODEC_MAX_FRAME 300         // Encoded frame with the COBS overhead and the delimiter
+
+// Zigzag LEB128, 1 to 5 bytes
+size_t codec_put_varint(uint8_t *out, int32_t value);
+
+// Batch entries: command code, payload length, payload. Return the bytes written
+size_t codec_batch_entry(uint8_t *out, uint8_t cmd_type, const uint8_t *payload, uint8_t length);
+size_t codec_batch_move_static(uint8_t *out, uint8_t axis, int32_t position_arcsec);
+// Rates in 0.0001 arcsec/s steps, rate_units[axis] is what goes on the wire
+size_t codec_batch_move_tracking(uint8_t *out, const int32_t rate_units[3]);
+
+// A whole frame ready for the wire, returns its length including the delimiter
+size_t codec_frame(uint8_t *out, uint8_t cmd_type, uint8_t msg_id, const uint8_t *data, uint8_t length);
+// One frame without its delimiter back into its fields, false if the COBS, length or CRC is wrong
+bool codec_unframe(const uint8_t *in, size_t in_length, uint8_t *cmd_type, uint8_t *msg_id,
+                   uint8_t *data, uint8_t *length);
+
+#endif // CODEC_H
@@ -0,0 +1,209 @@
+#include "onewire_model.h"
+#include <string.h>
+
+#define RESET_LOW_US 480                // Held low at least this long is a reset pulse
+#define WRITE_ZERO_LOW_US 15            // A slot held low past the device's sample point is a 0
+
+#define ROM_SEARCH 0xF0
+#define ROM_MATCH 0x55
+#define ROM_SKIP 0xCC
+#define FUNCTION_CONVERT_T 0x44
+#define FUNCTION_WRITE_SCRATCHPAD 0x4E
+#define FUNCTION_READ_SCRATCHPAD 0xBE
+
+typedef enum {
+    DEVICE_IDLE = 0,                    // Not addressed, waits for a reset
+    DEVICE_ROM_COMMAND,
+    DEVICE_SEARCH,                      // bits counts slots: bit, complement, the master's choice, 64 times
+    DEVICE_MATCH,
+    DEVICE_FUNCTION,
+    DEVICE_WRITE_SCRATCHPAD,
+    DEVICE_READ_SCRATCHPAD
+} device_state_t;
+
+onewire_model_device_t onewire_model_devices[ONEWIRE_MODEL_DEVICES];
+uint32_t onewire_model_converts = 0;
+
+static uint line_pin;
+static uint64_t low_since_us;
+static bool slot_level;                 // What the devices put on the line in the current slot
+
+uint8_t onewire_model_crc8(const uint8_t *data, int length) {
+    uint8_t crc = 0;
+    for (int i = 0; i < length; i++) {
+        for (int bit = 0; bit < 8; bit++) {
+            bool feedback = ((crc ^ (data[i] >> bit)) & 1) != 0;
+            crc >>= 1;
+            if (feedback) crc ^= 0x8C;  // x^8 + x^5 + x^4 + 1, reflected
+        }
+    }
+    return crc;
+}
+
+static bool rom_bit(const onewire_model_device_t *device, int bit) {
+    return (device->rom[bit / 8] >> (bit % 8)) & 1;
+}
+
+static void update_scratchpad_crc(onewire_model_device_t *device) {
+    device->scratchpad[8] = onewire_model_crc8(device->scratchpad, 8);
+}
+
+// 93.75 ms at 9 bit, doubling for every bit more
+static uint64_t conversion_us(const onewire_model_device_t *device) {
+    int bits = 9 + ((device->scratchpad[4] >> 5) & 0x03);
+    return 93750u << (bits - 9);
+}
+
+// The level a device leaves on the line in a read slot, released (1) while it listens
+static bool device_output(const onewire_model_device_t *device) {
+    switch (device->state) {
+        case DEVICE_SEARCH:
+            if (device->bits % 3 == 0) return rom_bit(device, device->bits / 3);
+            if (device->bits % 3 == 1) return !rom_bit(device, device->bits / 3);
+            return true;
+        case DEVICE_READ_SCRATCHPAD: {
+            if (device->bits >= 72) return true;
+            uint8_t byte = device->scratchpad[device->bits / 8];
+            if (device->bits / 8 == 8 && device->bad_crc) byte ^= 0x5A;
+            return (byte >> (device->bits % 8)) & 1;
+        }
+        default:
+            return true;
+    }
+}
+
+static void run_function(onewire_model_device_t *device, uint8_t function, uint64_t now_us) {
+    switch (function) {
+        case FUNCTION_CONVERT_T:
+            onewire_model_converts++;
+            device->scratchpad[0] = (uint8_t)device->raw_temp;
+            device->scratchpad[1] = (uint8_t)((uint16_t)device->raw_temp >> 8);
+            update_scratchpad_crc(device);
+            device->convert_done_us = now_us + conversion_us(device);
+            device->state = DEVICE_IDLE;
+            break;
+        case FUNCTION_WRITE_SCRATCHPAD:
+            device->state = DEVICE_WRITE_SCRATCHPAD;
+            break;
+        case FUNCTION_READ_SCRATCHPAD:
+            device->reads++;
+            if (now_us < device->convert_done_us) device->early_reads++;
+            device->state = DEVICE_READ_SCRATCHPAD;
+            break;
+        default:
+            device->state = DEVICE_IDLE;
+            break;
+    }
+    device->bits = 0;
+}
+
+// One slot is over, the master wrote master_bit (a read slot looks like writing a 1)
+static void end_slot(onewire_model_device_t *device, bool master_bit, uint64_t now_us) {
+    switch (device->state) {
+        case DEVICE_ROM_COMMAND:
+        case DEVICE_FUNCTION:
+        case DEVICE_WRITE_SCRATCHPAD:
+            device->shift = (uint8_t)((device->shift >> 1) | (master_bit ? 0x80 : 0));
+            if (++device->bits % 8 != 0) return;
+            if (device->state == DEVICE_WRITE_SCRATCHPAD) {
+                // TH, TL, configuration
+                device->scratchpad[1 + device->bits / 8] = device->shift;
+                if (device->bits / 8 == 3) {
+                    update_scratchpad_crc(device);
+                    device->state = DEVICE_IDLE;
+                }
+            } else if (device->state == DEVICE_FUNCTION) {
+                run_function(device, device->shift, now_us);
+            } else {
+                device->bits = 0;
+                device->matched = true;
+                if (device->shift == ROM_SEARCH) device->state = DEVICE_SEARCH;
+                else if (device->shift == ROM_MATCH) device->state = DEVICE_MATCH;
+                else if (device->shift == ROM_SKIP) device->state = DEVICE_FUNCTION;
+                else device->state = DEVICE_IDLE;
+            }
+            return;
+        case DEVICE_SEARCH:
+            // Out of the search as soon as the master goes the other way at a bit of ours
+            if (device->bits % 3 == 2 && master_bit != rom_bit(device, device->bits / 3)) {
+                device->state = DEVICE_IDLE;
+                return;
+            }
+            if (++device->bits == 64 * 3) device->state = DEVICE_IDLE;
+            return;
+        case DEVICE_MATCH:
+            if (master_bit != rom_bit(device, device->bits)) device->matched = false;
+            if (++device->bits < 64) return;
+            device->bits = 0;
+            device->state = device->matched ? DEVICE_FUNCTION : DEVICE_IDLE;
+            return;
+        case DEVICE_READ_SCRATCHPAD:
+            device->bits++;
+            return;
+        default:
+            return;
+    }
+}
+
+static void onewire_model_line(uint gpio, bool out, uint64_t now_us) {
+    if (gpio != line_pin) return;
+    if (out) {
+        // The master pulls low, whatever the devices held from the last slot ends here
+        low_since_us = now_us;
+        slot_level = true;
+        for (int i = 0; i < ONEWIRE_MODEL_DEVICES; i++) {
+            onewire_model_device_t *device = &onewire_model_devices[i];
+            if (device->present && !device_output(device)) slot_level = false;
+        }
+        host_gpio_set_input(line_pin, true);
+        return;
+    }
+
+    uint64_t low_us = now_us - low_since_us;
+    if (low_us >= RESET_LOW_US) {
+        // Every device starts over and answers with a presence pulse
+        bool presence = false;
+        for (int i = 0; i < ONEWIRE_MODEL_DEVICES; i++) {
+            onewire_model_device_t *device = &onewire_model_devices[i];
+            if (!device->present) continue;
+            device->state = DEVICE_ROM_COMMAND;
+            device->bits = 0;
+            presence = true;
+        }
+        host_gpio_set_input(line_pin, !presence);
+        return;
+    }
+
+    bool master_bit = low_us < WRITE_ZERO_LOW_US;
+    host_gpio_set_input(line_pin, master_bit ? slot_level : true);
+    for (int i = 0; i < ONEWIRE_MODEL_DEVICES; i++) {
+        onewire_model_device_t *device = &onewire_model_devices[i];
+        if (device->present) end_slot(device, master_bit, now_us);
+    }
+}
+
+void onewire_model_install(uint pin) {
+    memset(onewire_model_devices, 0, sizeof(onewire_model_devices));
+    onewire_model_converts = 0;
+    line_pin = pin;
+    host_gpio_set_input(pin, true);
+    host_gpio_dir_hook = onewire_model_line;
+}
+
+int onewire_model_add(const uint8_t rom[7], float celsius) {
+    for (int i = 0; i < ONEWIRE_MODEL_DEVICES; i++) {
+        onewire_model_device_t *device = &onewire_model_devices[i];
+        if (device->present) continue;
+        memset(device, 0, sizeof(*device));
+        device->present = true;
+        memcpy(device->rom, rom, 7);
+        device->rom[7] = onewire_model_crc8(rom, 7);
+        device->raw_temp = (int16_t)(celsius * 16.0f);
+        // Power-up scratchpad: 85 °C, alarm bytes, 12 bit
+        static const uint8_t power_up[8] = { 0x50, 0x05, 0x4B, 0x46, 0x7F, 0xFF, 0x0C, 0x10 };
+        memcpy(device->scratchpad, power_up, 8);
+        update_scratchpad_crc(device);
+        return i;
+    }
+    return -1;
+}
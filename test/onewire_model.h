@@ -0,0 +1,39 @@
+#ifndef ONEWIRE_MODEL_H
+#define ONEWIRE_MODEL_H
+
+// Devices on a 1-Wire line, written from the DS18B20 datasheet and Maxim application note 187 rather than from
+// DS18B20.c: reset and presence, time slots told apart by how long the master holds the line low, wired-AND answers,
+// the ROM search, Match and Skip ROM, Convert T and the scratchpad with its CRC
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+
+#define ONEWIRE_MODEL_DEVICES 8
+
+typedef struct {
+    bool present;               // On the line, answers
+    uint8_t rom[8];             // Family, serial, CRC: sent as is, a wrong CRC byte stays wrong
+    int16_t raw_temp;           // 1/16 °C, what the next Convert T measures
+    bool bad_crc;               // Scratchpad goes out with a wrong CRC byte
+    uint8_t scratchpad[9];
+    uint64_t convert_done_us;   // Conversion time of the configured resolution after the last Convert T
+    uint32_t early_reads;       // Scratchpad reads while a conversion was still running
+    uint32_t reads;
+    // Protocol state since the last reset
+    int state;
+    int bits;
+    uint8_t shift;
+    bool matched;
+} onewire_model_device_t;
+
+extern onewire_model_device_t onewire_model_devices[ONEWIRE_MODEL_DEVICES];
+extern uint32_t onewire_model_converts;
+
+// No devices, the line released and pulled up, the hook on the pin's direction. Before ds18b20_init
+void onewire_model_install(uint pin);
+// A present device with the Dallas CRC over the first seven ROM bytes, returns its index
+int onewire_model_add(const uint8_t rom[7], float celsius);
+uint8_t onewire_model_crc8(const uint8_t *data, int length);
+
+#endif // ONEWIRE_MODEL_H
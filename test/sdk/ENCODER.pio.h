@@ -0,0 +1,6 @@
+#pragma once
+#include "host_sdk.h"
+
+// Quadrature decoder program, the host PIO only passes FIFO words to the encoder model
+extern const pio_program_t quadrature_encoder_program;
+pio_sm_config quadrature_encoder_program_get_default_config(uint offset);
@@ -0,0 +1,8 @@
+#pragma once
+#include "host_sdk.h"
+
+// The TMC2209 single wire UART programs, the host PIO only passes FIFO words to the driver model
+extern const pio_program_t tmc2209_uart_tx_program;
+extern const pio_program_t tmc2209_uart_rx_program;
+pio_sm_config tmc2209_uart_tx_program_get_default_config(uint offset);
+pio_sm_config tmc2209_uart_rx_program_get_default_config(uint offset);
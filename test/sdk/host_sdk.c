@@ -0,0 +1,667 @@
+#include "host_sdk.h"
+#include <setjmp.h>
+#include <string.h>
+
+#define HOST_GPIO_COUNT 30
+#define HOST_ALARMS 8
+#define HOST_DMA_CHANNELS 12
+#define HOST_RX_FIFO 64
+#define HOST_SLEEP_SLICE_US 10          // Longest time step, hooks see sleeps in slices of this
+
+host_tick_hook_t host_tick_hook = NULL;
+host_gpio_hook_t host_gpio_hook = NULL;
+host_gpio_dir_hook_t host_gpio_dir_hook = NULL;
+host_pio_tx_hook_t host_pio_tx_hook = NULL;
+host_uart_tx_hook_t host_uart_tx_hook = NULL;
+
+static uint64_t now_us = 0;
+static bool in_hook = false;
+static volatile bool event_latched = false;
+
+// ---- Core 1 ----
+static void (*core1_entry)(void) = NULL;
+static bool core1_running = false;
+static uint64_t core1_end_us;
+static jmp_buf core1_exit;
+
+// ---- Alarms ----
+typedef struct {
+    bool active;
+    alarm_id_t id;
+    uint64_t at_us;
+    alarm_callback_t callback;
+    void *user_data;
+} host_alarm_t;
+static host_alarm_t alarms[HOST_ALARMS];
+static alarm_id_t next_alarm_id = 1;
+
+// ---- GPIO ----
+static uint32_t gpio_out = 0;
+static uint32_t gpio_dir_out = 0;
+static uint32_t gpio_in = 0;
+static uint32_t irq_enabled_events[HOST_GPIO_COUNT];
+static uint32_t irq_pending_events[HOST_GPIO_COUNT];
+static struct { uint32_t mask; void (*handler)(void); } raw_handlers[8];
+static uint8_t raw_handler_count = 0;
+static void (*irq_handlers[32])(void);
+static bool irq_enabled[32];
+
+// ---- UART ----
+struct uart_inst { int index; };
+static struct uart_inst uart_instances[2] = { {0}, {1} };
+uart_inst_t *uart0 = &uart_instances[0];
+uart_inst_t *uart1 = &uart_instances[1];
+static uart_hw_t uart_hw[2];
+uint host_uart_baud = 0;
+static uint8_t uart_rx[1024];
+static size_t uart_rx_head = 0, uart_rx_tail = 0;
+// The CDC port as an in-memory pipe each way, empty and closed unless a test plays the USB host
+bool host_usb_connected = false;
+host_usb_tx_hook_t host_usb_tx_hook = NULL;
+static uint8_t usb_rx[1024];
+static size_t usb_rx_head = 0, usb_rx_tail = 0;
+
+static void usb_out_chars(const char *buf, int len) {
+    if (host_usb_tx_hook && host_usb_connected) host_usb_tx_hook((const uint8_t *)buf, (size_t)len);
+}
+
+static int usb_in_chars(char *buf, int len) {
+    int count = 0;
+    while (count < len && usb_rx_tail != usb_rx_head) {
+        buf[count++] = (char)usb_rx[usb_rx_tail];
+        usb_rx_tail = (usb_rx_tail + 1) % sizeof(usb_rx);
+    }
+    return count;
+}
+
+stdio_driver_t stdio_usb = { usb_out_chars, NULL, usb_in_chars };
+
+// ---- DMA ----
+typedef struct {
+    bool claimed;
+    bool pending;
+    bool irq0;
+    volatile void *write_addr;
+    const volatile void *read_addr;
+    uint32_t count;
+} host_dma_t;
+static host_dma_t dma[HOST_DMA_CHANNELS];
+static dma_hw_t dma_registers;
+dma_hw_t *dma_hw = &dma_registers;
+
+// ---- PIO ----
+pio_hw_t host_pio[2];
+static uint32_t rx_fifo[2][4][HOST_RX_FIFO];
+static uint64_t rx_at_us[2][4][HOST_RX_FIFO];        // A word is in the FIFO from then on
+static uint8_t rx_head[2][4], rx_count[2][4];
+static uint8_t sm_claimed[2];
+static uint64_t tx_busy_until[2][4];
+
+uint8_t host_flash[PICO_FLASH_SIZE_BYTES];
+uint32_t host_flash_erases[PICO_FLASH_SIZE_BYTES / FLASH_SECTOR_SIZE];
+int32_t host_flash_program_budget = -1;
+
+const pio_program_t tmc2209_uart_tx_program = { NULL, 0, -1 };
+const pio_program_t tmc2209_uart_rx_program = { NULL, 0, -1 };
+const pio_program_t quadrature_encoder_program = { NULL, 0, -1 };
+
+__attribute__((constructor)) static void host_sdk_init(void) {
+    memset(host_flash, 0xFF, sizeof(host_flash));
+}
+
+// ---- Time ----
+
+static void fire_alarms(void) {
+    for (int i = 0; i < HOST_ALARMS; i++) {
+        host_alarm_t *alarm = &alarms[i];
+        if (!alarm->active || alarm->at_us > now_us) continue;
+        alarm->active = false;
+        int64_t again = alarm->callback(alarm->id, alarm->user_data);
+        if (again > 0) {
+            alarm->at_us += (uint64_t)again;
+            alarm->active = true;
+        }
+    }
+}
+
+static void complete_dma(void) {
+    for (uint ch = 0; ch < HOST_DMA_CHANNELS; ch++) {
+        host_dma_t *channel = &dma[ch];
+        if (!channel->pending) continue;
+        channel->pending = false;
+        const uint8_t *data = (const uint8_t *)channel->read_addr;
+        if (channel->write_addr == &uart_hw[0].dr || channel->write_addr == &uart_hw[1].dr) {
+            if (host_uart_tx_hook && data) host_uart_tx_hook(data, channel->count);
+        } else {
+            for (int p = 0; p < 2; p++) {
+                for (uint sm = 0; sm < 4; sm++) {
+                    if (channel->write_addr != &host_pio[p].txf[sm]) continue;
+                    for (uint32_t i = 0; i < channel->count && data; i++) {
+                        if (host_pio_tx_hook) host_pio_tx_hook(&host_pio[p], sm, data[i]);
+                    }
+                }
+            }
+        }
+        if (channel->irq0) {
+            dma_hw->ints0 |= 1u << ch;
+            if (irq_enabled[DMA_IRQ_0] && irq_handlers[DMA_IRQ_0]) irq_handlers[DMA_IRQ_0]();
+        }
+    }
+}
+
+void host_advance_us(uint64_t us) {
+    now_us += us;
+    fire_alarms();
+    complete_dma();
+    if (in_hook) return;
+    if (host_tick_hook) {
+        in_hook = true;
+        host_tick_hook(now_us);
+        in_hook = false;
+    }
+    if (core1_running && now_us >= core1_end_us) {
+        longjmp(core1_exit, 1);
+    }
+}
+
+uint64_t host_now_us(void) {
+    return now_us;
+}
+
+static void advance_to(uint64_t target_us) {
+    while (now_us < target_us) {
+        uint64_t left = target_us - now_us;
+        host_advance_us(left < HOST_SLEEP_SLICE_US ? left : HOST_SLEEP_SLICE_US);
+    }
+}
+
+// Reading the clock costs a microsecond, so a loop that only polls the time still moves on
+uint32_t time_us_32(void) {
+    host_advance_us(1);
+    return (uint32_t)now_us;
+}
+
+uint64_t time_us_64(void) {
+    host_advance_us(1);
+    return now_us;
+}
+
+absolute_time_t get_absolute_time(void) {
+    return time_us_64();
+}
+
+absolute_time_t from_us_since_boot(uint64_t us) {
+    return us;
+}
+
+uint32_t to_ms_since_boot(absolute_time_t t) {
+    return (uint32_t)(t / 1000);
+}
+
+int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to) {
+    return (int64_t)(to - from);
+}
+
+absolute_time_t make_timeout_time_us(uint64_t us) {
+    return now_us + us;
+}
+
+void sleep_us(uint64_t us) {
+    advance_to(now_us + us);
+}
+
+void sleep_until(absolute_time_t t) {
+    advance_to(t);
+}
+
+void busy_wait_us_32(uint32_t us) {
+    advance_to(now_us + us);
+}
+
+// Returns early once an event was sent, like WFE, true on the timeout
+bool best_effort_wfe_or_timeout(absolute_time_t timeout) {
+    while (now_us < timeout) {
+        if (event_latched) {
+            event_latched = false;
+            return false;
+        }
+        uint64_t left = timeout - now_us;
+        host_advance_us(left < HOST_SLEEP_SLICE_US ? left : HOST_SLEEP_SLICE_US);
+    }
+    event_latched = false;
+    return true;
+}
+
+void host_sev(void) {
+    event_latched = true;
+}
+
+alarm_id_t add_alarm_in_us(uint64_t us, alarm_callback_t callback, void *user_data, bool fire_if_past) {
+    for (int i = 0; i < HOST_ALARMS; i++) {
+        if (alarms[i].active) continue;
+        alarms[i] = (host_alarm_t){ true, next_alarm_id++, now_us + us, callback, user_data };
+        return alarms[i].id;
+    }
+    return -1;
+}
+
+bool cancel_alarm(alarm_id_t alarm_id) {
+    for (int i = 0; i < HOST_ALARMS; i++) {
+        if (alarms[i].active && alarms[i].id == alarm_id) {
+            alarms[i].active = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+// ---- Core 1 ----
+
+void multicore_launch_core1(void (*entry)(void)) {
+    core1_entry = entry;
+}
+
+void host_run_core1(uint64_t end_us) {
+    if (!core1_entry) return;
+    core1_end_us = end_us;
+    if (!setjmp(core1_exit)) {
+        core1_running = true;
+        core1_entry();
+    }
+    core1_running = false;
+}
+
+// ---- GPIO ----
+
+static void gpio_write(uint32_t after) {
+    uint32_t before = gpio_out;
+    gpio_out = after;
+    if (host_gpio_hook && before != after) host_gpio_hook(before, after, now_us);
+}
+
+void gpio_init(uint gpio) {
+    gpio_dir_out &= ~(1u << gpio);
+    gpio_write(gpio_out & ~(1u << gpio));
+}
+
+void gpio_set_dir(uint gpio, bool out) {
+    bool was_out = (gpio_dir_out >> gpio) & 1u;
+    if (out) {
+        gpio_dir_out |= 1u << gpio;
+    } else {
+        gpio_dir_out &= ~(1u << gpio);
+    }
+    if (host_gpio_dir_hook && was_out != out) host_gpio_dir_hook(gpio, out, now_us);
+}
+
+void gpio_put(uint gpio, bool value) {
+    gpio_write(value ? gpio_out | (1u << gpio) : gpio_out & ~(1u << gpio));
+}
+
+bool gpio_get(uint gpio) {
+    uint32_t levels = (gpio_out & gpio_dir_out) | (gpio_in & ~gpio_dir_out);
+    return (levels >> gpio) & 1u;
+}
+
+void gpio_set_mask(uint32_t mask) {
+    gpio_write(gpio_out | mask);
+}
+
+void gpio_clr_mask(uint32_t mask) {
+    gpio_write(gpio_out & ~mask);
+}
+
+void gpio_set_function(uint gpio, int function) {}
+void gpio_pull_up(uint gpio) {}
+void gpio_pull_down(uint gpio) {}
+
+void host_gpio_set_input(uint gpio, bool level) {
+    gpio_in = level ? gpio_in | (1u << gpio) : gpio_in & ~(1u << gpio);
+}
+
+void gpio_set_irq_enabled(uint gpio, uint32_t events, bool enabled) {
+    if (gpio >= HOST_GPIO_COUNT) return;
+    if (enabled) {
+        irq_enabled_events[gpio] |= events;
+    } else {
+        irq_enabled_events[gpio] &= ~events;
+    }
+}
+
+void gpio_add_raw_irq_handler_masked(uint32_t gpio_mask, void (*handler)(void)) {
+    if (raw_handler_count < sizeof(raw_handlers) / sizeof(raw_handlers[0])) {
+        raw_handlers[raw_handler_count].mask = gpio_mask;
+        raw_handlers[raw_handler_count].handler = handler;
+        raw_handler_count++;
+    }
+}
+
+void gpio_acknowledge_irq(uint gpio, uint32_t events) {
+    if (gpio < HOST_GPIO_COUNT) irq_pending_events[gpio] &= ~events;
+}
+
+uint32_t gpio_get_irq_event_mask(uint gpio) {
+    return gpio < HOST_GPIO_COUNT ? irq_pending_events[gpio] : 0;
+}
+
+void host_gpio_irq(uint gpio, uint32_t events) {
+    if (gpio >= HOST_GPIO_COUNT) return;
+    events &= irq_enabled_events[gpio];
+    if (!events) return;
+    irq_pending_events[gpio] |= events;
+    for (uint8_t i = 0; i < raw_handler_count; i++) {
+        if (raw_handlers[i].mask & (1u << gpio)) raw_handlers[i].handler();
+    }
+    if (irq_enabled[IO_IRQ_BANK0] && irq_handlers[IO_IRQ_BANK0]) irq_handlers[IO_IRQ_BANK0]();
+}
+
+// ---- Interrupts, spin locks ----
+
+void irq_set_exclusive_handler(uint num, void (*handler)(void)) {
+    if (num < 32) irq_handlers[num] = handler;
+}
+
+void irq_set_enabled(uint num, bool enabled) {
+    if (num < 32) irq_enabled[num] = enabled;
+}
+
+uint32_t save_and_disable_interrupts(void) {
+    return 0;
+}
+
+void restore_interrupts(uint32_t status) {}
+
+int spin_lock_claim_unused(bool required) {
+    static int next_lock = 16;
+    return next_lock++;
+}
+
+spin_lock_t *spin_lock_init(uint lock_num) {
+    static spin_lock_t locks[32];
+    return &locks[lock_num % 32];
+}
+
+uint32_t spin_lock_blocking(spin_lock_t *lock) {
+    return 0;
+}
+
+void spin_unlock(spin_lock_t *lock, uint32_t saved_irq) {}
+
+// ---- UART, stdio ----
+
+uint uart_init(uart_inst_t *uart, uint baudrate) {
+    if (uart == uart0) host_uart_baud = baudrate;
+    return baudrate;
+}
+
+uint uart_set_baudrate(uart_inst_t *uart, uint baudrate) {
+    if (uart == uart0) host_uart_baud = baudrate;
+    return baudrate;
+}
+
+void uart_set_irq_enables(uart_inst_t *uart, bool rx_has_data, bool tx_needs_data) {}
+
+bool uart_is_readable(uart_inst_t *uart) {
+    return uart_rx_tail != uart_rx_head;
+}
+
+char uart_getc(uart_inst_t *uart) {
+    if (uart_rx_tail == uart_rx_head) return 0;
+    char c = (char)uart_rx[uart_rx_tail];
+    uart_rx_tail = (uart_rx_tail + 1) % sizeof(uart_rx);
+    return c;
+}
+
+void uart_tx_wait_blocking(uart_inst_t *uart) {}
+
+uint uart_get_dreq(uart_inst_t *uart, bool is_tx) {
+    return 0;
+}
+
+uart_hw_t *uart_get_hw(uart_inst_t *uart) {
+    return &uart_hw[uart->index];
+}
+
+void host_uart_receive(const uint8_t *data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        uart_rx[uart_rx_head] = data[i];
+        uart_rx_head = (uart_rx_head + 1) % sizeof(uart_rx);
+    }
+    if (irq_enabled[UART0_IRQ] && irq_handlers[UART0_IRQ]) irq_handlers[UART0_IRQ]();
+}
+
+bool stdio_init_all(void) {
+    return true;
+}
+
+bool stdio_usb_init(void) {
+    return true;
+}
+
+bool stdio_usb_connected(void) {
+    return host_usb_connected;
+}
+
+void host_usb_receive(const uint8_t *data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        usb_rx[usb_rx_head] = data[i];
+        usb_rx_head = (usb_rx_head + 1) % sizeof(usb_rx);
+    }
+}
+
+void stdio_uart_init_full(uart_inst_t *uart, uint baud_rate, int tx_pin, int rx_pin) {}
+
+// ---- DMA, a transfer completes the next time the clock moves ----
+
+int dma_claim_unused_channel(bool required) {
+    for (int ch = 0; ch < HOST_DMA_CHANNELS; ch++) {
+        if (dma[ch].claimed) continue;
+        dma[ch].claimed = true;
+        return ch;
+    }
+    return -1;
+}
+
+dma_channel_config dma_channel_get_default_config(uint channel) {
+    return (dma_channel_config){ 0 };
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config *c, int size) {}
+void channel_config_set_read_increment(dma_channel_config *c, bool incr) {}
+void channel_config_set_write_increment(dma_channel_config *c, bool incr) {}
+void channel_config_set_dreq(dma_channel_config *c, uint dreq) {}
+
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, uint transfer_count, bool trigger) {
+    dma[channel].write_addr = write_addr;
+    dma[channel].read_addr = read_addr;
+    dma[channel].count = transfer_count;
+    if (trigger) dma[channel].pending = true;
+}
+
+void dma_channel_set_irq0_enabled(uint channel, bool enabled) {
+    dma[channel].irq0 = enabled;
+}
+
+void dma_channel_set_read_addr(uint channel, const volatile void *read_addr, bool trigger) {
+    dma[channel].read_addr = read_addr;
+    if (trigger) dma[channel].pending = true;
+}
+
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count, bool trigger) {
+    dma[channel].count = trans_count;
+    if (trigger) dma[channel].pending = true;
+}
+
+void dma_channel_start(uint channel) {
+    dma[channel].pending = true;
+}
+
+bool dma_channel_is_busy(uint channel) {
+    return channel < HOST_DMA_CHANNELS && dma[channel].pending;
+}
+
+void dma_channel_transfer_from_buffer_now(uint channel, const volatile void *read_addr, uint32_t transfer_count) {
+    dma[channel].read_addr = read_addr;
+    dma[channel].count = transfer_count;
+    dma[channel].pending = true;
+}
+
+// ---- PIO, the TX side goes to host_pio_tx_hook, the RX FIFOs are filled by the test ----
+
+static int pio_index(PIO pio) {
+    return pio == &host_pio[1] ? 1 : 0;
+}
+
+int pio_add_program(PIO pio, const pio_program_t *program) {
+    return 0;
+}
+
+int pio_claim_unused_sm(PIO pio, bool required) {
+    int p = pio_index(pio);
+    return sm_claimed[p] < 4 ? sm_claimed[p]++ : -1;
+}
+
+void pio_gpio_init(PIO pio, uint pin) {}
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config) {}
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled) {}
+void pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin_base, uint pin_count, bool is_out) {}
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t pin_values, uint32_t pin_mask) {}
+void pio_sm_set_pindirs_with_mask(PIO pio, uint sm, uint32_t pin_dirs, uint32_t pin_mask) {}
+
+bool pio_sm_is_tx_fifo_empty(PIO pio, uint sm) {
+    return now_us >= tx_busy_until[pio_index(pio)][sm];
+}
+
+// Words pushed for later are still on their way, only the ones that arrived count
+static uint8_t rx_arrived(int p, uint sm) {
+    uint8_t arrived = 0;
+    while (arrived < rx_count[p][sm] && rx_at_us[p][sm][(rx_head[p][sm] + arrived) % HOST_RX_FIFO] <= now_us) {
+        arrived++;
+    }
+    return arrived;
+}
+
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm) {
+    return rx_arrived(pio_index(pio), sm) == 0;
+}
+
+uint pio_sm_get_rx_fifo_level(PIO pio, uint sm) {
+    return rx_arrived(pio_index(pio), sm);
+}
+
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data) {
+    if (host_pio_tx_hook) host_pio_tx_hook(pio, sm, data);
+}
+
+uint32_t pio_sm_get(PIO pio, uint sm) {
+    int p = pio_index(pio);
+    if (rx_arrived(p, sm) == 0) return 0;
+    uint32_t data = rx_fifo[p][sm][rx_head[p][sm]];
+    rx_head[p][sm] = (rx_head[p][sm] + 1) % HOST_RX_FIFO;
+    rx_count[p][sm]--;
+    return data;
+}
+
+uint32_t pio_sm_get_blocking(PIO pio, uint sm) {
+    while (pio_sm_is_rx_fifo_empty(pio, sm)) {
+        host_advance_us(1);
+    }
+    return pio_sm_get(pio, sm);
+}
+
+void pio_sm_clear_fifos(PIO pio, uint sm) {
+    int p = pio_index(pio);
+    uint8_t arrived = rx_arrived(p, sm);
+    rx_head[p][sm] = (rx_head[p][sm] + arrived) % HOST_RX_FIFO;
+    rx_count[p][sm] -= arrived;
+}
+
+void pio_sm_restart(PIO pio, uint sm) {}
+void pio_sm_exec(PIO pio, uint sm, uint instr) {}
+
+uint pio_encode_jmp(uint addr) {
+    return addr;
+}
+
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx) {
+    return 0;
+}
+
+void host_pio_tx_busy(PIO pio, uint sm, uint64_t until_us) {
+    tx_busy_until[pio_index(pio)][sm] = until_us;
+}
+
+void host_pio_rx_push_at(PIO pio, uint sm, uint32_t data, uint64_t at_us) {
+    int p = pio_index(pio);
+    if (rx_count[p][sm] >= HOST_RX_FIFO) return;
+    uint8_t slot = (rx_head[p][sm] + rx_count[p][sm]) % HOST_RX_FIFO;
+    rx_fifo[p][sm][slot] = data;
+    rx_at_us[p][sm][slot] = at_us;
+    rx_count[p][sm]++;
+}
+
+void host_pio_rx_push(PIO pio, uint sm, uint32_t data) {
+    host_pio_rx_push_at(pio, sm, data, now_us);
+}
+
+void sm_config_set_out_pins(pio_sm_config *c, uint out_base, uint out_count) {}
+void sm_config_set_sideset_pins(pio_sm_config *c, uint sideset_base) {}
+void sm_config_set_in_pins(pio_sm_config *c, uint in_base) {}
+void sm_config_set_jmp_pin(pio_sm_config *c, uint pin) {}
+void sm_config_set_out_shift(pio_sm_config *c, bool shift_right, bool autopull, uint pull_threshold) {}
+void sm_config_set_in_shift(pio_sm_config *c, bool shift_right, bool autopush, uint push_threshold) {}
+void sm_config_set_fifo_join(pio_sm_config *c, int join) {}
+void sm_config_set_clkdiv(pio_sm_config *c, float div) {}
+
+pio_sm_config tmc2209_uart_tx_program_get_default_config(uint offset) {
+    return (pio_sm_config){ 0 };
+}
+
+pio_sm_config tmc2209_uart_rx_program_get_default_config(uint offset) {
+    return (pio_sm_config){ 0 };
+}
+
+pio_sm_config quadrature_encoder_program_get_default_config(uint offset) {
+    return (pio_sm_config){ 0 };
+}
+
+// ---- Flash, clocks, PWM, watchdog ----
+
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+    if (host_flash_program_budget == 0) return;
+    memset(&host_flash[flash_offs], 0xFF, count);
+    for (uint32_t offset = flash_offs; offset < flash_offs + count; offset += FLASH_SECTOR_SIZE) {
+        host_flash_erases[offset / FLASH_SECTOR_SIZE]++;
+    }
+}
+
+// Programming only clears bits, like the real flash
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (host_flash_program_budget == 0) return;
+        if (host_flash_program_budget > 0) host_flash_program_budget--;
+        host_flash[flash_offs + i] &= data[i];
+    }
+}
+
+uint32_t clock_get_hz(int clock) {
+    return 125000000;
+}
+
+uint pwm_gpio_to_slice_num(uint gpio) {
+    return (gpio >> 1) & 7;
+}
+
+uint pwm_gpio_to_channel(uint gpio) {
+    return gpio & 1;
+}
+
+void pwm_set_chan_level(uint slice_num, uint chan, uint16_t level) {}
+void pwm_set_wrap(uint slice_num, uint16_t wrap) {}
+void pwm_set_clkdiv(uint slice_num, float divider) {}
+void pwm_set_enabled(uint slice_num, bool enabled) {}
+
+void watchdog_reboot(uint32_t pc, uint32_t sp, uint32_t delay_ms) {
+    fprintf(stderr, "watchdog_reboot called\n");
+}
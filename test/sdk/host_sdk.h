@@ -0,0 +1,242 @@
+#ifndef HOST_SDK_H
+#define HOST_SDK_H
+
+// Host stand-in for the parts of the Pico SDK the firmware uses, so the modules build and run on a PC for the tests.
+// Time is simulated: it only moves when the firmware sleeps or reads the clock, and a test hook runs on every move.
+// GPIO writes, PIO FIFOs and DMA transfers are recorded or handed to models of the devices on the other end.
+// Every SDK header the firmware includes (pico/..., hardware/...) maps onto this one.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+typedef unsigned int uint;
+typedef uint64_t absolute_time_t;
+
+// ---- Platform ----
+#define __not_in_flash_func(f) f
+#define __time_critical_func(f) f
+#define tight_loop_contents() host_advance_us(1)
+#define __dmb() ((void)0)
+#define __wfe() ((void)0)
+#define __sev() host_sev()
+
+#define PICO_FLASH_SIZE_BYTES (2u * 1024u * 1024u)
+#define XIP_BASE ((uintptr_t)host_flash)
+#define FLASH_PAGE_SIZE 256u
+#define FLASH_SECTOR_SIZE 4096u
+
+// ---- GPIO ----
+#define GPIO_IN 0
+#define GPIO_OUT 1
+#define GPIO_FUNC_UART 2
+#define GPIO_FUNC_PWM 4
+#define GPIO_FUNC_PIO0 6
+#define GPIO_FUNC_PIO1 7
+#define GPIO_IRQ_LEVEL_LOW 0x1u
+#define GPIO_IRQ_LEVEL_HIGH 0x2u
+#define GPIO_IRQ_EDGE_FALL 0x4u
+#define GPIO_IRQ_EDGE_RISE 0x8u
+
+void gpio_init(uint gpio);
+void gpio_set_dir(uint gpio, bool out);
+void gpio_put(uint gpio, bool value);
+bool gpio_get(uint gpio);
+void gpio_set_function(uint gpio, int function);
+void gpio_pull_up(uint gpio);
+void gpio_pull_down(uint gpio);
+void gpio_set_mask(uint32_t mask);
+void gpio_clr_mask(uint32_t mask);
+void gpio_set_irq_enabled(uint gpio, uint32_t events, bool enabled);
+void gpio_add_raw_irq_handler_masked(uint32_t gpio_mask, void (*handler)(void));
+void gpio_acknowledge_irq(uint gpio, uint32_t events);
+uint32_t gpio_get_irq_event_mask(uint gpio);
+
+// ---- Time ----
+typedef int32_t alarm_id_t;
+typedef int64_t (*alarm_callback_t)(alarm_id_t id, void *user_data);
+
+uint32_t time_us_32(void);
+uint64_t time_us_64(void);
+absolute_time_t get_absolute_time(void);
+absolute_time_t from_us_since_boot(uint64_t us);
+uint32_t to_ms_since_boot(absolute_time_t t);
+int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to);
+absolute_time_t make_timeout_time_us(uint64_t us);
+void sleep_us(uint64_t us);
+void sleep_until(absolute_time_t t);
+void busy_wait_us_32(uint32_t us);
+bool best_effort_wfe_or_timeout(absolute_time_t timeout);
+alarm_id_t add_alarm_in_us(uint64_t us, alarm_callback_t callback, void *user_data, bool fire_if_past);
+bool cancel_alarm(alarm_id_t alarm_id);
+
+// ---- Interrupts, spin locks, multicore ----
+#define DMA_IRQ_0 11
+#define IO_IRQ_BANK0 13
+#define UART0_IRQ 20
+#define UART1_IRQ 21
+
+typedef volatile uint32_t spin_lock_t;
+
+void irq_set_exclusive_handler(uint num, void (*handler)(void));
+void irq_set_enabled(uint num, bool enabled);
+uint32_t save_and_disable_interrupts(void);
+void restore_interrupts(uint32_t status);
+int spin_lock_claim_unused(bool required);
+spin_lock_t *spin_lock_init(uint lock_num);
+uint32_t spin_lock_blocking(spin_lock_t *lock);
+void spin_unlock(spin_lock_t *lock, uint32_t saved_irq);
+void multicore_launch_core1(void (*entry)(void));
+
+// ---- UART, stdio ----
+typedef struct uart_inst uart_inst_t;
+typedef struct { volatile uint32_t dr; } uart_hw_t;
+extern uart_inst_t *uart0, *uart1;
+
+uint uart_init(uart_inst_t *uart, uint baudrate);
+uint uart_set_baudrate(uart_inst_t *uart, uint baudrate);
+void uart_set_irq_enables(uart_inst_t *uart, bool rx_has_data, bool tx_needs_data);
+bool uart_is_readable(uart_inst_t *uart);
+char uart_getc(uart_inst_t *uart);
+void uart_tx_wait_blocking(uart_inst_t *uart);
+uint uart_get_dreq(uart_inst_t *uart, bool is_tx);
+uart_hw_t *uart_get_hw(uart_inst_t *uart);
+
+typedef struct stdio_driver {
+    void (*out_chars)(const char *buf, int len);
+    void (*out_flush)(void);
+    int (*in_chars)(char *buf, int len);
+} stdio_driver_t;
+extern stdio_driver_t stdio_usb;
+bool stdio_init_all(void);
+bool stdio_usb_init(void);
+bool stdio_usb_connected(void);
+void stdio_uart_init_full(uart_inst_t *uart, uint baud_rate, int tx_pin, int rx_pin);
+
+// ---- DMA ----
+#define DMA_SIZE_8 0
+typedef struct { uint32_t ctrl; } dma_channel_config;
+typedef struct { volatile uint32_t ints0; } dma_hw_t;
+extern dma_hw_t *dma_hw;
+
+int dma_claim_unused_channel(bool required);
+dma_channel_config dma_channel_get_default_config(uint channel);
+void channel_config_set_transfer_data_size(dma_channel_config *c, int size);
+void channel_config_set_read_increment(dma_channel_config *c, bool incr);
+void channel_config_set_write_increment(dma_channel_config *c, bool incr);
+void channel_config_set_dreq(dma_channel_config *c, uint dreq);
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, uint transfer_count, bool trigger);
+void dma_channel_set_irq0_enabled(uint channel, bool enabled);
+void dma_channel_set_read_addr(uint channel, const volatile void *read_addr, bool trigger);
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count, bool trigger);
+void dma_channel_start(uint channel);
+bool dma_channel_is_busy(uint channel);
+void dma_channel_transfer_from_buffer_now(uint channel, const volatile void *read_addr, uint32_t transfer_count);
+
+// ---- PIO ----
+#define PIO_FIFO_JOIN_TX 1
+#define PIO_FIFO_JOIN_RX 2
+typedef struct pio_hw { volatile uint32_t txf[4]; volatile uint32_t rxf[4]; } pio_hw_t;
+typedef pio_hw_t *PIO;
+typedef struct { uint32_t unused; } pio_sm_config;
+typedef struct { const uint16_t *instructions; uint8_t length; int8_t origin; } pio_program_t;
+extern pio_hw_t host_pio[2];
+#define pio0 (&host_pio[0])
+#define pio1 (&host_pio[1])
+
+int pio_add_program(PIO pio, const pio_program_t *program);
+int pio_claim_unused_sm(PIO pio, bool required);
+void pio_gpio_init(PIO pio, uint pin);
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+void pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin_base, uint pin_count, bool is_out);
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t pin_values, uint32_t pin_mask);
+void pio_sm_set_pindirs_with_mask(PIO pio, uint sm, uint32_t pin_dirs, uint32_t pin_mask);
+bool pio_sm_is_tx_fifo_empty(PIO pio, uint sm);
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm);
+uint pio_sm_get_rx_fifo_level(PIO pio, uint sm);
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data);
+uint32_t pio_sm_get(PIO pio, uint sm);
+uint32_t pio_sm_get_blocking(PIO pio, uint sm);
+void pio_sm_clear_fifos(PIO pio, uint sm);
+void pio_sm_restart(PIO pio, uint sm);
+void pio_sm_exec(PIO pio, uint sm, uint instr);
+uint pio_encode_jmp(uint addr);
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx);
+void sm_config_set_out_pins(pio_sm_config *c, uint out_base, uint out_count);
+void sm_config_set_sideset_pins(pio_sm_config *c, uint sideset_base);
+void sm_config_set_in_pins(pio_sm_config *c, uint in_base);
+void sm_config_set_jmp_pin(pio_sm_config *c, uint pin);
+void sm_config_set_out_shift(pio_sm_config *c, bool shift_right, bool autopull, uint pull_threshold);
+void sm_config_set_in_shift(pio_sm_config *c, bool shift_right, bool autopush, uint push_threshold);
+void sm_config_set_fifo_join(pio_sm_config *c, int join);
+void sm_config_set_clkdiv(pio_sm_config *c, float div);
+
+// ---- Flash, clocks, PWM, watchdog ----
+#define clk_sys 5
+extern uint8_t host_flash[PICO_FLASH_SIZE_BYTES];
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+uint32_t clock_get_hz(int clock);
+uint pwm_gpio_to_slice_num(uint gpio);
+uint pwm_gpio_to_channel(uint gpio);
+void pwm_set_chan_level(uint slice_num, uint chan, uint16_t level);
+void pwm_set_wrap(uint slice_num, uint16_t wrap);
+void pwm_set_clkdiv(uint slice_num, float divider);
+void pwm_set_enabled(uint slice_num, bool enabled);
+void watchdog_reboot(uint32_t pc, uint32_t sp, uint32_t delay_ms);
+
+// ---- Test side ----
+
+// Runs whenever simulated time moves, not again while it is already running
+typedef void (*host_tick_hook_t)(uint64_t now_us);
+// Every change of the GPIO outputs, with the time it happened
+typedef void (*host_gpio_hook_t)(uint32_t before, uint32_t after, uint64_t now_us);
+// A pin switched between output and input, open drain lines like 1-Wire are driven that way
+typedef void (*host_gpio_dir_hook_t)(uint gpio, bool out, uint64_t now_us);
+// A word written to a PIO TX FIFO, by the CPU or by DMA
+typedef void (*host_pio_tx_hook_t)(PIO pio, uint sm, uint32_t data);
+// Bytes the firmware sent out over the UART (DMA)
+typedef void (*host_uart_tx_hook_t)(const uint8_t *data, size_t length);
+// Bytes the firmware wrote to the USB CDC port while a host has it open
+typedef void (*host_usb_tx_hook_t)(const uint8_t *data, size_t length);
+
+extern host_tick_hook_t host_tick_hook;
+extern host_gpio_hook_t host_gpio_hook;
+extern host_gpio_dir_hook_t host_gpio_dir_hook;
+extern host_pio_tx_hook_t host_pio_tx_hook;
+extern host_uart_tx_hook_t host_uart_tx_hook;
+extern host_usb_tx_hook_t host_usb_tx_hook;
+
+void host_sev(void);
+void host_advance_us(uint64_t us);
+// The simulated clock without moving it, for models called from the hooks
+uint64_t host_now_us(void);
+// Runs the entry given to multicore_launch_core1 until simulated time reaches end_us, then returns
+void host_run_core1(uint64_t end_us);
+// Input levels the firmware reads back with gpio_get (pins it does not drive)
+void host_gpio_set_input(uint gpio, bool level);
+// Fires the GPIO interrupt for a pin as if the events had happened on it
+void host_gpio_irq(uint gpio, uint32_t events);
+// The TX FIFO of a state machine reads as not empty until then, for models of what is on the other end of the pins
+void host_pio_tx_busy(PIO pio, uint sm, uint64_t until_us);
+void host_pio_rx_push(PIO pio, uint sm, uint32_t data);
+// Pushed now, read by the firmware from at_us on like a word still being shifted in, in order
+void host_pio_rx_push_at(PIO pio, uint sm, uint32_t data, uint64_t at_us);
+// Queues bytes for the UART receiver and runs its interrupt handler
+void host_uart_receive(const uint8_t *data, size_t length);
+// Rate UART0 was last set to, for models of the other end of the line
+extern uint host_uart_baud;
+// Queues bytes for the USB CDC port, read by the firmware's next poll of stdio_usb
+void host_usb_receive(const uint8_t *data, size_t length);
+// A USB host has the CDC port open
+extern bool host_usb_connected;
+// Erases per flash sector, for the wear checks
+extern uint32_t host_flash_erases[PICO_FLASH_SIZE_BYTES / FLASH_SECTOR_SIZE];
+// Bytes flash_range_program still gets to write before the power goes, what is left of that write and every erase or
+// write after it are lost. Negative while the power stays
+extern int32_t host_flash_program_budget;
+
+#endif // HOST_SDK_H
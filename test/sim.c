@@ -0,0 +1,227 @@
+#include "sim.h"
+#include <math.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "CONFIG.h"
+#include "FAULT.h"
+#include "UART.h"
+#include "ASTRO.h"
+#include "LIMITS.h"
+#include "HOME.h"
+#include "GUIDE.h"
+#include "SHUTTER.h"
+#include "SEQUENCE.h"
+#include "ALIGN.h"
+
+#define SIM_JITTER_US 100           // A step is due on one pass but goes out on the next, sleeps included
+#define SIM_ACCEL_MARGIN 1.1f
+#define SIM_MAX_REPORTS 10          // Acceleration failures printed per axis, the count goes on
+
+sim_axis_t sim_axes[NUM_AXES];
+int sim_failures = 0;
+void (*sim_configure)(void) = NULL;
+void (*sim_core0)(uint64_t now_us) = NULL;
+void (*sim_step)(uint8_t axis, bool direction, uint64_t now_us) = NULL;
+int32_t (*sim_pulse_units)(uint8_t axis) = NULL;
+bool sim_check_accel = true;
+
+// Averaged velocity checks: a short window for rates where single steps tell nothing (follower), a long one that
+// sees a ramp running a little above the limit, which a single step cannot tell from the step quantisation
+static const uint32_t window_us[SIM_WINDOWS] = { 5000, 200000 };
+
+static uint64_t next_core0_us = 0;
+static uint32_t accel_reports[NUM_AXES];
+
+float sim_axis_accel(uint8_t axis) {
+    float acceleration = device_config.acceleration > 0.0f ? device_config.acceleration : ACCELERATION_ARCSEC_S2;
+    return acceleration * stepper_steps_per_arcsec(axis);
+}
+
+static int32_t boot_pulse_units(uint8_t axis) {
+    return POSITION_MICROSTEPS / device_config.microstepping;
+}
+
+// Speed change the planner may make over a span, plus what starting from or coming to rest takes: the first and
+// last step of a ramp are steps at up to sqrt(4·a·u), not a continuous speed
+static float allowed_change(uint8_t axis, int32_t units, uint64_t span_us, int rest_jumps) {
+    float accel = sim_axis_accel(axis);
+    return accel * span_us / 1000000.0f * SIM_ACCEL_MARGIN + rest_jumps * sqrtf(4.0f * accel * units);
+}
+
+static void accel_fail(uint8_t axis, uint64_t now_us, float change, float allowed, const char *what) {
+    sim_failures++;
+    if (accel_reports[axis]++ < SIM_MAX_REPORTS) {
+        fprintf(stderr, "FAIL axis %d at %.6f s: %s changed speed by %.0f units/s, allowed %.0f\n",
+                axis, now_us / 1000000.0, what, change, allowed);
+    }
+}
+
+static void close_windows(uint8_t axis, uint64_t now_us, int32_t units) {
+    for (int w = 0; w < SIM_WINDOWS; w++) {
+        sim_window_t *window = &sim_axes[axis].windows[w];
+        float length_s = window_us[w] / 1000000.0f;
+        while (now_us >= window->start_us + window_us[w]) {
+            float velocity = window->units / length_s;
+            if (window->have_velocity && sim_check_accel) {
+                float change = fabsf(velocity - window->velocity);
+                // A pulse more or less in either window is jitter, not acceleration
+                int32_t pulse = units;
+                if (window->pulse_units > pulse) pulse = window->pulse_units;
+                if (window->last_pulse_units > pulse) pulse = window->last_pulse_units;
+                float allowed = allowed_change(axis, pulse, window_us[w], 1) + 2.0f * pulse / length_s;
+                if (change > allowed) accel_fail(axis, now_us, change, allowed, "average over a window");
+            }
+            window->velocity = velocity;
+            window->have_velocity = true;
+            window->units = 0;
+            window->last_pulse_units = window->pulse_units;
+            // A quiet window is still at the resolution of the pulse before it
+            window->pulse_units = sim_axes[axis].last_edge_units;
+            window->start_us += window_us[w];
+        }
+    }
+}
+
+// One step edge: speed of the interval before it, between the fastest and slowest the pass jitter allows,
+// against the previous interval
+static void record_step(uint8_t axis, bool direction, uint64_t now_us) {
+    sim_axis_t *ax = &sim_axes[axis];
+    int32_t units = sim_pulse_units(axis);
+
+    close_windows(axis, now_us, units);
+    for (int w = 0; w < SIM_WINDOWS; w++) {
+        ax->windows[w].units += direction ? units : -units;
+        if (units > ax->windows[w].pulse_units) ax->windows[w].pulse_units = units;
+    }
+
+    if (ax->have_edge && direction != ax->direction) {
+        // Only ever from rest: the interval before the reversal has to be one a ramp ends with
+        ax->reversals++;
+        if (ax->have_interval && sim_check_accel) {
+            float speed = (float)ax->last_small_units * 1000000.0f / ax->last_interval_us;
+            float allowed = allowed_change(axis, ax->last_units, 0, 2);
+            if (speed > allowed) accel_fail(axis, now_us, speed, allowed, "reversal");
+        }
+        ax->have_interval = false;
+    } else if (ax->have_edge) {
+        // Across a resolution switch the interval is somewhere between the pulses on its two ends
+        int32_t small = units < ax->last_edge_units ? units : ax->last_edge_units;
+        int32_t large = units > ax->last_edge_units ? units : ax->last_edge_units;
+        uint64_t dt = now_us - ax->last_edge_us;
+        float low = (float)small * 1000000.0f / dt;
+        float high = dt > SIM_JITTER_US ? (float)large * 1000000.0f / (dt - SIM_JITTER_US) : INFINITY;
+        if (sim_check_accel) {
+            if (ax->have_interval) {
+                uint64_t prev_dt = ax->last_interval_us;
+                float prev_low = (float)ax->last_small_units * 1000000.0f / prev_dt;
+                float prev_high = prev_dt > SIM_JITTER_US ?
+                    (float)ax->last_units * 1000000.0f / (prev_dt - SIM_JITTER_US) : INFINITY;
+                // Either interval may span a resolution switch, the larger pulse counts
+                int32_t pulse = large > ax->last_units ? large : ax->last_units;
+                float allowed = allowed_change(axis, pulse, (prev_dt + dt) / 2, 2);
+                if (low - prev_high > allowed) accel_fail(axis, now_us, low - prev_high, allowed, "step");
+                if (prev_low - high > allowed) accel_fail(axis, now_us, prev_low - high, allowed, "step");
+            } else {
+                float allowed = allowed_change(axis, large, 0, 2);
+                if (low > allowed) accel_fail(axis, now_us, low, allowed, "start from rest");
+            }
+        }
+        ax->last_interval_us = dt;
+        ax->last_units = large;
+        ax->last_small_units = small;
+        ax->have_interval = true;
+    }
+
+    ax->motor_units += direction ? units : -units;
+    ax->last_edge_units = units;
+    ax->pulses++;
+    ax->direction = direction;
+    ax->have_edge = true;
+    ax->last_edge_us = now_us;
+}
+
+static void sim_gpio(uint32_t before, uint32_t after, uint64_t now_us) {
+    uint32_t rising = after & ~before;
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        if (!(rising & (1u << device_config.step_pin[axis]))) continue;
+        bool direction = (after >> device_config.dir_pin[axis]) & 1u;
+        if (sim_step) sim_step(axis, direction, now_us);
+        record_step(axis, direction, now_us);
+    }
+}
+
+static void sim_tick(uint64_t now_us) {
+    if (now_us < next_core0_us) return;
+    next_core0_us = now_us + SIM_MS;
+    if (sim_core0) sim_core0(now_us);
+}
+
+uint64_t sim_now(void) {
+    return time_us_64();
+}
+
+void sim_boot(bool with_tmc) {
+    config_init();
+    device_config.tmc2209_enabled = with_tmc ? 1 : 0;
+    if (sim_configure) sim_configure();
+    host_gpio_set_input(device_config.en_sense_pin, EN_SENSE_POWERED_LEVEL);
+    if (!sim_pulse_units) sim_pulse_units = boot_pulse_units;
+
+    astro_init();
+    limits_init();
+    home_init();
+    guide_init();
+    shutter_init();
+    sequence_init();
+    align_init();
+    stepper_init();
+    uart_init_protocol();
+
+    memset(sim_axes, 0, sizeof(sim_axes));
+    uint64_t now_us = time_us_64();
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        for (int w = 0; w < SIM_WINDOWS; w++) {
+            sim_axes[axis].windows[w].start_us = now_us;
+        }
+    }
+    host_gpio_hook = sim_gpio;
+    host_tick_hook = sim_tick;
+    stepper_resume();
+}
+
+void sim_restart_checks(void) {
+    uint64_t now_us = time_us_64();
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        sim_axes[axis].have_interval = false;
+        for (int w = 0; w < SIM_WINDOWS; w++) {
+            sim_window_t *window = &sim_axes[axis].windows[w];
+            window->have_velocity = false;
+            window->units = 0;
+            window->pulse_units = 0;
+            window->last_pulse_units = 0;
+            window->start_us = now_us;
+        }
+    }
+}
+
+void sim_run(uint64_t until_us) {
+    host_run_core1(until_us);
+    uint64_t now_us = time_us_64();
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        close_windows(axis, now_us, sim_pulse_units(axis));
+    }
+}
+
+int sim_main(int argc, char **argv, const sim_scenario_t *scenarios, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (argc < 2 || strcmp(argv[1], scenarios[i].name) != 0) continue;
+        scenarios[i].run();
+        printf("%s: %s, %d failures\n", scenarios[i].name, sim_failures ? "FAILED" : "passed", sim_failures);
+        return sim_failures ? 1 : 0;
+    }
+    fprintf(stderr, "usage: %s <scenario>, one of:\n", argv[0]);
+    for (size_t i = 0; i < count; i++) {
+        fprintf(stderr, "  %s\n", scenarios[i].name);
+    }
+    return 2;
+}
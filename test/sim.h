@@ -0,0 +1,82 @@
+#ifndef SIM_H
+#define SIM_H
+
+// Shared part of the host tests: boots the firmware modules the way main() does, runs the core 1 step loop in
+// simulated time and follows the step and direction pins to where the motors actually are.
+// A test is one executable with named scenarios, each run as its own process since the firmware state is global
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "STEPPER.h"
+
+#define SIM_MS 1000ull
+#define SIM_S 1000000ull
+
+#define SIM_WINDOWS 2
+
+// Average velocity over consecutive windows, the speed change between two of them is bounded by accel × window
+typedef struct {
+    uint64_t start_us;
+    int32_t units;
+    int32_t pulse_units;            // Largest pulse in the window, the resolution can change on the way
+    bool have_velocity;
+    float velocity;
+    int32_t last_pulse_units;
+} sim_window_t;
+
+typedef struct {
+    int32_t motor_units;            // Where the pulses put the motor, 1/256 microsteps
+    uint32_t pulses;
+    uint32_t reversals;
+    uint64_t last_edge_us;
+    // Checker state
+    bool have_edge;
+    bool have_interval;
+    bool direction;
+    int32_t last_edge_units;        // Size of the last pulse
+    int32_t last_units;             // Larger and smaller pulse on the two ends of the last interval
+    int32_t last_small_units;
+    uint64_t last_interval_us;
+    sim_window_t windows[SIM_WINDOWS];
+} sim_axis_t;
+
+typedef struct {
+    const char *name;
+    void (*run)(void);
+} sim_scenario_t;
+
+extern sim_axis_t sim_axes[NUM_AXES];
+extern int sim_failures;
+// Config changes of a scenario, applied before the modules start like settings loaded from flash
+extern void (*sim_configure)(void);
+// Core 0 side of a scenario, called every millisecond of simulated time between the core 1 passes
+extern void (*sim_core0)(uint64_t now_us);
+// Every step pulse before it is counted, for a test that models the drivers
+extern void (*sim_step)(uint8_t axis, bool direction, uint64_t now_us);
+// Units one pulse moves the motor by, the boot resolution unless a test models the drivers
+extern int32_t (*sim_pulse_units)(uint8_t axis);
+// Step edges are checked against the acceleration limit while set
+extern bool sim_check_accel;
+
+#define SIM_CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            sim_failures++; \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__); \
+            fprintf(stderr, "\n"); \
+        } \
+    } while (0)
+
+// Config defaults, motor supply present, drivers without UART unless with_tmc
+void sim_boot(bool with_tmc);
+// Core 1 runs until the simulated clock reaches until_us
+void sim_run(uint64_t until_us);
+// Edge and window checks start over with the axes at rest, after a stop they are not meant to judge
+void sim_restart_checks(void);
+uint64_t sim_now(void);
+// Acceleration limit of an axis in 1/256 microsteps per s²
+float sim_axis_accel(uint8_t axis);
+int sim_main(int argc, char **argv, const sim_scenario_t *scenarios, size_t count);
+
+#endif // SIM_H
@@ -0,0 +1,245 @@
+// Pointing model against synthetic sky data: a mount with a known tilt, altitude index error, cone error and axis
+// non-perpendicularity is synced on stars spread over the sky while the sky turns. Each solve has to reproduce the
+// stars synced so far, the error terms have to come out as they were put in, and gotos through the model have to land
+// on stars that were never synced
+
+#include <math.h>
+#include <string.h>
+#include "sim.h"
+#include "ALIGN.h"
+#include "ASTRO.h"
+
+#define ARCSEC_TO_RAD (M_PI / (180.0 * 3600.0))
+#define RAD_TO_ARCSEC (180.0 * 3600.0 / M_PI)
+#define SYNC_INTERVAL_MS 30000              // The sky turns by 7.5' between two syncs
+#define MIN_EL_DEG 15.0
+#define MAX_EL_DEG 75.0
+#define CHECK_TARGETS 40
+
+// ---- The mount as it really is ----
+
+typedef struct {
+    double w[3];                            // Sky -> mount rotation as axis * angle
+    double index_el;                        // arcsec
+    double cone;
+    double nonperp;
+} mount_t;
+
+static const mount_t *truth;
+static double truth_r[9];
+
+static void rotation_from_vector(const double *w, double *r) {
+    double angle = sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]);
+    double k[3] = { w[0] / angle, w[1] / angle, w[2] / angle };
+    double s = sin(angle), c = cos(angle), t = 1.0 - c;
+    r[0] = t * k[0] * k[0] + c;        r[1] = t * k[0] * k[1] - s * k[2]; r[2] = t * k[0] * k[2] + s * k[1];
+    r[3] = t * k[0] * k[1] + s * k[2]; r[4] = t * k[1] * k[1] + c;        r[5] = t * k[1] * k[2] - s * k[0];
+    r[6] = t * k[0] * k[2] - s * k[1]; r[7] = t * k[1] * k[2] + s * k[0]; r[8] = t * k[2] * k[2] + c;
+}
+
+static double wrap_angle(double a) {
+    while (a > M_PI) a -= 2.0 * M_PI;
+    while (a < -M_PI) a += 2.0 * M_PI;
+    return a;
+}
+
+// Geometric elevation of a star at a time, the sky turning from time 0
+static double star_elevation(double ra_hours, double dec_deg, uint64_t time_us, double *v) {
+    double ra = ra_hours * (M_PI / 12.0) - (time_us / 1e6) * SIDEREAL_RATE_ARCSEC_PER_SEC * ARCSEC_TO_RAD;
+    double dec = dec_deg * (M_PI / 180.0);
+    double sky[3] = { cos(dec) * cos(ra), cos(dec) * sin(ra), sin(dec) };
+    for (int i = 0; i < 3; i++) {
+        v[i] = truth_r[i * 3] * sky[0] + truth_r[i * 3 + 1] * sky[1] + truth_r[i * 3 + 2] * sky[2];
+    }
+    return asin(v[2]);
+}
+
+// Where the axes have to be to put the star in the eyepiece, arcsec
+static void mount_angles(double ra_hours, double dec_deg, uint64_t time_us, double *el_arcsec, double *az_arcsec) {
+    double v[3];
+    double el = star_elevation(ra_hours, dec_deg, time_us, v);
+    double cone = truth->cone * ARCSEC_TO_RAD;
+    double nonperp = truth->nonperp * ARCSEC_TO_RAD;
+    *el_arcsec = (el + astro_refraction(el)) * RAD_TO_ARCSEC + truth->index_el;
+    *az_arcsec = (atan2(v[1], v[0]) + cone / cos(el) + nonperp * tan(el)) * RAD_TO_ARCSEC;
+}
+
+// Stars from a fixed pseudo random sequence, only those well above the horizon and off the zenith
+static uint32_t seed;
+
+static double uniform(void) {
+    seed = seed * 1664525u + 1013904223u;
+    return (seed >> 8) / 16777216.0;
+}
+
+static void pick_star(uint64_t time_us, float *ra_hours, float *dec_deg) {
+    for (;;) {
+        *ra_hours = (float)(24.0 * uniform());
+        *dec_deg = (float)(asin(2.0 * uniform() - 1.0) * 180.0 / M_PI);
+        double v[3];
+        double el = star_elevation(*ra_hours, *dec_deg, time_us, v) * 180.0 / M_PI;
+        if (el > MIN_EL_DEG && el < MAX_EL_DEG) return;
+    }
+}
+
+// ---- Syncs on the way, the model checked after each solve ----
+
+static int stars;                           // Syncs to do
+static double sync_noise;                   // Largest error of a sync, arcsec
+static int synced;
+static float synced_ra[ALIGN_MAX_STARS];
+static float synced_dec[ALIGN_MAX_STARS];
+static double worst_at_synced;              // Over the solves from ALIGN_TERMS_MIN_STARS on
+static align_model_t model;
+static uint32_t model_version;
+
+// Pointing error of the model on the sky (azimuth scaled by cos(el)), arcsec
+static double pointing_error(const align_model_t *m, float ra_hours, float dec_deg, uint64_t time_us) {
+    double el, az;
+    mount_angles(ra_hours, dec_deg, time_us, &el, &az);
+    // Refraction linearised at the elevation of the target, as the background task publishes it
+    double v[3];
+    double el_rad = star_elevation(ra_hours, dec_deg, time_us, v);
+    const double h = 1e-4;
+    astro_corrections_t corrections = {
+        .refraction_rad = (float)astro_refraction(el_rad),
+        .refraction_slope = (float)((astro_refraction(el_rad + h) - astro_refraction(el_rad - h)) / (2.0 * h)),
+        .refraction_el_rad = (float)el_rad,
+    };
+    float x, z, ha;
+    align_mount_angles(m, &corrections, ra_hours, dec_deg, time_us, &x, &z, &ha);
+    double d_el = x - el;
+    double d_az = wrap_angle((z - az) * ARCSEC_TO_RAD) * RAD_TO_ARCSEC * cos(el_rad);
+    return sqrt(d_el * d_el + d_az * d_az);
+}
+
+static void sync_core0(uint64_t now_us) {
+    if (synced >= stars || (now_us / 1000) % SYNC_INTERVAL_MS != 0) return;
+
+    float ra, dec;
+    pick_star(now_us, &ra, &dec);
+    double el, az;
+    mount_angles(ra, dec, now_us, &el, &az);
+    el += sync_noise * (2.0 * uniform() - 1.0);
+    az += sync_noise * (2.0 * uniform() - 1.0) / cos(el * ARCSEC_TO_RAD);
+    stepper_set_position(AXIS_X, (int32_t)lround(el * stepper_steps_per_arcsec(AXIS_X)));
+    stepper_set_position(AXIS_Z, (int32_t)lround(az * stepper_steps_per_arcsec(AXIS_Z)));
+    align_sync(ra, dec);
+    align_background_task();
+
+    // The newest ALIGN_MAX_STARS are kept
+    if (synced >= ALIGN_MAX_STARS) {
+        memmove(&synced_ra[0], &synced_ra[1], sizeof(float) * (ALIGN_MAX_STARS - 1));
+        memmove(&synced_dec[0], &synced_dec[1], sizeof(float) * (ALIGN_MAX_STARS - 1));
+    }
+    int kept = synced < ALIGN_MAX_STARS ? synced : ALIGN_MAX_STARS - 1;
+    synced_ra[kept] = ra;
+    synced_dec[kept] = dec;
+    synced++;
+
+    SIM_CHECK(align_get_model(&model, &model_version), "no new model after sync %d", synced);
+    SIM_CHECK(model.valid, "model not valid after sync %d", synced);
+    if (synced < ALIGN_TERMS_MIN_STARS) return;
+    for (int i = 0; i <= kept; i++) {
+        double error = pointing_error(&model, synced_ra[i], synced_dec[i], now_us);
+        if (error > worst_at_synced) worst_at_synced = error;
+    }
+}
+
+// Targets that were never synced, some time after the last sync
+static double pointing_rms(const align_model_t *m, double *worst) {
+    uint64_t time_us = sim_now() + 600 * SIM_S;
+    double sum = 0.0;
+    *worst = 0.0;
+    for (int i = 0; i < CHECK_TARGETS; i++) {
+        float ra, dec;
+        pick_star(time_us, &ra, &dec);
+        double error = pointing_error(m, ra, dec, time_us);
+        sum += error * error;
+        if (error > *worst) *worst = error;
+    }
+    return sqrt(sum / CHECK_TARGETS);
+}
+
+static void run_syncs(const mount_t *mount, int count, double noise) {
+    truth = mount;
+    rotation_from_vector(mount->w, truth_r);
+    stars = count;
+    sync_noise = noise;
+    seed = 12345;
+    sim_boot(false);
+    sim_core0 = sync_core0;
+    sim_run((uint64_t)(count + 1) * SYNC_INTERVAL_MS * SIM_MS);
+    SIM_CHECK(synced == count, "%d of %d syncs", synced, count);
+}
+
+static void check_terms(double tolerance) {
+    double terms[3] = { model.index_el * RAD_TO_ARCSEC, model.cone * RAD_TO_ARCSEC, model.nonperp * RAD_TO_ARCSEC };
+    double expected[3] = { truth->index_el, truth->cone, truth->nonperp };
+    const char *names[3] = { "index", "cone", "non-perpendicularity" };
+    printf("index %.2f cone %.2f non-perpendicularity %.2f arcsec\n", terms[0], terms[1], terms[2]);
+    for (int i = 0; i < 3; i++) {
+        SIM_CHECK(fabs(terms[i] - expected[i]) < tolerance, "%s %.2f arcsec, the mount has %.2f", names[i], terms[i],
+                  expected[i]);
+    }
+}
+
+// ---- An exact mount: every solve fits its stars, the terms come out, gotos land ----
+
+static const mount_t tilted = { { 0.35, -0.8, 1.2 }, 120.0, 300.0, -90.0 };
+
+static void scenario_terms(void) {
+    run_syncs(&tilted, 6, 0.0);
+    printf("worst error at the synced stars %.2f arcsec\n", worst_at_synced);
+    // The positions are whole 1/256 microsteps, under half an arcsec
+    SIM_CHECK(worst_at_synced < 1.0, "%.2f arcsec off a synced star", worst_at_synced);
+    check_terms(2.0);
+
+    double worst;
+    double rms = pointing_rms(&model, &worst);
+    printf("gotos %.2f arcsec RMS, worst %.2f\n", rms, worst);
+    SIM_CHECK(worst < 1.5, "goto %.2f arcsec off", worst);
+}
+
+// ---- Syncs with a few arcsec of centring error, more than the model keeps: the old ones drop out ----
+
+static void scenario_noise(void) {
+    run_syncs(&tilted, ALIGN_MAX_STARS + 4, 5.0);
+    check_terms(10.0);
+
+    double worst;
+    double rms = pointing_rms(&model, &worst);
+    // A plain rotation through the same stars, what the terms are worth
+    align_model_t rotation_only = model;
+    rotation_only.index_el = rotation_only.cone = rotation_only.nonperp = 0.0f;
+    double worst_rotation;
+    double rms_rotation = pointing_rms(&rotation_only, &worst_rotation);
+    printf("gotos %.2f arcsec RMS, worst %.2f, %.1f RMS without the terms\n", rms, worst, rms_rotation);
+    SIM_CHECK(rms < 3.0, "gotos %.2f arcsec RMS", rms);
+    SIM_CHECK(worst < 6.0, "goto %.2f arcsec off", worst);
+    SIM_CHECK(rms_rotation > 20.0 * rms, "terms worth little, %.2f arcsec RMS without them", rms_rotation);
+}
+
+// ---- A mount without errors on two stars: the rotation alone, the terms held at zero ----
+
+static const mount_t square = { { -0.2, 0.5, 2.4 }, 0.0, 0.0, 0.0 };
+
+static void scenario_two_stars(void) {
+    run_syncs(&square, 2, 0.0);
+    check_terms(0.01);
+
+    double worst;
+    double rms = pointing_rms(&model, &worst);
+    printf("gotos %.2f arcsec RMS, worst %.2f\n", rms, worst);
+    SIM_CHECK(worst < 1.5, "goto %.2f arcsec off", worst);
+}
+
+static const sim_scenario_t scenarios[] = {
+    { "terms", scenario_terms },
+    { "noise", scenario_noise },
+    { "two_stars", scenario_two_stars },
+};
+
+int main(int argc, char **argv) {
+    return sim_main(argc, argv, scenarios, sizeof(scenarios) / sizeof(scenarios[0]));
+}
@@ -0,0 +1,253 @@
+// Apparent place and refraction against references worked out another way. The firmware reduces J2000 to the place
+// of date with the closed formulas of Meeus ch. 21-23, four nutation terms and the aberration without its e-terms.
+// The reference here rotates unit vectors: the precession matrix, the nutation matrix from the 18 largest IAU 1980
+// terms and the aberration as the Earth's velocity from its elliptic orbit. The reference itself is held to the
+// worked example in Meeus first. Refraction is checked against Bennett's formula, which goes from the apparent
+// elevation the other way round, and for how it scales with the temperature and the pressure
+
+#include <math.h>
+#include "sim.h"
+#include "CONFIG.h"
+
+#define DEG_TO_RAD (M_PI / 180.0)
+#define ARCSEC_TO_RAD (M_PI / (180.0 * 3600.0))
+#define RAD_TO_ARCSEC (180.0 * 3600.0 / M_PI)
+#define UNIX_EPOCH_JD 2440587.5
+#define J2000_JD 2451545.0
+#define APPARENT_ARCSEC 1.5                 // Firmware against the reference, a few tenths go in the dropped terms
+
+// ---- The reference reduction ----
+
+typedef struct {
+    int d, m, mp, f, om;                    // Multiples of the Delaunay arguments
+    double psi, psi_t;                      // 0.0001 arcsec, and per century
+    double eps, eps_t;
+} nutation_term_t;
+
+// Meeus table 22.A, everything over 0.005 arcsec
+static const nutation_term_t nutation_terms[] = {
+    {  0,  0,  0,  0, 1, -171996, -174.2, 92025,  8.9 },
+    { -2,  0,  0,  2, 2,  -13187,   -1.6,  5736, -3.1 },
+    {  0,  0,  0,  2, 2,   -2274,   -0.2,   977, -0.5 },
+    {  0,  0,  0,  0, 2,    2062,    0.2,  -895,  0.5 },
+    {  0,  1,  0,  0, 0,    1426,   -3.4,    54, -0.1 },
+    {  0,  0,  1,  0, 0,     712,    0.1,    -7,  0.0 },
+    { -2,  1,  0,  2, 2,    -517,    1.2,   224, -0.6 },
+    {  0,  0,  0,  2, 1,    -386,   -0.4,   200,  0.0 },
+    {  0,  0,  1,  2, 2,    -301,    0.0,   129, -0.1 },
+    { -2, -1,  0,  2, 2,     217,   -0.5,   -95,  0.3 },
+    { -2,  0,  1,  0, 0,    -158,    0.0,     0,  0.0 },
+    { -2,  0,  0,  2, 1,     129,    0.1,   -70,  0.0 },
+    {  0,  0, -1,  2, 2,     123,    0.0,   -53,  0.0 },
+    {  2,  0,  0,  0, 0,      63,    0.0,     0,  0.0 },
+    {  0,  0,  1,  0, 1,      63,    0.1,   -33,  0.0 },
+    {  2,  0, -1,  2, 2,     -59,    0.0,    26,  0.0 },
+    {  0,  0, -1,  0, 1,     -58,   -0.1,    32,  0.0 },
+    {  0,  0,  1,  2, 1,     -51,    0.0,    27,  0.0 },
+};
+
+static void rotate_x(double *v, double a) {
+    double y = cos(a) * v[1] + sin(a) * v[2], z = -sin(a) * v[1] + cos(a) * v[2];
+    v[1] = y;
+    v[2] = z;
+}
+
+static void rotate_y(double *v, double a) {
+    double x = cos(a) * v[0] - sin(a) * v[2], z = sin(a) * v[0] + cos(a) * v[2];
+    v[0] = x;
+    v[2] = z;
+}
+
+static void rotate_z(double *v, double a) {
+    double x = cos(a) * v[0] + sin(a) * v[1], y = -sin(a) * v[0] + cos(a) * v[1];
+    v[0] = x;
+    v[1] = y;
+}
+
+static void reference_apparent(double ra_hours, double dec_deg, double jd, double *app_ra_hours, double *app_dec_deg) {
+    double t = (jd - J2000_JD) / 36525.0;
+    double ra = ra_hours * 15.0 * DEG_TO_RAD, dec = dec_deg * DEG_TO_RAD;
+    double v[3] = { cos(dec) * cos(ra), cos(dec) * sin(ra), sin(dec) };
+
+    // Precession: the mean equator of date, R3(-z) R2(theta) R3(-zeta)
+    double zeta  = (2306.2181 * t + 0.30188 * t * t + 0.017998 * t * t * t) * ARCSEC_TO_RAD;
+    double z     = (2306.2181 * t + 1.09468 * t * t + 0.018203 * t * t * t) * ARCSEC_TO_RAD;
+    double theta = (2004.3109 * t - 0.42665 * t * t - 0.041833 * t * t * t) * ARCSEC_TO_RAD;
+    rotate_z(v, -zeta);
+    rotate_y(v, theta);
+    rotate_z(v, -z);
+
+    // Nutation: to the ecliptic of date, along it by dpsi, back up to the true equator, R1(-eps) R3(-dpsi) R1(eps0)
+    double d  = (297.85036 + 445267.111480 * t) * DEG_TO_RAD;
+    double m  = (357.52772 + 35999.050340 * t) * DEG_TO_RAD;
+    double mp = (134.96298 + 477198.867398 * t) * DEG_TO_RAD;
+    double f  = (93.27191 + 483202.017538 * t) * DEG_TO_RAD;
+    double om = (125.04452 - 1934.136261 * t) * DEG_TO_RAD;
+    double dpsi = 0.0, deps = 0.0;
+    for (size_t i = 0; i < sizeof(nutation_terms) / sizeof(nutation_terms[0]); i++) {
+        const nutation_term_t *n = &nutation_terms[i];
+        double arg = n->d * d + n->m * m + n->mp * mp + n->f * f + n->om * om;
+        dpsi += (n->psi + n->psi_t * t) * sin(arg);
+        deps += (n->eps + n->eps_t * t) * cos(arg);
+    }
+    dpsi *= 1e-4 * ARCSEC_TO_RAD;
+    deps *= 1e-4 * ARCSEC_TO_RAD;
+    double eps0 = (84381.448 - 46.8150 * t - 0.00059 * t * t + 0.001813 * t * t * t) * ARCSEC_TO_RAD;
+    double eps = eps0 + deps;
+    rotate_x(v, eps0);
+    rotate_z(v, -dpsi);
+    rotate_x(v, -eps);
+
+    // Aberration: the Earth's velocity on its ellipse in units of c, added to the direction of the light
+    double l0 = (280.46646 + 36000.76983 * t + 0.0003032 * t * t) * DEG_TO_RAD;
+    double ms = (357.52911 + 35999.05029 * t - 0.0001537 * t * t) * DEG_TO_RAD;
+    double c = (1.914602 - 0.004817 * t - 0.000014 * t * t) * sin(ms) + (0.019993 - 0.000101 * t) * sin(2 * ms)
+             + 0.000289 * sin(3 * ms);
+    double sun = l0 + c * DEG_TO_RAD;
+    double e = 0.016708634 - 0.000042037 * t;
+    double perihelion = (102.93735 + 1.71946 * t + 0.00046 * t * t) * DEG_TO_RAD;
+    double k = 20.49552 * ARCSEC_TO_RAD;
+    double velocity[3] = { k * (sin(sun) - e * sin(perihelion)), -k * (cos(sun) - e * cos(perihelion)), 0.0 };
+    rotate_x(velocity, -eps);
+    double norm = 0.0;
+    for (int i = 0; i < 3; i++) {
+        v[i] += velocity[i];
+        norm += v[i] * v[i];
+    }
+    norm = sqrt(norm);
+
+    double app_ra = atan2(v[1], v[0]);
+    if (app_ra < 0) app_ra += 2.0 * M_PI;
+    *app_ra_hours = app_ra / (15.0 * DEG_TO_RAD);
+    *app_dec_deg = asin(v[2] / norm) / DEG_TO_RAD;
+}
+
+// Angle between two places, arcsec
+static double separation(double ra1_hours, double dec1_deg, double ra2_hours, double dec2_deg) {
+    double ra1 = ra1_hours * 15.0 * DEG_TO_RAD, dec1 = dec1_deg * DEG_TO_RAD;
+    double ra2 = ra2_hours * 15.0 * DEG_TO_RAD, dec2 = dec2_deg * DEG_TO_RAD;
+    double a[3] = { cos(dec1) * cos(ra1), cos(dec1) * sin(ra1), sin(dec1) };
+    double b[3] = { cos(dec2) * cos(ra2), cos(dec2) * sin(ra2), sin(dec2) };
+    double cross[3] = { a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0] };
+    double sin_angle = sqrt(cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2]);
+    return atan2(sin_angle, a[0] * b[0] + a[1] * b[1] + a[2] * b[2]) * RAD_TO_ARCSEC;
+}
+
+static double hms(int h, int m, double s) {
+    return h + m / 60.0 + s / 3600.0;
+}
+
+static double dms(int d, int m, double s) {
+    return d + m / 60.0 + s / 3600.0;
+}
+
+// The firmware's apparent place at a Julian date, told the time the way the host does
+static void firmware_apparent(double ra_hours, double dec_deg, double jd, double *app_ra_hours, double *app_dec_deg) {
+    astro_set_unix_time((int64_t)llround((jd - UNIX_EPOCH_JD) * 86400000.0));
+    astro_apparent(ra_hours, dec_deg, time_us_64(), app_ra_hours, app_dec_deg);
+}
+
+// ---- Meeus example 23.a: theta Persei on 2028 Nov 13.19 TD ----
+
+#define THETA_PER_JD 2462088.69
+
+static void scenario_meeus(void) {
+    sim_boot(false);
+    // J2000 place moved along by the proper motion, which the firmware leaves to the host
+    double years = (THETA_PER_JD - J2000_JD) / 365.25;
+    double ra = hms(2, 44, 11.986 + 0.03425 * years);
+    double dec = dms(49, 13, 42.48 - 0.0895 * years);
+    double expected_ra = hms(2, 46, 14.390), expected_dec = dms(49, 21, 7.45);
+
+    double ra_out, dec_out;
+    astro_apparent(ra, dec, time_us_64(), &ra_out, &dec_out);
+    SIM_CHECK(ra_out == ra && dec_out == dec, "moved without a time from the host");
+
+    double ref_ra, ref_dec;
+    reference_apparent(ra, dec, THETA_PER_JD, &ref_ra, &ref_dec);
+    double reference_error = separation(ref_ra, ref_dec, expected_ra, expected_dec);
+    firmware_apparent(ra, dec, THETA_PER_JD, &ra_out, &dec_out);
+    double firmware_error = separation(ra_out, dec_out, expected_ra, expected_dec);
+    double moved = separation(ra, dec, expected_ra, expected_dec);
+    printf("reference %.3f arcsec off the example, firmware %.3f, the place moved %.1f\n", reference_error,
+           firmware_error, moved);
+    SIM_CHECK(reference_error < 0.1, "reference %.3f arcsec off the example", reference_error);
+    SIM_CHECK(firmware_error < APPARENT_ARCSEC, "firmware %.3f arcsec off the example", firmware_error);
+}
+
+// ---- The whole sky over half a century, the poles left out where RA stops meaning much ----
+
+static const double grid_jd[] = { 2451545.0, 2455197.5, 2460676.5, 2462088.69, 2469807.5 };
+
+static void scenario_grid(void) {
+    sim_boot(false);
+    double worst = 0.0, sum = 0.0;
+    int count = 0;
+    for (size_t j = 0; j < sizeof(grid_jd) / sizeof(grid_jd[0]); j++) {
+        for (int dec = -80; dec <= 80; dec += 10) {
+            for (int ra = 0; ra < 24; ra++) {
+                double ref_ra, ref_dec, ra_out, dec_out;
+                reference_apparent(ra + 0.25, dec, grid_jd[j], &ref_ra, &ref_dec);
+                firmware_apparent(ra + 0.25, dec, grid_jd[j], &ra_out, &dec_out);
+                double error = separation(ra_out, dec_out, ref_ra, ref_dec);
+                SIM_CHECK(error < APPARENT_ARCSEC, "%.2fh %+d deg at JD %.2f: %.3f arcsec off", ra + 0.25, dec,
+                          grid_jd[j], error);
+                if (error > worst) worst = error;
+                sum += error * error;
+                count++;
+            }
+        }
+    }
+    printf("%d places, %.3f arcsec RMS, %.3f at worst\n", count, sqrt(sum / count), worst);
+}
+
+// ---- Refraction: Bennett from the apparent side, the zenith, the air ----
+
+static double bennett_arcmin(double apparent_deg) {
+    return 1.0 / tan((apparent_deg + 7.31 / (apparent_deg + 4.4)) * DEG_TO_RAD);
+}
+
+static double refraction_arcsec(double el_deg) {
+    return astro_refraction(el_deg * DEG_TO_RAD) * RAD_TO_ARCSEC;
+}
+
+static void scenario_refraction(void) {
+    sim_boot(false);
+    // Standard air: 1010 hPa, 10 C
+    double worst = 0.0;
+    for (double el = 5.0; el <= 90.0; el += 1.0) {
+        double r = refraction_arcsec(el);
+        double expected = bennett_arcmin(el + r / 3600.0) * 60.0;
+        if (fabs(r - expected) > worst) worst = fabs(r - expected);
+        SIM_CHECK(fabs(r - expected) < 5.0, "%.0f deg: %.1f arcsec, Bennett has %.1f", el, r, expected);
+    }
+    // A star on the apparent horizon is 34.5' below the true one
+    double horizon = refraction_arcsec(-34.5 / 60.0) / 60.0, zenith = refraction_arcsec(90.0), at_45 = refraction_arcsec(45.0);
+    printf("Bennett within %.2f arcsec from 5 deg up, %.1f' at the horizon, %.1f\" at 45 deg, %.3f\" at the zenith\n",
+           worst, horizon, at_45, zenith);
+    SIM_CHECK(fabs(horizon - 34.5) < 0.5, "%.1f arcmin at the horizon", horizon);
+    SIM_CHECK(fabs(zenith) < 0.05, "%.3f arcsec at the zenith", zenith);
+
+    // Cold air bends more, thin air less, in proportion to the density
+    astro_set_temperature(-10.0f);
+    double cold = refraction_arcsec(45.0);
+    device_config.pressure_hpa = 850.0f;
+    double cold_thin = refraction_arcsec(45.0);
+    // No sensor: the last temperature stays
+    astro_set_temperature(-1000.0f);
+    double no_sensor = refraction_arcsec(45.0);
+    printf("45 deg: %.2f\" at -10 C, %.2f\" at 850 hPa too\n", cold, cold_thin);
+    SIM_CHECK(fabs(cold / at_45 - 283.0 / 263.0) < 1e-6, "-10 C scales by %.5f", cold / at_45);
+    SIM_CHECK(fabs(cold_thin / cold - 850.0 / 1010.0) < 1e-6, "850 hPa scales by %.5f", cold_thin / cold);
+    SIM_CHECK(no_sensor == cold_thin, "the missing sensor's -1000 C taken, %.2f\"", no_sensor);
+}
+
+static const sim_scenario_t scenarios[] = {
+    { "meeus", scenario_meeus },
+    { "grid", scenario_grid },
+    { "refraction", scenario_refraction },
+};
+
+int main(int argc, char **argv) {
+    return sim_main(argc, argv, scenarios, sizeof(scenarios) / sizeof(scenarios[0]));
+}
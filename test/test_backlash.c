@@ -0,0 +1,196 @@
+// Backlash take-up against a gear model: the output shaft only follows the motor once the slack between them is
+// driven through. After every move, in either direction, the output has to be where the position counter says
+// (less the slack on the side it started engaged on), the take-up steps must not be counted, and the slack has to
+// go by at the take-up speed. Rate tracking reversed on the field rotation axis has to lose only that much time
+
+#include <math.h>
+#include "sim.h"
+#include "CONFIG.h"
+
+#define BACKLASH_ARCSEC 60.0f
+#define TAKEUP_ARCSEC 3600.0f               // The default take-up speed
+
+static int phase = 0;
+static uint64_t phase_start_us;
+
+static void next_phase(uint64_t now_us) {
+    phase++;
+    phase_start_us = now_us;
+}
+
+// ---- The gear: the motor moves within [output, output + slack] without moving the output ----
+
+typedef struct {
+    int32_t motor;                          // units
+    int32_t output;                         // units, the motor position it would have with the slack taken up downwards
+    int32_t slack;
+    uint32_t free_pulses;                   // Pulses that did not move the output
+    uint64_t free_run_start_us;
+    uint64_t last_free_us;
+    uint64_t longest_free_us;
+} gear_t;
+
+static gear_t gears[NUM_AXES];
+
+static void gear_step(uint8_t axis, bool direction, uint64_t now_us) {
+    gear_t *gear = &gears[axis];
+    int32_t pulse = sim_pulse_units(axis);
+    gear->motor += direction ? pulse : -pulse;
+    int32_t output = gear->output;
+    if (gear->motor > gear->output + gear->slack) gear->output = gear->motor - gear->slack;
+    if (gear->motor < gear->output) gear->output = gear->motor;
+    if (gear->output != output) return;
+
+    // In the slack, a run of them is one take-up
+    gear->free_pulses++;
+    if (now_us - gear->last_free_us > 100 * SIM_MS) gear->free_run_start_us = now_us;
+    gear->last_free_us = now_us;
+    uint64_t run_us = now_us - gear->free_run_start_us;
+    if (run_us > gear->longest_free_us) gear->longest_free_us = run_us;
+}
+
+// ---- Setup ----
+
+static void configure(void) {
+    device_config.backlash[AXIS_X] = BACKLASH_ARCSEC;
+    device_config.backlash[AXIS_Y] = BACKLASH_ARCSEC;
+}
+
+// Engaged for the way the first move goes, what the firmware assumes at boot
+static void start(bool first_positive) {
+    sim_configure = configure;
+    sim_boot(false);
+    // The take-up runs without a ramp, the motor is free in the slack
+    sim_check_accel = false;
+    sim_step = gear_step;
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        gear_t *gear = &gears[axis];
+        gear->slack = (int32_t)lroundf(BACKLASH_ARCSEC * stepper_steps_per_arcsec(axis));
+        gear->output = first_positive ? -gear->slack : 0;
+    }
+}
+
+// The whole number of pulses nearest the slack
+static int32_t takeup_pulses(uint8_t axis) {
+    return (int32_t)lroundf((float)gears[axis].slack / sim_pulse_units(axis));
+}
+
+static float units_to_arcsec(uint8_t axis, float units) {
+    return units / stepper_steps_per_arcsec(axis);
+}
+
+static float pulse_arcsec(uint8_t axis) {
+    return units_to_arcsec(axis, sim_pulse_units(axis));
+}
+
+// Output against the counter, the slack on the side the gear started engaged on taken off
+static float output_error(uint8_t axis) {
+    return units_to_arcsec(axis, gears[axis].output + gears[axis].slack - stepper_get_position(axis));
+}
+
+// ---- Static moves back and forth: the output ends where the counter says every time ----
+
+#define MOVES 5
+
+static const int32_t targets[MOVES] = { 3000, 1000, 2000, -500, -400 };
+static int move;
+static float worst_output_error;
+static float worst_counter_error;
+
+static void moves_core0(uint64_t now_us) {
+    if (phase == 0) {
+        stepper_queue_static_move(AXIS_X, targets[move]);
+        next_phase(now_us);
+    } else if (phase == 1 && !stepper_is_moving() && stepper_get_mode() == STEPPER_MODE_IDLE) {
+        float output = output_error(AXIS_X);
+        float counter = units_to_arcsec(AXIS_X, stepper_get_position(AXIS_X)) - targets[move];
+        // The take-up is not counted: the motor is off the counter by the take-up pulses after a move down
+        bool down = move > 0 && targets[move] < targets[move - 1];
+        int32_t motor = sim_axes[AXIS_X].motor_units - stepper_get_position(AXIS_X);
+        printf("to %ld: output %.1f arcsec off the counter, counter %.1f off the target, motor %.1f off the counter\n",
+               (long)targets[move], output, counter, units_to_arcsec(AXIS_X, motor));
+        if (fabsf(output) > worst_output_error) worst_output_error = fabsf(output);
+        if (fabsf(counter) > worst_counter_error) worst_counter_error = fabsf(counter);
+        int32_t expected_motor = down ? -takeup_pulses(AXIS_X) * sim_pulse_units(AXIS_X) : 0;
+        SIM_CHECK(motor == expected_motor, "move to %ld: motor %ld units off the counter, not %ld", (long)targets[move],
+                  (long)motor, (long)expected_motor);
+        move++;
+        phase = move < MOVES ? 0 : 2;
+    }
+}
+
+static void scenario_moves(void) {
+    start(true);
+    sim_core0 = moves_core0;
+    sim_run(20 * SIM_S);
+    SIM_CHECK(phase == 2, "not done, phase %d move %d", phase, move);
+    // The take-up goes out in whole pulses, the nearest count to the slack
+    SIM_CHECK(worst_output_error <= 0.5f * pulse_arcsec(AXIS_X) + 0.5f, "output up to %.1f arcsec off the counter",
+              worst_output_error);
+    SIM_CHECK(worst_counter_error <= 0.5f * pulse_arcsec(AXIS_X) + 0.5f, "counter up to %.1f arcsec off a target",
+              worst_counter_error);
+
+    // Four reversals, each a run of free pulses at the take-up speed
+    float takeup_s = BACKLASH_ARCSEC / TAKEUP_ARCSEC;
+    float free_s = gears[AXIS_X].longest_free_us / 1e6f;
+    float free_arcsec = gears[AXIS_X].free_pulses * pulse_arcsec(AXIS_X);
+    printf("%.1f arcsec in the slack, longest take-up %.1f ms, %.1f ms at the take-up speed\n", free_arcsec,
+           free_s * 1000.0f, takeup_s * 1000.0f);
+    SIM_CHECK(gears[AXIS_X].free_pulses == 4u * (uint32_t)takeup_pulses(AXIS_X),
+              "%lu pulses in the slack over four reversals", (unsigned long)gears[AXIS_X].free_pulses);
+    SIM_CHECK(free_s <= takeup_s * 1.2f + 0.005f, "a take-up took %.1f ms", free_s * 1000.0f);
+    // A move ramping on through its take-up would overshoot and pay for a reversal back
+    SIM_CHECK(sim_axes[AXIS_X].reversals == 4, "X reversed %lu times", (unsigned long)sim_axes[AXIS_X].reversals);
+}
+
+// ---- Rate tracking on the field rotation axis reversed: the output turns back after the take-up alone ----
+
+#define TRACK_RATE 20.0f
+#define TRACK_S 10
+
+static float output_at_reversal;
+static uint64_t reversal_us;
+
+static void rate_core0(uint64_t now_us) {
+    if (phase == 0) {
+        stepper_start_tracking(0.0f, TRACK_RATE, 0.0f);
+        next_phase(now_us);
+    } else if (phase == 1 && now_us - phase_start_us >= TRACK_S * SIM_S) {
+        output_at_reversal = units_to_arcsec(AXIS_Y, gears[AXIS_Y].output);
+        reversal_us = now_us;
+        stepper_start_tracking(0.0f, -TRACK_RATE, 0.0f);
+        next_phase(now_us);
+    } else if (phase == 2 && now_us - phase_start_us >= TRACK_S * SIM_S) {
+        stepper_stop_tracking();
+        next_phase(now_us);
+    }
+}
+
+static void scenario_rate(void) {
+    start(true);
+    sim_core0 = rate_core0;
+    sim_run((2 * TRACK_S + 2) * SIM_S);
+    SIM_CHECK(phase == 3, "not done, phase %d", phase);
+
+    // Back over the time since the reversal less the take-up, within the pulses rate tracking counts
+    float takeup_s = BACKLASH_ARCSEC / TAKEUP_ARCSEC;
+    float output = units_to_arcsec(AXIS_Y, gears[AXIS_Y].output);
+    float back = output_at_reversal - output;
+    float expected = TRACK_RATE * (TRACK_S - takeup_s);
+    printf("output back %.1f arcsec after the reversal, %.1f expected\n", back, expected);
+    SIM_CHECK(fabsf(back - expected) <= 2.0f * pulse_arcsec(AXIS_Y), "output back %.1f arcsec instead of %.1f", back,
+              expected);
+    float error = output_error(AXIS_Y);
+    SIM_CHECK(fabsf(error) <= 0.5f * pulse_arcsec(AXIS_Y) + 0.5f, "output %.1f arcsec off the counter", error);
+    SIM_CHECK(gears[AXIS_Y].longest_free_us / 1e6f <= takeup_s * 1.2f + 0.005f, "the take-up took %.1f ms",
+              gears[AXIS_Y].longest_free_us / 1e3f);
+}
+
+static const sim_scenario_t scenarios[] = {
+    { "moves", scenario_moves },
+    { "rate", scenario_rate },
+};
+
+int main(int argc, char **argv) {
+    return sim_main(argc, argv, scenarios, sizeof(scenarios) / sizeof(scenarios[0]));
+}
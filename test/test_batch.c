@@ -0,0 +1,331 @@
+// Protocol v2 batch frames from the host codec through the UART interrupt: what the firmware makes of them has to
+// match what went in, malformed batches are dropped as a whole, and random payloads are judged against an
+// independent reading of the README's batch format
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "codec.h"
+#include "UART.h"
+
+#define ROUND_TRIP_FRAMES 2000
+#define FUZZ_FRAMES 20000
+
+extern volatile stepper_command_t axis_commands[NUM_AXES];
+extern volatile tracking_state_t tracking_state;
+
+// What a batch leaves behind: the static move per axis and the tracking rates
+typedef struct {
+    bool move_valid[NUM_AXES];
+    int32_t move_target[NUM_AXES];
+    bool tracking;
+    float rates[NUM_AXES];
+} motion_state_t;
+
+static uint8_t next_id = 1;
+static uint8_t acked_id;
+static uint32_t ack_count;
+
+static void on_uart_tx(const uint8_t *data, size_t length) {
+    // The DMA sends whole frames, each ends in the delimiter
+    uint8_t cmd_type, msg_id, payload[256], payload_length;
+    size_t start = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] != 0) continue;
+        if (codec_unframe(&data[start], i - start, &cmd_type, &msg_id, payload, &payload_length) &&
+            cmd_type == CMD_ACK && payload_length == 1) {
+            acked_id = payload[0];
+            ack_count++;
+        }
+        start = i + 1;
+    }
+}
+
+static motion_state_t motion_state(void) {
+    motion_state_t state;
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        state.move_valid[axis] = axis_commands[axis].valid;
+        state.move_target[axis] = state.move_valid[axis] ? axis_commands[axis].target_position : 0;
+        state.rates[axis] = tracking_state.tracking_active ? tracking_state.rates_arcsec_per_sec[axis] : 0.0f;
+    }
+    state.tracking = tracking_state.tracking_active;
+    return state;
+}
+
+static bool same_state(const motion_state_t *a, const motion_state_t *b) {
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        if (a->move_valid[axis] != b->move_valid[axis] || a->move_target[axis] != b->move_target[axis]) return false;
+        if (a->rates[axis] != b->rates[axis]) return false;
+    }
+    return a->tracking == b->tracking;
+}
+
+static void reset_motion(void) {
+    stepper_stop_all_moves();
+    stepper_stop_tracking();
+}
+
+// Sends a batch the way a host does and lets the ACK go out, true if it was ACKed
+static bool send_batch(const uint8_t *batch, size_t length) {
+    uint8_t frame[CODEC_MAX_FRAME];
+    uint8_t id = next_id++;
+    if (next_id == 0) next_id = 1;
+    size_t frame_length = codec_frame(frame, CMD_BATCH, id, batch, (uint8_t)length);
+    uint32_t acks = ack_count;
+    host_uart_receive(frame, frame_length);
+    for (int i = 0; i < 8 && ack_count == acks; i++) {
+        uart_background_task();
+        host_advance_us(100);
+    }
+    return ack_count == acks + 1 && acked_id == id;
+}
+
+static int32_t random_value(void) {
+    // Every varint length from 1 to 5 bytes, and the extremes
+    switch (rand() % 8) {
+        case 0: return INT32_MAX;
+        case 1: return INT32_MIN;
+        case 2: return rand() % 128 - 64;
+        default: {
+            int bits = 1 + rand() % 31;
+            int32_t magnitude = (int32_t)(((uint32_t)rand() << 16 ^ (uint32_t)rand()) & ((1u << bits) - 1));
+            return rand() % 2 ? magnitude : -magnitude;
+        }
+    }
+}
+
+// ---- Round trip: valid batches of moves and rates, the last word per axis has to come out ----
+
+static void scenario_round_trip(void) {
+    sim_boot(false);
+    host_uart_tx_hook = on_uart_tx;
+    srand(44);
+    for (int frame = 0; frame < ROUND_TRIP_FRAMES; frame++) {
+        reset_motion();
+        motion_state_t expected = motion_state();
+        uint8_t batch[128];
+        size_t length = 0;
+        int entries = 1 + rand() % 5;
+        for (int e = 0; e < entries; e++) {
+            if (rand() % 3) {
+                uint8_t axis = (uint8_t)(rand() % NUM_AXES);
+                int32_t position = random_value();
+                length += codec_batch_move_static(&batch[length], axis, position);
+                expected.move_valid[axis] = true;
+                expected.move_target[axis] = position;
+                expected.tracking = false;
+                memset(expected.rates, 0, sizeof(expected.rates));
+            } else {
+                // Within every axis' step rate limit, or the firmware refuses the rates
+                int32_t units[NUM_AXES];
+                for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+                    units[axis] = random_value() % 60000000;
+                    expected.rates[axis] = units[axis] / BATCH_RATE_UNITS;
+                }
+                length += codec_batch_move_tracking(&batch[length], units);
+                memset(expected.move_valid, 0, sizeof(expected.move_valid));
+                memset(expected.move_target, 0, sizeof(expected.move_target));
+                expected.tracking = true;
+            }
+        }
+        SIM_CHECK(send_batch(batch, length), "frame %d not ACKed", frame);
+        motion_state_t state = motion_state();
+        SIM_CHECK(same_state(&state, &expected), "frame %d decoded differently", frame);
+        if (sim_failures > 10) return;
+    }
+}
+
+// ---- Malformed batches: dropped as a whole, still ACKed since the frame itself was fine ----
+
+static void expect_dropped(const char *what, const uint8_t *batch, size_t length) {
+    reset_motion();
+    motion_state_t before = motion_state();
+    SIM_CHECK(send_batch(batch, length), "%s: not ACKed", what);
+    motion_state_t after = motion_state();
+    SIM_CHECK(same_state(&before, &after), "%s: batch was not dropped", what);
+}
+
+static void scenario_malformed(void) {
+    sim_boot(false);
+    host_uart_tx_hook = on_uart_tx;
+    uint8_t batch[128];
+    size_t good = codec_batch_move_static(batch, AXIS_X, 1234);
+
+    // Each case follows a good entry, which must not run either
+    const uint8_t over_long_varint[] = { CMD_MOVE_STATIC, 6, AXIS_Y, 0x80, 0x80, 0x80, 0x80, 0x10 };
+    const uint8_t unterminated_varint[] = { CMD_MOVE_STATIC, 3, AXIS_Y, 0x81, 0x82 };
+    const uint8_t static_trailing[] = { CMD_MOVE_STATIC, 3, AXIS_Y, 0x04, 0x00 };
+    const uint8_t tracking_short[] = { CMD_MOVE_TRACKING, 2, 0x02, 0x04 };
+    const uint8_t tracking_trailing[] = { CMD_MOVE_TRACKING, 4, 0x02, 0x04, 0x06, 0x08 };
+    const uint8_t static_empty[] = { CMD_MOVE_STATIC, 0 };
+    const uint8_t length_overrun[] = { CMD_MOVE_STATIC, 9, AXIS_Y, 0x04 };
+    const uint8_t header_cut[] = { CMD_MOVE_STATIC };
+    const uint8_t nested[] = { CMD_BATCH, 4, CMD_MOVE_STATIC, 2, AXIS_Y, 0x04 };
+    const uint8_t ack[] = { CMD_ACK, 1, 0x42 };
+    const struct { const char *what; const uint8_t *bytes; size_t length; } cases[] = {
+        { "over-long varint", over_long_varint, sizeof(over_long_varint) },
+        { "unterminated varint", unterminated_varint, sizeof(unterminated_varint) },
+        { "trailing byte after a move", static_trailing, sizeof(static_trailing) },
+        { "two of three rates", tracking_short, sizeof(tracking_short) },
+        { "trailing byte after the rates", tracking_trailing, sizeof(tracking_trailing) },
+        { "move without a payload", static_empty, sizeof(static_empty) },
+        { "entry longer than the frame", length_overrun, sizeof(length_overrun) },
+        { "entry header cut off", header_cut, sizeof(header_cut) },
+        { "nested batch", nested, sizeof(nested) },
+        { "ACK in a batch", ack, sizeof(ack) },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        memcpy(&batch[good], cases[i].bytes, cases[i].length);
+        expect_dropped(cases[i].what, batch, good + cases[i].length);
+    }
+
+    // The largest value a 5 byte varint can carry is still taken
+    const uint8_t top_varint[] = { CMD_MOVE_STATIC, 6, AXIS_Y, 0xFE, 0xFF, 0xFF, 0xFF, 0x0F };
+    memcpy(&batch[good], top_varint, sizeof(top_varint));
+    reset_motion();
+    SIM_CHECK(send_batch(batch, good + sizeof(top_varint)), "5 byte varint: not ACKed");
+    SIM_CHECK(axis_commands[AXIS_X].valid && axis_commands[AXIS_X].target_position == 1234, "5 byte varint: X not moved");
+    SIM_CHECK(axis_commands[AXIS_Y].valid && axis_commands[AXIS_Y].target_position == INT32_MAX,
+              "5 byte varint: Y at %ld", (long)axis_commands[AXIS_Y].target_position);
+}
+
+// ---- Fuzz: random entries, judged by a separate reading of the format ----
+
+// Zigzag LEB128 of at most 5 bytes whose value fits 32 bits, read independently of UART.c
+static bool reference_varint(const uint8_t *data, size_t length, size_t *used, int32_t *value) {
+    uint64_t raw = 0;
+    for (size_t i = 0; i < length && i < 5; i++) {
+        raw |= (uint64_t)(data[i] & 0x7F) << (7 * i);
+        if (data[i] & 0x80) continue;
+        if (raw > UINT32_MAX) return false;
+        *used = i + 1;
+        *value = (int32_t)((uint32_t)raw >> 1) ^ -(int32_t)(raw & 1);
+        return true;
+    }
+    return false;
+}
+
+// Applies a batch to state the way the README says, false if the batch is malformed and must be dropped
+static bool reference_batch(const uint8_t *batch, size_t length, motion_state_t *state) {
+    motion_state_t result = *state;
+    size_t offset = 0;
+    while (offset < length) {
+        if (length - offset < 2) return false;
+        uint8_t cmd_type = batch[offset];
+        uint8_t entry_length = batch[offset + 1];
+        const uint8_t *payload = &batch[offset + 2];
+        offset += 2;
+        if (entry_length > length - offset) return false;
+        offset += entry_length;
+        if (cmd_type == CMD_ACK || cmd_type == CMD_BATCH) return false;
+
+        size_t used = 0;
+        int32_t values[NUM_AXES];
+        if (cmd_type == CMD_MOVE_STATIC) {
+            if (entry_length < 1 || !reference_varint(&payload[1], entry_length - 1, &used, &values[0]) ||
+                used != (size_t)entry_length - 1) return false;
+            uint8_t axis = payload[0];
+            if (axis >= NUM_AXES) continue;     // A valid entry the firmware ignores
+            result.move_valid[axis] = true;
+            result.move_target[axis] = values[0];
+            result.tracking = false;
+            memset(result.rates, 0, sizeof(result.rates));
+        } else if (cmd_type == CMD_MOVE_TRACKING) {
+            size_t at = 0;
+            for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+                if (!reference_varint(&payload[at], entry_length - at, &used, &values[axis])) return false;
+                at += used;
+            }
+            if (at != entry_length) return false;
+            bool possible = true;
+            for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+                if (fabsf(values[axis] / BATCH_RATE_UNITS) > stepper_max_rate_arcsec(axis)) possible = false;
+            }
+            if (!possible) continue;            // Refused with a limit event, nothing changes
+            memset(result.move_valid, 0, sizeof(result.move_valid));
+            memset(result.move_target, 0, sizeof(result.move_target));
+            result.tracking = true;
+            for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+                result.rates[axis] = values[axis] / BATCH_RATE_UNITS;
+            }
+        }
+    }
+    *state = result;
+    return true;
+}
+
+// Bytes that make varints of every length and their corruptions likely
+static uint8_t random_byte(void) {
+    switch (rand() % 4) {
+        case 0: return (uint8_t)(0x80 | rand());
+        case 1: return (uint8_t)(rand() & 0x7F);
+        case 2: return (uint8_t)(rand() % 3);
+        default: return (uint8_t)rand();
+    }
+}
+
+static void scenario_fuzz(void) {
+    sim_boot(false);
+    host_uart_tx_hook = on_uart_tx;
+    srand(4444);
+    uint32_t accepted = 0;
+    for (int frame = 0; frame < FUZZ_FRAMES; frame++) {
+        reset_motion();
+        uint8_t batch[120];
+        size_t length = 0;
+        int entries = 1 + rand() % 4;
+        for (int e = 0; e < entries; e++) {
+            if (length + 2 + 16 > sizeof(batch)) break;
+            // Half the entries are well formed, with axes past the last one and rates past the limit among them
+            if (rand() % 2) {
+                if (rand() % 2) {
+                    length += codec_batch_move_static(&batch[length], (uint8_t)(rand() % 4), random_value());
+                } else {
+                    int32_t units[NUM_AXES];
+                    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+                        units[axis] = random_value() % 100000000;
+                    }
+                    length += codec_batch_move_tracking(&batch[length], units);
+                }
+                continue;
+            }
+            // Commands without side effects beyond the motion state, plus the two that may not appear
+            static const uint8_t commands[] = { CMD_MOVE_STATIC, CMD_MOVE_TRACKING, CMD_MOVE_STATIC,
+                                                CMD_MOVE_TRACKING, CMD_GETPOS, CMD_ACK, CMD_BATCH };
+            uint8_t cmd_type = commands[rand() % sizeof(commands)];
+            uint8_t entry_length = (uint8_t)(rand() % 17);
+            batch[length] = cmd_type;
+            batch[length + 1] = entry_length;
+            for (uint8_t i = 0; i < entry_length; i++) {
+                batch[length + 2 + i] = random_byte();
+            }
+            if (cmd_type == CMD_MOVE_STATIC && entry_length > 0) batch[length + 2] = (uint8_t)(rand() % 4);
+            length += 2 + entry_length;
+        }
+        // Now and then a length field or the end of the batch is off
+        if (rand() % 8 == 0) batch[1] = (uint8_t)(batch[1] + rand() % 5 - 2);
+        if (rand() % 8 == 0 && length > 1) length -= 1 + rand() % 3 % length;
+
+        motion_state_t expected = motion_state();
+        bool valid = reference_batch(batch, length, &expected);
+        accepted += valid;
+        SIM_CHECK(send_batch(batch, length), "frame %d not ACKed", frame);
+        motion_state_t state = motion_state();
+        SIM_CHECK(same_state(&state, &expected), "frame %d: firmware and reference disagree (reference %s it)",
+                  frame, valid ? "runs" : "drops");
+        if (sim_failures > 10) return;
+    }
+    printf("%lu of %d random batches were valid\n", (unsigned long)accepted, FUZZ_FRAMES);
+    SIM_CHECK(accepted > FUZZ_FRAMES / 20 && accepted < FUZZ_FRAMES - FUZZ_FRAMES / 20, "fuzz too one-sided");
+}
+
+static const sim_scenario_t scenarios[] = {
+    { "round_trip", scenario_round_trip },
+    { "malformed", scenario_malformed },
+    { "fuzz", scenario_fuzz },
+};
+
+int main(int argc, char **argv) {
+    return sim_main(argc, argv, scenarios, sizeof(scenarios) / sizeof(scenarios[0]));
+}
@@ -0,0 +1,202 @@
+// Position checkpoints in the simulated flash: written once the axes are at rest after a pause or stop and while
+// tracking on the periodic interval, restored by the next boot with the reference flag that says how exact they are,
+// and a write cut short by a power loss leaves the checkpoint before it in force
+
+#include <string.h>
+#include "sim.h"
+#include "CONFIG.h"
+#include "CHECKPOINT.h"
+#include "PEC.h"
+
+#define CHECKPOINT_SLOTS (FLASHSTORE_SECTORS_CHECKPOINT * FLASH_SECTOR_SIZE / CHECKPOINT_RECORD_SIZE)
+#define TRACK_RATE_ARCSEC 15.0f
+
+static int phase = 0;
+static uint64_t phase_start_us;
+static int32_t saved_positions[NUM_AXES];
+
+static void next_phase(uint64_t now_us) {
+    phase++;
+    phase_start_us = now_us;
+}
+
+// Records in the checkpoint ring, torn ones included
+static int records_written(void) {
+    int records = 0;
+    for (uint32_t slot = 0; slot < CHECKPOINT_SLOTS; slot++) {
+        uint32_t magic;
+        memcpy(&magic, &host_flash[FLASHSTORE_CHECKPOINT_OFFSET + slot * CHECKPOINT_RECORD_SIZE], sizeof(magic));
+        if (magic == FLASHSTORE_MAGIC) records++;
+    }
+    return records;
+}
+
+static void save_positions(void) {
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        saved_positions[axis] = stepper_get_position(axis);
+    }
+}
+
+// What the next boot comes up with, the axes at rest
+static void reboot(void) {
+    host_flash_program_budget = -1;
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        stepper_set_position(axis, 0);
+        pec_applied_steps[axis] = 0;
+    }
+    stepper_set_reference(REFERENCE_NONE);
+    checkpoint_restore();
+}
+
+static void check_restored(const char *what, position_reference_t reference, stepper_mode_t mode) {
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        SIM_CHECK(stepper_get_position(axis) == saved_positions[axis], "%s: axis %d restored at %ld, was at %ld", what,
+                  axis, (long)stepper_get_position(axis), (long)saved_positions[axis]);
+    }
+    SIM_CHECK(stepper_get_reference() == reference, "%s: reference %d instead of %d", what, stepper_get_reference(),
+              reference);
+    SIM_CHECK(checkpoint_restored_mode() == mode, "%s: mode %d instead of %d", what, checkpoint_restored_mode(), mode);
+}
+
+// ---- Paused in the middle of a move, then stopped: exact records once at rest, none for an unchanged state ----
+
+static int records_at_pause;
+
+static void rest_core0(uint64_t now_us) {
+    checkpoint_background_task();
+    if (phase == 0) {
+        stepper_queue_static_move(AXIS_X, 20000);
+        stepper_queue_static_move(AXIS_Y, -8000);
+        next_phase(now_us);
+    } else if (phase == 1 && now_us - phase_start_us >= 1500 * SIM_MS) {
+        stepper_pause();
+        // Nothing while still braking
+        SIM_CHECK(records_written() == 0, "written before the pause");
+        next_phase(now_us);
+    } else if (phase == 2) {
+        if (stepper_is_moving()) {
+            SIM_CHECK(records_written() == 0, "written while braking for the pause");
+            return;
+        }
+        if (records_written() == 0) return;
+        records_at_pause = records_written();
+        // The same state again is not worth a record
+        checkpoint_request();
+        next_phase(now_us);
+    } else if (phase == 3 && now_us - phase_start_us >= 10 * SIM_MS) {
+        SIM_CHECK(records_written() == records_at_pause, "unchanged state written again");
+        save_positions();
+        reboot();
+        check_restored("pause", REFERENCE_RESTORED, STEPPER_MODE_STATIC);
+        sim_restart_checks();
+        stepper_resume();
+        next_phase(now_us);
+    } else if (phase == 4 && now_us - phase_start_us >= 500 * SIM_MS) {
+        stepper_stop();
+        next_phase(now_us);
+    } else if (phase == 5 && !stepper_is_moving() && records_written() > records_at_pause) {
+        save_positions();
+        reboot();
+        check_restored("stop", REFERENCE_RESTORED, STEPPER_MODE_IDLE);
+        next_phase(now_us);
+    }
+}
+
+static void scenario_rest(void) {
+    sim_boot(false);
+    sim_core0 = rest_core0;
+    sim_run(10 * SIM_S);
+    SIM_CHECK(phase == 6, "not done, phase %d", phase);
+}
+
+// ---- Tracking: a record every interval while the position keeps changing, restored as approximate ----
+
+#define TRACK_INTERVALS 2
+
+static int32_t position_at_record[TRACK_INTERVALS];
+static uint64_t record_us[TRACK_INTERVALS];
+
+static void tracking_core0(uint64_t now_us) {
+    int records = records_written();
+    checkpoint_background_task();
+    if (phase == 0) {
+        stepper_start_tracking(TRACK_RATE_ARCSEC, 0.0f, 0.0f);
+        next_phase(now_us);
+    } else if (records_written() > records && records < TRACK_INTERVALS) {
+        position_at_record[records] = stepper_get_position(AXIS_X);
+        record_us[records] = now_us;
+    }
+}
+
+static void scenario_tracking(void) {
+    sim_boot(false);
+    sim_core0 = tracking_core0;
+    uint64_t end_us = (TRACK_INTERVALS * CHECKPOINT_INTERVAL_MS + CHECKPOINT_INTERVAL_MS / 2) * SIM_MS;
+    sim_run(end_us);
+    SIM_CHECK(records_written() == TRACK_INTERVALS, "%d records in %d intervals", records_written(), TRACK_INTERVALS);
+    for (int i = 0; i < TRACK_INTERVALS; i++) {
+        uint64_t expected_us = (uint64_t)(i + 1) * CHECKPOINT_INTERVAL_MS * SIM_MS;
+        SIM_CHECK(record_us[i] >= expected_us && record_us[i] <= expected_us + 10 * SIM_MS,
+                  "record %d at %llu ms", i, (unsigned long long)(record_us[i] / SIM_MS));
+    }
+    int32_t now_at = stepper_get_position(AXIS_X);
+    save_positions();
+    saved_positions[AXIS_X] = position_at_record[TRACK_INTERVALS - 1];
+    reboot();
+    check_restored("tracking", REFERENCE_APPROXIMATE, STEPPER_MODE_TRACKING);
+    printf("restored %ld units behind where the axis got to\n", (long)(now_at - stepper_get_position(AXIS_X)));
+}
+
+// ---- Power lost while a checkpoint is written: the one before loads, the next one lands ----
+
+static void power_cut_core0(uint64_t now_us) {
+    checkpoint_background_task();
+    if (phase == 0) {
+        stepper_queue_static_move(AXIS_Z, 6000);
+        next_phase(now_us);
+    } else if (phase == 1 && !stepper_is_moving()) {
+        stepper_pause();
+        next_phase(now_us);
+    } else if (phase == 2 && records_written() == 1) {
+        save_positions();
+        sim_restart_checks();
+        stepper_resume();
+        stepper_queue_static_move(AXIS_Z, -3000);
+        next_phase(now_us);
+    } else if (phase == 3 && !stepper_is_moving()) {
+        // Part of the record, past its header
+        host_flash_program_budget = FLASHSTORE_HEADER_SIZE + 12;
+        stepper_pause();
+        next_phase(now_us);
+    } else if (phase == 4 && host_flash_program_budget == 0) {
+        int32_t z_after_move = stepper_get_position(AXIS_Z);
+        reboot();
+        check_restored("cut", REFERENCE_RESTORED, STEPPER_MODE_IDLE);
+        // The mount never left where the second move put it, the host syncs it back there and it is written again
+        stepper_set_position(AXIS_Z, z_after_move);
+        save_positions();
+        checkpoint_request();
+        next_phase(now_us);
+    } else if (phase == 5 && now_us - phase_start_us >= 10 * SIM_MS) {
+        reboot();
+        check_restored("after the cut", REFERENCE_RESTORED, STEPPER_MODE_IDLE);
+        next_phase(now_us);
+    }
+}
+
+static void scenario_power_cut(void) {
+    sim_boot(false);
+    sim_core0 = power_cut_core0;
+    sim_run(10 * SIM_S);
+    SIM_CHECK(phase == 6, "not done, phase %d", phase);
+}
+
+static const sim_scenario_t scenarios[] = {
+    { "rest", scenario_rest },
+    { "tracking", scenario_tracking },
+    { "power_cut", scenario_power_cut },
+};
+
+int main(int argc, char **argv) {
+    return sim_main(argc, argv, scenarios, sizeof(scenarios) / sizeof(scenarios[0]));
+}
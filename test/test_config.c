@@ -0,0 +1,249 @@
+// Configuration block in the simulated flash: values set over the protocol only take effect after a save and a
+// reboot, the step loop runs on the loaded gear ratio, the ring wears its sectors evenly, a write cut short by a power
+// loss leaves the previous block in force, and blocks from other firmware versions are read for what they share
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "CONFIG.h"
+
+#define CONFIG_SLOTS (FLASHSTORE_SECTORS_CONFIG * FLASH_SECTOR_SIZE / CONFIG_RECORD_SIZE)
+#define CONFIG_FIRST_SECTOR (FLASHSTORE_CONFIG_OFFSET / FLASH_SECTOR_SIZE)
+
+static uint32_t float_bits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static void save(void) {
+    config_request_save(0);
+    config_background_task();
+}
+
+// What the next boot loads
+static void reboot(void) {
+    host_flash_program_budget = -1;
+    config_init();
+}
+
+static uint32_t stored(uint8_t key) {
+    uint32_t value = 0;
+    SIM_CHECK(config_get(key, &value), "key %d not readable", key);
+    return value;
+}
+
+// ---- Set, refuse what is out of range, save, boot on it ----
+
+static const float gear_ratio_x = 1.5f * X_STEPPER_GEAR_RATIO;
+#define STEPS_PER_REV_SET 400
+
+static int phase = 0;
+
+static void move_core0(uint64_t now_us) {
+    if (phase == 0) {
+        stepper_queue_static_move(AXIS_X, 7200);
+        phase = 1;
+    } else if (phase == 1 && !stepper_is_moving()) {
+        phase = 2;
+    }
+}
+
+static void scenario_save_load(void) {
+    reboot();
+    device_config_t defaults;
+    config_set_defaults(&defaults);
+    SIM_CHECK(memcmp(&device_config, &defaults, sizeof(defaults)) == 0, "blank flash does not boot on the defaults");
+
+    SIM_CHECK(config_set(CONFIG_KEY_GEAR_RATIO_X, float_bits(gear_ratio_x)), "gear ratio refused");
+    SIM_CHECK(config_set(CONFIG_KEY_STEPS_PER_REV, STEPS_PER_REV_SET), "steps per revolution refused");
+    SIM_CHECK(config_set(CONFIG_KEY_BAUD_RATE, 230400), "baud rate refused");
+    // Out of range, the stored value stays
+    SIM_CHECK(!config_set(CONFIG_KEY_GEAR_RATIO_Y, float_bits(0.0f)), "gear ratio 0 taken");
+    SIM_CHECK(!config_set(CONFIG_KEY_GEAR_RATIO_Z, float_bits(NAN)), "gear ratio NaN taken");
+    SIM_CHECK(!config_set(CONFIG_KEY_MICROSTEPPING, 3), "3 microsteps taken");
+    SIM_CHECK(!config_set(CONFIG_KEY_STEP_PIN_Y, 40), "GPIO 40 taken");
+    SIM_CHECK(!config_set(CONFIG_KEY_COUNT, 1), "a key past the last taken");
+    SIM_CHECK(stored(CONFIG_KEY_GEAR_RATIO_Y) == float_bits(defaults.gear_ratio[AXIS_Y]), "refused gear ratio stored");
+    SIM_CHECK(stored(CONFIG_KEY_MICROSTEPPING) == defaults.microstepping, "refused microstepping stored");
+    SIM_CHECK(stored(CONFIG_KEY_STEP_PIN_Y) == defaults.step_pin[AXIS_Y], "refused pin stored");
+    // Only the stored block changes, what runs stays as booted
+    SIM_CHECK(device_config.gear_ratio[AXIS_X] == defaults.gear_ratio[AXIS_X], "gear ratio in use before a reboot");
+
+    save();
+    reboot();
+    SIM_CHECK(device_config.gear_ratio[AXIS_X] == gear_ratio_x, "gear ratio %.3f after the reboot",
+              device_config.gear_ratio[AXIS_X]);
+    SIM_CHECK(device_config.steps_per_rev == STEPS_PER_REV_SET, "%u steps per revolution after the reboot",
+              device_config.steps_per_rev);
+    SIM_CHECK(device_config.baud_rate == 230400, "baud rate %lu after the reboot", (unsigned long)device_config.baud_rate);
+    SIM_CHECK(device_config.gear_ratio[AXIS_Y] == defaults.gear_ratio[AXIS_Y], "Y gear ratio changed");
+
+    // The step loop on the loaded values: 2° of X on the new gearing
+    sim_boot(false);
+    float expected = STEPS_PER_REV_SET * POSITION_MICROSTEPS * gear_ratio_x / 1296000.0f;
+    SIM_CHECK(fabsf(stepper_steps_per_arcsec(AXIS_X) - expected) < 1e-4f * expected, "%.4f units per arcsec, expected %.4f",
+              stepper_steps_per_arcsec(AXIS_X), expected);
+    sim_core0 = move_core0;
+    sim_run(20 * SIM_S);
+    SIM_CHECK(phase == 2, "move not done");
+    int32_t target = (int32_t)lroundf(7200 * expected);
+    int32_t half_step = POSITION_MICROSTEPS / device_config.microstepping / 2;
+    SIM_CHECK(labs((long)(sim_axes[AXIS_X].motor_units - target)) <= half_step, "X motor at %ld units, 2° is %ld",
+              (long)sim_axes[AXIS_X].motor_units, (long)target);
+}
+
+// ---- Many saves: the ring goes round, each sector is erased in turn and the newest block always loads ----
+
+#define WEAR_SAVES (5 * CONFIG_SLOTS + 3)
+
+static void scenario_wear(void) {
+    reboot();
+    for (uint32_t i = 1; i <= WEAR_SAVES; i++) {
+        config_set(CONFIG_KEY_STEP_INTERVAL_US, i);
+        save();
+        reboot();
+        SIM_CHECK(device_config.step_interval_us == i, "save %lu loads %u", (unsigned long)i, device_config.step_interval_us);
+    }
+    uint32_t fewest = UINT32_MAX, most = 0, elsewhere = 0;
+    for (uint32_t sector = 0; sector < PICO_FLASH_SIZE_BYTES / FLASH_SECTOR_SIZE; sector++) {
+        uint32_t erases = host_flash_erases[sector];
+        if (sector < CONFIG_FIRST_SECTOR || sector >= CONFIG_FIRST_SECTOR + FLASHSTORE_SECTORS_CONFIG) {
+            elsewhere += erases;
+            continue;
+        }
+        if (erases < fewest) fewest = erases;
+        if (erases > most) most = erases;
+    }
+    printf("%d saves: config sectors erased %lu to %lu times\n", WEAR_SAVES, (unsigned long)fewest, (unsigned long)most);
+    SIM_CHECK(elsewhere == 0, "%lu erases outside the config region", (unsigned long)elsewhere);
+    SIM_CHECK(most - fewest <= 1, "uneven wear, %lu to %lu erases", (unsigned long)fewest, (unsigned long)most);
+    // One erase per trip round the ring and sector, the first trip finds them blank
+    SIM_CHECK(most <= WEAR_SAVES / CONFIG_SLOTS, "%lu erases for %d saves", (unsigned long)most, WEAR_SAVES);
+}
+
+// ---- Power lost in the middle of a save: the block before it loads, and the next save still lands ----
+
+static uint32_t config_erases(void) {
+    uint32_t erases = 0;
+    for (uint32_t sector = 0; sector < FLASHSTORE_SECTORS_CONFIG; sector++) {
+        erases += host_flash_erases[CONFIG_FIRST_SECTOR + sector];
+    }
+    return erases;
+}
+
+static void save_cut(int32_t bytes) {
+    host_flash_program_budget = bytes;
+    save();
+    reboot();
+}
+
+static void scenario_torn_write(void) {
+    reboot();
+    config_set(CONFIG_KEY_STEP_INTERVAL_US, 100);
+    save();
+
+    // Into the block, the header is there but not the CRC. Then nothing written at all
+    static const int32_t cuts[] = { CONFIG_RECORD_SIZE / 2, FLASHSTORE_HEADER_SIZE, 0 };
+    for (size_t i = 0; i < sizeof(cuts) / sizeof(cuts[0]); i++) {
+        config_set(CONFIG_KEY_STEP_INTERVAL_US, 200 + i);
+        save_cut(cuts[i]);
+        SIM_CHECK(device_config.step_interval_us == 100, "cut after %ld bytes loads %u", (long)cuts[i],
+                  device_config.step_interval_us);
+    }
+    config_set(CONFIG_KEY_STEP_INTERVAL_US, 300);
+    save();
+    reboot();
+    SIM_CHECK(device_config.step_interval_us == 300, "save after the cuts loads %u", device_config.step_interval_us);
+
+    // Cut right after the erase of the sector it goes into, the newest block is in the other one. Saves until one
+    // erases tell where the sectors start
+    uint32_t value = 400;
+    uint32_t erases = config_erases();
+    for (uint32_t i = 0; i <= CONFIG_SLOTS && config_erases() == erases; i++) {
+        config_set(CONFIG_KEY_STEP_INTERVAL_US, ++value);
+        save();
+    }
+    for (uint32_t i = 1; i < FLASH_SECTOR_SIZE / CONFIG_RECORD_SIZE; i++) {
+        config_set(CONFIG_KEY_STEP_INTERVAL_US, ++value);
+        save();
+    }
+    erases = config_erases();
+    config_set(CONFIG_KEY_STEP_INTERVAL_US, value + 1);
+    save_cut(CONFIG_RECORD_SIZE / 2);
+    SIM_CHECK(config_erases() == erases + 1, "the cut save did not erase a sector");
+    SIM_CHECK(device_config.step_interval_us == value, "cut after an erase loads %u, saved was %lu",
+              device_config.step_interval_us, (unsigned long)value);
+}
+
+// ---- A block from an older firmware, one with bad values, one from a newer firmware ----
+
+static flash_store_t store = {
+    .offset = FLASHSTORE_CONFIG_OFFSET,
+    .sectors = FLASHSTORE_SECTORS_CONFIG,
+    .record_size = CONFIG_RECORD_SIZE,
+};
+
+// Written the way that firmware would have, over whatever is in the ring
+static void write_block(const device_config_t *config) {
+    static uint8_t payload[CONFIG_RECORD_SIZE - FLASHSTORE_OVERHEAD];
+    flash_store_load(&store, payload);
+    memset(payload, 0, sizeof(payload));
+    memcpy(payload, config, sizeof(*config));
+    SIM_CHECK(flash_store_append(&store, payload), "block not written");
+}
+
+static void scenario_versions(void) {
+    device_config_t defaults;
+    config_set_defaults(&defaults);
+
+    // Version 1 ended before tmc2209_enabled, what follows in its record is nothing it wrote
+    device_config_t block = defaults;
+    block.version = 1;
+    block.size = offsetof(device_config_t, tmc2209_enabled);
+    block.gear_ratio[AXIS_Y] = 2.0f * defaults.gear_ratio[AXIS_Y];
+    memset((uint8_t *)&block + block.size, 0xA5, sizeof(block) - block.size);
+    write_block(&block);
+    reboot();
+    SIM_CHECK(device_config.gear_ratio[AXIS_Y] == block.gear_ratio[AXIS_Y], "version 1 gear ratio not loaded");
+    SIM_CHECK(memcmp((uint8_t *)&device_config + block.size, (uint8_t *)&defaults + block.size,
+                     sizeof(defaults) - block.size) == 0, "fields newer than version 1 not at their defaults");
+    SIM_CHECK(device_config.version == CONFIG_VERSION, "loaded as version %u", device_config.version);
+
+    // Values an older firmware let through, each goes back to its default
+    block = defaults;
+    block.steps_per_rev = 0;
+    block.microstepping = 48;
+    block.step_pin[AXIS_Z] = 31;
+    block.gear_ratio[AXIS_X] = -1.0f;
+    block.latitude = 91.0f;
+    block.step_interval_us = 77;
+    write_block(&block);
+    reboot();
+    SIM_CHECK(device_config.steps_per_rev == defaults.steps_per_rev, "0 steps per revolution loaded");
+    SIM_CHECK(device_config.microstepping == defaults.microstepping, "48 microsteps loaded");
+    SIM_CHECK(device_config.step_pin[AXIS_Z] == defaults.step_pin[AXIS_Z], "GPIO 31 loaded");
+    SIM_CHECK(device_config.gear_ratio[AXIS_X] == defaults.gear_ratio[AXIS_X], "negative gear ratio loaded");
+    SIM_CHECK(device_config.latitude == defaults.latitude, "latitude 91 loaded");
+    SIM_CHECK(device_config.step_interval_us == 77, "valid field next to bad ones not loaded");
+
+    // Newer than this firmware: nothing in it can be trusted to mean the same
+    block = defaults;
+    block.version = CONFIG_VERSION + 1;
+    block.step_interval_us = 88;
+    write_block(&block);
+    reboot();
+    SIM_CHECK(memcmp(&device_config, &defaults, sizeof(defaults)) == 0, "block from a newer firmware loaded");
+}
+
+static const sim_scenario_t scenarios[] = {
+    { "save_load", scenario_save_load },
+    { "wear", scenario_wear },
+    { "torn_write", scenario_torn_write },
+    { "versions", scenario_versions },
+};
+
+int main(int argc, char **argv) {
+    return sim_main(argc, argv, scenarios, sizeof(scenarios) / sizeof(scenarios[0]));
+}
@@ -0,0 +1,185 @@
+// DS18B20 sensors on the 1-Wire model: the ROM search has to find every sensor through the branches of the ROM tree
+// and skip what is not one, the readings go by ROM and drop a bad CRC or a sensor gone from the line, and no pass of
+// the background task waits for a conversion
+
+#include <math.h>
+#include <string.h>
+#include "sim.h"
+#include "onewire_model.h"
+#include "DS18B20.h"
+#include "CONFIG.h"
+#include "PIN_ASSIGNMENTS.h"
+
+#define PASS_MAX_US 15000               // Bus traffic of one pass, the reads of a single sensor
+
+// Family 0x28 serials that share their first bits and part ways at different depths of the tree
+static const uint8_t sensor_roms[][7] = {
+    { 0x28, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66 },
+    { 0x28, 0x11, 0x22, 0x33, 0x44, 0x55, 0xE6 },
+    { 0x28, 0x91, 0x22, 0x33, 0x44, 0x55, 0x66 },
+    { 0x28, 0x10, 0x00, 0x00, 0x00, 0x00, 0x01 },
+};
+static const float sensor_celsius[] = { 21.5f, -10.25f, 0.0625f, 85.0f };
+#define SENSORS (int)(sizeof(sensor_roms) / sizeof(sensor_roms[0]))
+
+// Another family on the same line, first in search order
+static const uint8_t other_rom[7] = { 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+
+static int sensor_device[SENSORS];
+
+static void add_sensors(void) {
+    for (int i = 0; i < SENSORS; i++) {
+        sensor_device[i] = onewire_model_add(sensor_roms[i], sensor_celsius[i]);
+    }
+}
+
+// The search takes 0 before 1 at every branch, from the first bit sent (bit 0 of the family byte) on
+static bool search_order(const uint8_t *a, const uint8_t *b) {
+    for (int bit = 0; bit < 64; bit++) {
+        bool bit_a = (a[bit / 8] >> (bit % 8)) & 1;
+        bool bit_b = (b[bit / 8] >> (bit % 8)) & 1;
+        if (bit_a != bit_b) return !bit_a;
+    }
+    return false;
+}
+
+static int sensor_at(const uint8_t *rom) {
+    for (int i = 0; i < SENSORS; i++) {
+        if (memcmp(rom, onewire_model_devices[sensor_device[i]].rom, 8) == 0) return i;
+    }
+    return -1;
+}
+
+static void check_found_all(void) {
+    SIM_CHECK(ds18b20_count() == SENSORS, "%d sensors found instead of %d", ds18b20_count(), SENSORS);
+    uint8_t previous[8];
+    for (uint8_t index = 0; index < ds18b20_count(); index++) {
+        uint8_t rom[8];
+        SIM_CHECK(ds18b20_get_rom(index, rom), "no ROM for sensor %d", index);
+        SIM_CHECK(sensor_at(rom) >= 0, "sensor %d has a ROM no sensor has", index);
+        SIM_CHECK(index == 0 || search_order(previous, rom), "sensor %d out of ROM order", index);
+        memcpy(previous, rom, 8);
+    }
+}
+
+// Main loop passes for a while, the longest one is returned
+static uint64_t run_background(uint64_t duration_us) {
+    uint64_t longest_us = 0;
+    uint64_t end_us = time_us_64() + duration_us;
+    while (time_us_64() < end_us) {
+        uint64_t start_us = time_us_64();
+        ds18b20_background_task();
+        uint64_t pass_us = time_us_64() - start_us;
+        if (pass_us > longest_us) longest_us = pass_us;
+        sleep_us(1000);
+    }
+    return longest_us;
+}
+
+static void boot(uint8_t resolution) {
+    config_init();
+    device_config.temp_resolution = resolution;
+    onewire_model_install(TEMP_SENSE_PIN);
+}
+
+// ---- ROM search through several branches, another family and a ROM read with a bad CRC ----
+
+static void scenario_search(void) {
+    boot(12);
+    onewire_model_add(other_rom, 0.0f);
+    add_sensors();
+    // A device whose ROM does not check out, as a garbled search pass would read it
+    static const uint8_t garbled_rom[7] = { 0x28, 0x11, 0x22, 0x33, 0x44, 0x55, 0x67 };
+    int garbled = onewire_model_add(garbled_rom, 0.0f);
+    onewire_model_devices[garbled].rom[7] ^= 0x01;
+
+    ds18b20_init(TEMP_SENSE_PIN);
+    check_found_all();
+    for (uint8_t index = 0; index < ds18b20_count(); index++) {
+        uint8_t rom[8];
+        ds18b20_get_rom(index, rom);
+        SIM_CHECK(memcmp(rom, onewire_model_devices[garbled].rom, 8) != 0, "ROM with a bad CRC listed");
+    }
+    // The resolution went to every sensor with Skip ROM
+    for (int i = 0; i < SENSORS; i++) {
+        uint8_t config = onewire_model_devices[sensor_device[i]].scratchpad[4];
+        SIM_CHECK(config == 0x7F, "sensor %d configuration 0x%02X", i, config);
+    }
+}
+
+// ---- Readings by ROM: a bad scratchpad CRC and a sensor that left the line are dropped ----
+
+static void scenario_read(void) {
+    boot(12);
+    add_sensors();
+    ds18b20_init(TEMP_SENSE_PIN);
+    check_found_all();
+
+    onewire_model_devices[sensor_device[1]].bad_crc = true;
+    uint64_t longest_us = run_background(2500 * SIM_MS);
+    SIM_CHECK(longest_us <= PASS_MAX_US, "a pass took %llu us", (unsigned long long)longest_us);
+    SIM_CHECK(onewire_model_converts >= 2 * SENSORS, "%lu conversions", (unsigned long)onewire_model_converts);
+
+    for (uint8_t index = 0; index < ds18b20_count(); index++) {
+        uint8_t rom[8];
+        ds18b20_get_rom(index, rom);
+        int sensor = sensor_at(rom);
+        onewire_model_device_t *device = &onewire_model_devices[sensor_device[sensor]];
+        SIM_CHECK(device->reads >= 2, "sensor %d read %lu times", sensor, (unsigned long)device->reads);
+        SIM_CHECK(device->early_reads == 0, "sensor %d read before its conversion was done", sensor);
+        float celsius;
+        bool valid = ds18b20_get_temp(index, &celsius);
+        if (device->bad_crc) {
+            SIM_CHECK(!valid, "sensor %d reading kept with a bad CRC", sensor);
+        } else {
+            SIM_CHECK(valid && celsius == sensor_celsius[sensor], "sensor %d reads %.4f instead of %.4f", sensor,
+                      valid ? celsius : NAN, sensor_celsius[sensor]);
+        }
+    }
+
+    // Gone from the line: it reads all ones, which is not a reading
+    onewire_model_devices[sensor_device[2]].present = false;
+    run_background(2500 * SIM_MS);
+    for (uint8_t index = 0; index < ds18b20_count(); index++) {
+        uint8_t rom[8];
+        ds18b20_get_rom(index, rom);
+        float celsius;
+        if (sensor_at(rom) == 2) SIM_CHECK(!ds18b20_get_temp(index, &celsius), "reading from a sensor that is gone");
+    }
+}
+
+// ---- 9 bit: the shorter conversion is waited for, the low bits are cut ----
+
+static void scenario_resolution(void) {
+    boot(9);
+    add_sensors();
+    ds18b20_init(TEMP_SENSE_PIN);
+    check_found_all();
+    SIM_CHECK(ds18b20_resolution() == 9, "resolution %d", ds18b20_resolution());
+    for (int i = 0; i < SENSORS; i++) {
+        uint8_t config = onewire_model_devices[sensor_device[i]].scratchpad[4];
+        SIM_CHECK(config == 0x1F, "sensor %d configuration 0x%02X", i, config);
+    }
+
+    run_background(1500 * SIM_MS);
+    for (uint8_t index = 0; index < ds18b20_count(); index++) {
+        uint8_t rom[8];
+        ds18b20_get_rom(index, rom);
+        int sensor = sensor_at(rom);
+        SIM_CHECK(onewire_model_devices[sensor_device[sensor]].early_reads == 0, "sensor %d read too early", sensor);
+        float celsius;
+        float expected = floorf(sensor_celsius[sensor] * 2.0f) / 2.0f;
+        SIM_CHECK(ds18b20_get_temp(index, &celsius) && celsius == expected, "sensor %d reads %.4f instead of %.4f",
+                  sensor, celsius, expected);
+    }
+}
+
+static const sim_scenario_t scenarios[] = {
+    { "search", scenario_search },
+    { "read", scenario_read },
+    { "resolution", scenario_resolution },
+};
+
+int main(int argc, char **argv) {
+    return sim_main(argc, argv, scenarios, sizeof(scenarios) / sizeof(scenarios[0]));
+}
@@ -0,0 +1,246 @@
+// Encoder correction against an axis that misses steps: the encoder follows the axis output, which loses the pulses a
+// slip swallows, and its count reaches the firmware through the PIO RX FIFO like the quadrature program pushes it.
+// After slips in a static move and in rate tracking the output has to be back on the position counter, the counter on
+// the target, and the telemetry has to have shown the error. Setting the position must not turn into a correction
+
+#include <math.h>
+#include "sim.h"
+#include "CONFIG.h"
+#include "ENCODER.h"
+
+#define X_COUNTS 648000.0f                  // 2 arcsec a count
+#define Z_COUNTS -648000.0f                 // Mounted the other way round
+#define X_PIN 26
+#define Z_PIN 28
+
+static int phase = 0;
+static uint64_t phase_start_us;
+
+static void next_phase(uint64_t now_us) {
+    phase++;
+    phase_start_us = now_us;
+}
+
+// ---- The axis output and its encoder ----
+
+typedef struct {
+    int32_t output;                         // units, where the axis really is
+    uint32_t slip_every;                    // Every nth pulse is lost while slipping, 0 for none
+    uint32_t slipped;                       // Pulses lost
+    int sm;                                 // State machine on pio1 with the count, -1 without an encoder
+    float counts_per_rev;
+} axis_output_t;
+
+static axis_output_t outputs[NUM_AXES];
+static host_tick_hook_t sim_tick_hook;
+
+static void output_step(uint8_t axis, bool direction, uint64_t now_us) {
+    axis_output_t *out = &outputs[axis];
+    if (out->slip_every && sim_axes[axis].pulses % out->slip_every == 0) {
+        out->slipped++;
+        return;
+    }
+    int32_t pulse = sim_pulse_units(axis);
+    out->output += direction ? pulse : -pulse;
+}
+
+static int32_t encoder_count(uint8_t axis) {
+    const axis_output_t *out = &outputs[axis];
+    float arcsec = out->output / stepper_steps_per_arcsec(axis);
+    return (int32_t)floorf(arcsec * out->counts_per_rev / FULL_TURN_ARCSEC);
+}
+
+// The state machine pushes the count over and over, a read always finds one in the FIFO
+static void encoder_tick(uint64_t now_us) {
+    sim_tick_hook(now_us);
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        const axis_output_t *out = &outputs[axis];
+        if (out->sm < 0 || pio_sm_get_rx_fifo_level(pio1, (uint)out->sm) > 0) continue;
+        host_pio_rx_push(pio1, (uint)out->sm, (uint32_t)encoder_count(axis));
+    }
+}
+
+// ---- Setup ----
+
+static void configure(void) {
+    device_config.encoder_pin[AXIS_X] = X_PIN;
+    device_config.encoder_counts_per_rev[AXIS_X] = X_COUNTS;
+    device_config.encoder_pin[AXIS_Z] = Z_PIN;
+    device_config.encoder_counts_per_rev[AXIS_Z] = Z_COUNTS;
+}
+
+static void start(void) {
+    sim_configure = configure;
+    sim_boot(false);
+    sim_step = output_step;
+    // Claimed on pio1 in axis order
+    outputs[AXIS_X] = (axis_output_t){ .sm = 0, .counts_per_rev = X_COUNTS };
+    outputs[AXIS_Y] = (axis_output_t){ .sm = -1 };
+    outputs[AXIS_Z] = (axis_output_t){ .sm = 1, .counts_per_rev = Z_COUNTS };
+    sim_tick_hook = host_tick_hook;
+    host_tick_hook = encoder_tick;
+}
+
+static float units_to_arcsec(uint8_t axis, float units) {
+    return units / stepper_steps_per_arcsec(axis);
+}
+
+// Output against the counter, arcsec
+static float output_error(uint8_t axis) {
+    return units_to_arcsec(axis, outputs[axis].output - stepper_get_position(axis));
+}
+
+// Within a pulse and an encoder count, the deadband is about that
+static float tolerance(uint8_t axis) {
+    return units_to_arcsec(axis, sim_pulse_units(axis)) + FULL_TURN_ARCSEC / fabsf(outputs[axis].counts_per_rev);
+}
+
+static float worst_reported[NUM_AXES];
+
+static void watch_telemetry(void) {
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        float reported = fabsf(encoder_get_error(axis));
+        if (reported > worst_reported[axis]) worst_reported[axis] = reported;
+    }
+}
+
+// ---- A static move losing every 20th pulse over its first part ----
+
+#define MOVE_ARCSEC 3000
+#define SLIP_PULSES 250
+
+static void move_core0(uint64_t now_us) {
+    watch_telemetry();
+    // The last slips have to be seen by a check while the move still runs, corrections only go out with motion
+    if (sim_axes[AXIS_X].pulses >= SLIP_PULSES) outputs[AXIS_X].slip_every = 0;
+    if (phase == 0) {
+        outputs[AXIS_X].slip_every = 20;
+        stepper_queue_static_move(AXIS_X, MOVE_ARCSEC);
+        next_phase(now_us);
+    } else if (phase == 1 && !stepper_is_moving() && stepper_get_mode() == STEPPER_MODE_IDLE) {
+        next_phase(now_us);
+    }
+}
+
+static void scenario_move(void) {
+    start();
+    sim_core0 = move_core0;
+    sim_run(10 * SIM_S);
+    SIM_CHECK(phase == 2, "not done, phase %d", phase);
+
+    float slipped = outputs[AXIS_X].slipped * units_to_arcsec(AXIS_X, sim_pulse_units(AXIS_X));
+    float output = output_error(AXIS_X);
+    float counter = units_to_arcsec(AXIS_X, stepper_get_position(AXIS_X)) - MOVE_ARCSEC;
+    printf("%lu pulses slipped (%.1f arcsec), output %.1f arcsec off the counter, counter %.1f off the target, "
+           "%.1f arcsec reported at worst\n", (unsigned long)outputs[AXIS_X].slipped, slipped, output, counter,
+           worst_reported[AXIS_X]);
+    SIM_CHECK(outputs[AXIS_X].slipped >= 10, "only %lu pulses slipped", (unsigned long)outputs[AXIS_X].slipped);
+    SIM_CHECK(fabsf(output) <= tolerance(AXIS_X), "output %.1f arcsec off the counter", output);
+    SIM_CHECK(fabsf(counter) <= tolerance(AXIS_X), "counter %.1f arcsec off the target", counter);
+    // The trim pulses do not count in the position
+    float extra = units_to_arcsec(AXIS_X, sim_axes[AXIS_X].motor_units - stepper_get_position(AXIS_X));
+    SIM_CHECK(fabsf(extra - slipped) <= tolerance(AXIS_X), "%.1f arcsec of trim for %.1f slipped", extra, slipped);
+    SIM_CHECK(worst_reported[AXIS_X] >= 2.0f * units_to_arcsec(AXIS_X, sim_pulse_units(AXIS_X)),
+              "telemetry showed %.1f arcsec at worst", worst_reported[AXIS_X]);
+    SIM_CHECK(fabsf(encoder_get_error(AXIS_X)) <= tolerance(AXIS_X), "telemetry still shows %.1f arcsec",
+              encoder_get_error(AXIS_X));
+}
+
+// ---- Rate tracking on both encoder axes, a burst of slips in the middle: trimmed while tracking goes on ----
+
+#define TRACK_RATE 200.0f
+#define TRACK_S 10
+
+static float tracked_at_end[NUM_AXES];
+
+static void track_core0(uint64_t now_us) {
+    watch_telemetry();
+    uint64_t elapsed = now_us - phase_start_us;
+    if (phase == 0) {
+        stepper_start_tracking(TRACK_RATE, 0.0f, -TRACK_RATE);
+        next_phase(now_us);
+    } else if (phase == 1) {
+        // A stall for a second, every other pulse lost
+        uint32_t slip_every = elapsed >= 3 * SIM_S && elapsed < 4 * SIM_S ? 2 : 0;
+        outputs[AXIS_X].slip_every = slip_every;
+        outputs[AXIS_Z].slip_every = slip_every;
+        if (elapsed >= TRACK_S * SIM_S) {
+            for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+                tracked_at_end[axis] = units_to_arcsec(axis, stepper_get_position(axis));
+            }
+            next_phase(now_us);
+        }
+    }
+}
+
+static void scenario_track(void) {
+    start();
+    // Rate tracking puts a trim out like PEC, by doubling a tracking pulse
+    sim_check_accel = false;
+    sim_core0 = track_core0;
+    sim_run((TRACK_S + 1) * SIM_S);
+    SIM_CHECK(phase == 2, "not done, phase %d", phase);
+    SIM_CHECK(stepper_get_mode() == STEPPER_MODE_TRACKING, "tracking stopped, mode %d", stepper_get_mode());
+
+    uint8_t axes[] = { AXIS_X, AXIS_Z };
+    for (size_t i = 0; i < sizeof(axes); i++) {
+        uint8_t axis = axes[i];
+        float output = output_error(axis);
+        float tracked = tracked_at_end[axis];
+        printf("axis %d: %lu pulses slipped, output %.1f arcsec off the counter, tracked %.1f arcsec, "
+               "%.1f reported at worst\n", axis, (unsigned long)outputs[axis].slipped, output, tracked,
+               worst_reported[axis]);
+        SIM_CHECK(outputs[axis].slipped >= 10, "axis %d: only %lu pulses slipped", axis,
+                  (unsigned long)outputs[axis].slipped);
+        SIM_CHECK(fabsf(output) <= tolerance(axis), "axis %d: output %.1f arcsec off the counter", axis, output);
+        // The counter keeps the rate, the slips do not hold it back
+        float expected = (axis == AXIS_X ? TRACK_RATE : -TRACK_RATE) * TRACK_S;
+        SIM_CHECK(fabsf(tracked - expected) <= 2.0f * tolerance(axis), "axis %d tracked %.1f arcsec instead of %.1f", axis,
+                  tracked, expected);
+        // Trimmed every check, the error never gets far past a pulse
+        SIM_CHECK(worst_reported[axis] >= units_to_arcsec(axis, sim_pulse_units(axis)),
+                  "axis %d: telemetry showed %.1f arcsec at worst", axis, worst_reported[axis]);
+    }
+    SIM_CHECK(sim_axes[AXIS_Y].motor_units == stepper_get_position(AXIS_Y), "Y without an encoder trimmed");
+}
+
+// ---- Position set on an idle axis, then a short move: the encoder takes the new position over ----
+
+#define SET_ARCSEC 5000
+#define SHORT_MOVE_ARCSEC 100
+
+static void rezero_core0(uint64_t now_us) {
+    if (phase == 0 && now_us - phase_start_us >= 100 * SIM_MS) {
+        // Let the encoder see the axis at rest first
+        stepper_set_position(AXIS_X, (int32_t)lroundf(SET_ARCSEC * stepper_steps_per_arcsec(AXIS_X)));
+        next_phase(now_us);
+    } else if (phase == 1 && now_us - phase_start_us >= 100 * SIM_MS) {
+        stepper_queue_static_move(AXIS_X, SET_ARCSEC + SHORT_MOVE_ARCSEC);
+        next_phase(now_us);
+    } else if (phase == 2 && !stepper_is_moving() && stepper_get_mode() == STEPPER_MODE_IDLE) {
+        next_phase(now_us);
+    }
+}
+
+static void scenario_rezero(void) {
+    start();
+    sim_core0 = rezero_core0;
+    sim_run(5 * SIM_S);
+    SIM_CHECK(phase == 3, "not done, phase %d", phase);
+    // Only the move itself went out, nothing to chase the jump in the counter
+    float moved = units_to_arcsec(AXIS_X, outputs[AXIS_X].output);
+    printf("output moved %.1f arcsec for a %d arcsec move\n", moved, SHORT_MOVE_ARCSEC);
+    SIM_CHECK(fabsf(moved - SHORT_MOVE_ARCSEC) <= tolerance(AXIS_X), "output moved %.1f arcsec", moved);
+    SIM_CHECK(fabsf(encoder_get_error(AXIS_X)) <= tolerance(AXIS_X), "telemetry shows %.1f arcsec",
+              encoder_get_error(AXIS_X));
+}
+
+static const sim_scenario_t scenarios[] = {
+    { "move", scenario_move },
+    { "track", scenario_track },
+    { "rezero", scenario_rezero },
+};
+
+int main(int argc, char **argv) {
+    return sim_main(argc, argv, scenarios, sizeof(scenarios) / sizeof(scenarios[0]));
+}
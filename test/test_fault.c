@@ -0,0 +1,188 @@
+// Motor supply loss: an EN_SENSE edge injected mid-move has to stop the pulses and disable the drivers from inside
+// the interrupt, the report has to go out with the freeze latency, and the drivers only come back once the supply
+// has been stable for FAULT_RESTORE_STABLE_MS
+
+#include <string.h>
+#include "sim.h"
+#include "codec.h"
+#include "CONFIG.h"
+#include "FAULT.h"
+#include "UART.h"
+
+#define FAULT_MAX_LATENCY_US 1000   // One pass of the step loop, it sleeps at most a step interval
+
+static int phase = 0;
+static uint32_t lost_reports;
+static uint32_t restored_reports;
+static uint16_t reported_latency_us;
+static uint64_t lost_report_us;
+static uint64_t restored_report_us;
+static bool ack_due;
+static uint8_t ack_id;
+static int last_report_id = -1;
+
+static void on_uart_tx(const uint8_t *data, size_t length) {
+    uint8_t cmd_type, msg_id, payload[256], payload_length;
+    size_t start = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] != 0) continue;
+        if (codec_unframe(&data[start], i - start, &cmd_type, &msg_id, payload, &payload_length) &&
+            cmd_type == CMD_ESTOPTRIG && payload_length == 5) {
+            // Sent again until the host ACKs it, with the same id
+            ack_due = true;
+            ack_id = msg_id;
+            if (msg_id == last_report_id) {
+                start = i + 1;
+                continue;
+            }
+            last_report_id = msg_id;
+            if (payload[0] == FAULT_STATE_POWER_LOST) {
+                lost_reports++;
+                lost_report_us = sim_now();
+                memcpy(&reported_latency_us, &payload[1], sizeof(uint16_t));
+            } else if (payload[0] == FAULT_STATE_POWER_RESTORED) {
+                restored_reports++;
+                restored_report_us = sim_now();
+            }
+        }
+        start = i + 1;
+    }
+}
+
+// The core 0 main loop's part in it, and the host's ACK
+static void background(void) {
+    fault_background_task();
+    uart_background_task();
+    if (ack_due) {
+        static uint8_t next_id = 0;
+        uint8_t frame[CODEC_MAX_FRAME];
+        ack_due = false;
+        if (++next_id == 0) next_id = 1;
+        host_uart_receive(frame, codec_frame(frame, CMD_ACK, next_id, &ack_id, 1));
+    }
+}
+
+static void supply_edge(bool powered) {
+    host_gpio_set_input(device_config.en_sense_pin, powered ? EN_SENSE_POWERED_LEVEL : !EN_SENSE_POWERED_LEVEL);
+    host_gpio_irq(device_config.en_sense_pin, powered ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL);
+}
+
+static bool drivers_enabled(void) {
+    return gpio_get(device_config.en_pin) == 0;
+}
+
+static void check_motors_match_counters(void) {
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        SIM_CHECK(sim_axes[axis].motor_units == stepper_get_position(axis),
+                  "axis %d motor at %ld units, counter at %ld", axis,
+                  (long)sim_axes[axis].motor_units, (long)stepper_get_position(axis));
+    }
+}
+
+// ---- Supply lost at cruise speed, back a second later, the move after it works ----
+
+static uint64_t lost_at_us;
+static uint64_t restored_at_us;
+static uint32_t pulses_at_report[NUM_AXES];
+
+static void power_loss_core0(uint64_t now_us) {
+    background();
+    if (phase == 0) {
+        stepper_queue_static_move(AXIS_X, 40000);
+        stepper_queue_static_move(AXIS_Y, -20000);
+        phase = 1;
+    } else if (phase == 1 && now_us >= 1500 * SIM_MS) {
+        SIM_CHECK(stepper_is_moving(), "not moving when the supply goes");
+        sim_check_accel = false;        // Stopping dead is the point
+        lost_at_us = now_us;
+        supply_edge(false);
+        // All of it happened in the interrupt, before the step loop runs again
+        SIM_CHECK(fault_is_active(), "no fault after the falling edge");
+        SIM_CHECK(!drivers_enabled(), "drivers still enabled after the interrupt");
+        SIM_CHECK(fault_freeze_pending, "step loop not told to freeze");
+        phase = 2;
+    } else if (phase == 2 && lost_reports) {
+        for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+            pulses_at_report[axis] = sim_axes[axis].pulses;
+            SIM_CHECK(!sim_axes[axis].have_edge || sim_axes[axis].last_edge_us <= lost_at_us + reported_latency_us,
+                      "axis %d pulsed %llu us after the edge, the report says frozen after %u us", axis,
+                      (unsigned long long)(sim_axes[axis].last_edge_us - lost_at_us), reported_latency_us);
+        }
+        // Nothing moves without the supply
+        stepper_resume();
+        stepper_queue_static_move(AXIS_Z, 5000);
+        SIM_CHECK(!drivers_enabled() && !stepper_is_moving(), "a move started without motor power");
+        phase = 3;
+    } else if (phase == 3 && now_us >= 2500 * SIM_MS) {
+        restored_at_us = now_us;
+        supply_edge(true);
+        phase = 4;
+    } else if (phase == 4 && restored_reports) {
+        for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+            SIM_CHECK(sim_axes[axis].pulses == pulses_at_report[axis], "axis %d pulsed while the supply was off", axis);
+        }
+        SIM_CHECK(!fault_is_active(), "fault still active after the restore report");
+        sim_restart_checks();
+        sim_check_accel = true;
+        stepper_resume();
+        stepper_queue_static_move(AXIS_X, 0);
+        phase = 5;
+    } else if (phase == 5 && !stepper_is_moving()) {
+        phase = 6;
+    }
+}
+
+static void scenario_power_loss(void) {
+    sim_boot(false);
+    host_uart_tx_hook = on_uart_tx;
+    sim_core0 = power_loss_core0;
+    sim_run(8 * SIM_S);
+    SIM_CHECK(phase == 6, "loss and restore not done, phase %d", phase);
+    SIM_CHECK(lost_reports == 1 && restored_reports == 1, "%lu loss and %lu restore reports",
+              (unsigned long)lost_reports, (unsigned long)restored_reports);
+    printf("step loop frozen %u us after the edge\n", reported_latency_us);
+    SIM_CHECK(reported_latency_us <= FAULT_MAX_LATENCY_US, "froze after %u us", reported_latency_us);
+    SIM_CHECK(lost_report_us - lost_at_us <= 10 * SIM_MS, "loss reported %llu us after the edge",
+              (unsigned long long)(lost_report_us - lost_at_us));
+    SIM_CHECK(restored_report_us - restored_at_us >= FAULT_RESTORE_STABLE_MS * SIM_MS,
+              "restored %llu us after the supply came back", (unsigned long long)(restored_report_us - restored_at_us));
+    SIM_CHECK(stepper_get_reference() == REFERENCE_LOST, "position reference kept through a loss at speed");
+    SIM_CHECK(!sim_axes[AXIS_Z].have_edge, "Z moved");
+    check_motors_match_counters();
+}
+
+// ---- A bouncing supply at rest: one loss, the restore waits for the last edge ----
+
+static uint64_t last_bounce_us;
+
+static void bounce_core0(uint64_t now_us) {
+    background();
+    static const uint32_t edges_ms[] = { 200, 400, 500, 600, 650, 700 };
+    if (phase < (int)(sizeof(edges_ms) / sizeof(edges_ms[0])) && now_us >= edges_ms[phase] * SIM_MS) {
+        // Falling first, every other edge is the supply coming back
+        supply_edge(phase % 2 == 1);
+        last_bounce_us = now_us;
+        phase++;
+    }
+}
+
+static void scenario_bounce(void) {
+    sim_boot(false);
+    host_uart_tx_hook = on_uart_tx;
+    sim_core0 = bounce_core0;
+    sim_run(3 * SIM_S);
+    SIM_CHECK(lost_reports == 1 && restored_reports == 1, "%lu loss and %lu restore reports",
+              (unsigned long)lost_reports, (unsigned long)restored_reports);
+    SIM_CHECK(restored_report_us - last_bounce_us >= FAULT_RESTORE_STABLE_MS * SIM_MS,
+              "restored %llu us after the last edge", (unsigned long long)(restored_report_us - last_bounce_us));
+    SIM_CHECK(!fault_is_active(), "fault still active");
+}
+
+static const sim_scenario_t scenarios[] = {
+    { "power_loss", scenario_power_loss },
+    { "bounce", scenario_bounce },
+};
+
+int main(int argc, char **argv) {
+    return sim_main(argc, argv, scenarios, sizeof(scenarios) / sizeof(scenarios[0]));
+}
@@ -0,0 +1,204 @@
+// Trajectory follower for fast movers: a dense profile well above the step interval's rate limit, followed with
+// feed-forward. The recorded step edges are checked against the acceleration limit and against the profile,
+// and the follower has to brake from its speed at the limit when it is paused or the profile is stopped
+
+#include <math.h>
+#include <string.h>
+#include "sim.h"
+#include "CONFIG.h"
+#include "PROFILE.h"
+
+#define ACCELERATION_ARCSEC 200000.0f       // A mount built for satellites, the profile uses half of it
+#define POINT_MS 20
+#define RAMP_S 1.5f
+#define CRUISE_S 2.0f
+#define PROFILE_S (2.0f * RAMP_S + CRUISE_S)
+#define X_ACCEL 100000.0f                   // Tops out at 150000"/s, about 21 kHz at 16 microsteps
+#define Z_SWING 1000.0f
+#define CRUISE_ERROR_ARCSEC 10.0f           // Tracking error allowed at constant speed, a pulse is 7"
+#define RAMP_ERROR_ARCSEC 25.0f             // And while the profile accelerates, the points are 20 ms apart
+
+static int phase = 0;
+static uint32_t next_point = 0;
+static uint64_t start_us = 0;
+static float worst_cruise_error = 0.0f;
+static float worst_ramp_error = 0.0f;
+static float worst_report_mismatch = 0.0f;
+
+// X speeds up, cruises and slows down, Z swings out and back (a reversal) with zero speed at both ends
+static float profile_x(float t) {
+    if (t <= 0.0f) return 0.0f;
+    float v = X_ACCEL * RAMP_S;
+    float ramp = 0.5f * X_ACCEL * RAMP_S * RAMP_S;
+    if (t < RAMP_S) return 0.5f * X_ACCEL * t * t;
+    if (t < RAMP_S + CRUISE_S) return ramp + v * (t - RAMP_S);
+    if (t > PROFILE_S) t = PROFILE_S;
+    float left = PROFILE_S - t;
+    return 2.0f * ramp + v * CRUISE_S - 0.5f * X_ACCEL * left * left;
+}
+
+static float profile_z(float t) {
+    if (t <= 0.0f || t >= PROFILE_S) return 0.0f;
+    return Z_SWING * (1.0f - cosf(2.0f * (float)M_PI * t / PROFILE_S));
+}
+
+// The target the firmware follows: straight lines between the points
+static float profile_target(uint8_t axis, float t) {
+    float (*curve)(float) = axis == AXIS_X ? profile_x : profile_z;
+    float last_s = PROFILE_S;
+    if (t >= last_s) return curve(last_s);
+    uint32_t k = (uint32_t)(t * 1000.0f / POINT_MS);
+    float t0 = k * POINT_MS / 1000.0f;
+    float t1 = (k + 1) * POINT_MS / 1000.0f;
+    return curve(t0) + (curve(t1) - curve(t0)) * (t - t0) / (t1 - t0);
+}
+
+// Whatever fits into the ring now, in frames of up to PROFILE_MAX_CHUNK points like the host sends them
+static void top_up_profile(void) {
+    uint32_t last_point = (uint32_t)(PROFILE_S * 1000.0f / POINT_MS);
+    while (next_point <= last_point) {
+        uint8_t data[PROFILE_MAX_CHUNK * 16];
+        uint8_t count = 0;
+        while (count < PROFILE_MAX_CHUNK && next_point + count <= last_point) {
+            uint32_t time_ms = (next_point + count) * POINT_MS;
+            float t = time_ms / 1000.0f;
+            float position[NUM_AXES] = { profile_x(t), 0.0f, profile_z(t) };
+            memcpy(&data[count * 16], &time_ms, sizeof(time_ms));
+            memcpy(&data[count * 16 + 4], position, sizeof(position));
+            count++;
+        }
+        if (!profile_upload(count, data)) return;
+        next_point += count;
+    }
+}
+
+static void check_motors_match_counters(void) {
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        SIM_CHECK(sim_axes[axis].motor_units == stepper_get_position(axis),
+                  "axis %d motor at %ld units, counter at %ld", axis,
+                  (long)sim_axes[axis].motor_units, (long)stepper_get_position(axis));
+    }
+}
+
+// Where the motor is against where the profile says it should be, and what the firmware reports for it
+static void measure_tracking_error(uint64_t now_us) {
+    float t = (now_us - start_us) / 1000000.0f;
+    bool cruising = t > RAMP_S + 0.1f && t < RAMP_S + CRUISE_S;
+    for (uint8_t axis = 0; axis < NUM_AXES; axis += 2) {
+        float target = profile_target(axis, t);
+        float motor = sim_axes[axis].motor_units / stepper_steps_per_arcsec(axis);
+        float error = fabsf(target - motor);
+        if (axis == AXIS_X && cruising) {
+            if (error > worst_cruise_error) worst_cruise_error = error;
+        } else if (error > worst_ramp_error) {
+            worst_ramp_error = error;
+        }
+        // The report is taken on core 1 against the counters up to a control period ago
+        float reported = stepper_get_tracking_error(axis);
+        float mismatch = fabsf(fabsf(reported) - error);
+        if (mismatch > worst_report_mismatch) worst_report_mismatch = mismatch;
+    }
+}
+
+static void configure(void) {
+    device_config.acceleration = ACCELERATION_ARCSEC;
+}
+
+static void start_profile(void) {
+    top_up_profile();
+    start_us = sim_now();
+    stepper_start_profile(true);
+}
+
+// ---- The whole profile, then holding its end ----
+
+static void follow_core0(uint64_t now_us) {
+    if (phase == 0) {
+        start_profile();
+        phase = 1;
+        return;
+    }
+    top_up_profile();
+    if (phase == 1) {
+        measure_tracking_error(now_us);
+        if (now_us - start_us > (uint64_t)(PROFILE_S * 1000000.0f) + 500 * SIM_MS) phase = 2;
+    }
+}
+
+static void scenario_follow(void) {
+    sim_configure = configure;
+    sim_boot(false);
+    sim_core0 = follow_core0;
+    sim_run(7 * SIM_S);
+    SIM_CHECK(phase == 2, "profile not done, phase %d", phase);
+    printf("worst tracking error: %.2f\" at cruise, %.2f\" otherwise, report off by up to %.2f\"\n",
+           worst_cruise_error, worst_ramp_error, worst_report_mismatch);
+    SIM_CHECK(worst_cruise_error <= CRUISE_ERROR_ARCSEC, "cruise tracking error %.2f\"", worst_cruise_error);
+    SIM_CHECK(worst_ramp_error <= RAMP_ERROR_ARCSEC, "tracking error %.2f\"", worst_ramp_error);
+    SIM_CHECK(worst_report_mismatch <= RAMP_ERROR_ARCSEC, "reported tracking error off by %.2f\"", worst_report_mismatch);
+    // Faster than the step interval allows, so the follower really did the pulsing
+    float cruise_rate = X_ACCEL * RAMP_S * stepper_steps_per_arcsec(AXIS_X) / sim_pulse_units(AXIS_X);
+    SIM_CHECK(cruise_rate > 10000.0f, "profile only needs %.0f pulses/s", cruise_rate);
+    SIM_CHECK(sim_axes[AXIS_Z].reversals == 1, "Z reversed %lu times", (unsigned long)sim_axes[AXIS_Z].reversals);
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        float target = axis == AXIS_X ? profile_x(PROFILE_S) : 0.0f;
+        float off = stepper_get_position(axis) / stepper_steps_per_arcsec(axis) - target;
+        SIM_CHECK(fabsf(off) < 1.0f, "axis %d holds %.2f\" off the last point", axis, off);
+    }
+    check_motors_match_counters();
+}
+
+// ---- Stopped at cruise speed in three ways, each has to brake at the acceleration limit ----
+
+static void (*stop_action)(void);
+
+static void stop_core0(uint64_t now_us) {
+    if (phase == 0) {
+        start_profile();
+        phase = 1;
+        return;
+    }
+    top_up_profile();
+    if (phase == 1 && now_us - start_us >= (uint64_t)((RAMP_S + 1.0f) * 1000000.0f)) {
+        stop_action();
+        phase = 2;
+    } else if (phase == 2 && !stepper_is_moving()) {
+        phase = 3;
+    }
+}
+
+static void run_stop(void (*action)(void)) {
+    stop_action = action;
+    sim_configure = configure;
+    sim_boot(false);
+    sim_core0 = stop_core0;
+    sim_run(6 * SIM_S);
+    SIM_CHECK(phase == 3, "not at rest after the stop, phase %d", phase);
+    check_motors_match_counters();
+}
+
+static void scenario_pause(void) {
+    run_stop(stepper_pause);
+    SIM_CHECK(stepper_is_paused(), "not paused");
+}
+
+static void scenario_profile_stop(void) {
+    run_stop(profile_stop);
+    SIM_CHECK(stepper_get_mode() == STEPPER_MODE_IDLE, "still in mode %d", stepper_get_mode());
+}
+
+static void scenario_stop(void) {
+    run_stop(stepper_stop);
+    SIM_CHECK(!stepper_is_enabled(), "drivers still enabled");
+}
+
+static const sim_scenario_t scenarios[] = {
+    { "follow", scenario_follow },
+    { "pause", scenario_pause },
+    { "profile_stop", scenario_profile_stop },
+    { "stop", scenario_stop },
+};
+
+int main(int argc, char **argv) {
+    return sim_main(argc, argv, scenarios, sizeof(scenarios) / sizeof(scenarios[0]));
+}
@@ -0,0 +1,290 @@
+// Guide corrections on top of running tracking: simulated ST-4 lines pulled low and released on a rate-tracking axis,
+// and CMD_GUIDE pulses and nudges sent through the UART while a celestial target is tracked. The motors have to end
+// up where tracking plus the corrections put them, a pulse replaced part way through only counts as far as it got,
+// CMD_GUIDE is never ACKed, and CMD_GUIDE_STATUS has to report the offsets, the lines held and the latencies
+
+#include <math.h>
+#include <string.h>
+#include "sim.h"
+#include "codec.h"
+#include "CONFIG.h"
+#include "GUIDE.h"
+#include "UART.h"
+
+#define DEG 3600                            // arcsec
+#define FIRST_PIN 26                        // RA+, RA-, Dec+, Dec-
+#define RA_AXIS AXIS_Z                      // The default mapping
+#define DEC_AXIS AXIS_X
+#define LATENCY_LIMIT_US 1000               // Under the step loop's slowest pass while tracking
+
+static int phase = 0;
+static uint64_t phase_start_us;
+
+static void next_phase(uint64_t now_us) {
+    phase++;
+    phase_start_us = now_us;
+}
+
+// ---- The host end of the link: guide status, ACKs counted ----
+
+typedef struct {
+    bool seen;
+    float offset[NUM_AXES];
+    uint16_t command_latency_us;
+    uint16_t command_latency_max_us;
+    uint16_t st4_latency_us;
+    uint16_t st4_latency_max_us;
+    uint16_t commands;
+    uint8_t lines;
+} guide_status_t;
+
+static guide_status_t status;
+static bool ack_due;
+static uint8_t ack_id;
+static int last_message_id = -1;
+static bool acked[256];                     // Ids the firmware ACKed
+
+static void on_uart_tx(const uint8_t *data, size_t length) {
+    uint8_t cmd_type, msg_id, payload[256], payload_length;
+    size_t start = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] != 0) continue;
+        if (codec_unframe(&data[start], i - start, &cmd_type, &msg_id, payload, &payload_length)) {
+            if (cmd_type == CMD_ACK && payload_length >= 1) {
+                acked[payload[0]] = true;
+            } else if (cmd_type != CMD_ACK) {
+                ack_due = true;
+                ack_id = msg_id;
+                if (msg_id != last_message_id && cmd_type == CMD_GUIDE_STATUS && payload_length == 23) {
+                    status.seen = true;
+                    memcpy(status.offset, &payload[0], sizeof(status.offset));
+                    uint16_t values[5];
+                    memcpy(values, &payload[12], sizeof(values));
+                    status.command_latency_us = values[0];
+                    status.command_latency_max_us = values[1];
+                    status.st4_latency_us = values[2];
+                    status.st4_latency_max_us = values[3];
+                    status.commands = values[4];
+                    status.lines = payload[22];
+                }
+                last_message_id = msg_id;
+            }
+        }
+        start = i + 1;
+    }
+}
+
+static uint8_t host_send(uint8_t cmd_type, const uint8_t *data, uint8_t length) {
+    static uint8_t next_id = 0;
+    uint8_t frame[CODEC_MAX_FRAME];
+    if (++next_id == 0) next_id = 1;
+    size_t frame_length = codec_frame(frame, cmd_type, next_id, data, length);
+    host_uart_receive(frame, frame_length);
+    return next_id;
+}
+
+static void background(void) {
+    guide_background_task();
+    uart_background_task();
+    if (ack_due) {
+        ack_due = false;
+        host_send(CMD_ACK, &ack_id, 1);
+    }
+}
+
+static void request_status(void) {
+    uint8_t action = GUIDE_ACTION_STATUS;
+    status.seen = false;
+    host_send(CMD_GUIDE_CONTROL, &action, 1);
+}
+
+// ---- Setup ----
+
+static void configure(void) {
+    for (uint8_t line = 0; line < GUIDE_LINE_COUNT; line++) {
+        device_config.guide_pin[line] = FIRST_PIN + line;
+        // Released, the pull-up holds it high
+        host_gpio_set_input(FIRST_PIN + line, true);
+    }
+}
+
+static void start(void) {
+    sim_configure = configure;
+    sim_boot(false);
+    host_uart_tx_hook = on_uart_tx;
+}
+
+static float motor_arcsec(uint8_t axis) {
+    return sim_axes[axis].motor_units / stepper_steps_per_arcsec(axis);
+}
+
+static void place(uint8_t axis, float arcsec) {
+    int32_t units = (int32_t)lroundf(arcsec * stepper_steps_per_arcsec(axis));
+    stepper_set_position(axis, units);
+    sim_axes[axis].motor_units = units;
+}
+
+static float pulse_arcsec(uint8_t axis) {
+    return sim_pulse_units(axis) / stepper_steps_per_arcsec(axis);
+}
+
+static void check_latency(uint16_t last_us, uint16_t worst_us, const char *what) {
+    printf("%s latency last %u us, worst %u us\n", what, last_us, worst_us);
+    SIM_CHECK(worst_us > 0 && worst_us < LATENCY_LIMIT_US, "%s latency worst %u us", what, worst_us);
+    SIM_CHECK(last_us <= worst_us, "%s latency last %u over the worst %u", what, last_us, worst_us);
+}
+
+// Rate tracking counts whole pulses once they are due, a celestial target rounds to the nearest one
+static void check_axis(uint8_t axis, float expected_offset, float expected_arcsec, float tolerance) {
+    float motor = motor_arcsec(axis);
+    printf("axis %d: guide offset %.2f arcsec, motor %.1f where %.1f was expected\n", axis, status.offset[axis], motor,
+           expected_arcsec);
+    SIM_CHECK(fabsf(status.offset[axis] - expected_offset) < 0.05f, "axis %d guide offset %.2f instead of %.2f", axis,
+              status.offset[axis], expected_offset);
+    SIM_CHECK(fabsf(motor - expected_arcsec) <= tolerance, "axis %d at %.1f arcsec instead of %.1f", axis, motor,
+              expected_arcsec);
+}
+
+// ---- ST-4 lines on rate tracking: RA+ held, then Dec- and RA- together, the axes follow the lines held ----
+
+#define TRACK_RATE 15.0f
+#define RA_POS_S 10
+#define RA_NEG_S 6
+#define DEC_NEG_S 10
+
+static uint64_t tracking_start_us;
+
+static void set_line(guide_line_t line, bool active) {
+    // Active low, open collector
+    host_gpio_set_input(FIRST_PIN + line, !active);
+    host_gpio_irq(FIRST_PIN + line, active ? GPIO_IRQ_EDGE_FALL : GPIO_IRQ_EDGE_RISE);
+}
+
+static void st4_core0(uint64_t now_us) {
+    background();
+    if (phase == 0) {
+        float rates[NUM_AXES] = { 0.0f, 0.0f, 0.0f };
+        rates[RA_AXIS] = TRACK_RATE;
+        stepper_start_tracking(rates[AXIS_X], rates[AXIS_Y], rates[AXIS_Z]);
+        tracking_start_us = now_us;
+        next_phase(now_us);
+    } else if (phase == 1 && now_us - phase_start_us >= 1 * SIM_S) {
+        set_line(GUIDE_LINE_RA_POS, true);
+        next_phase(now_us);
+    } else if (phase == 2 && now_us - phase_start_us >= RA_POS_S * SIM_S) {
+        set_line(GUIDE_LINE_RA_POS, false);
+        set_line(GUIDE_LINE_DEC_NEG, true);
+        next_phase(now_us);
+    } else if (phase == 3 && now_us - phase_start_us >= (DEC_NEG_S - RA_NEG_S) * SIM_S) {
+        set_line(GUIDE_LINE_RA_NEG, true);
+        request_status();
+        next_phase(now_us);
+    } else if (phase == 4 && status.seen) {
+        uint8_t held = (1u << GUIDE_LINE_RA_NEG) | (1u << GUIDE_LINE_DEC_NEG);
+        SIM_CHECK(status.lines == held, "lines 0x%02x reported, 0x%02x held", status.lines, held);
+        status.seen = false;
+        next_phase(now_us);
+    } else if (phase == 5 && now_us - phase_start_us >= RA_NEG_S * SIM_S) {
+        set_line(GUIDE_LINE_RA_NEG, false);
+        set_line(GUIDE_LINE_DEC_NEG, false);
+        next_phase(now_us);
+    } else if (phase == 6 && now_us - phase_start_us >= 2 * SIM_S) {
+        request_status();
+        next_phase(now_us);
+    } else if (phase == 7 && status.seen) {
+        SIM_CHECK(stepper_get_mode() == STEPPER_MODE_TRACKING, "mode %d, tracking stopped", stepper_get_mode());
+        SIM_CHECK(status.lines == 0, "lines 0x%02x reported after the release", status.lines);
+        float ra_offset = device_config.guide_rate * (RA_POS_S - RA_NEG_S);
+        float dec_offset = -device_config.guide_rate * DEC_NEG_S;
+        float tolerance = pulse_arcsec(RA_AXIS);
+        check_axis(RA_AXIS, ra_offset, TRACK_RATE * (now_us - tracking_start_us) / 1e6f + ra_offset, tolerance);
+        check_axis(DEC_AXIS, dec_offset, dec_offset, tolerance);
+        check_latency(status.st4_latency_us, status.st4_latency_max_us, "ST-4");
+        SIM_CHECK(status.commands == 0, "%u guide commands counted", status.commands);
+        next_phase(now_us);
+    }
+}
+
+static void scenario_st4(void) {
+    start();
+    sim_core0 = st4_core0;
+    sim_run(30 * SIM_S);
+    SIM_CHECK(phase == 8, "not done, phase %d", phase);
+}
+
+// ---- CMD_GUIDE on celestial tracking: pulses on both axes, a nudge, a long pulse cut short by a new one ----
+
+#define DEC_DEG 30.0f
+#define RA_HOURS 3.0f
+#define SIDEREAL_PER_S 15.041f              // The pan target of the plain matrix runs back at the sidereal rate
+
+static const float identity[9] = { 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f };
+static uint8_t guide_ids[4];
+static int guides_sent;
+
+static void send_guide(guide_mode_t mode, int16_t x, int16_t y, int16_t z) {
+    uint8_t data[7];
+    int16_t values[NUM_AXES] = { x, y, z };
+    data[0] = mode;
+    memcpy(&data[1], values, sizeof(values));
+    guide_ids[guides_sent++] = host_send(CMD_GUIDE, data, sizeof(data));
+}
+
+static void command_core0(uint64_t now_us) {
+    background();
+    if (phase == 0) {
+        stepper_start_celestial_tracking(RA_HOURS, DEC_DEG, identity, 0, 90.0f);
+        next_phase(now_us);
+    } else if (phase == 1 && stepper_is_celestial_tracking() && now_us - phase_start_us >= 1 * SIM_S) {
+        // 30 arcsec up in Dec, 22.5 back in RA
+        send_guide(GUIDE_MODE_PULSE, 4000, 0, -3000);
+        next_phase(now_us);
+    } else if (phase == 2 && now_us - phase_start_us >= 5 * SIM_S) {
+        // 10 arcsec down in Dec
+        send_guide(GUIDE_MODE_NUDGE, -1000, 0, 0);
+        next_phase(now_us);
+    } else if (phase == 3 && now_us - phase_start_us >= 3 * SIM_S) {
+        send_guide(GUIDE_MODE_PULSE, 0, 0, 8000);
+        next_phase(now_us);
+    } else if (phase == 4 && now_us - phase_start_us >= 2 * SIM_S) {
+        // Replaces the one above after 15 arcsec
+        send_guide(GUIDE_MODE_PULSE, 0, 0, -1000);
+        next_phase(now_us);
+    } else if (phase == 5 && now_us - phase_start_us >= 3 * SIM_S) {
+        request_status();
+        next_phase(now_us);
+    } else if (phase == 6 && status.seen) {
+        SIM_CHECK(stepper_is_celestial_tracking(), "mode %d, tracking stopped", stepper_get_mode());
+        float rate = device_config.guide_rate;
+        float dec_offset = rate * 4.0f - 10.0f;
+        float ra_offset = -rate * 3.0f + rate * 2.0f - rate * 1.0f;
+        float tolerance = 0.5f * pulse_arcsec(RA_AXIS) + 1.0f;
+        check_axis(DEC_AXIS, dec_offset, DEC_DEG * DEG + dec_offset, tolerance);
+        float pan = RA_HOURS * 54000.0f - now_us / 1e6f * SIDEREAL_PER_S;
+        check_axis(RA_AXIS, ra_offset, pan + ra_offset, tolerance);
+        check_latency(status.command_latency_us, status.command_latency_max_us, "CMD_GUIDE");
+        SIM_CHECK(status.commands == guides_sent, "%u guide commands counted, %d sent", status.commands, guides_sent);
+        for (int i = 0; i < guides_sent; i++) {
+            SIM_CHECK(!acked[guide_ids[i]], "CMD_GUIDE %d ACKed", i);
+        }
+        next_phase(now_us);
+    }
+}
+
+static void scenario_command(void) {
+    start();
+    place(AXIS_X, DEC_DEG * DEG);
+    place(AXIS_Z, RA_HOURS * 54000.0f);
+    sim_core0 = command_core0;
+    sim_run(30 * SIM_S);
+    SIM_CHECK(phase == 7, "not done, phase %d", phase);
+}
+
+static const sim_scenario_t scenarios[] = {
+    { "st4", scenario_st4 },
+    { "command", scenario_command },
+};
+
+int main(int argc, char **argv) {
+    return sim_main(argc, argv, scenarios, sizeof(scenarios) / sizeof(scenarios[0]));
+}
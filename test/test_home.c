@@ -0,0 +1,383 @@
+// Homing on simulated switches: each switch trips at a fixed rotor position between two pulses, its edges raised as GPIO
+// interrupts on the step loop's core. The latch edge has to become the configured home position to within a pulse,
+// homing again from anywhere has to land on the same counter to a fraction of a pulse, contact bounce must not change
+// that, and a switch that never trips or a pause on the way leave the reference alone with the matching CMD_HOME_STATUS
+//
+// The rotor trails the step pulses: it moves from the previous pulse's position to the current one's over the interval
+// until the next. The firmware interpolates the edge from the last pulse on, so it sees the switch up to a pulse further
+// along, the same on every approach at the latch speed
+
+#include <math.h>
+#include <string.h>
+#include "sim.h"
+#include "codec.h"
+#include "CONFIG.h"
+#include "HOME.h"
+#include "UART.h"
+
+#define DEG 3600                            // arcsec
+#define X_PIN 26
+#define Z_PIN 27
+#define X_HOME_ARCSEC (90 * DEG)
+#define Z_HOME_ARCSEC (-45 * DEG)
+#define MAX_STATUSES 8
+
+static int phase = 0;
+static uint64_t phase_start_us;
+
+static void next_phase(uint64_t now_us) {
+    phase++;
+    phase_start_us = now_us;
+}
+
+// ---- The host end of the link: homing results, ACKed ----
+
+typedef struct {
+    uint8_t axis;
+    uint8_t result;
+    float correction;
+    float spread;
+} home_status_t;
+
+static home_status_t statuses[MAX_STATUSES];
+static int status_count;
+static bool ack_due;
+static uint8_t ack_id;
+static int last_message_id = -1;
+
+static void on_uart_tx(const uint8_t *data, size_t length) {
+    uint8_t cmd_type, msg_id, payload[256], payload_length;
+    size_t start = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] != 0) continue;
+        if (codec_unframe(&data[start], i - start, &cmd_type, &msg_id, payload, &payload_length) && cmd_type != CMD_ACK) {
+            ack_due = true;
+            ack_id = msg_id;
+            if (msg_id != last_message_id && cmd_type == CMD_HOME_STATUS && payload_length == 10 &&
+                status_count < MAX_STATUSES) {
+                home_status_t *status = &statuses[status_count++];
+                status->axis = payload[0];
+                status->result = payload[1];
+                memcpy(&status->correction, &payload[2], sizeof(float));
+                memcpy(&status->spread, &payload[6], sizeof(float));
+            }
+            last_message_id = msg_id;
+        }
+        start = i + 1;
+    }
+}
+
+static void host_send(uint8_t cmd_type, const uint8_t *data, uint8_t length) {
+    static uint8_t next_id = 0;
+    uint8_t frame[CODEC_MAX_FRAME];
+    if (++next_id == 0) next_id = 1;
+    size_t frame_length = codec_frame(frame, cmd_type, next_id, data, length);
+    host_uart_receive(frame, frame_length);
+}
+
+static void background(void) {
+    home_background_task();
+    uart_background_task();
+    if (ack_due) {
+        ack_due = false;
+        host_send(CMD_ACK, &ack_id, 1);
+    }
+}
+
+static void home(uint8_t axis_mask) {
+    host_send(CMD_HOME, &axis_mask, 1);
+}
+
+// ---- The switches ----
+
+typedef struct {
+    uint8_t pin;
+    bool positive;                          // Tripped on the positive side of the edge, searched for that way
+    bool active_high;
+    float edge_arcsec;                      // Where the rotor trips it
+    bool connected;
+    int bounce_toggles;                     // Chatter after every edge
+    // State
+    bool active;
+    int bounces_left;
+    uint64_t next_bounce_us;
+} home_switch_t;
+
+static home_switch_t switches[NUM_AXES];
+static host_tick_hook_t sim_tick_hook;
+
+#define BOUNCE_US 500                       // Six toggles, 3 ms of chatter
+
+static float rotor_units(uint8_t axis, uint64_t now_us) {
+    const sim_axis_t *a = &sim_axes[axis];
+    if (!a->have_interval || a->last_interval_us == 0) return (float)a->motor_units;
+    float behind = 1.0f - (float)(now_us - a->last_edge_us) / (float)a->last_interval_us;
+    if (behind <= 0.0f) return (float)a->motor_units;
+    return a->motor_units - (a->direction ? behind : -behind) * a->last_edge_units;
+}
+
+static void set_level(home_switch_t *sw, bool active) {
+    bool level = active == sw->active_high;
+    host_gpio_set_input(sw->pin, level);
+    host_gpio_irq(sw->pin, level ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL);
+}
+
+static void switch_tick(uint64_t now_us) {
+    sim_tick_hook(now_us);
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        home_switch_t *sw = &switches[axis];
+        if (!sw->pin) continue;
+        float edge_units = sw->edge_arcsec * stepper_steps_per_arcsec(axis);
+        float rotor = rotor_units(axis, now_us);
+        bool active = sw->connected && (sw->positive ? rotor >= edge_units : rotor <= edge_units);
+        if (active != sw->active) {
+            sw->active = active;
+            set_level(sw, active);
+            sw->bounces_left = sw->bounce_toggles;
+            sw->next_bounce_us = now_us + BOUNCE_US;
+        } else if (sw->bounces_left > 0 && now_us >= sw->next_bounce_us) {
+            // An even count of toggles, the last one back where the rotor put it
+            sw->bounces_left--;
+            set_level(sw, (sw->bounces_left & 1) ? !active : active);
+            sw->next_bounce_us = now_us + BOUNCE_US;
+        }
+    }
+}
+
+// ---- Setup ----
+
+static void configure(void) {
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        home_switch_t *sw = &switches[axis];
+        if (!sw->pin) continue;
+        device_config.home_pin[axis] = sw->pin;
+        if (sw->positive) device_config.home_direction |= 1u << axis;
+        if (sw->active_high) device_config.home_active_high |= 1u << axis;
+        // At rest off the switch, the level its pull gives
+        host_gpio_set_input(sw->pin, !sw->active_high);
+    }
+    device_config.home_position[AXIS_X] = X_HOME_ARCSEC;
+    device_config.home_position[AXIS_Z] = Z_HOME_ARCSEC;
+}
+
+static void start(void) {
+    sim_configure = configure;
+    sim_boot(false);
+    host_uart_tx_hook = on_uart_tx;
+    sim_tick_hook = host_tick_hook;
+    host_tick_hook = switch_tick;
+}
+
+// Where the axes would have been put, the motors there as well
+static void place(uint8_t axis, float arcsec) {
+    int32_t units = (int32_t)lroundf(arcsec * stepper_steps_per_arcsec(axis));
+    stepper_set_position(axis, units);
+    sim_axes[axis].motor_units = units;
+}
+
+static float pulse_units(uint8_t axis) {
+    return (float)sim_pulse_units(axis);
+}
+
+// Counter minus motor, the correction homing made, in units
+static int32_t counter_offset(uint8_t axis) {
+    return stepper_get_position(axis) - sim_axes[axis].motor_units;
+}
+
+// Where the counter puts the switch edge against the configured home position, units
+static float edge_error(uint8_t axis, int32_t home_arcsec) {
+    float steps_per_arcsec = stepper_steps_per_arcsec(axis);
+    float counter_at_edge = switches[axis].edge_arcsec * steps_per_arcsec + counter_offset(axis);
+    return counter_at_edge - home_arcsec * steps_per_arcsec;
+}
+
+static void check_status(int index, uint8_t axis, uint8_t result) {
+    SIM_CHECK(index < status_count, "no status %d, %d came", index, status_count);
+    if (index >= status_count) return;
+    SIM_CHECK(statuses[index].axis == axis && statuses[index].result == result,
+              "status %d: axis %d result %d instead of %d %d", index, statuses[index].axis, statuses[index].result, axis,
+              result);
+}
+
+// Off the switch by the pulse the firmware counts ahead of the rotor at most, plus the rounding on the way
+static void check_edge(uint8_t axis, int32_t home_arcsec) {
+    float error = edge_error(axis, home_arcsec);
+    printf("axis %d: switch edge %.1f units off the home position, a pulse is %.0f\n", axis, error, pulse_units(axis));
+    if (switches[axis].positive) {
+        SIM_CHECK(error <= 2.0f && error >= -pulse_units(axis) - 2.0f, "axis %d edge %.1f units off", axis, error);
+    } else {
+        SIM_CHECK(error >= -2.0f && error <= pulse_units(axis) + 2.0f, "axis %d edge %.1f units off", axis, error);
+    }
+}
+
+static void check_at_rest(void) {
+    SIM_CHECK(!home_is_active() && !stepper_is_moving(), "still homing");
+}
+
+// ---- X then Z, one searching up with an active high switch, the other down with an active low one ----
+
+static void two_axes_core0(uint64_t now_us) {
+    background();
+    if (phase == 0) {
+        home((1u << AXIS_X) | (1u << AXIS_Z));
+        next_phase(now_us);
+    } else if (phase == 1 && now_us - phase_start_us > 10 * SIM_MS && !home_is_active()) {
+        next_phase(now_us);
+    }
+}
+
+static void setup_two_axes(int bounce_toggles) {
+    switches[AXIS_X] = (home_switch_t){ X_PIN, true, true, 5000.3f, true, bounce_toggles };
+    switches[AXIS_Z] = (home_switch_t){ Z_PIN, false, false, -7000.6f, true, bounce_toggles };
+    start();
+    sim_core0 = two_axes_core0;
+    sim_run(120 * SIM_S);
+    SIM_CHECK(phase == 2, "not done, phase %d", phase);
+    SIM_CHECK(status_count == 2, "%d statuses", status_count);
+    check_status(0, AXIS_X, HOME_RESULT_HOMED);
+    check_status(1, AXIS_Z, HOME_RESULT_HOMED);
+    SIM_CHECK(stepper_get_reference() == REFERENCE_HOMED, "reference %d", stepper_get_reference());
+    check_edge(AXIS_X, X_HOME_ARCSEC);
+    check_edge(AXIS_Z, Z_HOME_ARCSEC);
+    for (int i = 0; i < status_count; i++) {
+        // The reported correction is the shift of the counter
+        uint8_t axis = statuses[i].axis;
+        float shift = counter_offset(axis) / stepper_steps_per_arcsec(axis);
+        SIM_CHECK(fabsf(statuses[i].correction - shift) < 0.01f, "axis %d correction %.2f, the counter moved %.2f", axis,
+                  statuses[i].correction, shift);
+        printf("axis %d: fast and slow edges %.2f arcsec apart\n", axis, statuses[i].spread);
+        // Both edges on the same switch, apart by the rounding of the interpolation at the two speeds
+        SIM_CHECK(fabsf(statuses[i].spread) < 2.0f, "axis %d fast and slow edges %.2f arcsec apart", axis,
+                  statuses[i].spread);
+    }
+    check_at_rest();
+}
+
+static void scenario_two_axes(void) {
+    setup_two_axes(0);
+}
+
+// ---- The same with contact chatter after every edge ----
+
+static void scenario_bounce(void) {
+    setup_two_axes(6);
+}
+
+// ---- X homed again from below the switch, just below it and on it, the switch tripping a little further along each
+// time: the counter follows it to a fraction of a pulse, where whole pulses would scatter over one ----
+
+#define REPEAT_RUNS 5
+
+static const float repeat_starts[REPEAT_RUNS] = { 0.0f, 4000.0f, 4990.0f, 6000.0f, 9000.0f };
+static int run;
+static float run_edge[REPEAT_RUNS];
+static float run_error[REPEAT_RUNS];
+
+static void repeat_core0(uint64_t now_us) {
+    background();
+    if (phase == 0) {
+        // A third of a pulse further each time, over more than a pulse in all
+        float pulse_arcsec = pulse_units(AXIS_X) / stepper_steps_per_arcsec(AXIS_X);
+        switches[AXIS_X].edge_arcsec = 5000.3f + run * pulse_arcsec / 3.0f;
+        run_edge[run] = switches[AXIS_X].edge_arcsec;
+        place(AXIS_X, repeat_starts[run]);
+        home(1u << AXIS_X);
+        next_phase(now_us);
+    } else if (phase == 1 && now_us - phase_start_us > 10 * SIM_MS && !home_is_active()) {
+        check_status(run, AXIS_X, HOME_RESULT_HOMED);
+        run_error[run] = edge_error(AXIS_X, X_HOME_ARCSEC);
+        run++;
+        phase = run < REPEAT_RUNS ? 0 : 2;
+    }
+}
+
+static void scenario_repeat(void) {
+    switches[AXIS_X] = (home_switch_t){ X_PIN, true, true, 5000.3f, true, 0 };
+    start();
+    sim_core0 = repeat_core0;
+    sim_run(REPEAT_RUNS * 60 * SIM_S);
+    SIM_CHECK(phase == 2, "not done, phase %d run %d", phase, run);
+
+    float lowest = run_error[0], highest = run_error[0];
+    for (int i = 0; i < run; i++) {
+        printf("from %.0f arcsec, switch at %.2f: edge %.1f units off the home position\n", repeat_starts[i],
+               run_edge[i], run_error[i]);
+        if (run_error[i] < lowest) lowest = run_error[i];
+        if (run_error[i] > highest) highest = run_error[i];
+    }
+    SIM_CHECK(highest - lowest <= 0.2f * pulse_units(AXIS_X), "switch edge spread over %.1f units, a pulse is %.0f",
+              highest - lowest, pulse_units(AXIS_X));
+    SIM_CHECK(stepper_get_reference() == REFERENCE_HOMED, "reference %d", stepper_get_reference());
+    check_at_rest();
+}
+
+// ---- A switch that never trips: a full turn searched, then FAILED, the reference and counter as they were ----
+
+static void missing_core0(uint64_t now_us) {
+    background();
+    if (phase == 0) {
+        home(1u << AXIS_X);
+        next_phase(now_us);
+    } else if (phase == 1 && now_us - phase_start_us > 10 * SIM_MS && !home_is_active()) {
+        next_phase(now_us);
+    }
+}
+
+static void scenario_missing(void) {
+    switches[AXIS_X] = (home_switch_t){ X_PIN, true, true, 5000.3f, false, 0 };
+    start();
+    position_reference_t reference = stepper_get_reference();
+    sim_core0 = missing_core0;
+    float search_s = (float)HOME_SEARCH_ARCSEC / HOME_SEARCH_SPEED_ARCSEC;
+    sim_run((uint64_t)((search_s + 20.0f) * SIM_S));
+    SIM_CHECK(phase == 2, "not done, phase %d", phase);
+    SIM_CHECK(status_count == 1, "%d statuses", status_count);
+    check_status(0, AXIS_X, HOME_RESULT_FAILED);
+    float x = sim_axes[AXIS_X].motor_units / stepper_steps_per_arcsec(AXIS_X);
+    printf("searched to %.0f arcsec\n", x);
+    SIM_CHECK(fabsf(x - HOME_SEARCH_ARCSEC) < 4.0f, "searched to %.0f arcsec", x);
+    SIM_CHECK(counter_offset(AXIS_X) == 0, "counter moved by %ld units", (long)counter_offset(AXIS_X));
+    SIM_CHECK(stepper_get_reference() == reference, "reference %d, was %d", stepper_get_reference(), reference);
+    check_at_rest();
+}
+
+// ---- Paused during the slow approach: ABORTED, the reference and counter as they were ----
+
+static void pause_core0(uint64_t now_us) {
+    background();
+    if (phase == 0) {
+        home(1u << AXIS_X);
+        next_phase(now_us);
+    } else if (phase == 1 && now_us - phase_start_us >= 10 * SIM_S) {
+        // Backed off and creeping back up by now
+        stepper_pause();
+        next_phase(now_us);
+    } else if (phase == 2 && !home_is_active() && !stepper_is_moving()) {
+        next_phase(now_us);
+    }
+}
+
+static void scenario_pause(void) {
+    switches[AXIS_X] = (home_switch_t){ X_PIN, true, true, 5000.3f, true, 0 };
+    start();
+    position_reference_t reference = stepper_get_reference();
+    sim_core0 = pause_core0;
+    sim_run(20 * SIM_S);
+    SIM_CHECK(phase == 3, "not done, phase %d", phase);
+    SIM_CHECK(status_count == 1, "%d statuses", status_count);
+    check_status(0, AXIS_X, HOME_RESULT_ABORTED);
+    SIM_CHECK(counter_offset(AXIS_X) == 0, "counter moved by %ld units", (long)counter_offset(AXIS_X));
+    SIM_CHECK(stepper_get_reference() == reference, "reference %d, was %d", stepper_get_reference(), reference);
+}
+
+static const sim_scenario_t scenarios[] = {
+    { "two_axes", scenario_two_axes },
+    { "bounce", scenario_bounce },
+    { "repeat", scenario_repeat },
+    { "missing", scenario_missing },
+    { "pause", scenario_pause },
+};
+
+int main(int argc, char **argv) {
+    return sim_main(argc, argv, scenarios, sizeof(scenarios) / sizeof(scenarios[0]));
+}
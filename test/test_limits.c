@@ -0,0 +1,275 @@
+// Soft limits and forbidden zones guarded on core 1: rate tracking and a celestial target sinking below the horizon run
+// into a limit, a slew heads through a zone. Each has to be cancelled in time to brake to rest at the acceleration
+// limit without crossing, with one CMD_LIMIT_EVENT for it. A move that ends on a limit or next to a zone is not stopped
+// and a move into a zone is refused
+
+#include <math.h>
+#include <string.h>
+#include "sim.h"
+#include "codec.h"
+#include "CONFIG.h"
+#include "LIMITS.h"
+#include "UART.h"
+
+#define DEG 3600                            // arcsec
+
+static int phase = 0;
+static uint64_t phase_start_us;
+
+static void next_phase(uint64_t now_us) {
+    phase++;
+    phase_start_us = now_us;
+}
+
+// ---- The host end of the link: limit events, ACKed ----
+
+typedef struct {
+    uint8_t kind;
+    uint8_t index;
+    int32_t position[NUM_AXES];
+} event_t;
+
+static event_t event;
+static int events;
+static bool ack_due;
+static uint8_t ack_id;
+static int last_message_id = -1;
+
+static void on_uart_tx(const uint8_t *data, size_t length) {
+    uint8_t cmd_type, msg_id, payload[256], payload_length;
+    size_t start = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] != 0) continue;
+        if (codec_unframe(&data[start], i - start, &cmd_type, &msg_id, payload, &payload_length) && cmd_type != CMD_ACK) {
+            ack_due = true;
+            ack_id = msg_id;
+            if (msg_id != last_message_id && cmd_type == CMD_LIMIT_EVENT && payload_length == 14) {
+                event.kind = payload[0];
+                event.index = payload[1];
+                memcpy(event.position, &payload[2], sizeof(event.position));
+                events++;
+            }
+            last_message_id = msg_id;
+        }
+        start = i + 1;
+    }
+}
+
+static void host_send(uint8_t cmd_type, const uint8_t *data, uint8_t length) {
+    static uint8_t next_id = 0;
+    uint8_t frame[CODEC_MAX_FRAME];
+    if (++next_id == 0) next_id = 1;
+    size_t frame_length = codec_frame(frame, cmd_type, next_id, data, length);
+    host_uart_receive(frame, frame_length);
+}
+
+static void background(void) {
+    limits_background_task();
+    uart_background_task();
+    if (ack_due) {
+        ack_due = false;
+        host_send(CMD_ACK, &ack_id, 1);
+    }
+}
+
+// ---- Setup ----
+
+static int32_t soft_min[NUM_AXES];
+static int32_t soft_max[NUM_AXES];
+static limit_zone_t zone;
+
+static void configure(void) {
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        device_config.soft_limit_min[axis] = soft_min[axis];
+        device_config.soft_limit_max[axis] = soft_max[axis];
+    }
+    device_config.limit_zones[0] = zone;
+}
+
+static float motor_arcsec(uint8_t axis) {
+    return sim_axes[axis].motor_units / stepper_steps_per_arcsec(axis);
+}
+
+static void place(uint8_t axis, float arcsec) {
+    int32_t units = (int32_t)lroundf(arcsec * stepper_steps_per_arcsec(axis));
+    stepper_set_position(axis, units);
+    sim_axes[axis].motor_units = units;
+}
+
+static void start(void) {
+    sim_configure = configure;
+    sim_boot(false);
+    host_uart_tx_hook = on_uart_tx;
+}
+
+static void check_event(uint8_t kind, uint8_t index) {
+    SIM_CHECK(events == 1, "%d limit events", events);
+    SIM_CHECK(event.kind == kind && event.index == index, "event kind %d index %d instead of %d %d", event.kind,
+              event.index, kind, index);
+}
+
+// Motors where the counters say, and at rest
+static void check_at_rest(void) {
+    SIM_CHECK(stepper_get_mode() == STEPPER_MODE_IDLE && !stepper_is_moving(), "still moving, mode %d",
+              stepper_get_mode());
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        SIM_CHECK(sim_axes[axis].motor_units == stepper_get_position(axis), "axis %d motor off its counter", axis);
+    }
+}
+
+// ---- Rate tracking into the upper tilt limit, fast enough to need a real braking distance ----
+
+#define RATE_ARCSEC 3000.0f
+
+static float x_highest;
+
+static void rate_core0(uint64_t now_us) {
+    background();
+    float x = motor_arcsec(AXIS_X);
+    if (x > x_highest) x_highest = x;
+    if (phase == 0) {
+        stepper_start_tracking(RATE_ARCSEC, 0.0f, 0.0f);
+        next_phase(now_us);
+    } else if (phase == 1 && stepper_get_mode() == STEPPER_MODE_IDLE && !stepper_is_moving()) {
+        next_phase(now_us);
+    }
+}
+
+static void scenario_rate(void) {
+    soft_min[AXIS_X] = -5 * DEG;
+    soft_max[AXIS_X] = 5 * DEG;
+    start();
+    sim_core0 = rate_core0;
+    sim_run(20 * SIM_S);
+    SIM_CHECK(phase == 2, "never stopped, phase %d", phase);
+
+    // Braking from the tracking rate takes RATE²/2a, it has to have started no earlier than a check period before that
+    float braking = RATE_ARCSEC * RATE_ARCSEC / (2.0f * ACCELERATION_ARCSEC_S2);
+    float slack = RATE_ARCSEC * LIMIT_CHECK_US / 1e6f + 2.0f * braking * 0.05f + 20.0f;
+    printf("stopped at %.1f arcsec, the limit is %ld, braking takes %.1f\n", x_highest, (long)soft_max[AXIS_X], braking);
+    SIM_CHECK(x_highest <= soft_max[AXIS_X], "tilt went up to %.1f arcsec", x_highest);
+    SIM_CHECK(x_highest >= soft_max[AXIS_X] - slack, "stopped at %.1f arcsec, %.1f short of the limit", x_highest,
+              soft_max[AXIS_X] - x_highest);
+    check_event(LIMIT_EVENT_SOFT_LIMIT, AXIS_X);
+    SIM_CHECK(event.position[AXIS_X] <= soft_max[AXIS_X], "event at %ld arcsec", (long)event.position[AXIS_X]);
+    check_at_rest();
+}
+
+// ---- A celestial target sinking through the horizon: tracking stops above it ----
+
+// Sky -> mount with the tilt following cos(dec)cos(ra), the target sets while the sky turns
+static const float setting_matrix[9] = { 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f };
+#define SET_DEC_DEG 10.0f
+#define SET_RA_H 18.005f                    // Just above the horizon at the start, going down
+
+static float x_lowest;
+
+static void horizon_core0(uint64_t now_us) {
+    background();
+    float x = motor_arcsec(AXIS_X);
+    if (x < x_lowest) x_lowest = x;
+    if (phase == 0) {
+        stepper_start_celestial_tracking(SET_RA_H, SET_DEC_DEG, setting_matrix, 0, 90.0f);
+        next_phase(now_us);
+    } else if (phase == 1 && stepper_is_celestial_tracking()) {
+        next_phase(now_us);
+    } else if (phase == 2 && stepper_get_mode() == STEPPER_MODE_IDLE && !stepper_is_moving()) {
+        next_phase(now_us);
+    }
+}
+
+static void scenario_horizon(void) {
+    soft_min[AXIS_X] = 0;
+    soft_max[AXIS_X] = 90 * DEG;
+    start();
+    // On the target already
+    float ra = SET_RA_H * (float)M_PI / 12.0f;
+    float dec = SET_DEC_DEG * (float)M_PI / 180.0f;
+    place(AXIS_X, asinf(cosf(dec) * cosf(ra)) * (180.0f * 3600.0f / (float)M_PI));
+    place(AXIS_Z, atan2f(sinf(dec), cosf(dec) * sinf(ra)) * (180.0f * 3600.0f / (float)M_PI));
+    x_lowest = motor_arcsec(AXIS_X);
+    printf("target %.1f arcsec above the horizon\n", x_lowest);
+    sim_core0 = horizon_core0;
+    sim_run(120 * SIM_S);
+    SIM_CHECK(phase == 3, "not stopped, phase %d", phase);
+    printf("tilt went down to %.1f arcsec\n", x_lowest);
+    SIM_CHECK(x_lowest >= 0.0f, "tilt went down to %.1f arcsec, below the horizon", x_lowest);
+    SIM_CHECK(x_lowest < 20.0f, "stopped %.1f arcsec above the horizon", x_lowest);
+    check_event(LIMIT_EVENT_SOFT_LIMIT, AXIS_X);
+    check_at_rest();
+}
+
+// ---- A slew in tilt heading through a zone stops short of it, a move into it is refused ----
+
+static float x_highest_zone;
+
+static void zone_core0(uint64_t now_us) {
+    background();
+    float x = motor_arcsec(AXIS_X);
+    if (x > x_highest_zone) x_highest_zone = x;
+    if (phase == 0) {
+        stepper_queue_static_move(AXIS_X, 15 * DEG);
+        SIM_CHECK(stepper_get_mode() == STEPPER_MODE_IDLE, "move into the zone taken");
+        stepper_queue_static_move(AXIS_X, 30 * DEG);
+        SIM_CHECK(stepper_get_mode() == STEPPER_MODE_STATIC, "move past the zone refused");
+        next_phase(now_us);
+    } else if (phase == 1 && stepper_get_mode() == STEPPER_MODE_IDLE && !stepper_is_moving()) {
+        next_phase(now_us);
+    }
+}
+
+static void scenario_zone(void) {
+    // Tilt 10°..20° over pan 170°..-170°, across the seam, the pan axis at 175° in it
+    zone = (limit_zone_t){ 10 * DEG, 20 * DEG, 170 * DEG, -170 * DEG };
+    start();
+    place(AXIS_Z, 175.0f * DEG);
+    sim_core0 = zone_core0;
+    sim_run(30 * SIM_S);
+    SIM_CHECK(phase == 2, "not stopped, phase %d", phase);
+    printf("tilt went up to %.1f arcsec, the zone starts at %d\n", x_highest_zone, 10 * DEG);
+    SIM_CHECK(x_highest_zone < 10 * DEG, "tilt went up to %.1f arcsec, into the zone", x_highest_zone);
+    SIM_CHECK(x_highest_zone > 9 * DEG, "stopped at %.1f arcsec, well short of the zone", x_highest_zone);
+    check_event(LIMIT_EVENT_ZONE, 0);
+    check_at_rest();
+}
+
+// ---- Legal moves: to the soft limit, and past a zone in pan, run to the end without an event ----
+
+static void legal_core0(uint64_t now_us) {
+    background();
+    if (phase == 0) {
+        stepper_queue_static_move(AXIS_X, soft_max[AXIS_X]);
+        stepper_queue_static_move(AXIS_Z, 160 * DEG);
+        next_phase(now_us);
+    } else if (phase == 1 && stepper_get_mode() == STEPPER_MODE_IDLE && !stepper_is_moving()) {
+        next_phase(now_us);
+    }
+}
+
+static void scenario_legal(void) {
+    soft_max[AXIS_X] = 10 * DEG;
+    soft_min[AXIS_X] = -10 * DEG;
+    // The pan move ends a degree before the zone, the tilt inside its range the whole time
+    zone = (limit_zone_t){ -20 * DEG, 20 * DEG, 161 * DEG, 170 * DEG };
+    start();
+    sim_core0 = legal_core0;
+    sim_run(120 * SIM_S);
+    SIM_CHECK(phase == 2, "not done, phase %d", phase);
+    float x = motor_arcsec(AXIS_X);
+    float z = motor_arcsec(AXIS_Z);
+    SIM_CHECK(fabsf(x - soft_max[AXIS_X]) < 4.0f, "tilt at %.1f arcsec, the limit is %ld", x, (long)soft_max[AXIS_X]);
+    SIM_CHECK(fabsf(z - 160 * DEG) < 4.0f, "pan at %.1f arcsec", z);
+    SIM_CHECK(events == 0, "%d limit events", events);
+    check_at_rest();
+}
+
+static const sim_scenario_t scenarios[] = {
+    { "rate", scenario_rate },
+    { "horizon", scenario_horizon },
+    { "zone", scenario_zone },
+    { "legal", scenario_legal },
+};
+
+int main(int argc, char **argv) {
+    return sim_main(argc, argv, scenarios, sizeof(scenarios) / sizeof(scenarios[0]));
+}
@@ -0,0 +1,352 @@
+// Baud rate negotiation over a loopback line: the host end has a rate of its own, bytes between ends at different
+// rates arrive as garbage, and bit errors are injected while they match. A switch on a clean line has to be confirmed,
+// a noisy line or a deaf host has to drop the link back to the configured rate, and a switch the host never follows
+// has to be undone after the confirmation time
+
+#include <string.h>
+#include "sim.h"
+#include "codec.h"
+#include "CONFIG.h"
+#include "LINK.h"
+#include "UART.h"
+
+#define FAST_RATE 460800
+
+static int phase = 0;
+static uint64_t phase_start_us;
+
+static void next_phase(uint64_t now_us) {
+    phase++;
+    phase_start_us = now_us;
+}
+
+// ---- The line ----
+
+static uint32_t host_rate;                  // What the host end is set to
+static float bit_error_rate;                // Per bit on a fast line, both ways
+static bool deaf;                           // Nothing the Pico sends gets through
+static uint32_t random_state = 12345;
+
+static uint32_t next_random(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static void through_line(uint8_t *data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (host_rate != host_uart_baud) {
+            data[i] = (uint8_t)next_random();
+            continue;
+        }
+        if (host_rate == device_config.baud_rate) continue;
+        for (int bit = 0; bit < 8; bit++) {
+            if ((next_random() & 0xFFFFFF) < bit_error_rate * 0x1000000) data[i] ^= (uint8_t)(1u << bit);
+        }
+    }
+}
+
+// ---- The host end: link status and ACKs it gets, everything from the Pico ACKed ----
+
+typedef struct {
+    uint32_t rate;
+    uint8_t state;
+    uint8_t event;
+    uint32_t total_ok;
+    uint32_t total_bad;
+    uint16_t fallbacks;
+} link_status_t;
+
+static link_status_t status;
+static int statuses;
+static uint8_t acked_id;
+static bool ack_due;
+static uint8_t ack_id;
+static int last_message_id = -1;
+
+static void on_uart_tx(const uint8_t *sent, size_t length) {
+    if (deaf) return;
+    uint8_t data[CODEC_MAX_FRAME];
+    if (length > sizeof(data)) return;
+    memcpy(data, sent, length);
+    through_line(data, length);
+
+    uint8_t cmd_type, msg_id, payload[256], payload_length;
+    size_t start = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] != 0) continue;
+        if (codec_unframe(&data[start], i - start, &cmd_type, &msg_id, payload, &payload_length)) {
+            if (cmd_type == CMD_ACK && payload_length == 1) {
+                acked_id = payload[0];
+            } else if (cmd_type != CMD_ACK) {
+                ack_due = true;
+                ack_id = msg_id;
+                if (msg_id != last_message_id && cmd_type == CMD_LINK_STATUS && payload_length == 24) {
+                    memcpy(&status.rate, &payload[0], sizeof(uint32_t));
+                    status.state = payload[4];
+                    status.event = payload[5];
+                    memcpy(&status.total_ok, &payload[14], sizeof(uint32_t));
+                    memcpy(&status.total_bad, &payload[18], sizeof(uint32_t));
+                    memcpy(&status.fallbacks, &payload[22], sizeof(uint16_t));
+                    statuses++;
+                }
+                last_message_id = msg_id;
+            }
+        }
+        start = i + 1;
+    }
+}
+
+static uint8_t host_send(uint8_t cmd_type, const uint8_t *data, uint8_t length) {
+    static uint8_t next_id = 0;
+    uint8_t frame[CODEC_MAX_FRAME];
+    if (++next_id == 0) next_id = 1;
+    size_t frame_length = codec_frame(frame, cmd_type, next_id, data, length);
+    through_line(frame, frame_length);
+    host_uart_receive(frame, frame_length);
+    return next_id;
+}
+
+static uint8_t send_baud_set(uint32_t rate) {
+    uint8_t payload[4];
+    memcpy(payload, &rate, sizeof(payload));
+    return host_send(CMD_BAUD_SET, payload, sizeof(payload));
+}
+
+static void background(void) {
+    uart_background_task();
+    if (ack_due) {
+        ack_due = false;
+        host_send(CMD_ACK, &ack_id, 1);
+    }
+}
+
+static void start(void) {
+    sim_boot(false);
+    host_rate = device_config.baud_rate;
+    host_uart_tx_hook = on_uart_tx;
+}
+
+// True once every period_us, for a host sending at a steady pace
+static bool every(uint64_t now_us, uint64_t period_us) {
+    static uint64_t last_us;
+    if (now_us - last_us < period_us) return false;
+    last_us = now_us;
+    return true;
+}
+
+// A fresh status at the rate the host is on
+static void ask_status(void) {
+    statuses = 0;
+    uint8_t none = 0;
+    host_send(CMD_LINK_CONTROL, &none, 0);
+}
+
+// ---- A clean line: an odd rate is refused, the fast one confirmed and kept ----
+
+#define CLEAN_FRAMES 100
+
+static uint8_t baud_set_id;
+static int frames_sent;
+
+static void clean_core0(uint64_t now_us) {
+    background();
+    uint64_t elapsed = now_us - phase_start_us;
+    if (phase == 0) {
+        statuses = 0;
+        send_baud_set(12345);
+        next_phase(now_us);
+    } else if (phase == 1 && statuses > 0) {
+        SIM_CHECK(status.event == LINK_EVENT_REJECTED && status.rate == device_config.baud_rate,
+                  "odd rate: event %d, rate %lu", status.event, (unsigned long)status.rate);
+        baud_set_id = send_baud_set(FAST_RATE);
+        next_phase(now_us);
+    } else if (phase == 2 && acked_id == baud_set_id) {
+        next_phase(now_us);
+    } else if (phase == 3 && elapsed >= 2 * SIM_MS) {
+        // The ACK is through, the Pico has switched by now
+        host_rate = FAST_RATE;
+        ask_status();
+        next_phase(now_us);
+    } else if (phase == 4 && statuses > 0 && status.rate == FAST_RATE && status.state == LINK_STATE_STABLE) {
+        SIM_CHECK(status.event == LINK_EVENT_SWITCHED, "switch ended with event %d", status.event);
+        next_phase(now_us);
+    } else if (phase == 5 && every(now_us, 5 * SIM_MS)) {
+        ask_status();
+        if (++frames_sent == CLEAN_FRAMES) next_phase(now_us);
+    } else if (phase == 6 && elapsed >= 100 * SIM_MS) {
+        next_phase(now_us);
+    }
+}
+
+static void scenario_clean(void) {
+    start();
+    sim_core0 = clean_core0;
+    sim_run(5 * SIM_S);
+    SIM_CHECK(phase == 7, "not done, phase %d", phase);
+    printf("at %u baud, %lu good and %lu bad frames, %u fallbacks\n", host_uart_baud, (unsigned long)status.total_ok,
+           (unsigned long)status.total_bad, status.fallbacks);
+    SIM_CHECK(host_uart_baud == FAST_RATE, "UART at %u baud", host_uart_baud);
+    SIM_CHECK(status.rate == FAST_RATE && status.fallbacks == 0, "status rate %lu, %u fallbacks",
+              (unsigned long)status.rate, status.fallbacks);
+    SIM_CHECK(status.total_bad == 0, "%lu bad frames on a clean line", (unsigned long)status.total_bad);
+    SIM_CHECK(status.total_ok >= CLEAN_FRAMES, "only %lu good frames", (unsigned long)status.total_ok);
+}
+
+// ---- A noisy fast line: confirmed, then the error rate drops it back within a couple of windows ----
+
+#define NOISY_BIT_ERRORS 0.01f              // About 40% of the short frames hit
+
+static int noisy_frames;                    // Sent at the fast rate
+static link_status_t fallen_back;
+
+static void noisy_core0(uint64_t now_us) {
+    background();
+    uint64_t elapsed = now_us - phase_start_us;
+    if (phase == 0) {
+        baud_set_id = send_baud_set(FAST_RATE);
+        next_phase(now_us);
+    } else if (phase == 1 && acked_id == baud_set_id) {
+        next_phase(now_us);
+    } else if (phase == 2 && elapsed >= 2 * SIM_MS) {
+        host_rate = FAST_RATE;
+        next_phase(now_us);
+    } else if (phase == 3 && every(now_us, 5 * SIM_MS)) {
+        // Asking until the Pico falls back. Its long status frames hardly ever make it through the noise, the host
+        // cannot tell the switch was confirmed
+        if (host_uart_baud != FAST_RATE) {
+            next_phase(now_us);
+            return;
+        }
+        ask_status();
+        noisy_frames++;
+    } else if (phase == 4 && elapsed >= 50 * SIM_MS) {
+        // Nothing gets through at the fast rate any more, the host goes back to the configured one
+        host_rate = device_config.baud_rate;
+        ask_status();
+        next_phase(now_us);
+    } else if (phase == 5 && statuses > 0 && status.rate == device_config.baud_rate) {
+        // Not the status from the switch, still being retransmitted
+        fallen_back = status;
+        next_phase(now_us);
+    }
+}
+
+static void scenario_noisy(void) {
+    start();
+    bit_error_rate = NOISY_BIT_ERRORS;
+    sim_core0 = noisy_core0;
+    sim_run(10 * SIM_S);
+    SIM_CHECK(phase == 6, "not done, phase %d", phase);
+    printf("fell back after %d frames at %d baud, %lu good and %lu bad frames\n", noisy_frames, FAST_RATE,
+           (unsigned long)fallen_back.total_ok, (unsigned long)fallen_back.total_bad);
+    SIM_CHECK(noisy_frames <= 3 * LINK_WINDOW_FRAMES, "%d frames at the fast rate before falling back", noisy_frames);
+    SIM_CHECK(host_uart_baud == device_config.baud_rate, "UART at %u baud", host_uart_baud);
+    // A fallback and not an undone switch, the first frame at the fast rate confirmed it
+    SIM_CHECK(fallen_back.rate == device_config.baud_rate && fallen_back.event == LINK_EVENT_FALLBACK && fallen_back.fallbacks == 1,
+              "status rate %lu, event %d, %u fallbacks", (unsigned long)fallen_back.rate, fallen_back.event, fallen_back.fallbacks);
+    SIM_CHECK(fallen_back.total_bad * 100 >= (fallen_back.total_ok + fallen_back.total_bad) * LINK_ERROR_PERCENT / 2,
+              "only %lu of %lu frames bad", (unsigned long)fallen_back.total_bad,
+              (unsigned long)(fallen_back.total_ok + fallen_back.total_bad));
+}
+
+// ---- A switch the host never follows: the Pico goes back after the confirmation time ----
+
+static uint64_t switched_us;
+static uint64_t returned_us;
+
+static void unconfirmed_core0(uint64_t now_us) {
+    background();
+    uint64_t elapsed = now_us - phase_start_us;
+    if (phase == 0) {
+        baud_set_id = send_baud_set(115200);
+        next_phase(now_us);
+    } else if (phase == 1 && host_uart_baud == 115200) {
+        switched_us = now_us;
+        next_phase(now_us);
+    } else if (phase == 2) {
+        // Still talking at the old rate, garbage to the Pico until it comes back
+        if (host_uart_baud != 115200) {
+            returned_us = now_us;
+            next_phase(now_us);
+        } else if (every(now_us, 100 * SIM_MS)) {
+            ask_status();
+        }
+    } else if (phase == 3 && elapsed >= 10 * SIM_MS) {
+        ask_status();
+        next_phase(now_us);
+    } else if (phase == 4 && statuses > 0) {
+        next_phase(now_us);
+    }
+}
+
+static void scenario_unconfirmed(void) {
+    start();
+    sim_core0 = unconfirmed_core0;
+    sim_run(10 * SIM_S);
+    SIM_CHECK(phase == 5, "not done, phase %d", phase);
+    float back_ms = (returned_us - switched_us) / 1000.0f;
+    printf("back after %.1f ms\n", back_ms);
+    SIM_CHECK(back_ms >= LINK_CONFIRM_MS && back_ms <= LINK_CONFIRM_MS + 50, "back after %.1f ms", back_ms);
+    SIM_CHECK(host_uart_baud == device_config.baud_rate, "UART at %u baud", host_uart_baud);
+    SIM_CHECK(status.rate == device_config.baud_rate && status.event == LINK_EVENT_CONFIRM_TIMEOUT,
+              "status rate %lu, event %d", (unsigned long)status.rate, status.event);
+    SIM_CHECK(status.fallbacks == 0, "undoing a switch counted as %u fallbacks", status.fallbacks);
+}
+
+// ---- A host that stops hearing after the switch: the unACKed messages drop the link back ----
+
+static void deaf_core0(uint64_t now_us) {
+    background();
+    uint64_t elapsed = now_us - phase_start_us;
+    if (phase == 0) {
+        baud_set_id = send_baud_set(FAST_RATE);
+        next_phase(now_us);
+    } else if (phase == 1 && acked_id == baud_set_id) {
+        next_phase(now_us);
+    } else if (phase == 2 && elapsed >= 2 * SIM_MS) {
+        // The confirmation gets to the Pico, nothing comes back
+        host_rate = FAST_RATE;
+        deaf = true;
+        ask_status();
+        next_phase(now_us);
+    } else if (phase == 3 && host_uart_baud != FAST_RATE) {
+        switched_us = phase_start_us;
+        returned_us = now_us;
+        deaf = false;
+        host_rate = device_config.baud_rate;
+        next_phase(now_us);
+    } else if (phase == 4 && elapsed >= 10 * SIM_MS) {
+        ask_status();
+        next_phase(now_us);
+    } else if (phase == 5 && statuses > 0) {
+        next_phase(now_us);
+    }
+}
+
+static void scenario_deaf(void) {
+    start();
+    sim_core0 = deaf_core0;
+    sim_run(10 * SIM_S);
+    SIM_CHECK(phase == 6, "not done, phase %d", phase);
+    // The retransmissions of the first message have to run out first
+    float back_ms = (returned_us - switched_us) / 1000.0f;
+    printf("back after %.1f ms\n", back_ms);
+    SIM_CHECK(back_ms >= MAX_RETRANSMITS * ACK_TIMEOUT_MS, "back after %.1f ms", back_ms);
+    SIM_CHECK(back_ms <= (MAX_RETRANSMITS + 1) * ACK_TIMEOUT_MS + 100, "back after %.1f ms", back_ms);
+    SIM_CHECK(host_uart_baud == device_config.baud_rate, "UART at %u baud", host_uart_baud);
+    SIM_CHECK(status.rate == device_config.baud_rate && status.event == LINK_EVENT_FALLBACK && status.fallbacks == 1,
+              "status rate %lu, event %d, %u fallbacks", (unsigned long)status.rate, status.event, status.fallbacks);
+}
+
+static const sim_scenario_t scenarios[] = {
+    { "clean", scenario_clean },
+    { "noisy", scenario_noisy },
+    { "unconfirmed", scenario_unconfirmed },
+    { "deaf", scenario_deaf },
+};
+
+int main(int argc, char **argv) {
+    return sim_main(argc, argv, scenarios, sizeof(scenarios) / sizeof(scenarios[0]));
+}
@@ -0,0 +1,195 @@
+// Periodic error correction against a mount with a sinusoidal error over the motor revolution: a table of the error
+// played back, and one recorded from a simulated guider, have to cancel most of it while tracking
+
+#include <math.h>
+#include <stdlib.h>
+#include "sim.h"
+#include "tmc_model.h"
+#include "CONFIG.h"
+#include "PEC.h"
+#include "GUIDE.h"
+
+#define ERROR_AMPLITUDE_ARCSEC 8.0f
+#define TRACK_RATE_ARCSEC 300.0f            // Fine steps, one motor revolution in about two and a half minutes
+#define SAMPLE_MS 10
+#define GUIDE_CADENCE_MS 1000
+#define MAX_RESIDUAL_RATIO 0.1f             // RMS left with PEC on, of the RMS without
+
+static int phase = 0;
+static uint64_t phase_start_us;
+static double square_sum;
+static uint32_t samples;
+static float rms_without;
+static float rms_with;
+
+static float period_s(void) {
+    return pec_period_steps / stepper_steps_per_arcsec(AXIS_X) / TRACK_RATE_ARCSEC;
+}
+
+// What the gears add to the motor's angle on the sky, over one motor revolution
+static float periodic_error(int32_t motor_units) {
+    float turns = (float)motor_units / pec_period_steps;
+    return ERROR_AMPLITUDE_ARCSEC * sinf(2.0f * (float)M_PI * turns);
+}
+
+static float sky_arcsec(void) {
+    return sim_axes[AXIS_X].motor_units / stepper_steps_per_arcsec(AXIS_X) + periodic_error(sim_axes[AXIS_X].motor_units);
+}
+
+// Sky against the position counter: the gear error and whatever PEC put out, which is not counted
+static float pointing_error(void) {
+    return sky_arcsec() - stepper_get_position(AXIS_X) / stepper_steps_per_arcsec(AXIS_X);
+}
+
+static void sample(uint64_t now_us) {
+    if ((now_us / 1000) % SAMPLE_MS != 0) return;
+    float error = pointing_error();
+    square_sum += (double)error * error;
+    samples++;
+}
+
+static float take_rms(void) {
+    float rms = samples ? (float)sqrt(square_sum / samples) : 0.0f;
+    square_sum = 0.0;
+    samples = 0;
+    return rms;
+}
+
+static bool period_over(uint64_t now_us) {
+    return now_us - phase_start_us >= (uint64_t)(period_s() * SIM_S);
+}
+
+static void next_phase(uint64_t now_us) {
+    phase++;
+    phase_start_us = now_us;
+}
+
+// ---- A table of the error, uploaded: one revolution without, one with ----
+
+static void playback_core0(uint64_t now_us) {
+    if (phase == 0) {
+        int8_t table[PEC_TABLE_SIZE];
+        for (int i = 0; i < PEC_TABLE_SIZE; i++) {
+            // Against the error at the middle of the bin
+            float error = periodic_error((int32_t)((i + 0.5f) * pec_period_steps / PEC_TABLE_SIZE));
+            table[i] = (int8_t)lroundf(-error / PEC_UNIT_ARCSEC);
+        }
+        for (int start = 0; start < PEC_TABLE_SIZE; start += PEC_MAX_CHUNK) {
+            pec_upload(AXIS_X, (uint8_t)start, PEC_MAX_CHUNK, &table[start]);
+        }
+        stepper_start_tracking(TRACK_RATE_ARCSEC, 0.0f, 0.0f);
+        next_phase(now_us);
+    } else if (phase == 1) {
+        // Up to speed
+        if (now_us - phase_start_us >= SIM_S) next_phase(now_us);
+    } else if (phase == 2) {
+        sample(now_us);
+        if (!period_over(now_us)) return;
+        rms_without = take_rms();
+        pec_set_enabled(AXIS_X, true);
+        next_phase(now_us);
+    } else if (phase == 3) {
+        // The correction catches up with the table
+        if (now_us - phase_start_us >= SIM_S) next_phase(now_us);
+    } else if (phase == 4) {
+        sample(now_us);
+        if (!period_over(now_us)) return;
+        rms_with = take_rms();
+        next_phase(now_us);
+    }
+}
+
+static void check_cancelled(void) {
+    printf("periodic error %.2f arcsec RMS without PEC, %.2f with\n", rms_without, rms_with);
+    float expected = ERROR_AMPLITUDE_ARCSEC / sqrtf(2.0f);
+    SIM_CHECK(fabsf(rms_without - expected) < 0.1f * expected, "%.2f arcsec RMS without PEC, the error is %.2f",
+              rms_without, expected);
+    SIM_CHECK(rms_with < MAX_RESIDUAL_RATIO * rms_without, "%.2f arcsec RMS left with PEC", rms_with);
+}
+
+static void scenario_playback(void) {
+    tmc_model_install();
+    sim_check_accel = false;        // A doubled tracking step goes out right behind the first
+    sim_boot(true);
+    sim_core0 = playback_core0;
+    sim_run((uint64_t)((2.0f * period_s() + 5.0f) * SIM_S));
+    SIM_CHECK(phase == 5, "not done, phase %d", phase);
+    check_cancelled();
+}
+
+// ---- Recorded from guide pulses: a guider corrects the error for a revolution, then PEC alone ----
+
+static float track_start_arcsec;
+static uint64_t track_start_us;
+
+static bool table_recorded(void) {
+    for (int i = 0; i < PEC_TABLE_SIZE; i++) {
+        if (pec_axes[AXIS_X].table[i] != 0) return true;
+    }
+    return false;
+}
+
+// Pulses the mount back onto the star, the star moving at the tracking rate
+static void guide(uint64_t now_us) {
+    if ((now_us / 1000) % GUIDE_CADENCE_MS != 0) return;
+    float star = track_start_arcsec + TRACK_RATE_ARCSEC * (now_us - track_start_us) / 1000000.0f;
+    float error = sky_arcsec() - star;
+    float ms = -error / device_config.guide_rate * 1000.0f;
+    if (ms > INT16_MAX) ms = INT16_MAX;
+    if (ms < -INT16_MAX) ms = -INT16_MAX;
+    int16_t values[NUM_AXES] = { (int16_t)lroundf(ms), 0, 0 };
+    if (values[AXIS_X] != 0) guide_command(GUIDE_MODE_PULSE, values, (uint32_t)now_us);
+}
+
+static void record_core0(uint64_t now_us) {
+    if (phase == 0) {
+        stepper_start_tracking(TRACK_RATE_ARCSEC, 0.0f, 0.0f);
+        next_phase(now_us);
+    } else if (phase == 1) {
+        if (now_us - phase_start_us < SIM_S) return;
+        track_start_arcsec = sky_arcsec();
+        track_start_us = now_us;
+        pec_start_recording(AXIS_X);
+        next_phase(now_us);
+    } else if (phase == 2) {
+        guide(now_us);
+        if (!table_recorded()) return;
+        // No more guiding, the recorded table alone
+        pec_set_enabled(AXIS_X, true);
+        next_phase(now_us);
+    } else if (phase == 3) {
+        if (now_us - phase_start_us >= SIM_S) next_phase(now_us);
+    } else if (phase == 4) {
+        sample(now_us);
+        if (!period_over(now_us)) return;
+        rms_with = take_rms();
+        pec_set_enabled(AXIS_X, false);
+        next_phase(now_us);
+    } else if (phase == 5) {
+        if (now_us - phase_start_us >= SIM_S) next_phase(now_us);
+    } else if (phase == 6) {
+        sample(now_us);
+        if (!period_over(now_us)) return;
+        rms_without = take_rms();
+        next_phase(now_us);
+    }
+}
+
+static void scenario_record(void) {
+    tmc_model_install();
+    sim_check_accel = false;
+    sim_boot(true);
+    sim_core0 = record_core0;
+    sim_run((uint64_t)((3.5f * period_s() + 5.0f) * SIM_S));
+    SIM_CHECK(phase == 7, "not done, phase %d", phase);
+    check_cancelled();
+}
+
+static const sim_scenario_t scenarios[] = {
+    { "playback", scenario_playback },
+    { "record", scenario_record },
+};
+
+int main(int argc, char **argv) {
+    return sim_main(argc, argv, scenarios, sizeof(scenarios) / sizeof(scenarios[0]));
+}
@@ -0,0 +1,270 @@
+// Tracking profile for a slow non-sidereal target, sent the way a host would: CMD_PROFILE_UPLOAD frames of up to
+// PROFILE_MAX_CHUNK points through the UART, topped up from the free space in each CMD_PROFILE_STATUS. The motors have
+// to follow the straight lines between the points without an underrun, hold the last point, and a bad batch or one
+// that does not fit must leave the ring as it was
+
+#include <math.h>
+#include <string.h>
+#include "sim.h"
+#include "codec.h"
+#include "CONFIG.h"
+#include "PROFILE.h"
+#include "UART.h"
+
+#define POINT_MS 1000
+#define PROFILE_POINTS 200                  // Three times the ring, it has to be topped up on the way
+#define PROFILE_S ((PROFILE_POINTS - 1) * POINT_MS / 1000.0f)
+#define HOLD_S 5.0f
+
+static int phase = 0;
+static uint64_t start_us;
+
+// ---- The host end of the link ----
+
+typedef struct {
+    bool seen;
+    bool active;
+    bool underrun;
+    uint16_t free_slots;
+    uint32_t last_time_ms;
+} profile_status_t;
+
+static profile_status_t status;
+static uint32_t statuses;
+static bool ack_due;
+static uint8_t ack_id;
+static int last_message_id = -1;
+static uint32_t host_bytes;
+
+static void on_uart_tx(const uint8_t *data, size_t length) {
+    uint8_t cmd_type, msg_id, payload[256], payload_length;
+    size_t start = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] != 0) continue;
+        if (codec_unframe(&data[start], i - start, &cmd_type, &msg_id, payload, &payload_length) && cmd_type != CMD_ACK) {
+            // Sent again until the host ACKs it, with the same id
+            ack_due = true;
+            ack_id = msg_id;
+            if (msg_id != last_message_id && cmd_type == CMD_PROFILE_STATUS && payload_length == 18) {
+                status.seen = true;
+                status.active = payload[0] != 0;
+                status.underrun = payload[1] != 0;
+                memcpy(&status.free_slots, &payload[2], sizeof(uint16_t));
+                memcpy(&status.last_time_ms, &payload[8], sizeof(uint32_t));
+                statuses++;
+            }
+            last_message_id = msg_id;
+        }
+        start = i + 1;
+    }
+}
+
+static void host_send(uint8_t cmd_type, const uint8_t *data, uint8_t length) {
+    static uint8_t next_id = 0;
+    uint8_t frame[CODEC_MAX_FRAME];
+    if (++next_id == 0) next_id = 1;
+    size_t frame_length = codec_frame(frame, cmd_type, next_id, data, length);
+    host_bytes += frame_length;
+    host_uart_receive(frame, frame_length);
+}
+
+// The core 0 main loop's part in it, and the host's ACK
+static void background(void) {
+    uart_background_task();
+    if (ack_due) {
+        ack_due = false;
+        host_send(CMD_ACK, &ack_id, 1);
+    }
+}
+
+// ---- The target: a comet speeding up in X and weaving in Y ----
+
+static float target_curve(uint8_t axis, float t) {
+    if (axis == AXIS_X) return 20.0f * t + 0.25f * t * t;
+    if (axis == AXIS_Y) return 300.0f * sinf(2.0f * (float)M_PI * t / 80.0f);
+    return 0.0f;
+}
+
+// What the firmware follows: straight lines between the points, the last one held
+static float profile_target(uint8_t axis, float t) {
+    if (t >= PROFILE_S) return target_curve(axis, PROFILE_S);
+    float point_s = POINT_MS / 1000.0f;
+    float t0 = floorf(t / point_s) * point_s;
+    float t1 = t0 + point_s;
+    return target_curve(axis, t0) + (target_curve(axis, t1) - target_curve(axis, t0)) * (t - t0) / point_s;
+}
+
+static void put_point(uint8_t *data, uint32_t time_ms, const float position[NUM_AXES]) {
+    memcpy(data, &time_ms, sizeof(time_ms));
+    memcpy(&data[4], position, NUM_AXES * sizeof(float));
+}
+
+static uint32_t next_point = 0;
+
+// One frame of points if the last status says it fits
+static void top_up(void) {
+    if (!status.seen || next_point >= PROFILE_POINTS || status.free_slots < PROFILE_MAX_CHUNK) return;
+    uint8_t data[1 + PROFILE_MAX_CHUNK * 16];
+    uint8_t count = 0;
+    while (count < PROFILE_MAX_CHUNK && next_point < PROFILE_POINTS) {
+        float t = next_point * POINT_MS / 1000.0f;
+        float position[NUM_AXES] = { target_curve(AXIS_X, t), target_curve(AXIS_Y, t), target_curve(AXIS_Z, t) };
+        put_point(&data[1 + count * 16], next_point * POINT_MS, position);
+        next_point++;
+        count++;
+    }
+    data[0] = count;
+    status.seen = false;            // Until the answer to this one
+    host_send(CMD_PROFILE_UPLOAD, data, (uint8_t)(1 + count * 16));
+}
+
+static void control(uint8_t action) {
+    host_send(CMD_PROFILE_CONTROL, &action, 1);
+}
+
+// ---- Uploaded in batches while it plays, followed to the end, the last point held ----
+
+static float worst_error[NUM_AXES];
+static bool underrun_in_profile;
+
+static void measure_error(uint64_t now_us) {
+    float t = (now_us - start_us) / 1000000.0f;
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        float motor = sim_axes[axis].motor_units / stepper_steps_per_arcsec(axis);
+        float error = fabsf(profile_target(axis, t) - motor);
+        if (error > worst_error[axis]) worst_error[axis] = error;
+    }
+}
+
+static void comet_core0(uint64_t now_us) {
+    background();
+    if (phase == 0) {
+        // Ask for the status, the first upload goes by its free space
+        control(PROFILE_ACTION_STATUS);
+        phase = 1;
+    } else if (phase == 1) {
+        top_up();
+        if (next_point < PROFILE_MAX_POINTS - PROFILE_MAX_CHUNK) return;
+        control(PROFILE_ACTION_START);
+        start_us = now_us;
+        phase = 2;
+    } else if (phase == 2) {
+        top_up();
+        // Once the axes caught up with the first point, a slew from where they stood
+        if (now_us - start_us > 2 * SIM_S) measure_error(now_us);
+        if (stepper_get_mode() == STEPPER_MODE_PROFILE && (now_us / 1000) % 1000 == 0) control(PROFILE_ACTION_STATUS);
+        if (status.underrun && now_us - start_us < (uint64_t)(PROFILE_S * SIM_S)) underrun_in_profile = true;
+        if (now_us - start_us >= (uint64_t)((PROFILE_S + HOLD_S) * SIM_S)) phase = 3;
+    }
+}
+
+static void scenario_comet(void) {
+    sim_boot(false);
+    host_uart_tx_hook = on_uart_tx;
+    sim_core0 = comet_core0;
+    sim_run((uint64_t)((PROFILE_S + HOLD_S + 5.0f) * SIM_S));
+    SIM_CHECK(phase == 3, "not done, phase %d", phase);
+    SIM_CHECK(next_point == PROFILE_POINTS, "%lu of %d points uploaded", (unsigned long)next_point, PROFILE_POINTS);
+    SIM_CHECK(!underrun_in_profile, "underrun while points were still coming");
+    SIM_CHECK(status.underrun, "no underrun reported past the last point");
+
+    // Within a pulse of the lines between the points all the way, and on the last one to the nearest pulse
+    printf("worst error X %.2f Y %.2f arcsec, host sent %lu bytes in %.0f s\n", worst_error[AXIS_X], worst_error[AXIS_Y],
+           (unsigned long)host_bytes, PROFILE_S);
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        float pulse_arcsec = POSITION_MICROSTEPS / device_config.microstepping / stepper_steps_per_arcsec(axis);
+        SIM_CHECK(worst_error[axis] < pulse_arcsec, "axis %d %.2f arcsec off the profile, a pulse is %.2f", axis,
+                  worst_error[axis], pulse_arcsec);
+        float motor = sim_axes[axis].motor_units / stepper_steps_per_arcsec(axis);
+        float end = target_curve(axis, PROFILE_S);
+        SIM_CHECK(fabsf(motor - end) <= 0.5f * pulse_arcsec, "axis %d at %.2f, the last point is %.2f", axis, motor, end);
+        SIM_CHECK(sim_axes[axis].motor_units == stepper_get_position(axis), "axis %d motor off its counter", axis);
+    }
+}
+
+// ---- Batches that must not change the ring: times not increasing, more than fits. Then a clear ----
+
+static uint16_t free_before;
+
+static void send_points(uint8_t count, uint32_t first_ms, uint32_t step_ms) {
+    uint8_t data[1 + PROFILE_MAX_CHUNK * 16];
+    float position[NUM_AXES] = { 100.0f, 0.0f, 0.0f };
+    for (uint8_t i = 0; i < count; i++) {
+        put_point(&data[1 + i * 16], first_ms + i * step_ms, position);
+    }
+    data[0] = count;
+    status.seen = false;
+    host_send(CMD_PROFILE_UPLOAD, data, (uint8_t)(1 + count * 16));
+}
+
+static void rejects_core0(uint64_t now_us) {
+    background();
+    if (phase == 0) {
+        send_points(PROFILE_MAX_CHUNK, 0, 100);
+        phase = 1;
+    } else if (phase == 1 && status.seen) {
+        SIM_CHECK(status.free_slots == PROFILE_MAX_POINTS - PROFILE_MAX_CHUNK, "%u free after one batch",
+                  status.free_slots);
+        free_before = status.free_slots;
+        // The second point goes back in time
+        uint8_t data[1 + 2 * 16];
+        float position[NUM_AXES] = { 0.0f, 0.0f, 0.0f };
+        put_point(&data[1], 5000, position);
+        put_point(&data[17], 4000, position);
+        data[0] = 2;
+        status.seen = false;
+        host_send(CMD_PROFILE_UPLOAD, data, sizeof(data));
+        phase = 2;
+    } else if (phase == 2 && status.seen) {
+        SIM_CHECK(status.free_slots == free_before, "%u free after a batch going back in time", status.free_slots);
+        // Before the last point already there
+        send_points(1, 100, 0);
+        phase = 3;
+    } else if (phase == 3 && status.seen) {
+        SIM_CHECK(status.free_slots == free_before, "%u free after a point before the last one", status.free_slots);
+        send_points(PROFILE_MAX_CHUNK, status.last_time_ms + 100, 100);
+        phase = 4;
+    } else if (phase == 4 && status.seen) {
+        // Fill it up, the batch after that does not fit
+        if (status.free_slots >= PROFILE_MAX_CHUNK) {
+            send_points(PROFILE_MAX_CHUNK, status.last_time_ms + 100, 100);
+            return;
+        }
+        free_before = status.free_slots;
+        send_points(PROFILE_MAX_CHUNK, status.last_time_ms + 100, 100);
+        phase = 5;
+    } else if (phase == 5 && status.seen) {
+        SIM_CHECK(status.free_slots == free_before, "%u free after a batch that does not fit", status.free_slots);
+        control(PROFILE_ACTION_START);
+        start_us = now_us;
+        phase = 6;
+    } else if (phase == 6 && now_us - start_us >= 2 * SIM_S) {
+        SIM_CHECK(stepper_get_mode() == STEPPER_MODE_PROFILE, "profile not running");
+        status.seen = false;
+        control(PROFILE_ACTION_CLEAR);
+        phase = 7;
+    } else if (phase == 7 && status.seen) {
+        SIM_CHECK(!status.active && status.free_slots == PROFILE_MAX_POINTS, "active %d with %u free after the clear",
+                  status.active, status.free_slots);
+        phase = 8;
+    } else if (phase == 8 && !stepper_is_moving()) {
+        phase = 9;
+    }
+}
+
+static void scenario_rejects(void) {
+    sim_boot(false);
+    host_uart_tx_hook = on_uart_tx;
+    sim_core0 = rejects_core0;
+    sim_run(10 * SIM_S);
+    SIM_CHECK(phase == 9, "not done, phase %d", phase);
+}
+
+static const sim_scenario_t scenarios[] = {
+    { "comet", scenario_comet },
+    { "rejects", scenario_rejects },
+};
+
+int main(int argc, char **argv) {
+    return sim_main(argc, argv, scenarios, sizeof(scenarios) / sizeof(scenarios[0]));
+}
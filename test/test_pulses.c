@@ -0,0 +1,182 @@
+// Step output from the axis descriptor table, followed write by write on the GPIO outputs: axes due in the same pass
+// have to step with one register write, direction changes go out before the pulses with the setup time, the second X
+// driver's direction pin is always the inverse of the first, and pins moved in the config are the only ones driven
+
+#include <math.h>
+#include "sim.h"
+#include "CONFIG.h"
+
+#define MOVE_ARCSEC 2000
+
+static int phase = 0;
+static uint64_t phase_start_us;
+
+static void next_phase(uint64_t now_us) {
+    phase++;
+    phase_start_us = now_us;
+}
+
+// ---- The GPIO writes ----
+
+static host_gpio_hook_t sim_gpio_hook;
+static uint32_t step_pins;                  // Masks from the config
+static uint32_t dir_pins;
+static uint32_t driven_pins;                // Every output the step loop may touch
+static uint32_t step_writes;                // Writes raising step pins
+static uint32_t step_writes_all_axes;
+static uint32_t step_and_dir_writes;        // Writes changing a direction pin and raising a step pin at once
+static uint32_t stray_writes;               // Writes touching pins outside driven_pins
+static uint32_t inverted_mismatches;        // Step pulses with the two X direction pins at the same level
+static uint32_t short_setups;               // Step pulses less than the setup time after a direction change
+static uint64_t last_dir_change_us;
+static bool dir_changed;
+
+static void on_gpio(uint32_t before, uint32_t after, uint64_t now_us) {
+    sim_gpio_hook(before, after, now_us);
+    uint32_t changed = before ^ after;
+    uint32_t rising_steps = after & ~before & step_pins;
+    if (changed & ~driven_pins) stray_writes++;
+    if (changed & dir_pins) {
+        dir_changed = true;
+        last_dir_change_us = now_us;
+    }
+    if (!rising_steps) return;
+
+    step_writes++;
+    if (rising_steps == step_pins) step_writes_all_axes++;
+    if (changed & dir_pins) step_and_dir_writes++;
+    if (dir_changed && now_us - last_dir_change_us < device_config.dir_setup_us) short_setups++;
+    dir_changed = false;
+    bool x_dir = (after >> device_config.dir_pin[AXIS_X]) & 1u;
+    bool x_dir_inv = (after >> device_config.x_dir_inv_pin) & 1u;
+    if (x_dir == x_dir_inv) inverted_mismatches++;
+}
+
+static void start(void) {
+    sim_boot(false);
+    step_pins = dir_pins = 0;
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        step_pins |= 1u << device_config.step_pin[axis];
+        dir_pins |= 1u << device_config.dir_pin[axis];
+    }
+    dir_pins |= 1u << device_config.x_dir_inv_pin;
+    driven_pins = step_pins | dir_pins | 1u << device_config.en_pin;
+    sim_gpio_hook = host_gpio_hook;
+    host_gpio_hook = on_gpio;
+}
+
+static float motor_arcsec(uint8_t axis) {
+    return sim_axes[axis].motor_units / stepper_steps_per_arcsec(axis);
+}
+
+static void check_writes(void) {
+    printf("%lu step writes, %lu with a direction change\n", (unsigned long)step_writes,
+           (unsigned long)step_and_dir_writes);
+    SIM_CHECK(step_writes > 0, "no steps");
+    SIM_CHECK(step_and_dir_writes == 0, "%lu writes changed direction and stepped at once",
+              (unsigned long)step_and_dir_writes);
+    SIM_CHECK(short_setups == 0, "%lu pulses inside the direction setup time", (unsigned long)short_setups);
+    SIM_CHECK(inverted_mismatches == 0, "%lu pulses with both X direction pins at one level",
+              (unsigned long)inverted_mismatches);
+    SIM_CHECK(stray_writes == 0, "%lu writes to pins outside the config", (unsigned long)stray_writes);
+}
+
+// ---- Three axes with the same gearing, out and back: every pulse on all three step pins in one write ----
+
+static void together_configure(void) {
+    device_config.gear_ratio[AXIS_Y] = device_config.gear_ratio[AXIS_X];
+    device_config.gear_ratio[AXIS_Z] = device_config.gear_ratio[AXIS_X];
+}
+
+static void move_all(int32_t arcsec) {
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        stepper_queue_static_move(axis, arcsec);
+    }
+}
+
+static void together_core0(uint64_t now_us) {
+    if (phase == 0) {
+        move_all(MOVE_ARCSEC);
+        next_phase(now_us);
+    } else if (phase == 1 && !stepper_is_moving() && stepper_get_mode() == STEPPER_MODE_IDLE) {
+        move_all(0);
+        next_phase(now_us);
+    } else if (phase == 2 && !stepper_is_moving() && stepper_get_mode() == STEPPER_MODE_IDLE) {
+        next_phase(now_us);
+    }
+}
+
+static void scenario_together(void) {
+    sim_configure = together_configure;
+    start();
+    sim_core0 = together_core0;
+    sim_run(10 * SIM_S);
+    SIM_CHECK(phase == 3, "not done, phase %d", phase);
+    printf("%lu of %lu step writes pulse all three axes\n", (unsigned long)step_writes_all_axes,
+           (unsigned long)step_writes);
+    SIM_CHECK(step_writes_all_axes == step_writes, "%lu of %lu step writes pulse all three axes",
+              (unsigned long)step_writes_all_axes, (unsigned long)step_writes);
+    check_writes();
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        SIM_CHECK(sim_axes[axis].motor_units == 0, "axis %d back at %ld units", axis,
+                  (long)sim_axes[axis].motor_units);
+        SIM_CHECK(sim_axes[axis].pulses == sim_axes[AXIS_X].pulses, "axis %d %lu pulses, X %lu", axis,
+                  (unsigned long)sim_axes[axis].pulses, (unsigned long)sim_axes[AXIS_X].pulses);
+        SIM_CHECK(sim_axes[axis].reversals == 1, "axis %d reversed %lu times", axis,
+                  (unsigned long)sim_axes[axis].reversals);
+    }
+}
+
+// ---- Pins moved in the config: the moves come out on them and nothing else is driven ----
+
+static void remap_configure(void) {
+    device_config.step_pin[AXIS_X] = 26;
+    device_config.dir_pin[AXIS_X] = 27;
+    device_config.x_dir_inv_pin = 28;
+    device_config.step_pin[AXIS_Y] = 5;
+    device_config.dir_pin[AXIS_Y] = 6;
+    device_config.step_pin[AXIS_Z] = 7;
+    device_config.dir_pin[AXIS_Z] = 8;
+}
+
+static const int32_t remap_targets[NUM_AXES] = { MOVE_ARCSEC, -2 * MOVE_ARCSEC, 3 * MOVE_ARCSEC };
+
+static void remap_core0(uint64_t now_us) {
+    if (phase == 0) {
+        for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+            stepper_queue_static_move(axis, remap_targets[axis]);
+        }
+        next_phase(now_us);
+    } else if (phase == 1 && !stepper_is_moving() && stepper_get_mode() == STEPPER_MODE_IDLE) {
+        // X back down, both of its direction pins flip
+        stepper_queue_static_move(AXIS_X, -MOVE_ARCSEC);
+        next_phase(now_us);
+    } else if (phase == 2 && !stepper_is_moving() && stepper_get_mode() == STEPPER_MODE_IDLE) {
+        next_phase(now_us);
+    }
+}
+
+static void scenario_remap(void) {
+    sim_configure = remap_configure;
+    start();
+    sim_core0 = remap_core0;
+    sim_run(20 * SIM_S);
+    SIM_CHECK(phase == 3, "not done, phase %d", phase);
+    check_writes();
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        float expected = axis == AXIS_X ? -MOVE_ARCSEC : remap_targets[axis];
+        float pulse_arcsec = sim_pulse_units(axis) / stepper_steps_per_arcsec(axis);
+        SIM_CHECK(fabsf(motor_arcsec(axis) - expected) <= 0.5f * pulse_arcsec + 0.5f, "axis %d at %.1f arcsec, not %.0f",
+                  axis, motor_arcsec(axis), expected);
+        SIM_CHECK(sim_axes[axis].motor_units == stepper_get_position(axis), "axis %d motor off its counter", axis);
+    }
+}
+
+static const sim_scenario_t scenarios[] = {
+    { "together", scenario_together },
+    { "remap", scenario_remap },
+};
+
+int main(int argc, char **argv) {
+    return sim_main(argc, argv, scenarios, sizeof(scenarios) / sizeof(scenarios[0]));
+}
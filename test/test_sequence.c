@@ -0,0 +1,375 @@
+// The exposure/dither sequencer run from a plan sent over the UART, the camera trigger output followed through the
+// GPIO writes. Each exposure has to last its length to the alarm's resolution with the gaps in between, the mount has
+// to sit on the dither position of the frame (the tracking line plus the spiral point) for the whole exposure, the
+// progress events have to count the frames and dithers, and the offset has to be taken back at the end or on abort.
+// A plan that cannot run has to be rejected without the trigger moving
+
+#include <math.h>
+#include <string.h>
+#include "sim.h"
+#include "codec.h"
+#include "CONFIG.h"
+#include "SEQUENCE.h"
+#include "UART.h"
+
+#define TRIGGER_PIN 27
+#define RA_AXIS AXIS_Z                      // The default guide axes
+#define DEC_AXIS AXIS_X
+#define TRACK_RATE 15.0f                    // RA, arcsec/s
+
+static int phase = 0;
+static uint64_t phase_start_us;
+
+static void next_phase(uint64_t now_us) {
+    phase++;
+    phase_start_us = now_us;
+}
+
+// ---- The camera: exposures from the trigger output, where the mount was off the tracking line at both ends ----
+
+#define MAX_EXPOSURES 16
+
+typedef struct {
+    uint64_t start_us;
+    uint64_t end_us;                        // 0 while open
+    float start_offset[2];                  // RA, Dec arcsec off the tracking line
+    float end_offset[2];
+} exposure_t;
+
+static exposure_t exposures[MAX_EXPOSURES];
+static int exposure_count;
+static host_gpio_hook_t sim_gpio_hook;
+static uint64_t tracking_start_us;
+static bool tracking_started;
+
+static float motor_arcsec(uint8_t axis) {
+    return sim_axes[axis].motor_units / stepper_steps_per_arcsec(axis);
+}
+
+static void mount_offset(uint64_t now_us, float offset[2]) {
+    float line = tracking_started ? TRACK_RATE * (now_us - tracking_start_us) / 1e6f : 0.0f;
+    offset[0] = motor_arcsec(RA_AXIS) - line;
+    offset[1] = motor_arcsec(DEC_AXIS);
+}
+
+static void camera_gpio(uint32_t before, uint32_t after, uint64_t now_us) {
+    sim_gpio_hook(before, after, now_us);
+    uint32_t mask = 1u << TRIGGER_PIN;
+    if (!((before ^ after) & mask)) return;
+    bool open = (after & mask) != 0;
+    if (open && exposure_count < MAX_EXPOSURES) {
+        exposure_t *exposure = &exposures[exposure_count++];
+        exposure->start_us = now_us;
+        exposure->end_us = 0;
+        mount_offset(now_us, exposure->start_offset);
+    } else if (!open && exposure_count > 0) {
+        exposure_t *exposure = &exposures[exposure_count - 1];
+        exposure->end_us = now_us;
+        mount_offset(now_us, exposure->end_offset);
+    }
+}
+
+// ---- The host end: plans sent, progress events decoded and ACKed ----
+
+#define MAX_EVENTS 16
+
+typedef struct {
+    uint8_t event;
+    uint8_t phase;
+    uint16_t frames_done;
+    uint16_t frames;
+    uint16_t dithers;
+    float offset[2];
+} sequence_status_t;
+
+static sequence_status_t events[MAX_EVENTS];
+static int event_count;
+static bool ack_due;
+static uint8_t ack_id;
+static int last_message_id = -1;
+
+static void on_uart_tx(const uint8_t *data, size_t length) {
+    uint8_t cmd_type, msg_id, payload[256], payload_length;
+    size_t start = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] != 0) continue;
+        if (codec_unframe(&data[start], i - start, &cmd_type, &msg_id, payload, &payload_length) &&
+            cmd_type != CMD_ACK) {
+            ack_due = true;
+            ack_id = msg_id;
+            if (msg_id != last_message_id && cmd_type == CMD_SEQUENCE_STATUS && payload_length == 16 &&
+                event_count < MAX_EVENTS) {
+                sequence_status_t *status = &events[event_count++];
+                status->event = payload[0];
+                status->phase = payload[1];
+                memcpy(&status->frames_done, &payload[2], sizeof(uint16_t));
+                memcpy(&status->frames, &payload[4], sizeof(uint16_t));
+                memcpy(&status->dithers, &payload[6], sizeof(uint16_t));
+                memcpy(status->offset, &payload[8], sizeof(status->offset));
+            }
+            last_message_id = msg_id;
+        }
+        start = i + 1;
+    }
+}
+
+static void host_send(uint8_t cmd_type, const uint8_t *data, uint8_t length) {
+    static uint8_t next_id = 0;
+    if (++next_id == 0) next_id = 1;
+    uint8_t frame[CODEC_MAX_FRAME];
+    host_uart_receive(frame, codec_frame(frame, cmd_type, next_id, data, length));
+}
+
+// The main loop, as far as the sequencer goes
+static void background(void) {
+    sequence_background_task();
+    uart_background_task();
+    if (ack_due) {
+        ack_due = false;
+        host_send(CMD_ACK, &ack_id, 1);
+    }
+}
+
+typedef struct {
+    uint32_t exposure_ms;
+    uint16_t frames;
+    uint16_t gap_ms;
+    uint8_t pattern;
+    uint8_t every;
+    float amplitude;
+    float rate;
+    uint16_t settle_ms;
+    uint16_t tolerance;                     // 0.01 arcsec
+} plan_t;
+
+static void send_plan(const plan_t *plan) {
+    uint8_t payload[22];
+    memcpy(&payload[0], &plan->exposure_ms, sizeof(uint32_t));
+    memcpy(&payload[4], &plan->frames, sizeof(uint16_t));
+    memcpy(&payload[6], &plan->gap_ms, sizeof(uint16_t));
+    payload[8] = plan->pattern;
+    payload[9] = plan->every;
+    memcpy(&payload[10], &plan->amplitude, sizeof(float));
+    memcpy(&payload[14], &plan->rate, sizeof(float));
+    memcpy(&payload[18], &plan->settle_ms, sizeof(uint16_t));
+    memcpy(&payload[20], &plan->tolerance, sizeof(uint16_t));
+    host_send(CMD_SEQUENCE_START, payload, sizeof(payload));
+}
+
+static void send_action(uint8_t action) {
+    host_send(CMD_SEQUENCE_CONTROL, &action, 1);
+}
+
+// ---- Setup ----
+
+static void configure(void) {
+    device_config.trigger_pin = TRIGGER_PIN;
+    device_config.trigger_active_high = 1;
+}
+
+static void start(void) {
+    sim_configure = configure;
+    sim_boot(false);
+    sim_gpio_hook = host_gpio_hook;
+    host_gpio_hook = camera_gpio;
+    host_uart_tx_hook = on_uart_tx;
+}
+
+static void start_tracking(uint64_t now_us) {
+    float rates[NUM_AXES] = { 0.0f, 0.0f, 0.0f };
+    rates[RA_AXIS] = TRACK_RATE;
+    stepper_start_tracking(rates[AXIS_X], rates[AXIS_Y], rates[AXIS_Z]);
+    tracking_start_us = now_us;
+    tracking_started = true;
+}
+
+static float pulse_arcsec(uint8_t axis) {
+    return sim_pulse_units(axis) / stepper_steps_per_arcsec(axis);
+}
+
+// Walked outwards from the start: (1,0), (1,1), (0,1), (-1,1), (-1,0), ...
+static const int spiral[][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 }, { -1, 1 }, { -1, 0 } };
+
+// The exposure was open for its length and sat on the dither position at both ends. Rate tracking counts whole pulses
+// once they are due, that much off the line either way
+static void check_exposure(int i, uint32_t exposure_ms, float amplitude) {
+    const exposure_t *exposure = &exposures[i];
+    float expected[2] = { spiral[i][0] * amplitude, spiral[i][1] * amplitude };
+    int64_t width_us = (int64_t)(exposure->end_us - exposure->start_us);
+    printf("exposure %d: %.3f ms, RA %+.1f/%+.1f Dec %+.1f/%+.1f arcsec off the line, %+.0f/%+.0f expected\n", i,
+           width_us / 1e3, exposure->start_offset[0], exposure->end_offset[0], exposure->start_offset[1],
+           exposure->end_offset[1], expected[0], expected[1]);
+    SIM_CHECK(exposure->end_us != 0, "exposure %d never ended", i);
+    SIM_CHECK(llabs(width_us - (int64_t)exposure_ms * 1000) <= 20, "exposure %d lasted %lld us", i,
+              (long long)width_us);
+    float tolerance[2] = { pulse_arcsec(RA_AXIS) + 0.5f, pulse_arcsec(DEC_AXIS) + 0.5f };
+    for (int a = 0; a < 2; a++) {
+        SIM_CHECK(fabsf(exposure->start_offset[a] - expected[a]) <= tolerance[a],
+                  "exposure %d started %.1f arcsec off on %s, %.1f expected", i, exposure->start_offset[a],
+                  a == 0 ? "RA" : "Dec", expected[a]);
+        SIM_CHECK(fabsf(exposure->end_offset[a] - expected[a]) <= tolerance[a],
+                  "exposure %d ended %.1f arcsec off on %s, %.1f expected", i, exposure->end_offset[a],
+                  a == 0 ? "RA" : "Dec", expected[a]);
+    }
+}
+
+static void check_back_on_line(uint64_t now_us) {
+    float offset[2];
+    mount_offset(now_us, offset);
+    printf("after the sequence RA %+.1f Dec %+.1f arcsec off the line\n", offset[0], offset[1]);
+    SIM_CHECK(fabsf(offset[0]) <= pulse_arcsec(RA_AXIS) + 0.5f, "RA left %.1f arcsec off the line", offset[0]);
+    SIM_CHECK(fabsf(offset[1]) <= pulse_arcsec(DEC_AXIS) + 0.5f, "Dec left %.1f arcsec off the line", offset[1]);
+}
+
+// ---- Frames without dithers, no tracking needed: the trigger alone ----
+
+static const plan_t plain = { .exposure_ms = 200, .frames = 4, .gap_ms = 300 };
+
+static void plain_core0(uint64_t now_us) {
+    background();
+    uint64_t elapsed = now_us - phase_start_us;
+    if (phase == 0 && elapsed >= 100 * SIM_MS) {
+        send_plan(&plain);
+        next_phase(now_us);
+    } else if (phase == 1 && event_count > 0 && events[event_count - 1].event == SEQUENCE_EVENT_FINISHED) {
+        next_phase(now_us);
+    }
+}
+
+static void scenario_plain(void) {
+    start();
+    sim_core0 = plain_core0;
+    sim_run(5 * SIM_S);
+    SIM_CHECK(phase == 2, "not done, phase %d", phase);
+    SIM_CHECK(exposure_count == plain.frames, "%d exposures for %u frames", exposure_count, plain.frames);
+    for (int i = 0; i < exposure_count; i++) {
+        check_exposure(i, plain.exposure_ms, 0.0f);
+        if (i == 0) continue;
+        // The readout gap goes by in the main loop, a millisecond late at most
+        uint64_t gap_us = exposures[i].start_us - exposures[i - 1].end_us;
+        SIM_CHECK(gap_us >= plain.gap_ms * SIM_MS && gap_us <= (plain.gap_ms + 2) * SIM_MS, "gap %d was %lu us", i,
+                  (unsigned long)gap_us);
+    }
+    // A frame event after each frame but the last, which is the finish
+    SIM_CHECK(event_count == plain.frames, "%d events", event_count);
+    for (int i = 0; i < event_count; i++) {
+        uint8_t expected = i + 1 < plain.frames ? SEQUENCE_EVENT_FRAME_DONE : SEQUENCE_EVENT_FINISHED;
+        SIM_CHECK(events[i].event == expected, "event %d is %u", i, events[i].event);
+        SIM_CHECK(events[i].frames_done == i + 1 && events[i].frames == plain.frames, "event %d: %u of %u frames", i,
+                  events[i].frames_done, events[i].frames);
+        SIM_CHECK(events[i].dithers == 0, "event %d: %u dithers", i, events[i].dithers);
+    }
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        SIM_CHECK(sim_axes[axis].pulses == 0, "axis %d moved %lu pulses", axis, (unsigned long)sim_axes[axis].pulses);
+    }
+}
+
+// ---- A spiral dither before every frame while RA tracks: on the spiral point for each exposure, back at the end ----
+
+#define DITHER_ARCSEC 12.0f
+
+static const plan_t spiral_plan = { .exposure_ms = 500, .frames = 5, .gap_ms = 200, .pattern = SEQUENCE_DITHER_SPIRAL,
+                                    .every = 1, .amplitude = DITHER_ARCSEC, .rate = 30.0f, .settle_ms = 800,
+                                    .tolerance = 0 };
+
+static void dither_core0(uint64_t now_us) {
+    background();
+    uint64_t elapsed = now_us - phase_start_us;
+    if (phase == 0) {
+        start_tracking(now_us);
+        next_phase(now_us);
+    } else if (phase == 1 && elapsed >= 1 * SIM_S) {
+        send_plan(&spiral_plan);
+        next_phase(now_us);
+    } else if (phase == 2 && event_count > 0 && events[event_count - 1].event == SEQUENCE_EVENT_FINISHED) {
+        next_phase(now_us);
+    } else if (phase == 3 && elapsed >= 2 * SIM_S) {
+        check_back_on_line(now_us);
+        next_phase(now_us);
+    }
+}
+
+static void scenario_dither(void) {
+    start();
+    sim_core0 = dither_core0;
+    sim_run(30 * SIM_S);
+    SIM_CHECK(phase == 4, "not done, phase %d", phase);
+    SIM_CHECK(exposure_count == spiral_plan.frames, "%d exposures for %u frames", exposure_count, spiral_plan.frames);
+    for (int i = 0; i < exposure_count; i++) {
+        check_exposure(i, spiral_plan.exposure_ms, DITHER_ARCSEC);
+        // Dithered and settled before it opens
+        if (i > 0) {
+            uint64_t gap_us = exposures[i].start_us - exposures[i - 1].end_us;
+            uint64_t shortest_us = (spiral_plan.gap_ms + spiral_plan.settle_ms) * SIM_MS;
+            SIM_CHECK(gap_us >= shortest_us, "exposure %d opened %lu us after the last", i, (unsigned long)gap_us);
+        }
+    }
+    // The offsets reported are the spiral point of the frame just taken, zero once finished
+    SIM_CHECK(event_count == spiral_plan.frames, "%d events", event_count);
+    for (int i = 0; i < event_count; i++) {
+        bool last = i + 1 == spiral_plan.frames;
+        SIM_CHECK(events[i].dithers == i, "event %d: %u dithers", i, events[i].dithers);
+        float expected[2] = { last ? 0.0f : spiral[i][0] * DITHER_ARCSEC, last ? 0.0f : spiral[i][1] * DITHER_ARCSEC };
+        SIM_CHECK(events[i].offset[0] == expected[0] && events[i].offset[1] == expected[1],
+                  "event %d reports %.1f/%.1f arcsec", i, events[i].offset[0], events[i].offset[1]);
+    }
+    SIM_CHECK(stepper_get_mode() == STEPPER_MODE_TRACKING, "tracking stopped, mode %d", stepper_get_mode());
+}
+
+// ---- Rejected without tracking, then aborted part way through the second exposure ----
+
+static uint64_t abort_us;
+
+static void abort_core0(uint64_t now_us) {
+    background();
+    uint64_t elapsed = now_us - phase_start_us;
+    if (phase == 0 && elapsed >= 100 * SIM_MS) {
+        // Dithers need a tracking mode to ride on
+        send_plan(&spiral_plan);
+        next_phase(now_us);
+    } else if (phase == 1 && event_count > 0) {
+        SIM_CHECK(events[0].event == SEQUENCE_EVENT_REJECTED, "event %u for a plan without tracking", events[0].event);
+        SIM_CHECK(exposure_count == 0, "the trigger moved for a rejected plan");
+        start_tracking(now_us);
+        send_plan(&spiral_plan);
+        next_phase(now_us);
+    } else if (phase == 2 && exposure_count == 2 && now_us - exposures[1].start_us >= 100 * SIM_MS) {
+        abort_us = now_us;
+        send_action(SEQUENCE_ACTION_ABORT);
+        next_phase(now_us);
+    } else if (phase == 3 && elapsed >= 2 * SIM_S) {
+        check_back_on_line(now_us);
+        next_phase(now_us);
+    }
+}
+
+static void scenario_abort(void) {
+    start();
+    sim_core0 = abort_core0;
+    sim_run(20 * SIM_S);
+    SIM_CHECK(phase == 4, "not done, phase %d", phase);
+    SIM_CHECK(exposure_count == 2, "%d exposures", exposure_count);
+    check_exposure(0, spiral_plan.exposure_ms, DITHER_ARCSEC);
+    // Closed as soon as the abort came in
+    uint64_t closed_us = exposures[1].end_us - abort_us;
+    printf("closed %lu us after the abort was sent\n", (unsigned long)closed_us);
+    SIM_CHECK(exposures[1].end_us > abort_us && closed_us <= 5 * SIM_MS, "closed %lu us after the abort",
+              (unsigned long)closed_us);
+    SIM_CHECK(event_count == 3, "%d events", event_count);
+    const sequence_status_t *aborted = &events[event_count - 1];
+    SIM_CHECK(aborted->event == SEQUENCE_EVENT_ABORTED, "last event %u", aborted->event);
+    SIM_CHECK(aborted->frames_done == 1 && aborted->dithers == 1, "aborted after %u frames, %u dithers",
+              aborted->frames_done, aborted->dithers);
+    SIM_CHECK(aborted->offset[0] == 0.0f && aborted->offset[1] == 0.0f, "aborted at %.1f/%.1f arcsec",
+              aborted->offset[0], aborted->offset[1]);
+}
+
+static const sim_scenario_t scenarios[] = {
+    { "plain", scenario_plain },
+    { "dither", scenario_dither },
+    { "abort", scenario_abort },
+};
+
+int main(int argc, char **argv) {
+    return sim_main(argc, argv, scenarios, sizeof(scenarios) / sizeof(scenarios[0]));
+}
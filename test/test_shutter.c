@@ -0,0 +1,322 @@
+// Shutter and flash-sync capture from simulated edges on the sync input. The edges land between the core 0 calls and
+// between step pulses while the axes track; each CMD_SHUTTER_EVENT has to carry the edge's time and where the axes
+// really were, the position between the two pulses around it, in order with the start and end flags alternating.
+// A burst the ring cannot hold has to be reported as dropped rather than lost without a word
+
+#include <math.h>
+#include <string.h>
+#include "sim.h"
+#include "codec.h"
+#include "CONFIG.h"
+#include "SHUTTER.h"
+#include "ASTRO.h"
+#include "UART.h"
+
+#define SYNC_PIN 26
+
+static int phase = 0;
+static uint64_t phase_start_us;
+
+static void next_phase(uint64_t now_us) {
+    phase++;
+    phase_start_us = now_us;
+}
+
+// ---- Edges on the sync input, and where the motors were at each ----
+
+#define MAX_EDGES 64
+
+typedef struct {
+    uint64_t time_us;
+    bool resolved[NUM_AXES];                // The pulse after the edge has gone out
+    int32_t last_units[NUM_AXES];           // Motor and its last pulse before the edge
+    uint64_t last_pulse_us[NUM_AXES];
+    double true_units[NUM_AXES];            // Between the two pulses by the time, the motor at rest without a next one
+} edge_t;
+
+static edge_t edges[MAX_EDGES];
+static int edge_count;
+static uint64_t last_pulse_us[NUM_AXES];
+static host_tick_hook_t sim_tick_hook;
+static uint64_t next_edge_us;               // 0 for none due
+static bool next_level;
+static bool active_high;
+
+static void edge(uint64_t now_us, bool level) {
+    edge_t *e = &edges[edge_count++];
+    e->time_us = now_us;
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        e->last_units[axis] = sim_axes[axis].motor_units;
+        e->last_pulse_us[axis] = last_pulse_us[axis];
+        e->true_units[axis] = sim_axes[axis].motor_units;
+    }
+    host_gpio_set_input(SYNC_PIN, level);
+    host_gpio_irq(SYNC_PIN, level ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL);
+}
+
+static void count_pulse(uint8_t axis, bool direction, uint64_t now_us) {
+    int32_t pulse = sim_pulse_units(axis);
+    for (int i = 0; i < edge_count; i++) {
+        edge_t *e = &edges[i];
+        if (e->resolved[axis] || now_us <= e->time_us) continue;
+        e->resolved[axis] = true;
+        double fraction = (double)(e->time_us - e->last_pulse_us[axis]) / (now_us - e->last_pulse_us[axis]);
+        e->true_units[axis] = e->last_units[axis] + (direction ? pulse : -pulse) * fraction;
+    }
+    last_pulse_us[axis] = now_us;
+}
+
+// Latched in the interrupt, the host clock moves on by a µs with every read
+static bool at_edge(int64_t time_us, const edge_t *e) {
+    return time_us >= (int64_t)e->time_us && time_us <= (int64_t)e->time_us + 1;
+}
+
+static void edge_tick(uint64_t now_us) {
+    sim_tick_hook(now_us);
+    if (!next_edge_us || now_us < next_edge_us) return;
+    next_edge_us = 0;
+    edge(now_us, next_level);
+}
+
+// ---- The host end: events decoded and ACKed ----
+
+typedef struct {
+    uint16_t sequence;
+    uint8_t flags;
+    uint8_t dropped;
+    int64_t time_us;
+    int32_t hundredths[NUM_AXES];
+} event_t;
+
+static event_t events[MAX_EDGES];
+static int event_count;
+static int duplicates;
+static bool ack_due;
+static uint8_t ack_id;
+static int last_message_id = -1;
+
+static void on_uart_tx(const uint8_t *data, size_t length) {
+    uint8_t cmd_type, msg_id, payload[256], payload_length;
+    size_t start = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] != 0) continue;
+        if (codec_unframe(&data[start], i - start, &cmd_type, &msg_id, payload, &payload_length) &&
+            cmd_type != CMD_ACK) {
+            ack_due = true;
+            ack_id = msg_id;
+            if (msg_id == last_message_id) {
+                duplicates++;
+            } else if (cmd_type == CMD_SHUTTER_EVENT && payload_length == 24 && event_count < MAX_EDGES) {
+                event_t *event = &events[event_count++];
+                memcpy(&event->sequence, &payload[0], sizeof(uint16_t));
+                event->flags = payload[2];
+                event->dropped = payload[3];
+                memcpy(&event->time_us, &payload[4], sizeof(int64_t));
+                memcpy(event->hundredths, &payload[12], sizeof(event->hundredths));
+            }
+            last_message_id = msg_id;
+        }
+        start = i + 1;
+    }
+}
+
+// The main loop, as far as the events go
+static void background(void) {
+    shutter_background_task();
+    uart_background_task();
+    if (ack_due) {
+        ack_due = false;
+        static uint8_t next_id = 0;
+        if (++next_id == 0) next_id = 1;
+        uint8_t frame[CODEC_MAX_FRAME];
+        host_uart_receive(frame, codec_frame(frame, CMD_ACK, next_id, &ack_id, 1));
+    }
+}
+
+// ---- Setup ----
+
+static void configure(void) {
+    device_config.shutter_pin = SYNC_PIN;
+    device_config.shutter_active_high = active_high ? 1 : 0;
+}
+
+static void start(bool high) {
+    active_high = high;
+    // Idle at the inactive level before the pull is set
+    host_gpio_set_input(SYNC_PIN, !high);
+    next_level = high;
+    sim_configure = configure;
+    sim_boot(false);
+    sim_step = count_pulse;
+    sim_tick_hook = host_tick_hook;
+    host_tick_hook = edge_tick;
+    host_uart_tx_hook = on_uart_tx;
+}
+
+// ---- Exposures while tracking, odd times between pulses and core 0 calls. The clock is set half way ----
+
+#define EXPOSURES 8
+#define EXPOSURE_MS 150
+#define GAP_MS 100
+#define X_RATE 150.0f
+#define Y_RATE -40.0f
+#define UNIX_MS 1760000000000ll
+
+static uint64_t clock_set_us;
+
+static void exposures_core0(uint64_t now_us) {
+    background();
+    uint64_t elapsed = now_us - phase_start_us;
+    if (phase == 0) {
+        stepper_start_tracking(X_RATE, Y_RATE, 0.0f);
+        next_phase(now_us);
+    } else if (phase == 1 && elapsed >= 500 * SIM_MS && !next_edge_us) {
+        if (edge_count == EXPOSURES) {
+            astro_set_unix_time(UNIX_MS);
+            clock_set_us = now_us;
+        }
+        if (edge_count == 2 * EXPOSURES) {
+            next_phase(now_us);
+            return;
+        }
+        // Starts after the gap, ends after the exposure, each a few hundred µs off the millisecond
+        bool starting = edge_count % 2 == 0;
+        next_edge_us = now_us + (starting ? GAP_MS : EXPOSURE_MS) * SIM_MS + 137 + 61 * edge_count;
+        next_level = starting == active_high;
+    } else if (phase == 2 && elapsed >= 500 * SIM_MS) {
+        next_phase(now_us);
+    }
+}
+
+static void scenario_exposures(void) {
+    start(true);
+    sim_core0 = exposures_core0;
+    sim_run(10 * SIM_S);
+    SIM_CHECK(phase == 3, "not done, phase %d", phase);
+    SIM_CHECK(event_count == edge_count, "%d events for %d edges", event_count, edge_count);
+
+    double worst_pulses = 0.0;
+    int64_t unix_offset_us = 0;
+    for (int i = 0; i < event_count && i < edge_count; i++) {
+        const event_t *event = &events[i];
+        const edge_t *e = &edges[i];
+        SIM_CHECK(event->sequence == i, "event %d has sequence %u", i, event->sequence);
+        SIM_CHECK(event->dropped == 0, "event %d: %u dropped", i, event->dropped);
+        bool starting = (event->flags & SHUTTER_FLAG_START) != 0;
+        SIM_CHECK(starting == (i % 2 == 0), "event %d is %s", i, starting ? "a start" : "an end");
+
+        // Boot time before the clock is set, unix time after, the same offset for all of those
+        bool unix_time = (event->flags & SHUTTER_FLAG_UNIX_TIME) != 0;
+        SIM_CHECK(unix_time == (i >= EXPOSURES), "event %d %s unix time", i, unix_time ? "in" : "not in");
+        if (!unix_time) {
+            SIM_CHECK(at_edge(event->time_us, e), "event %d at %lld us, the edge at %llu", i,
+                      (long long)event->time_us, (unsigned long long)e->time_us);
+        } else {
+            int64_t offset_us = event->time_us - (int64_t)e->time_us;
+            if (i == EXPOSURES) unix_offset_us = offset_us;
+            SIM_CHECK(offset_us == unix_offset_us, "event %d off the clock by %lld us", i,
+                      (long long)(offset_us - unix_offset_us));
+        }
+
+        for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+            double reported = event->hundredths[axis] / 100.0;
+            double truth = e->true_units[axis] / stepper_steps_per_arcsec(axis);
+            double pulses = fabs(reported - truth) * stepper_steps_per_arcsec(axis) / sim_pulse_units(axis);
+            if (pulses > worst_pulses) worst_pulses = pulses;
+        }
+    }
+    // The clock set in milliseconds against a boot time in µs
+    int64_t expected_offset_us = UNIX_MS * 1000 - (int64_t)clock_set_us;
+    printf("%d events, positions up to %.3f pulses off the motor, unix offset %lld us off\n", event_count, worst_pulses,
+           (long long)(unix_offset_us - expected_offset_us));
+    SIM_CHECK(llabs(unix_offset_us - expected_offset_us) < 1000, "unix time %lld us off",
+              (long long)(unix_offset_us - expected_offset_us));
+    // Between the pulses, not the last one: a step counter alone is up to a pulse behind
+    SIM_CHECK(worst_pulses <= 0.1, "a position %.3f pulses off the motor", worst_pulses);
+    SIM_CHECK(duplicates == 0, "%d events sent twice", duplicates);
+}
+
+// ---- A burst of short pulses in one millisecond, active low: the ring overflows ----
+
+#define BURST_EDGES 40
+
+static void burst_core0(uint64_t now_us) {
+    background();
+    if (phase == 0 && now_us - phase_start_us >= 100 * SIM_MS) {
+        // An edge every 20 µs, nothing goes out before core 0 comes back
+        for (int i = 0; i < BURST_EDGES; i++) {
+            host_advance_us(20);
+            edge(time_us_64(), i % 2 != 0);
+        }
+        next_phase(now_us);
+    } else if (phase == 1 && now_us - phase_start_us >= 2 * SIM_S) {
+        next_phase(now_us);
+    }
+}
+
+static void scenario_burst(void) {
+    start(false);
+    sim_core0 = burst_core0;
+    sim_run(3 * SIM_S);
+    SIM_CHECK(phase == 2, "not done, phase %d", phase);
+    int dropped = 0;
+    for (int i = 0; i < event_count; i++) {
+        dropped += events[i].dropped;
+        SIM_CHECK(events[i].sequence == i, "event %d has sequence %u", i, events[i].sequence);
+    }
+    printf("%d events sent, %d reported dropped, for %d edges\n", event_count, dropped, BURST_EDGES);
+    // One slot of the ring stays empty
+    SIM_CHECK(event_count == SHUTTER_MAX_EVENTS - 1, "%d events sent", event_count);
+    SIM_CHECK(event_count + dropped == BURST_EDGES, "%d sent and %d dropped for %d edges", event_count, dropped,
+              BURST_EDGES);
+    // The ring keeps the first edges, the level alternating from a start
+    for (int i = 0; i < event_count; i++) {
+        bool starting = (events[i].flags & SHUTTER_FLAG_START) != 0;
+        SIM_CHECK(starting == (i % 2 == 0), "event %d is %s", i, starting ? "a start" : "an end");
+        SIM_CHECK(at_edge(events[i].time_us, &edges[i]), "event %d at %lld us, the edge at %llu", i,
+                  (long long)events[i].time_us, (unsigned long long)edges[i].time_us);
+    }
+}
+
+// ---- Pulses shorter than the interrupt takes to come in: both edges pending, the level says where it ended ----
+
+static void both_edges(bool level) {
+    host_gpio_set_input(SYNC_PIN, level);
+    host_gpio_irq(SYNC_PIN, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL);
+}
+
+static void short_core0(uint64_t now_us) {
+    background();
+    uint64_t elapsed = now_us - phase_start_us;
+    if (phase == 0 && elapsed >= 100 * SIM_MS) {
+        // A flash back at the idle level
+        both_edges(false);
+        next_phase(now_us);
+    } else if (phase == 1 && elapsed >= 100 * SIM_MS) {
+        // A glitch at the start of an exposure, it stays open
+        both_edges(true);
+        next_phase(now_us);
+    } else if (phase == 2 && elapsed >= 100 * SIM_MS) {
+        next_phase(now_us);
+    }
+}
+
+static void scenario_short(void) {
+    start(true);
+    sim_core0 = short_core0;
+    sim_run(1 * SIM_S);
+    SIM_CHECK(phase == 3, "not done, phase %d", phase);
+    SIM_CHECK(event_count == 2, "%d events for two pulses", event_count);
+    SIM_CHECK(!(events[0].flags & SHUTTER_FLAG_START), "a pulse back at the idle level taken for a start");
+    SIM_CHECK(events[1].flags & SHUTTER_FLAG_START, "a pulse left at the active level taken for an end");
+}
+
+static const sim_scenario_t scenarios[] = {
+    { "exposures", scenario_exposures },
+    { "burst", scenario_burst },
+    { "short", scenario_short },
+};
+
+int main(int argc, char **argv) {
+    return sim_main(argc, argv, scenarios, sizeof(scenarios) / sizeof(scenarios[0]));
+}
@@ -0,0 +1,181 @@
+// Step loop with the motion planner: moves, ramped pause, resume and stop, rate tracking.
+// Every step edge goes through the acceleration check in sim.c, the motor has to end up where the counters say
+
+#include <math.h>
+#include "sim.h"
+#include "CONFIG.h"
+
+static int phase = 0;
+
+static void check_motors_match_counters(void) {
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        SIM_CHECK(sim_axes[axis].motor_units == stepper_get_position(axis),
+                  "axis %d motor at %ld units, counter at %ld", axis,
+                  (long)sim_axes[axis].motor_units, (long)stepper_get_position(axis));
+    }
+}
+
+static void check_at_arcsec(uint8_t axis, int32_t arcsec) {
+    int32_t target = (int32_t)lroundf(arcsec * stepper_steps_per_arcsec(axis));
+    int32_t half_step = POSITION_MICROSTEPS / device_config.microstepping / 2;
+    int32_t off = stepper_get_position(axis) - target;
+    SIM_CHECK(off <= half_step && off >= -half_step, "axis %d %ld units off its target", axis, (long)off);
+}
+
+// ---- Move out at full speed and back ----
+
+static void move_core0(uint64_t now_us) {
+    if (phase == 0) {
+        stepper_queue_static_move(AXIS_X, 20000);
+        stepper_queue_static_move(AXIS_Y, -5000);
+        stepper_queue_static_move(AXIS_Z, 300);
+        phase = 1;
+    } else if (phase == 1 && !stepper_is_moving()) {
+        for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+            stepper_queue_static_move(axis, 0);
+        }
+        phase = 2;
+    } else if (phase == 2 && !stepper_is_moving()) {
+        phase = 3;
+    }
+}
+
+static void scenario_move(void) {
+    sim_boot(false);
+    sim_core0 = move_core0;
+    sim_run(12 * SIM_S);
+    SIM_CHECK(phase == 3, "moves not done, phase %d", phase);
+    SIM_CHECK(sim_axes[AXIS_X].reversals == 1, "X reversed %lu times", (unsigned long)sim_axes[AXIS_X].reversals);
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        check_at_arcsec(axis, 0);
+    }
+    check_motors_match_counters();
+}
+
+// ---- Pause at cruise speed, resume, finish the move ----
+
+static void pause_resume_core0(uint64_t now_us) {
+    if (phase == 0) {
+        stepper_queue_static_move(AXIS_X, 30000);
+        stepper_queue_static_move(AXIS_Z, -30000);
+        phase = 1;
+    } else if (phase == 1 && now_us >= 1500 * SIM_MS) {
+        stepper_pause();
+        SIM_CHECK(!stepper_is_paused(), "pause at speed was not ramped");
+        phase = 2;
+    } else if (phase == 2 && stepper_is_paused()) {
+        SIM_CHECK(stepper_get_mode() == STEPPER_MODE_STATIC, "the move was forgotten by the pause");
+        phase = 3;
+    } else if (phase == 3 && now_us >= 3 * SIM_S) {
+        stepper_resume();
+        phase = 4;
+    } else if (phase == 4 && !stepper_is_moving()) {
+        phase = 5;
+    }
+}
+
+static void scenario_pause_resume(void) {
+    sim_boot(false);
+    sim_core0 = pause_resume_core0;
+    sim_run(10 * SIM_S);
+    SIM_CHECK(phase == 5, "pause and resume not done, phase %d", phase);
+    check_at_arcsec(AXIS_X, 30000);
+    check_at_arcsec(AXIS_Z, -30000);
+    check_motors_match_counters();
+}
+
+// ---- Stop at cruise speed: ramp down, then the drivers are disabled ----
+
+static void stop_core0(uint64_t now_us) {
+    if (phase == 0) {
+        stepper_queue_static_move(AXIS_Y, 40000);
+        phase = 1;
+    } else if (phase == 1 && now_us >= 2 * SIM_S) {
+        stepper_stop();
+        SIM_CHECK(stepper_is_enabled(), "stop at speed was not ramped");
+        phase = 2;
+    } else if (phase == 2 && !stepper_is_enabled()) {
+        phase = 3;
+    }
+}
+
+static void scenario_stop(void) {
+    sim_boot(false);
+    sim_core0 = stop_core0;
+    sim_run(5 * SIM_S);
+    SIM_CHECK(phase == 3, "stop did not disable the drivers, phase %d", phase);
+    SIM_CHECK(stepper_get_mode() == STEPPER_MODE_IDLE, "stop left a motion mode");
+    check_motors_match_counters();
+}
+
+// ---- Rate tracking near the step rate limit, paused and resumed ----
+
+static int32_t tracking_mark_units;
+
+static void tracking_core0(uint64_t now_us) {
+    if (phase == 0) {
+        stepper_start_tracking(6000.0f, -3000.0f, 15.0f);
+        phase = 1;
+    } else if (phase == 1 && now_us >= 2 * SIM_S) {
+        stepper_pause();
+        phase = 2;
+    } else if (phase == 2 && stepper_is_paused()) {
+        phase = 3;
+    } else if (phase == 3 && now_us >= 3 * SIM_S) {
+        stepper_resume();
+        phase = 4;
+    } else if (phase == 4 && now_us >= 5 * SIM_S) {
+        stepper_start_tracking(-6000.0f, 0.0f, 15.0f);
+        phase = 5;
+    } else if (phase == 5 && now_us >= 6500 * SIM_MS) {
+        tracking_mark_units = sim_axes[AXIS_X].motor_units;
+        phase = 6;
+    }
+}
+
+static void scenario_tracking(void) {
+    sim_boot(false);
+    sim_core0 = tracking_core0;
+    sim_run(7 * SIM_S);
+    SIM_CHECK(phase == 6, "tracking pause and resume not done, phase %d", phase);
+    SIM_CHECK(sim_axes[AXIS_X].reversals == 1, "X reversed %lu times", (unsigned long)sim_axes[AXIS_X].reversals);
+    // At the full rate again after the reversal
+    float rate = (sim_axes[AXIS_X].motor_units - tracking_mark_units) / 0.5f / stepper_steps_per_arcsec(AXIS_X);
+    SIM_CHECK(fabsf(rate + 6000.0f) < 120.0f, "X tracks at %.0f arcsec/s instead of -6000", rate);
+    check_motors_match_counters();
+}
+
+// ---- The checker itself: a hard pause at cruise speed has to show up ----
+
+static void hard_pause_core0(uint64_t now_us) {
+    if (phase == 0) {
+        stepper_queue_static_move(AXIS_X, 30000);
+        phase = 1;
+    } else if (phase == 1 && now_us >= 1500 * SIM_MS) {
+        stepper_hard_pause();
+        phase = 2;
+    }
+}
+
+static void scenario_hard_pause(void) {
+    sim_boot(false);
+    sim_core0 = hard_pause_core0;
+    sim_run(3 * SIM_S);
+    int caught = sim_failures;
+    sim_failures = 0;
+    SIM_CHECK(phase == 2, "hard pause not reached, phase %d", phase);
+    SIM_CHECK(caught > 0, "stopping from cruise speed within a step went through the acceleration check");
+    check_motors_match_counters();
+}
+
+static const sim_scenario_t scenarios[] = {
+    { "move", scenario_move },
+    { "pause_resume", scenario_pause_resume },
+    { "stop", scenario_stop },
+    { "tracking", scenario_tracking },
+    { "hard_pause", scenario_hard_pause },
+};
+
+int main(int argc, char **argv) {
+    return sim_main(argc, argv, scenarios, sizeof(scenarios) / sizeof(scenarios[0]));
+}
@@ -0,0 +1,301 @@
+// TMC2209 register driver against the register map model: boot configuration verified through the interface
+// counter, the fallback to the strapping when a driver does not take its writes, core 1's microstep switches by DMA
+// while the step loop runs, and the bus flag that keeps core 1 off the wire while core 0 has it
+
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "tmc_model.h"
+#include "CONFIG.h"
+#include "TMC2209.h"
+#include "PEC.h"
+
+static int phase = 0;
+
+static void check_motors_match_counters(void) {
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        SIM_CHECK(sim_axes[axis].motor_units == stepper_get_position(axis),
+                  "axis %d motor at %ld units, counter at %ld", axis,
+                  (long)sim_axes[axis].motor_units, (long)stepper_get_position(axis));
+    }
+}
+
+static void check_bus_clean(void) {
+    SIM_CHECK(tmc_model_bad_datagrams == 0, "%lu bad datagrams on the wire", (unsigned long)tmc_model_bad_datagrams);
+    SIM_CHECK(tmc_model_steps_while_switching == 0, "%lu pulses while CHOPCONF was on the wire",
+              (unsigned long)tmc_model_steps_while_switching);
+    for (uint8_t address = 0; address < TMC_MODEL_DRIVERS; address++) {
+        SIM_CHECK(tmc_model_drivers[address].misaligned_steps == 0, "driver %d made %lu short steps", address,
+                  (unsigned long)tmc_model_drivers[address].misaligned_steps);
+    }
+}
+
+// ---- Boot: every driver configured and every write counted by the driver ----
+
+static void scenario_configure(void) {
+    tmc_model_install();
+    sim_boot(true);
+    SIM_CHECK(tmc2209_is_enabled(), "drivers not in use");
+    uint32_t ihold_irun = (device_config.hold_current & 0x1F) | ((uint32_t)(device_config.run_current & 0x1F) << 8) |
+                          ((uint32_t)TMC2209_IHOLDDELAY << 16);
+    for (uint8_t address = 0; address < TMC_MODEL_DRIVERS; address++) {
+        const tmc_model_driver_t *driver = &tmc_model_drivers[address];
+        SIM_CHECK(driver->ifcnt == 3, "driver %d counted %d writes", address, driver->ifcnt);
+        SIM_CHECK(driver->registers[TMC2209_REG_GCONF] == TMC2209_GCONF_DEFAULT, "driver %d GCONF %08lx", address,
+                  (unsigned long)driver->registers[TMC2209_REG_GCONF]);
+        SIM_CHECK(driver->registers[TMC2209_REG_IHOLD_IRUN] == ihold_irun, "driver %d IHOLD_IRUN %08lx", address,
+                  (unsigned long)driver->registers[TMC2209_REG_IHOLD_IRUN]);
+        SIM_CHECK(tmc_model_microsteps(address) == device_config.microstepping, "driver %d at %d microsteps",
+                  address, tmc_model_microsteps(address));
+    }
+
+    // Diagnostics come back through the read path
+    tmc_model_drivers[device_config.tmc2209_address[AXIS_Y]].registers[TMC2209_REG_SG_RESULT] = 123;
+    tmc_model_drivers[device_config.tmc2209_address[AXIS_Y]].registers[TMC2209_REG_DRV_STATUS] = 0x80000C0Du;
+    tmc2209_status_t status;
+    SIM_CHECK(tmc2209_read_status(AXIS_Y, &status), "status read failed");
+    SIM_CHECK(status.sg_result == 123 && status.drv_status == 0x80000C0Du && status.microstepping == 16,
+              "status %u %08lx %u", status.sg_result, (unsigned long)status.drv_status, status.microstepping);
+    check_bus_clean();
+}
+
+// ---- A driver that does not take its writes or does not answer: the strapping stays in charge ----
+
+static void check_fallback(void) {
+    SIM_CHECK(!tmc2209_is_enabled(), "drivers in use although one failed");
+    uint32_t done;
+    SIM_CHECK(!tmc2209_try_set_microstepping(AXIS_Y, 256, &done), "microstep switch without working drivers");
+
+    // Moves run on the boot resolution, which is what the strapping gives
+    stepper_queue_static_move(AXIS_Y, 2000);
+    sim_run(3 * SIM_S);
+    SIM_CHECK(!stepper_is_moving(), "move not done");
+    check_motors_match_counters();
+}
+
+static void scenario_lost_write(void) {
+    tmc_model_install();
+    tmc_model_drivers[TMC2209_ADDRESS_X2].drop_writes = true;
+    sim_boot(true);
+    check_fallback();
+}
+
+static void scenario_missing_driver(void) {
+    tmc_model_install();
+    tmc_model_drivers[TMC2209_ADDRESS_Z].present = false;
+    sim_boot(true);
+    check_fallback();
+}
+
+// ---- Core 1 wants the bus while core 0 is in the middle of a transaction ----
+
+static uint32_t attempts = 0;
+static uint32_t taken = 0;
+
+static void switch_from_core1(void) {
+    uint32_t done;
+    attempts++;
+    if (tmc2209_try_set_microstepping(AXIS_Y, 256, &done)) taken++;
+}
+
+static void scenario_bus_busy(void) {
+    tmc_model_install();
+    sim_boot(true);
+    tmc_model_driver_t *y = &tmc_model_drivers[TMC2209_ADDRESS_Y];
+    uint32_t chopconf_writes = y->writes[TMC2209_REG_CHOPCONF];
+
+    // Every datagram core 0 puts on the wire, the write and the two reads of the status, is one core 1 must not get into
+    tmc_model_on_datagram = switch_from_core1;
+    tmc2209_set_current(AXIS_Y, 20, 10);
+    tmc2209_status_t status;
+    tmc2209_read_status(AXIS_Y, &status);
+    tmc_model_on_datagram = NULL;
+    SIM_CHECK(attempts == 3 && taken == 0, "core 1 got the bus %lu of %lu times", (unsigned long)taken,
+              (unsigned long)attempts);
+    SIM_CHECK(status.ok, "status read disturbed");
+    SIM_CHECK(y->writes[TMC2209_REG_CHOPCONF] == chopconf_writes, "CHOPCONF written while the bus was taken");
+
+    // With the bus free the switch goes out by DMA, a blocking write right behind it waits for the wire
+    uint32_t done;
+    uint64_t started_us = sim_now();
+    SIM_CHECK(tmc2209_try_set_microstepping(AXIS_X, 256, &done), "free bus refused");
+    tmc2209_set_current(AXIS_X, 18, 9);
+    for (int i = 0; i < 2; i++) {
+        tmc_model_driver_t *x = &tmc_model_drivers[i == 0 ? TMC2209_ADDRESS_X : TMC2209_ADDRESS_X2];
+        SIM_CHECK(x->writes[TMC2209_REG_CHOPCONF] == 2 && x->writes[TMC2209_REG_IHOLD_IRUN] == 2,
+                  "X driver %d got %lu CHOPCONF and %lu IHOLD_IRUN writes", i,
+                  (unsigned long)x->writes[TMC2209_REG_CHOPCONF], (unsigned long)x->writes[TMC2209_REG_IHOLD_IRUN]);
+        // The step loop waits until done, by then the driver has to have the new resolution
+        SIM_CHECK(x->chopconf_at_us <= started_us + (uint32_t)(done - (uint32_t)started_us),
+                  "X driver %d switches %ld us after the firmware steps again", i,
+                  (long)(x->chopconf_at_us - started_us) - (long)(uint32_t)(done - (uint32_t)started_us));
+    }
+    sim_run(sim_now() + 10 * SIM_MS);
+    SIM_CHECK(tmc_model_microsteps(TMC2209_ADDRESS_X) == 256 && tmc_model_microsteps(TMC2209_ADDRESS_X2) == 256,
+              "X drivers at %d and %d microsteps", tmc_model_microsteps(TMC2209_ADDRESS_X),
+              tmc_model_microsteps(TMC2209_ADDRESS_X2));
+    check_bus_clean();
+}
+
+// ---- Moves with the resolution switched by core 1 on the way ----
+
+static void microstepping_core0(uint64_t now_us) {
+    if (phase == 0) {
+        stepper_queue_static_move(AXIS_X, 3000);
+        stepper_queue_static_move(AXIS_Y, -2000);
+        stepper_queue_static_move(AXIS_Z, 1000);
+        phase = 1;
+    } else if (phase == 1 && !stepper_is_moving()) {
+        for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+            stepper_queue_static_move(axis, 0);
+        }
+        phase = 2;
+    } else if (phase == 2 && !stepper_is_moving()) {
+        phase = 3;
+    }
+}
+
+static void scenario_microstepping(void) {
+    tmc_model_install();
+    sim_boot(true);
+    sim_core0 = microstepping_core0;
+    sim_run(10 * SIM_S);
+    SIM_CHECK(phase == 3, "moves not done, phase %d", phase);
+    for (uint8_t address = 0; address < TMC_MODEL_DRIVERS; address++) {
+        // Coarse out, fine at the target, coarse back, fine at home
+        SIM_CHECK(tmc_model_drivers[address].resolution_changes >= 4, "driver %d switched %lu times", address,
+                  (unsigned long)tmc_model_drivers[address].resolution_changes);
+    }
+    SIM_CHECK(tmc_model_drivers[TMC2209_ADDRESS_X].motor_units == tmc_model_drivers[TMC2209_ADDRESS_X2].motor_units,
+              "X drivers apart");
+    check_motors_match_counters();
+    check_bus_clean();
+}
+
+// ---- Thousands of resolution switches, with step output the position does not count in between ----
+
+#define SWITCH_ROUNDS 600
+#define SWITCH_MIN_CHANGES 2000
+
+static int rounds = 0;
+static int rates_left = 0;
+static uint64_t rate_until_us = 0;
+static int32_t sync_offset[NUM_AXES];       // Position set without moving the motors
+
+// Random moves, half of them ending inside the fine zone. Every fourth round is rate tracking on both sides of the
+// fine step rate instead, every seventh starts with a sync to an odd position
+static void switching_core0(uint64_t now_us) {
+    if (phase == 1) {
+        if (now_us < rate_until_us) return;
+        if (rates_left-- > 0) {
+            static const float rates[] = { 700.0f, -50.0f, 300.0f, -900.0f };
+            // The last rate is 0: stopping tracking drops the rate without a ramp
+            float rate = rates_left ? rates[rand() % 4] : 0.0f;
+            stepper_start_tracking(rate, -rate, rate / 2.0f);
+            rate_until_us = now_us + 300 * SIM_MS;
+            return;
+        }
+        stepper_stop_tracking();
+        phase = 0;
+        return;
+    }
+    if (rounds >= SWITCH_ROUNDS || stepper_is_moving()) return;
+    rounds++;
+    if (rounds % 4 == 0) {
+        phase = 1;
+        rates_left = 3;
+        rate_until_us = now_us;
+        return;
+    }
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        if (rounds % 7 == 0) {
+            int32_t position = stepper_get_position(axis);
+            int32_t synced = position + 1 + 2 * (rand() % 8);
+            stepper_set_position(axis, synced);
+            sync_offset[axis] += synced - position;
+        }
+        int32_t distance = rand() % 2 ? rand() % 41 - 20 : rand() % 3001 - 1500;
+        stepper_queue_static_move(axis, stepper_get_position_arcsec(axis) + distance);
+    }
+}
+
+static void run_switching(void) {
+    sim_core0 = switching_core0;
+    srand(30);
+    sim_run(1000 * SIM_S);
+    SIM_CHECK(rounds >= SWITCH_ROUNDS, "only %d rounds", rounds);
+    uint32_t changes = 0;
+    for (uint8_t address = 0; address < TMC_MODEL_DRIVERS; address++) {
+        changes += tmc_model_drivers[address].resolution_changes;
+    }
+    printf("%lu resolution switches\n", (unsigned long)changes);
+    SIM_CHECK(changes >= SWITCH_MIN_CHANGES, "only %lu resolution switches", (unsigned long)changes);
+    SIM_CHECK(tmc_model_drivers[TMC2209_ADDRESS_X].motor_units == tmc_model_drivers[TMC2209_ADDRESS_X2].motor_units,
+              "X drivers apart");
+    check_bus_clean();
+}
+
+// Every pulse the motor made is in the position, in the corrections or in a sync
+static void check_motors_match_output(void) {
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        int32_t output = stepper_get_position(axis) - sync_offset[axis] + pec_applied_steps[axis];
+        SIM_CHECK(sim_axes[axis].motor_units == output, "axis %d motor at %ld units, output %ld", axis,
+                  (long)sim_axes[axis].motor_units, (long)output);
+    }
+}
+
+static void scenario_switching(void) {
+    tmc_model_install();
+    sim_boot(true);
+    run_switching();
+    check_motors_match_output();
+}
+
+// PEC output, in moves and as dropped and doubled tracking steps, leaves the motor between two coarse positions
+static void scenario_pec(void) {
+    tmc_model_install();
+    sim_check_accel = false;        // A doubled tracking step goes out right behind the first
+    int8_t table[PEC_TABLE_SIZE];
+    for (int i = 0; i < PEC_TABLE_SIZE; i++) {
+        table[i] = (int8_t)(i % 16 < 8 ? 3 * (i % 8) : 3 * (8 - i % 8));
+    }
+    sim_boot(true);
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        for (int start = 0; start < PEC_TABLE_SIZE; start += PEC_MAX_CHUNK) {
+            SIM_CHECK(pec_upload(axis, (uint8_t)start, PEC_MAX_CHUNK, &table[start]), "PEC upload refused");
+        }
+        pec_set_enabled(axis, true);
+    }
+    run_switching();
+    check_motors_match_output();
+}
+
+// Backlash take-up steps are not counted anywhere, the motor only has to stay on whole steps
+static void configure_backlash(void) {
+    for (uint8_t axis = 0; axis < NUM_AXES; axis++) {
+        device_config.backlash[axis] = 13.0f;
+    }
+}
+
+static void scenario_backlash(void) {
+    tmc_model_install();
+    sim_configure = configure_backlash;
+    sim_check_accel = false;        // Take-up runs at its own speed without a ramp
+    sim_boot(true);
+    run_switching();
+}
+
+static const sim_scenario_t scenarios[] = {
+    { "configure", scenario_configure },
+    { "lost_write", scenario_lost_write },
+    { "missing_driver", scenario_missing_driver },
+    { "bus_busy", scenario_bus_busy },
+    { "microstepping", scenario_microstepping },
+    { "switching", scenario_switching },
+    { "pec", scenario_pec },
+    { "backlash", scenario_backlash },
+};
+
+int main(int argc, char **argv) {
+    return sim_main(argc, argv, scenarios, sizeof(scenarios) / sizeof(scenarios[0]));
+}
@@ -0,0 +1,272 @@
+// The command protocol over both transports, the USB CDC port as an in-memory pipe next to the UART line. Responses
+// have to go out on the transport the last good frame came in on, the UART has to take over again when the USB host
+// closes the port, and frames arriving on both at once have to be decoded apart without an error counted
+
+#include <math.h>
+#include <string.h>
+#include "sim.h"
+#include "codec.h"
+#include "CONFIG.h"
+#include "LINK.h"
+#include "UART.h"
+
+static int phase = 0;
+static uint64_t phase_start_us;
+
+static void next_phase(uint64_t now_us) {
+    phase++;
+    phase_start_us = now_us;
+}
+
+// ---- The host end on each transport: what came back where, messages ACKed on the transport they came on ----
+
+typedef enum { HOST_UART = 0, HOST_USB = 1 } host_port_t;
+
+typedef struct {
+    int acks;                               // ACKs received
+    uint8_t acked_id;
+    int statuses;                           // CMD_LINK_STATUS received
+    uint32_t status_ok;                     // Good and bad frames since boot, from the last status
+    uint32_t status_bad;
+    uint8_t status_event;
+    int messages;                           // Everything but ACKs
+    bool ack_due;
+    uint8_t ack_id;
+    int last_message_id;
+    bool answering;                         // ACKs what it gets
+} host_end_t;
+
+static host_end_t ends[2];
+
+static void host_receive(host_port_t port, const uint8_t *data, size_t length) {
+    host_end_t *end = &ends[port];
+    uint8_t cmd_type, msg_id, payload[256], payload_length;
+    size_t start = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] != 0) continue;
+        if (codec_unframe(&data[start], i - start, &cmd_type, &msg_id, payload, &payload_length)) {
+            if (cmd_type == CMD_ACK && payload_length == 1) {
+                end->acks++;
+                end->acked_id = payload[0];
+            } else if (cmd_type != CMD_ACK) {
+                end->messages++;
+                end->ack_due = end->answering;
+                end->ack_id = msg_id;
+                if (msg_id != end->last_message_id && cmd_type == CMD_LINK_STATUS && payload_length == 24) {
+                    end->status_event = payload[5];
+                    memcpy(&end->status_ok, &payload[14], sizeof(uint32_t));
+                    memcpy(&end->status_bad, &payload[18], sizeof(uint32_t));
+                    end->statuses++;
+                }
+                end->last_message_id = msg_id;
+            }
+        }
+        start = i + 1;
+    }
+}
+
+static void on_uart_tx(const uint8_t *data, size_t length) {
+    host_receive(HOST_UART, data, length);
+}
+
+static void on_usb_tx(const uint8_t *data, size_t length) {
+    host_receive(HOST_USB, data, length);
+}
+
+// A whole frame for the port, the caller delivers it
+static size_t host_frame(uint8_t *frame, uint8_t cmd_type, const uint8_t *data, uint8_t length) {
+    static uint8_t next_id = 0;
+    if (++next_id == 0) next_id = 1;
+    return codec_frame(frame, cmd_type, next_id, data, length);
+}
+
+static void deliver(host_port_t port, const uint8_t *frame, size_t length) {
+    if (port == HOST_USB) {
+        host_usb_receive(frame, length);
+    } else {
+        host_uart_receive(frame, length);
+    }
+}
+
+static void host_send(host_port_t port, uint8_t cmd_type, const uint8_t *data, uint8_t length) {
+    uint8_t frame[CODEC_MAX_FRAME];
+    deliver(port, frame, host_frame(frame, cmd_type, data, length));
+}
+
+static void ask_status(host_port_t port) {
+    uint8_t none = 0;
+    host_send(port, CMD_LINK_CONTROL, &none, 0);
+}
+
+static void background(void) {
+    uart_background_task();
+    for (int port = HOST_UART; port <= HOST_USB; port++) {
+        if (!ends[port].ack_due) continue;
+        ends[port].ack_due = false;
+        host_send((host_port_t)port, CMD_ACK, &ends[port].ack_id, 1);
+    }
+}
+
+static void start(void) {
+    sim_boot(false);
+    for (int port = HOST_UART; port <= HOST_USB; port++) {
+        ends[port] = (host_end_t){ .last_message_id = -1, .answering = true };
+    }
+    host_uart_tx_hook = on_uart_tx;
+    host_usb_tx_hook = on_usb_tx;
+    host_usb_connected = true;
+}
+
+// ---- Answers follow the transport: USB, then UART, then USB again. The rate stays a UART matter ----
+
+#define FAST_RATE 115200
+
+static int uart_messages_before;
+
+static void follow_core0(uint64_t now_us) {
+    background();
+    uint64_t elapsed = now_us - phase_start_us;
+    if (phase == 0) {
+        ask_status(HOST_USB);
+        next_phase(now_us);
+    } else if (phase == 1 && elapsed >= 20 * SIM_MS) {
+        SIM_CHECK(ends[HOST_USB].acks == 1 && ends[HOST_USB].statuses == 1, "USB got %d ACKs, %d statuses",
+                  ends[HOST_USB].acks, ends[HOST_USB].statuses);
+        SIM_CHECK(ends[HOST_UART].acks == 0 && ends[HOST_UART].messages == 0, "the UART answered a USB command");
+        ask_status(HOST_UART);
+        next_phase(now_us);
+    } else if (phase == 2 && elapsed >= 20 * SIM_MS) {
+        SIM_CHECK(ends[HOST_UART].acks == 1 && ends[HOST_UART].statuses == 1, "UART got %d ACKs, %d statuses",
+                  ends[HOST_UART].acks, ends[HOST_UART].statuses);
+        SIM_CHECK(ends[HOST_USB].acks == 1 && ends[HOST_USB].statuses == 1, "USB answered a UART command");
+        uart_messages_before = ends[HOST_UART].messages;
+        // No rate to set on USB, refused with a status there
+        uint8_t payload[4];
+        uint32_t rate = FAST_RATE;
+        memcpy(payload, &rate, sizeof(payload));
+        host_send(HOST_USB, CMD_BAUD_SET, payload, sizeof(payload));
+        next_phase(now_us);
+    } else if (phase == 3 && elapsed >= 20 * SIM_MS) {
+        SIM_CHECK(ends[HOST_USB].acks == 2 && ends[HOST_USB].statuses == 2, "USB got %d ACKs, %d statuses",
+                  ends[HOST_USB].acks, ends[HOST_USB].statuses);
+        SIM_CHECK(ends[HOST_USB].status_event == LINK_EVENT_NONE, "CMD_BAUD_SET over USB left event %d",
+                  ends[HOST_USB].status_event);
+        SIM_CHECK(ends[HOST_UART].messages == uart_messages_before, "the UART answered a USB command");
+        next_phase(now_us);
+    }
+}
+
+static void scenario_follow(void) {
+    start();
+    sim_core0 = follow_core0;
+    sim_run(1 * SIM_S);
+    SIM_CHECK(phase == 4, "not done, phase %d", phase);
+    SIM_CHECK(host_uart_baud == device_config.baud_rate, "UART at %u baud after CMD_BAUD_SET over USB", host_uart_baud);
+}
+
+// ---- The USB host closes the port with a message of ours unACKed: the retransmission goes out on the UART ----
+
+static void close_core0(uint64_t now_us) {
+    background();
+    uint64_t elapsed = now_us - phase_start_us;
+    if (phase == 0) {
+        ends[HOST_USB].answering = false;
+        ask_status(HOST_USB);
+        next_phase(now_us);
+    } else if (phase == 1 && elapsed >= 20 * SIM_MS) {
+        SIM_CHECK(ends[HOST_USB].statuses == 1, "USB got %d statuses", ends[HOST_USB].statuses);
+        host_usb_connected = false;
+        next_phase(now_us);
+    } else if (phase == 2 && ends[HOST_UART].statuses > 0) {
+        next_phase(now_us);
+    } else if (phase == 3 && elapsed >= 20 * SIM_MS) {
+        // Commands on the UART answered there from now on
+        ask_status(HOST_UART);
+        next_phase(now_us);
+    } else if (phase == 4 && elapsed >= 20 * SIM_MS) {
+        next_phase(now_us);
+    }
+}
+
+static void scenario_close(void) {
+    start();
+    sim_core0 = close_core0;
+    sim_run(3 * SIM_S);
+    SIM_CHECK(phase == 5, "not done, phase %d", phase);
+    printf("UART got %d statuses, %d ACKs after the port closed\n", ends[HOST_UART].statuses, ends[HOST_UART].acks);
+    SIM_CHECK(ends[HOST_UART].statuses == 2, "UART got %d statuses", ends[HOST_UART].statuses);
+    SIM_CHECK(ends[HOST_UART].acks == 1, "UART got %d ACKs", ends[HOST_UART].acks);
+}
+
+// ---- Both at once: a USB frame trickling in a few bytes a poll with UART frames landing in between ----
+
+#define X_TARGET 1000
+#define Z_TARGET -2000
+
+static uint8_t usb_frame[CODEC_MAX_FRAME];
+static size_t usb_frame_length;
+static size_t usb_sent;
+
+static void move_payload(uint8_t *payload, uint8_t axis, int32_t arcsec) {
+    payload[0] = axis;
+    memcpy(&payload[1], &arcsec, sizeof(int32_t));
+}
+
+static void both_core0(uint64_t now_us) {
+    background();
+    uint64_t elapsed = now_us - phase_start_us;
+    if (phase == 0) {
+        uint8_t payload[5];
+        move_payload(payload, AXIS_X, X_TARGET);
+        usb_frame_length = host_frame(usb_frame, CMD_MOVE_STATIC, payload, sizeof(payload));
+        next_phase(now_us);
+    } else if (phase == 1) {
+        // Three bytes a millisecond, the UART move and a status request in the middle of it
+        size_t chunk = usb_frame_length - usb_sent < 3 ? usb_frame_length - usb_sent : 3;
+        host_usb_receive(&usb_frame[usb_sent], chunk);
+        usb_sent += chunk;
+        // The first chunk has been polled by now
+        if (usb_sent == 6) {
+            uint8_t payload[5];
+            move_payload(payload, AXIS_Z, Z_TARGET);
+            host_send(HOST_UART, CMD_MOVE_STATIC, payload, sizeof(payload));
+        }
+        if (usb_sent == usb_frame_length) next_phase(now_us);
+    } else if (phase == 2 && elapsed >= 20 * SIM_MS) {
+        ask_status(HOST_UART);
+        next_phase(now_us);
+    } else if (phase == 3 && !stepper_is_moving() && stepper_get_mode() == STEPPER_MODE_IDLE &&
+               elapsed >= 20 * SIM_MS) {
+        next_phase(now_us);
+    }
+}
+
+static void scenario_both(void) {
+    start();
+    sim_core0 = both_core0;
+    sim_run(10 * SIM_S);
+    SIM_CHECK(phase == 4, "not done, phase %d", phase);
+    float x = sim_axes[AXIS_X].motor_units / stepper_steps_per_arcsec(AXIS_X);
+    float z = sim_axes[AXIS_Z].motor_units / stepper_steps_per_arcsec(AXIS_Z);
+    printf("X at %.1f arcsec, Z at %.1f, %d + %d ACKs, UART frames %lu good %lu bad\n", x, z, ends[HOST_UART].acks,
+           ends[HOST_USB].acks, (unsigned long)ends[HOST_UART].status_ok, (unsigned long)ends[HOST_UART].status_bad);
+    SIM_CHECK(fabsf(x - X_TARGET) < 4.0f, "X at %.1f arcsec, the USB move lost", x);
+    SIM_CHECK(fabsf(z - Z_TARGET) < 4.0f, "Z at %.1f arcsec, the UART move lost", z);
+    // Each ACK goes out on the transport of the last good frame, all three commands are covered
+    SIM_CHECK(ends[HOST_UART].acks + ends[HOST_USB].acks == 3, "%d + %d ACKs for three commands",
+              ends[HOST_UART].acks, ends[HOST_USB].acks);
+    SIM_CHECK(ends[HOST_UART].statuses == 1, "UART got %d statuses", ends[HOST_UART].statuses);
+    // The link quality is the UART's alone: the move and the status request
+    SIM_CHECK(ends[HOST_UART].status_ok == 2 && ends[HOST_UART].status_bad == 0, "UART frames %lu good %lu bad",
+              (unsigned long)ends[HOST_UART].status_ok, (unsigned long)ends[HOST_UART].status_bad);
+}
+
+static const sim_scenario_t scenarios[] = {
+    { "follow", scenario_follow },
+    { "close", scenario_close },
+    { "both", scenario_both },
+};
+
+int main(int argc, char **argv) {
+    return sim_main(argc, argv, scenarios, sizeof(scenarios) / sizeof(scenarios[0]));
+}
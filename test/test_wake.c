@@ -0,0 +1,148 @@
+// Idle wake-up of core 1: with nothing to step it waits in WFE, a command from core 0 has to end the wait with its
+// event rather than the timeout. A move queued on an idle axis and a resume from pause have to get their first pulse
+// out well inside the wait they interrupt, and the wake-up time core 1 reports has to say the same
+//
+// Simulated time only has the logic: the WFE ends on the next 10 µs slice after the event, what the silicon takes
+// to wake up and what the sleep saves is measured on the device through the latency in CMD_STATUS
+
+#include "sim.h"
+#include "CONFIG.h"
+
+#define MOVE_ARCSEC 500
+#define WAKE_US 100                         // Command to first pulse, the waits it cuts short are 1 and 10 ms
+
+static int phase = 0;
+static uint64_t phase_start_us;
+
+static void next_phase(uint64_t now_us) {
+    phase++;
+    phase_start_us = now_us;
+}
+
+// ---- Commands sent between the millisecond core 0 calls, anywhere in a wait, and the first pulse after each ----
+
+#define OFFSETS 4
+
+static const uint64_t offsets_us[OFFSETS] = { 130, 370, 610, 850 };
+static host_tick_hook_t sim_tick_hook;
+static void (*due_command)(void);
+static uint64_t due_us;
+static uint64_t command_us;
+static bool waiting;
+static uint64_t worst_pulse_after_us;
+static int pulses_after;
+
+static void first_pulse(uint8_t axis, bool direction, uint64_t now_us) {
+    if (!waiting) return;
+    waiting = false;
+    pulses_after++;
+    if (now_us - command_us > worst_pulse_after_us) worst_pulse_after_us = now_us - command_us;
+}
+
+static void command_tick(uint64_t now_us) {
+    sim_tick_hook(now_us);
+    if (!due_command || now_us < due_us) return;
+    command_us = now_us;
+    waiting = true;
+    due_command();
+    due_command = NULL;
+}
+
+// Goes out at the offset past now, in the slice it falls in
+static void send_at(uint64_t now_us, uint64_t offset_us, void (*command)(void)) {
+    due_us = now_us + offset_us;
+    due_command = command;
+}
+
+static void start(void) {
+    sim_boot(false);
+    sim_step = first_pulse;
+    sim_tick_hook = host_tick_hook;
+    host_tick_hook = command_tick;
+}
+
+static void check_wake(const char *what) {
+    uint16_t last_us, worst_us;
+    stepper_get_wake_latency(&last_us, &worst_us);
+    printf("%s: first pulse %lu us after the command at worst, wake-up %u us, %u at worst\n", what,
+           (unsigned long)worst_pulse_after_us, last_us, worst_us);
+    SIM_CHECK(pulses_after == OFFSETS, "%s: %d of %d commands got a pulse", what, pulses_after, OFFSETS);
+    SIM_CHECK(worst_pulse_after_us <= WAKE_US, "%s: first pulse %lu us after a command", what,
+              (unsigned long)worst_pulse_after_us);
+    SIM_CHECK(worst_us <= WAKE_US, "%s: woke up after %u us at worst", what, worst_us);
+}
+
+// ---- Moves queued on an axis idle for a while, core 1 in its 1 ms wait ----
+
+static int move;
+
+static void queue_move(void) {
+    stepper_queue_static_move(AXIS_X, (move + 1) * MOVE_ARCSEC);
+}
+
+static void idle_core0(uint64_t now_us) {
+    uint64_t elapsed = now_us - phase_start_us;
+    if (phase == 0 && elapsed >= 100 * SIM_MS) {
+        send_at(now_us, offsets_us[move], queue_move);
+        next_phase(now_us);
+    } else if (phase == 1 && !due_command && !stepper_is_moving() && stepper_get_mode() == STEPPER_MODE_IDLE) {
+        move++;
+        phase = move < OFFSETS ? 0 : 2;
+        phase_start_us = now_us;
+    }
+}
+
+static void scenario_idle(void) {
+    start();
+    sim_core0 = idle_core0;
+    sim_run(5 * SIM_S);
+    SIM_CHECK(phase == 2, "not done, phase %d", phase);
+    check_wake("idle");
+}
+
+// ---- Moves queued while paused, then the resume: core 1 in its 10 ms wait ----
+
+static uint32_t pulses_at_pause;
+
+static void resume(void) {
+    stepper_resume();
+}
+
+static void paused_core0(uint64_t now_us) {
+    uint64_t elapsed = now_us - phase_start_us;
+    if (phase == 0) {
+        stepper_pause();
+        next_phase(now_us);
+    } else if (phase == 1 && elapsed >= 100 * SIM_MS) {
+        SIM_CHECK(stepper_is_paused(), "not paused");
+        pulses_at_pause = sim_axes[AXIS_X].pulses;
+        queue_move();
+        next_phase(now_us);
+    } else if (phase == 2 && elapsed >= 100 * SIM_MS) {
+        SIM_CHECK(sim_axes[AXIS_X].pulses == pulses_at_pause, "%lu pulses while paused",
+                  (unsigned long)(sim_axes[AXIS_X].pulses - pulses_at_pause));
+        send_at(now_us, offsets_us[move], resume);
+        next_phase(now_us);
+    } else if (phase == 3 && !due_command && !stepper_is_moving() && stepper_get_mode() == STEPPER_MODE_IDLE) {
+        move++;
+        phase = move < OFFSETS ? 0 : 4;
+        phase_start_us = now_us;
+    }
+}
+
+static void scenario_paused(void) {
+    start();
+    sim_core0 = paused_core0;
+    sim_run(5 * SIM_S);
+    SIM_CHECK(phase == 4, "not done, phase %d", phase);
+    check_wake("paused");
+}
+
+static const sim_scenario_t scenarios[] = {
+    { "idle", scenario_idle },
+    { "paused", scenario_paused },
+};
+
+int main(int argc, char **argv) {
+    return sim_main(argc, argv, scenarios, sizeof(scenarios) / sizeof(scenarios[0]));
+}
@@ -0,0 +1,250 @@
+// Pan axis around the ±180° seam of the celestial targets: tracking has to carry on across it with a small step, a goto
+// takes the shortest way that stays inside the soft limits, a tracked target leaving them unwinds the axis through
+// the legal side, and static moves outside them are refused. A move half a step short of its target is done
+
+#include <math.h>
+#include "sim.h"
+#include "CONFIG.h"
+
+#define DEG 3600                            // arcsec
+#define DEC_DEG 30.0f
+#define SIDEREAL_PER_S 15.041f              // The pan target of the plain matrix runs back at the sidereal rate
+
+static const float identity[9] = { 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f };
+
+static int phase = 0;
+static uint64_t phase_start_us;
+static int32_t limit_min_arcsec;            // Z soft limits, both 0 without
+static int32_t limit_max_arcsec;
+static float z_min_arcsec;                  // Where the pan motor has been
+static float z_max_arcsec;
+static float z_last_arcsec;
+static float z_largest_jump;                // Largest change between two milliseconds
+
+static void next_phase(uint64_t now_us) {
+    phase++;
+    phase_start_us = now_us;
+}
+
+static void configure_limits(void) {
+    device_config.soft_limit_min[AXIS_Z] = limit_min_arcsec;
+    device_config.soft_limit_max[AXIS_Z] = limit_max_arcsec;
+}
+
+static float motor_arcsec(uint8_t axis) {
+    return sim_axes[axis].motor_units / stepper_steps_per_arcsec(axis);
+}
+
+// Where the axes would have been put, the motors there as well
+static void place(uint8_t axis, float arcsec) {
+    int32_t units = (int32_t)lroundf(arcsec * stepper_steps_per_arcsec(axis));
+    stepper_set_position(axis, units);
+    sim_axes[axis].motor_units = units;
+}
+
+static void follow_z(void) {
+    float z = motor_arcsec(AXIS_Z);
+    if (z < z_min_arcsec) z_min_arcsec = z;
+    if (z > z_max_arcsec) z_max_arcsec = z;
+    if (fabsf(z - z_last_arcsec) > z_largest_jump) z_largest_jump = fabsf(z - z_last_arcsec);
+    z_last_arcsec = z;
+}
+
+// Celestial target whose pan angle is pan_arcsec right now, the latitude of the pole keeps field rotation at 0
+static void goto_pan(float pan_arcsec) {
+    float ra_hours = pan_arcsec / 54000.0f;
+    if (ra_hours < 0.0f) ra_hours += 24.0f;
+    stepper_start_celestial_tracking(ra_hours, DEC_DEG, identity, 0, 90.0f);
+}
+
+static void start(float z_arcsec) {
+    sim_configure = configure_limits;
+    sim_boot(false);
+    place(AXIS_X, DEC_DEG * DEG);
+    place(AXIS_Z, z_arcsec);
+    z_min_arcsec = z_max_arcsec = z_last_arcsec = z_arcsec;
+}
+
+// ---- Tracking across the seam: the target goes on past -180° instead of back the long way ----
+
+#define CROSSING_S 30
+
+static void crossing_core0(uint64_t now_us) {
+    follow_z();
+    if (phase == 0) {
+        // Two and a half minutes of arc before the seam, the sky turning towards it
+        goto_pan(-180.0f * DEG + 150.0f);
+        next_phase(now_us);
+    }
+}
+
+static void scenario_crossing(void) {
+    start(-180.0f * DEG + 150.0f);
+    sim_core0 = crossing_core0;
+    sim_run(CROSSING_S * SIM_S);
+
+    float expected = -180.0f * DEG + 150.0f - CROSSING_S * SIDEREAL_PER_S;
+    float z = motor_arcsec(AXIS_Z);
+    printf("pan at %.1f arcsec, tracked to %.1f, largest step %.1f arcsec\n", z, expected, z_largest_jump);
+    SIM_CHECK(fabsf(z - expected) < 10.0f, "pan at %.1f arcsec instead of %.1f", z, expected);
+    SIM_CHECK(z_max_arcsec < -180.0f * DEG + 160.0f, "pan went up to %.1f arcsec", z_max_arcsec);
+    SIM_CHECK(sim_axes[AXIS_Z].reversals == 0, "pan reversed %lu times", (unsigned long)sim_axes[AXIS_Z].reversals);
+    SIM_CHECK(stepper_is_celestial_tracking(), "not tracking");
+}
+
+// ---- Gotos: across the seam when that is the short legal way, the long way round when the short one is not ----
+
+static float goto_target;
+static uint64_t goto_start_us;
+
+// Checked once the axis has settled on the tracked target
+static float goto_error(uint64_t now_us, int32_t turns) {
+    float expected = goto_target + turns * 360.0f * DEG - (now_us - goto_start_us) / 1e6f * SIDEREAL_PER_S;
+    return motor_arcsec(AXIS_Z) - expected;
+}
+
+static void gotos_core0(uint64_t now_us) {
+    follow_z();
+    if (phase == 0) {
+        // At -183°, 178° is a degree away as -182°, inside the limits
+        goto_target = 178.0f * DEG;
+        goto_start_us = now_us;
+        goto_pan(goto_target);
+        next_phase(now_us);
+    } else if (phase == 1 && stepper_is_celestial_tracking()) {
+        SIM_CHECK(now_us - phase_start_us < 5 * SIM_S, "first goto took %.1f s", (now_us - phase_start_us) / 1e6f);
+        next_phase(now_us);
+    } else if (phase == 2 && now_us - phase_start_us >= 2 * SIM_S) {
+        float error = goto_error(now_us, -1);
+        SIM_CHECK(fabsf(error) < 5.0f, "first goto %.1f arcsec off", error);
+        SIM_CHECK(z_max_arcsec - z_min_arcsec < 2.0f * DEG, "first goto swung over %.1f arcsec", z_max_arcsec - z_min_arcsec);
+        // 175° is 3° away as -185°, under the limit, and 357° the other way round
+        goto_target = 175.0f * DEG;
+        goto_start_us = now_us;
+        z_min_arcsec = z_max_arcsec = motor_arcsec(AXIS_Z);
+        goto_pan(goto_target);
+        next_phase(now_us);
+    } else if (phase == 3 && stepper_is_celestial_tracking()) {
+        next_phase(now_us);
+    } else if (phase == 4 && now_us - phase_start_us >= 2 * SIM_S) {
+        float error = goto_error(now_us, 0);
+        SIM_CHECK(fabsf(error) < 5.0f, "second goto %.1f arcsec off", error);
+        SIM_CHECK(z_min_arcsec >= limit_min_arcsec && z_max_arcsec <= limit_max_arcsec,
+                  "second goto went from %.1f to %.1f arcsec, the limits are %ld to %ld", z_min_arcsec, z_max_arcsec,
+                  (long)limit_min_arcsec, (long)limit_max_arcsec);
+        next_phase(now_us);
+    }
+}
+
+static void scenario_gotos(void) {
+    limit_min_arcsec = -184 * DEG;
+    limit_max_arcsec = 190 * DEG;
+    start(-183.0f * DEG);
+    sim_core0 = gotos_core0;
+    sim_run(240 * SIM_S);
+    SIM_CHECK(phase == 5, "not done, phase %d", phase);
+}
+
+// ---- Tracked into the lower limit: the axis turns back and carries on a turn further up ----
+
+#define UNWIND_S 300
+
+static float unwind_expected(uint64_t now_us) {
+    return 180.0f * DEG + 150.0f - now_us / 1e6f * SIDEREAL_PER_S;
+}
+
+static void unwind_core0(uint64_t now_us) {
+    follow_z();
+    if (phase == 0) {
+        goto_pan(-180.0f * DEG + 150.0f);
+        next_phase(now_us);
+    } else if (phase == 1 && motor_arcsec(AXIS_Z) > 0.0f) {
+        // On the way up
+        next_phase(now_us);
+    } else if (phase == 2 && fabsf(motor_arcsec(AXIS_Z) - unwind_expected(now_us)) < 10.0f) {
+        printf("pan went down to %.1f arcsec, back on the target after %.1f s\n", z_min_arcsec, now_us / 1e6f);
+        next_phase(now_us);
+    }
+}
+
+static void scenario_unwind(void) {
+    limit_min_arcsec = -180 * DEG + 50;
+    limit_max_arcsec = 180 * DEG + 600;
+    start(-180.0f * DEG + 150.0f);
+    sim_core0 = unwind_core0;
+    sim_run(UNWIND_S * SIM_S);
+    SIM_CHECK(phase == 3, "never unwound onto the target, phase %d", phase);
+    SIM_CHECK(stepper_get_mode() == STEPPER_MODE_CELESTIAL, "mode %d after the unwind", stepper_get_mode());
+
+    float z = motor_arcsec(AXIS_Z);
+    float expected = unwind_expected(sim_now());
+    SIM_CHECK(z_min_arcsec >= limit_min_arcsec, "pan down to %.1f arcsec, the limit is %ld", z_min_arcsec,
+              (long)limit_min_arcsec);
+    SIM_CHECK(z_max_arcsec <= limit_max_arcsec, "pan up to %.1f arcsec, the limit is %ld", z_max_arcsec,
+              (long)limit_max_arcsec);
+    SIM_CHECK(fabsf(z - expected) < 10.0f, "pan at %.1f arcsec instead of %.1f", z, expected);
+}
+
+// ---- Static moves: outside the limits they are refused, inside they run ----
+
+static void static_core0(uint64_t now_us) {
+    if (phase == 0) {
+        stepper_queue_static_move(AXIS_Z, limit_max_arcsec + 1);
+        SIM_CHECK(stepper_get_mode() == STEPPER_MODE_IDLE, "move past the upper limit taken");
+        stepper_queue_static_move(AXIS_Z, limit_min_arcsec - 1);
+        SIM_CHECK(stepper_get_mode() == STEPPER_MODE_IDLE, "move past the lower limit taken");
+        stepper_queue_static_move(AXIS_Z, limit_min_arcsec + DEG);
+        SIM_CHECK(stepper_get_mode() == STEPPER_MODE_STATIC, "move inside the limits refused");
+        next_phase(now_us);
+    } else if (phase == 1 && !stepper_is_moving()) {
+        next_phase(now_us);
+    }
+}
+
+static void scenario_static(void) {
+    limit_min_arcsec = -10 * DEG;
+    limit_max_arcsec = 10 * DEG;
+    start(0.0f);
+    sim_core0 = static_core0;
+    sim_run(30 * SIM_S);
+    SIM_CHECK(phase == 2, "not done, phase %d", phase);
+    float z = motor_arcsec(AXIS_Z);
+    float expected = limit_min_arcsec + DEG;
+    SIM_CHECK(fabsf(z - expected) < 4.0f, "pan at %.1f arcsec instead of %.1f", z, expected);
+}
+
+// ---- A move to a target exactly half a step away: neither a step nor a move left hanging ----
+
+static void half_step_core0(uint64_t now_us) {
+    if (phase == 0) {
+        stepper_queue_static_move(AXIS_Z, DEG);
+        next_phase(now_us);
+    } else if (phase == 1 && now_us - phase_start_us >= 100 * SIM_MS) {
+        next_phase(now_us);
+    }
+}
+
+static void scenario_half_step(void) {
+    start(0.0f);
+    int32_t target_units = (int32_t)lroundf(DEG * stepper_steps_per_arcsec(AXIS_Z));
+    int32_t half_step = sim_pulse_units(AXIS_Z) / 2;
+    stepper_set_position(AXIS_Z, target_units - half_step);
+    sim_axes[AXIS_Z].motor_units = target_units - half_step;
+    sim_core0 = half_step_core0;
+    sim_run(1 * SIM_S);
+    SIM_CHECK(phase == 2, "not done, phase %d", phase);
+    SIM_CHECK(sim_axes[AXIS_Z].pulses == 0, "%lu pulses", (unsigned long)sim_axes[AXIS_Z].pulses);
+    SIM_CHECK(stepper_get_mode() == STEPPER_MODE_IDLE, "move still running, mode %d", stepper_get_mode());
+}
+
+static const sim_scenario_t scenarios[] = {
+    { "crossing", scenario_crossing },
+    { "gotos", scenario_gotos },
+    { "unwind", scenario_unwind },
+    { "static", scenario_static },
+    { "half_step", scenario_half_step },
+};
+
+int main(int argc, char **argv) {
+    return sim_main(argc, argv, scenarios, sizeof(scenarios) / sizeof(scenarios[0]));
+}
@@ -0,0 +1,180 @@
+#include "tmc_model.h"
+#include <string.h>
+#include "sim.h"
+#include "CONFIG.h"
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+
+// TMC2209.c claims the first two state machines of a fresh pio0, transmitter first
+#define TMC_MODEL_SM_TX 0
+#define TMC_MODEL_SM_RX 1
+
+#define REG_GCONF 0x00
+#define REG_IFCNT 0x02
+#define REG_MSCNT 0x6A
+#define REG_CHOPCONF 0x6C
+#define GCONF_MSTEP_REG_SELECT (1u << 7)
+#define CHOPCONF_RESET 0x10000053u
+#define SEND_DELAY_US 70                    // SENDDELAY reset value, 8 bit times before a reply
+
+tmc_model_driver_t tmc_model_drivers[TMC_MODEL_DRIVERS];
+uint32_t tmc_model_bad_datagrams = 0;
+uint32_t tmc_model_steps_while_switching = 0;
+void (*tmc_model_on_datagram)(void) = NULL;
+
+static uint8_t datagram[8];
+static uint8_t datagram_length = 0;
+static uint64_t line_free_us = 0;           // When the wire is done with what was sent so far
+
+// Datasheet CRC8: polynomial 0x07, initial 0, each byte LSB first
+static uint8_t datasheet_crc(const uint8_t *data, int length) {
+    uint8_t crc = 0;
+    for (int i = 0; i < length; i++) {
+        uint8_t byte = data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = ((crc >> 7) ^ (byte & 1)) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+            byte >>= 1;
+        }
+    }
+    return crc;
+}
+
+static void apply_pending(tmc_model_driver_t *driver, uint64_t now_us) {
+    if (!driver->chopconf_pending || now_us < driver->chopconf_at_us) return;
+    uint32_t before = driver->registers[REG_CHOPCONF];
+    driver->registers[REG_CHOPCONF] = driver->chopconf_next;
+    driver->chopconf_pending = false;
+    if ((before ^ driver->chopconf_next) & (0x0Fu << 24)) driver->resolution_changes++;
+}
+
+uint16_t tmc_model_microsteps(uint8_t address) {
+    tmc_model_driver_t *driver = &tmc_model_drivers[address];
+    apply_pending(driver, host_now_us());
+    if (!(driver->registers[REG_GCONF] & GCONF_MSTEP_REG_SELECT)) return TMC_MODEL_STRAP_MICROSTEPS;
+    uint8_t mres = (driver->registers[REG_CHOPCONF] >> 24) & 0x0F;
+    return mres > 8 ? 1 : (uint16_t)(256u >> mres);
+}
+
+static void receive_write(tmc_model_driver_t *driver, uint8_t reg, uint32_t value, uint64_t done_us) {
+    if (driver->drop_writes) return;
+    driver->ifcnt++;
+    driver->writes[reg]++;
+    if (reg == REG_CHOPCONF) {
+        driver->chopconf_pending = true;
+        driver->chopconf_next = value;
+        driver->chopconf_at_us = done_us;
+    } else if (reg != REG_IFCNT && reg != REG_MSCNT) {
+        driver->registers[reg] = value;
+    }
+}
+
+// Reply datagram: sync, master address 0xFF, register, 32 bits MSB first, CRC. It takes the wire after the request
+static void send_reply(tmc_model_driver_t *driver, uint8_t reg) {
+    uint32_t value = driver->registers[reg];
+    if (reg == REG_IFCNT) value = driver->ifcnt;
+    if (reg == REG_MSCNT) value = (uint32_t)driver->motor_units & 0x3FF;
+    uint8_t reply[8] = { 0x05, 0xFF, reg, (uint8_t)(value >> 24), (uint8_t)(value >> 16), (uint8_t)(value >> 8),
+                         (uint8_t)value, 0 };
+    reply[7] = datasheet_crc(reply, 7);
+    line_free_us += SEND_DELAY_US;
+    for (int i = 0; i < 8; i++) {
+        line_free_us += TMC_MODEL_BYTE_US;
+        host_pio_rx_push_at(pio0, TMC_MODEL_SM_RX, (uint32_t)reply[i] << 24, line_free_us);
+    }
+}
+
+static void datagram_done(uint64_t done_us) {
+    uint8_t length = datagram_length;
+    datagram_length = 0;
+    if (datagram[length - 1] != datasheet_crc(datagram, length - 1)) {
+        tmc_model_bad_datagrams++;
+        return;
+    }
+    uint8_t address = datagram[1] & 0x03;
+    tmc_model_driver_t *driver = &tmc_model_drivers[address];
+    if (datagram[1] >= TMC_MODEL_DRIVERS || !driver->present) return;
+    uint8_t reg = datagram[2] & 0x7F;
+    if (length == 8) {
+        uint32_t value = ((uint32_t)datagram[3] << 24) | ((uint32_t)datagram[4] << 16) |
+                         ((uint32_t)datagram[5] << 8) | datagram[6];
+        receive_write(driver, reg, value, done_us);
+    } else {
+        send_reply(driver, reg);
+    }
+}
+
+// One byte onto the wire: the receiver hears it (one wire), the drivers collect it into datagrams
+static void tmc_model_tx(PIO pio, uint sm, uint32_t data) {
+    if (pio != pio0 || sm != TMC_MODEL_SM_TX) return;
+    uint8_t byte = (uint8_t)data;
+    uint64_t now_us = host_now_us();
+    if (line_free_us < now_us) line_free_us = now_us;
+    line_free_us += TMC_MODEL_BYTE_US;
+    // The FIFO is empty once the last byte has moved on into the shift register
+    host_pio_tx_busy(pio0, TMC_MODEL_SM_TX, line_free_us - TMC_MODEL_BYTE_US);
+    host_pio_rx_push_at(pio0, TMC_MODEL_SM_RX, (uint32_t)byte << 24, line_free_us);
+
+    if (datagram_length == 0) {
+        if ((byte & 0x0F) != 0x05) {
+            tmc_model_bad_datagrams++;
+            return;
+        }
+        if (tmc_model_on_datagram) tmc_model_on_datagram();
+    }
+    datagram[datagram_length++] = byte;
+    if (datagram_length < 3) return;
+    uint8_t wanted = (datagram[2] & 0x80) ? 8 : 4;
+    if (datagram_length == wanted) datagram_done(line_free_us);
+}
+
+// A step pulse moves the counter to the next position of the resolution, which is a whole step only from one of them
+static void move_driver(tmc_model_driver_t *driver, bool direction, uint64_t now_us) {
+    apply_pending(driver, now_us);
+    if (driver->chopconf_pending) tmc_model_steps_while_switching++;
+    int32_t width = 256 / tmc_model_microsteps((uint8_t)(driver - tmc_model_drivers));
+    int32_t from = driver->motor_units;
+    int32_t below = from >= 0 ? from / width * width : -((-from + width - 1) / width * width);
+    int32_t to;
+    if (below != from) {
+        driver->misaligned_steps++;
+        to = direction ? below + width : below;
+    } else {
+        to = direction ? from + width : from - width;
+    }
+    driver->motor_units = to;
+    driver->last_step_units = to - from >= 0 ? to - from : from - to;
+}
+
+static int axis_addresses(uint8_t axis, uint8_t *addresses) {
+    addresses[0] = device_config.tmc2209_address[axis] & 0x03;
+    if (axis != AXIS_X) return 1;
+    addresses[1] = device_config.tmc2209_x2_address & 0x03;
+    return 2;
+}
+
+static void tmc_model_step(uint8_t axis, bool direction, uint64_t now_us) {
+    uint8_t addresses[2];
+    int count = axis_addresses(axis, addresses);
+    for (int i = 0; i < count; i++) {
+        move_driver(&tmc_model_drivers[addresses[i]], direction, now_us);
+    }
+}
+
+static int32_t tmc_model_pulse_units(uint8_t axis) {
+    uint8_t addresses[2];
+    axis_addresses(axis, addresses);
+    tmc_model_driver_t *driver = &tmc_model_drivers[addresses[0]];
+    if (driver->last_step_units) return driver->last_step_units;
+    return 256 / tmc_model_microsteps(addresses[0]);
+}
+
+void tmc_model_install(void) {
+    memset(tmc_model_drivers, 0, sizeof(tmc_model_drivers));
+    for (int i = 0; i < TMC_MODEL_DRIVERS; i++) {
+        tmc_model_drivers[i].present = true;
+        tmc_model_drivers[i].registers[REG_CHOPCONF] = CHOPCONF_RESET;
+    }
+    host_pio_tx_hook = tmc_model_tx;
+    sim_step = tmc_model_step;
+    sim_pulse_units = tmc_model_pulse_units;
+}
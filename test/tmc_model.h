@@ -0,0 +1,41 @@
+#ifndef TMC_MODEL_H
+#define TMC_MODEL_H
+
+// TMC2209 drivers on the single wire bus, written from the datasheet rather than from TMC2209.c: the register map,
+// the interface counter, the echo of everything sent on the wire, read replies, and the microstep counter that
+// every step pulse moves by the resolution in CHOPCONF
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TMC_MODEL_DRIVERS 4             // Addresses 0 to 3
+#define TMC_MODEL_STRAP_MICROSTEPS 16   // MS1/MS2 as strapped on the board, until GCONF selects MRES
+#define TMC_MODEL_BYTE_US 87            // One byte with start and stop bit at 115200 baud
+
+typedef struct {
+    bool present;               // Answers on the bus
+    bool drop_writes;           // Writes never arrive (a bad line), the interface counter stays
+    uint32_t registers[128];
+    uint8_t ifcnt;              // Successful writes, wraps like the register
+    uint32_t writes[128];       // Successful writes per register
+    int32_t motor_units;        // Microstep counter without the wrap, 1/256 microsteps like the positions
+    int32_t last_step_units;
+    uint32_t misaligned_steps;  // Steps from between two positions of the resolution, they fall short
+    uint32_t resolution_changes;
+    // A CHOPCONF write takes effect when its last byte is through
+    bool chopconf_pending;
+    uint32_t chopconf_next;
+    uint64_t chopconf_at_us;
+} tmc_model_driver_t;
+
+extern tmc_model_driver_t tmc_model_drivers[TMC_MODEL_DRIVERS];
+extern uint32_t tmc_model_bad_datagrams;        // Bad sync or CRC: interleaved, cut short or garbled datagrams
+extern uint32_t tmc_model_steps_while_switching; // Pulses while a CHOPCONF write was still on the wire
+// Called on the first byte of every datagram on the wire while set, with the firmware's bus in use
+extern void (*tmc_model_on_datagram)(void);
+
+// All drivers present with their reset values, the hooks into the host SDK and sim.c. Before sim_boot(true)
+void tmc_model_install(void);
+uint16_t tmc_model_microsteps(uint8_t address);
+
+#endif // TMC_MODEL_H